@@ -53,9 +53,9 @@ Returns:
   return EFI_SUCCESS;
 }
 
+STATIC
 EFI_STATUS
-EFIAPI
-IpmiSendCommandToBmc (
+IpmiSendCommandToBmcWorker (
   IN      IPMI_TRANSPORT            *This,
   IN      UINT8                         NetFunction,
   IN      UINT8                         Lun,
@@ -251,6 +251,86 @@ Returns:
   return EFI_SUCCESS;
 }
 
+EFI_STATUS
+EFIAPI
+IpmiSendCommandToBmc (
+  IN      IPMI_TRANSPORT                *This,
+  IN      UINT8                         NetFunction,
+  IN      UINT8                         Lun,
+  IN      UINT8                         Command,
+  IN      UINT8                         *CommandData,
+  IN      UINT8                         CommandDataSize,
+  IN OUT  UINT8                         *ResponseData,
+  IN OUT  UINT8                         *ResponseDataSize,
+  IN      VOID                          *Context
+  )
+/*++
+
+Routine Description:
+
+  Send IPMI command to BMC, and account the time spent in the transport
+  so that the commands dominating POST time can be identified.
+
+Arguments:
+
+  This              - Pointer to IPMI protocol instance
+  NetFunction       - Net Function of command to send
+  Lun               - LUN of command to send
+  Command           - IPMI command to send
+  CommandData       - Pointer to command data buffer, if needed
+  CommandDataSize   - Size of command data buffer
+  ResponseData      - Pointer to response data buffer
+  ResponseDataSize  - Pointer to response data buffer size
+  Context           - Context
+
+Returns:
+
+  EFI_INVALID_PARAMETER - One of the input values is bad
+  EFI_DEVICE_ERROR      - IPMI command failed
+  EFI_BUFFER_TOO_SMALL  - Response buffer is too small
+  EFI_UNSUPPORTED       - Command is not supported by BMC
+  EFI_SUCCESS           - Command completed successfully
+
+--*/
+{
+  IPMI_BMC_INSTANCE_DATA  *IpmiInstance;
+  EFI_STATUS              Status;
+  UINT64                  StartTicks;
+  UINT64                  ElapsedTime;
+
+  IpmiInstance = INSTANCE_FROM_SM_IPMI_BMC_THIS (This);
+
+  StartTicks = GetPerformanceCounter ();
+  Status = IpmiSendCommandToBmcWorker (
+             This,
+             NetFunction,
+             Lun,
+             Command,
+             CommandData,
+             CommandDataSize,
+             ResponseData,
+             ResponseDataSize,
+             Context
+             );
+  ElapsedTime = DivU64x32 (GetTimeInNanoSecond (GetPerformanceCounter () - StartTicks), 1000);
+
+  IpmiInstance->CommandCount++;
+  IpmiInstance->CommandTime += ElapsedTime;
+
+  DEBUG ((
+    (ElapsedTime >= IPMI_SLOW_COMMAND_THRESHOLD) ? DEBUG_INFO : DEBUG_VERBOSE,
+    "IPMI NetFn 0x%02x Cmd 0x%02x: %r in %ld us (total %d commands, %ld us)\n",
+    NetFunction,
+    Command,
+    Status,
+    ElapsedTime,
+    IpmiInstance->CommandCount,
+    IpmiInstance->CommandTime
+    ));
+
+  return Status;
+}
+
 
 EFI_STATUS
 EFIAPI
@@ -14,6 +14,11 @@
 #define MAX_SOFT_COUNT    10
 #define COMP_CODE_NORMAL  0x00
 
+//
+// Commands taking longer than this are reported at DEBUG_INFO level
+//
+#define IPMI_SLOW_COMMAND_THRESHOLD 10000 // [us]
+
 //
 // IPMI command completion codes to check for in the UpdateErrorStatus routine.
 // These completion codes indicate a soft error and a running total of the occurrences
@@ -57,6 +62,8 @@ typedef struct {
   UINT16              IpmiIoBase;
   IPMI_TRANSPORT      IpmiTransport;
   EFI_HANDLE          IpmiSmmHandle;
+  UINT32              CommandCount;
+  UINT64              CommandTime;      // [us] Total time spent in IpmiSendCommandToBmc
 } IPMI_BMC_INSTANCE_DATA;
 
 //
@@ -8,6 +8,76 @@
 
 #include "KcsBmc.h"
 
+EFI_STATUS
+KcsWaitForStatus (
+  UINT64                            KcsTimeoutPeriod,
+  UINT16                            KcsPort,
+  UINT8                             Mask,
+  UINT8                             Value,
+  KCS_STATUS                        *KcsStatus
+  )
+/*++
+
+Routine Description:
+
+  Wait until the masked KCS status register matches the expected value.
+
+  The BMC usually answers within a few microseconds, so the status is first
+  polled back to back for KCS_POLL_SPIN_COUNT reads. After that the delay
+  between polls starts at KCS_MIN_DELAY_UNIT and doubles up to KCS_DELAY_UNIT.
+  The total delay is bounded by KcsTimeoutPeriod * KCS_DELAY_UNIT, the same
+  budget as polling in fixed KCS_DELAY_UNIT steps.
+
+Arguments:
+
+  KcsTimeoutPeriod - The timeout, in units of KCS_DELAY_UNIT
+  KcsPort          - The base port of KCS
+  Mask             - The status bits to check
+  Value            - The expected value of the status bits
+  KcsStatus        - The last status read
+
+Returns:
+
+  EFI_DEVICE_ERROR - The BMC did not respond in time or is not present
+  EFI_SUCCESS      - The status matches the expected value
+
+--*/
+{
+  UINT64          TimeOut;
+  UINT64          Elapsed;
+  UINTN           Delay;
+  UINTN           Spin;
+
+  TimeOut = MultU64x32 (KcsTimeoutPeriod, KCS_DELAY_UNIT);
+  Elapsed = 0;
+  Delay   = KCS_MIN_DELAY_UNIT;
+  Spin    = 0;
+
+  while (TRUE) {
+    KcsStatus->RawData = IoRead8 (KcsPort + 1);
+    if (KcsStatus->RawData == 0xFF) {
+      return EFI_DEVICE_ERROR;
+    }
+    if ((KcsStatus->RawData & Mask) == Value) {
+      return EFI_SUCCESS;
+    }
+
+    if (Spin < KCS_POLL_SPIN_COUNT) {
+      Spin++;
+      continue;
+    }
+
+    if (Elapsed >= TimeOut) {
+      return EFI_DEVICE_ERROR;
+    }
+    MicroSecondDelay (Delay);
+    Elapsed += Delay;
+    if (Delay < KCS_DELAY_UNIT) {
+      Delay = MIN (Delay * 2, KCS_DELAY_UNIT);
+    }
+  }
+}
+
 EFI_STATUS
 KcsErrorExit (
   UINT64                            KcsTimeoutPeriod,
@@ -38,96 +108,55 @@ Returns:
   KCS_STATUS      KcsStatus;
   UINT8           BmcStatus;
   UINT8           RetryCount;
-  UINT64          TimeOut;
 
-  TimeOut     = 0;
   RetryCount  = 0;
   while (RetryCount < KCS_ABORT_RETRY_COUNT) {
 
-    TimeOut = 0;
-    do {
-      MicroSecondDelay (KCS_DELAY_UNIT);
-      KcsStatus.RawData = IoRead8 (KcsPort + 1);
-      if (KcsStatus.RawData == 0xFF || (TimeOut >= KcsTimeoutPeriod)) {
-        RetryCount = KCS_ABORT_RETRY_COUNT;
-        break;
-      }
-      TimeOut++;
-    } while (KcsStatus.Status.Ibf);
-
-    if (RetryCount >= KCS_ABORT_RETRY_COUNT) {
+    Status = KcsWaitForStatus (KcsTimeoutPeriod, KcsPort, KCS_STATUS_IBF, 0, &KcsStatus);
+    if (EFI_ERROR (Status)) {
+      RetryCount = KCS_ABORT_RETRY_COUNT;
       break;
     }
 
     KcsData = KCS_ABORT;
     IoWrite8 ((KcsPort + 1), KcsData);
 
-    TimeOut = 0;
-    do {
-      MicroSecondDelay (KCS_DELAY_UNIT);
-      KcsStatus.RawData = IoRead8 (KcsPort + 1);
-      if (KcsStatus.RawData == 0xFF || (TimeOut >= KcsTimeoutPeriod)) {
-        Status = EFI_DEVICE_ERROR;
-        goto LabelError;
-      }
-      TimeOut++;
-    } while (KcsStatus.Status.Ibf);
+    Status = KcsWaitForStatus (KcsTimeoutPeriod, KcsPort, KCS_STATUS_IBF, 0, &KcsStatus);
+    if (EFI_ERROR (Status)) {
+      goto LabelError;
+    }
 
     KcsData = IoRead8 (KcsPort);
 
     KcsData = 0x0;
     IoWrite8 (KcsPort, KcsData);
 
-    TimeOut = 0;
-    do {
-      MicroSecondDelay (KCS_DELAY_UNIT);
-      KcsStatus.RawData = IoRead8 (KcsPort + 1);
-      if (KcsStatus.RawData == 0xFF || (TimeOut >= KcsTimeoutPeriod)) {
-        Status = EFI_DEVICE_ERROR;
-        goto LabelError;
-      }
-      TimeOut++;
-    } while (KcsStatus.Status.Ibf);
+    Status = KcsWaitForStatus (KcsTimeoutPeriod, KcsPort, KCS_STATUS_IBF, 0, &KcsStatus);
+    if (EFI_ERROR (Status)) {
+      goto LabelError;
+    }
 
     if (KcsStatus.Status.State == KcsReadState) {
-      TimeOut = 0;
-      do {
-        MicroSecondDelay (KCS_DELAY_UNIT);
-        KcsStatus.RawData = IoRead8 (KcsPort + 1);
-        if (KcsStatus.RawData == 0xFF || (TimeOut >= KcsTimeoutPeriod)) {
-          Status = EFI_DEVICE_ERROR;
-          goto LabelError;
-        }
-        TimeOut++;
-      } while (!KcsStatus.Status.Obf);
+      Status = KcsWaitForStatus (KcsTimeoutPeriod, KcsPort, KCS_STATUS_OBF, KCS_STATUS_OBF, &KcsStatus);
+      if (EFI_ERROR (Status)) {
+        goto LabelError;
+      }
 
       BmcStatus = IoRead8 (KcsPort);
 
       KcsData = KCS_READ;
       IoWrite8 (KcsPort, KcsData);
 
-      TimeOut = 0;
-      do {
-        MicroSecondDelay (KCS_DELAY_UNIT);
-        KcsStatus.RawData = IoRead8 (KcsPort + 1);
-        if (KcsStatus.RawData == 0xFF || (TimeOut >= KcsTimeoutPeriod)) {
-          Status = EFI_DEVICE_ERROR;
-          goto LabelError;
-        }
-        TimeOut++;
-      } while (KcsStatus.Status.Ibf);
+      Status = KcsWaitForStatus (KcsTimeoutPeriod, KcsPort, KCS_STATUS_IBF, 0, &KcsStatus);
+      if (EFI_ERROR (Status)) {
+        goto LabelError;
+      }
 
       if (KcsStatus.Status.State == KcsIdleState) {
-        TimeOut = 0;
-        do {
-          MicroSecondDelay (KCS_DELAY_UNIT);
-          KcsStatus.RawData = IoRead8 (KcsPort + 1);
-          if (KcsStatus.RawData == 0xFF || (TimeOut >= KcsTimeoutPeriod)) {
-            Status = EFI_DEVICE_ERROR;
-            goto LabelError;
-          }
-          TimeOut++;
-        } while (!KcsStatus.Status.Obf);
+        Status = KcsWaitForStatus (KcsTimeoutPeriod, KcsPort, KCS_STATUS_OBF, KCS_STATUS_OBF, &KcsStatus);
+        if (EFI_ERROR (Status)) {
+          goto LabelError;
+        }
 
         KcsData = IoRead8 (KcsPort);
         break;
@@ -185,7 +214,6 @@ Returns:
   EFI_STATUS      Status;
   KCS_STATUS      KcsStatus;
   UINT8           KcsData;
-  UINT64          TimeOut;
 
   if (Idle == NULL) {
     return EFI_INVALID_PARAMETER;
@@ -193,16 +221,10 @@ Returns:
 
   *Idle = FALSE;
 
-  TimeOut = 0;
-  do {
-    MicroSecondDelay (KCS_DELAY_UNIT);
-    KcsStatus.RawData = IoRead8 (KcsPort + 1);
-    if (KcsStatus.RawData == 0xFF || (TimeOut >= KcsTimeoutPeriod)) {
-      Status = EFI_DEVICE_ERROR;
-      goto LabelError;
-    }
-    TimeOut++;
-  } while (KcsStatus.Status.Ibf);
+  Status = KcsWaitForStatus (KcsTimeoutPeriod, KcsPort, KCS_STATUS_IBF, 0, &KcsStatus);
+  if (EFI_ERROR (Status)) {
+    goto LabelError;
+  }
 
   if (KcsState == KcsWriteState) {
     KcsData = IoRead8 (KcsPort);
@@ -218,16 +240,10 @@ Returns:
   }
 
   if (KcsState == KcsReadState) {
-    TimeOut = 0;
-    do {
-      MicroSecondDelay (KCS_DELAY_UNIT);
-      KcsStatus.RawData = IoRead8 (KcsPort + 1);
-      if (KcsStatus.RawData == 0xFF || (TimeOut >= KcsTimeoutPeriod)) {
-        Status = EFI_DEVICE_ERROR;
-        goto LabelError;
-      }
-      TimeOut++;
-    } while (!KcsStatus.Status.Obf);
+    Status = KcsWaitForStatus (KcsTimeoutPeriod, KcsPort, KCS_STATUS_OBF, KCS_STATUS_OBF, &KcsStatus);
+    if (EFI_ERROR (Status)) {
+      goto LabelError;
+    }
   }
 
   if (KcsState == KcsWriteState || (*Idle == TRUE)) {
@@ -273,22 +289,15 @@ Returns:
   EFI_STATUS      Status;
   UINT8           i;
   BOOLEAN         Idle;
-  UINT64          TimeOut;
 
   KcsIoBase = KcsPort;
 
-  TimeOut = 0;
-
-  do {
-    MicroSecondDelay (KCS_DELAY_UNIT);
-    KcsStatus.RawData = IoRead8 (KcsIoBase + 1);
-    if ((KcsStatus.RawData == 0xFF) || (TimeOut >= KcsTimeoutPeriod)) {
-      if ((Status = KcsErrorExit (KcsTimeoutPeriod, KcsIoBase, Context)) != EFI_SUCCESS) {
-        return Status;
-      }
+  Status = KcsWaitForStatus (KcsTimeoutPeriod, KcsIoBase, KCS_STATUS_IBF, 0, &KcsStatus);
+  if (EFI_ERROR (Status)) {
+    if ((Status = KcsErrorExit (KcsTimeoutPeriod, KcsIoBase, Context)) != EFI_SUCCESS) {
+      return Status;
     }
-    TimeOut++;
-  } while (KcsStatus.Status.Ibf);
+  }
 
   KcsData = KCS_WRITE_START;
   IoWrite8 ((KcsIoBase + 1), KcsData);
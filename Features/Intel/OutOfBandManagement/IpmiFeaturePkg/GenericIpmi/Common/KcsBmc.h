@@ -20,6 +20,11 @@
 #define KCS_GET_STATUS        0x60
 #define KCS_ABORT             0x60
 #define KCS_DELAY_UNIT        50  // [s] Each KSC IO delay
+#define KCS_MIN_DELAY_UNIT    1   // [s] First KCS IO delay once spinning is over
+#define KCS_POLL_SPIN_COUNT   16  // Status polls without delay before backing off
+
+#define KCS_STATUS_OBF        BIT0
+#define KCS_STATUS_IBF        BIT1
 
 //
 // In OpenBMC, UpdateMode: the bit 7 of byte 4 in get device id command is used for the BMC status:
@@ -118,6 +123,36 @@ Returns:
 //
 //Internal Fucntion List
 //
+EFI_STATUS
+KcsWaitForStatus (
+  UINT64                            KcsTimeoutPeriod,
+  UINT16                            KcsPort,
+  UINT8                             Mask,
+  UINT8                             Value,
+  KCS_STATUS                        *KcsStatus
+  )
+/*++
+
+Routine Description:
+
+  Wait until the masked KCS status register matches the expected value
+
+Arguments:
+
+  KcsTimeoutPeriod - The timeout, in units of KCS_DELAY_UNIT
+  KcsPort          - The base port of KCS
+  Mask             - The status bits to check
+  Value            - The expected value of the status bits
+  KcsStatus        - The last status read
+
+Returns:
+
+  EFI_DEVICE_ERROR - The BMC did not respond in time or is not present
+  EFI_SUCCESS      - The status matches the expected value
+
+--*/
+;
+
 EFI_STATUS
 KcsErrorExit (
   UINT64                            KcsTimeoutPeriod,
@@ -14,6 +14,425 @@ SPDX-License-Identifier: BSD-2-Clause-Patent
 #include <Library/IpmiCommandLib.h>
 #include <IndustryStandard/Ipmi.h>
 
+//
+// Largest FRU read attempted first. BMCs that cannot return that many bytes
+// in one response fail the request, and the read size is halved down to
+// FRU_READ_MIN_COUNT.
+//
+#define FRU_READ_MAX_COUNT        0xF0
+#define FRU_READ_MIN_COUNT        0x10
+
+#define FRU_AREA_MULTIPLIER       8
+#define FRU_TYPE_LENGTH_END       0xC1
+#define FRU_TYPE_CODE(TypeLength) (((TypeLength) >> 6) & 0x3)
+#define FRU_LENGTH(TypeLength)    ((TypeLength) & 0x3F)
+
+#define FRU_TYPE_BINARY           0
+#define FRU_TYPE_BCD_PLUS         1
+#define FRU_TYPE_6BIT_ASCII       2
+#define FRU_TYPE_8BIT_ASCII       3
+
+//
+// Offset of the first type/length byte of each info area
+//
+#define FRU_CHASSIS_FIELDS_OFFSET 3
+#define FRU_BOARD_FIELDS_OFFSET   6
+#define FRU_PRODUCT_FIELDS_OFFSET 3
+
+//
+// Maximum length of a decoded FRU string, excluding the NULL terminator.
+// A FRU type/length byte encodes at most 63 bytes of data.
+//
+#define FRU_STRING_LENGTH         63
+
+typedef CHAR8 FRU_STRING[FRU_STRING_LENGTH + 1];
+
+typedef struct {
+  UINT8       ChassisType;
+  FRU_STRING  ChassisPartNumber;
+  FRU_STRING  ChassisSerialNumber;
+  FRU_STRING  BoardManufacturer;
+  FRU_STRING  BoardProductName;
+  FRU_STRING  BoardSerialNumber;
+  FRU_STRING  BoardPartNumber;
+  FRU_STRING  ProductManufacturer;
+  FRU_STRING  ProductName;
+  FRU_STRING  ProductPartModelNumber;
+  FRU_STRING  ProductVersion;
+  FRU_STRING  ProductSerialNumber;
+  FRU_STRING  ProductAssetTag;
+} FRU_INVENTORY;
+
+UINT8  mFruReadCount = FRU_READ_MAX_COUNT;
+
+EFI_STATUS
+ReadFruBuffer (
+  IN  UINT16  Offset,
+  IN  UINT16  Length,
+  OUT UINT8   *Buffer
+  )
+/*++
+
+Routine Description:
+
+  Read a range of the FRU device 0 inventory area with as few IPMI
+  round-trips as the BMC allows.
+
+Arguments:
+
+  Offset - Offset in the FRU inventory area
+  Length - Number of bytes to read
+  Buffer - Buffer receiving the data
+
+Returns:
+
+  EFI_STATUS
+
+--*/
+{
+  EFI_STATUS                   Status;
+  IPMI_READ_FRU_DATA_REQUEST   Request;
+  UINT8                        ResponseBuffer[sizeof (IPMI_READ_FRU_DATA_RESPONSE) + FRU_READ_MAX_COUNT];
+  IPMI_READ_FRU_DATA_RESPONSE  *Response;
+  UINT32                       ResponseSize;
+
+  Response = (IPMI_READ_FRU_DATA_RESPONSE *)ResponseBuffer;
+
+  while (Length > 0) {
+    Request.DeviceId        = 0;
+    Request.InventoryOffset = Offset;
+    Request.CountToRead     = (UINT8)MIN (Length, mFruReadCount);
+
+    ResponseSize = sizeof (IPMI_READ_FRU_DATA_RESPONSE) + Request.CountToRead;
+    Status = IpmiReadFruData (&Request, Response, &ResponseSize);
+    if (EFI_ERROR (Status)) {
+      //
+      // The transport fails commands with an abnormal completion code. Retry
+      // with a smaller read size, and keep it for the following reads.
+      //
+      if (mFruReadCount > FRU_READ_MIN_COUNT) {
+        mFruReadCount /= 2;
+        continue;
+      }
+      DEBUG ((DEBUG_ERROR, "IpmiFru: read at 0x%x failed Status=%r\n", Offset, Status));
+      return EFI_DEVICE_ERROR;
+    }
+
+    if ((Response->CountReturned == 0) ||
+        (Response->CountReturned > Request.CountToRead) ||
+        (ResponseSize < sizeof (IPMI_READ_FRU_DATA_RESPONSE) + Response->CountReturned)) {
+      return EFI_DEVICE_ERROR;
+    }
+
+    CopyMem (Buffer, Response->Data, Response->CountReturned);
+    Buffer += Response->CountReturned;
+    Offset += Response->CountReturned;
+    Length -= Response->CountReturned;
+  }
+
+  return EFI_SUCCESS;
+}
+
+BOOLEAN
+IsFruChecksumValid (
+  IN UINT8  *Data,
+  IN UINTN  Length
+  )
+{
+  return (BOOLEAN)(CalculateSum8 (Data, Length) == 0);
+}
+
+VOID
+DecodeFruString (
+  IN  UINT8                  TypeLength,
+  IN  UINT8                  *Data,
+  OUT FRU_STRING  String
+  )
+/*++
+
+Routine Description:
+
+  Convert one FRU type/length encoded field to a NULL terminated ASCII string.
+
+Arguments:
+
+  TypeLength - The type/length byte of the field
+  Data       - The field data following the type/length byte
+  String     - The decoded string
+
+Returns:
+
+  None
+
+--*/
+{
+  STATIC CONST CHAR8  BcdPlus[] = "0123456789 -.???";
+  UINTN               Length;
+  UINTN               Index;
+  UINTN               Count;
+  UINT32              Bits;
+
+  Length = FRU_LENGTH (TypeLength);
+  Count  = 0;
+
+  switch (FRU_TYPE_CODE (TypeLength)) {
+  case FRU_TYPE_8BIT_ASCII:
+    for (Index = 0; Index < Length && Count < FRU_STRING_LENGTH; Index++) {
+      String[Count++] = (CHAR8)Data[Index];
+    }
+    break;
+
+  case FRU_TYPE_6BIT_ASCII:
+    //
+    // Four 6-bit characters are packed little endian in each 3 bytes
+    //
+    Bits = 0;
+    for (Index = 0; Index < Length * 8 / 6 && Count < FRU_STRING_LENGTH; Index++) {
+      Bits = Data[Index * 6 / 8];
+      if ((Index * 6 / 8) + 1 < Length) {
+        Bits |= (UINT32)Data[(Index * 6 / 8) + 1] << 8;
+      }
+      String[Count++] = (CHAR8)(((Bits >> ((Index * 6) % 8)) & 0x3F) + 0x20);
+    }
+    break;
+
+  case FRU_TYPE_BCD_PLUS:
+    for (Index = 0; Index < Length && Count + 1 < FRU_STRING_LENGTH; Index++) {
+      String[Count++] = BcdPlus[Data[Index] & 0xF];
+      String[Count++] = BcdPlus[Data[Index] >> 4];
+    }
+    break;
+
+  default:
+    //
+    // Binary fields are not meaningful as strings
+    //
+    break;
+  }
+
+  //
+  // Strip trailing pad characters
+  //
+  while (Count > 0 && (String[Count - 1] == ' ' || String[Count - 1] == '\0')) {
+    Count--;
+  }
+  String[Count] = '\0';
+}
+
+EFI_STATUS
+ParseFruFields (
+  IN  UINT8                  *Area,
+  IN  UINTN                  AreaLength,
+  IN  UINTN                  Offset,
+  IN  UINTN                  FieldCount,
+  OUT FRU_STRING  **Fields
+  )
+/*++
+
+Routine Description:
+
+  Walk the type/length fields of an info area and decode the leading ones.
+
+Arguments:
+
+  Area       - The info area, including its checksum byte
+  AreaLength - Length of the info area
+  Offset     - Offset of the first type/length byte
+  FieldCount - Number of fields to decode
+  Fields     - The strings receiving the decoded fields, NULL to skip one
+
+Returns:
+
+  EFI_STATUS
+
+--*/
+{
+  UINTN  Index;
+  UINT8  TypeLength;
+
+  for (Index = 0; Index < FieldCount; Index++) {
+    //
+    // The last byte of the area is its checksum
+    //
+    if (Offset >= AreaLength - 1) {
+      return EFI_VOLUME_CORRUPTED;
+    }
+    TypeLength = Area[Offset++];
+    if (TypeLength == FRU_TYPE_LENGTH_END) {
+      break;
+    }
+    if (Offset + FRU_LENGTH (TypeLength) > AreaLength - 1) {
+      return EFI_VOLUME_CORRUPTED;
+    }
+    if (Fields[Index] != NULL) {
+      DecodeFruString (TypeLength, &Area[Offset], *Fields[Index]);
+    }
+    Offset += FRU_LENGTH (TypeLength);
+  }
+
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+ReadFruArea (
+  IN  UINT16  InventoryAreaSize,
+  IN  UINT8   StartingOffset,
+  OUT UINT8   **Area,
+  OUT UINTN   *AreaLength
+  )
+/*++
+
+Routine Description:
+
+  Read one info area in full and verify its checksum. The first read is as
+  large as the BMC allows, so the area length byte and usually the whole area
+  arrive in a single round-trip.
+
+Arguments:
+
+  InventoryAreaSize - Size of the FRU inventory area
+  StartingOffset    - Area offset from the common header, in multiples of 8 bytes
+  Area              - The area data, allocated from pool
+  AreaLength        - Length of the area, including its checksum byte
+
+Returns:
+
+  EFI_STATUS
+
+--*/
+{
+  EFI_STATUS  Status;
+  UINT8       Prefix[FRU_READ_MAX_COUNT];
+  UINT16      Offset;
+  UINTN       PrefixLength;
+  UINTN       Length;
+  UINT8       *Buffer;
+
+  Offset = (UINT16)(StartingOffset * FRU_AREA_MULTIPLIER);
+  if (Offset + 2 > InventoryAreaSize) {
+    return EFI_VOLUME_CORRUPTED;
+  }
+
+  PrefixLength = MIN (mFruReadCount, InventoryAreaSize - Offset);
+  Status = ReadFruBuffer (Offset, (UINT16)PrefixLength, Prefix);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  Length = Prefix[1] * FRU_AREA_MULTIPLIER;
+  if ((Length < 2) || (Offset + Length > InventoryAreaSize)) {
+    return EFI_VOLUME_CORRUPTED;
+  }
+
+  Buffer = AllocatePool (Length);
+  if (Buffer == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  CopyMem (Buffer, Prefix, MIN (PrefixLength, Length));
+  if (Length > PrefixLength) {
+    Status = ReadFruBuffer (
+               (UINT16)(Offset + PrefixLength),
+               (UINT16)(Length - PrefixLength),
+               Buffer + PrefixLength
+               );
+    if (EFI_ERROR (Status)) {
+      FreePool (Buffer);
+      return Status;
+    }
+  }
+
+  if (!IsFruChecksumValid (Buffer, Length)) {
+    FreePool (Buffer);
+    return EFI_CRC_ERROR;
+  }
+
+  *Area       = Buffer;
+  *AreaLength = Length;
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+ParseFruInventory (
+  IN  UINT16                  InventoryAreaSize,
+  IN  IPMI_FRU_COMMON_HEADER  *CommonHeader,
+  OUT FRU_INVENTORY           *Inventory
+  )
+/*++
+
+Routine Description:
+
+  Read and parse the chassis, board and product info areas in one pass.
+
+Arguments:
+
+  InventoryAreaSize - Size of the FRU inventory area
+  CommonHeader      - The FRU common header
+  Inventory         - The decoded inventory fields
+
+Returns:
+
+  EFI_STATUS
+
+--*/
+{
+  EFI_STATUS  Status;
+  UINT8       *Area;
+  UINTN       AreaLength;
+  FRU_STRING  *Fields[6];
+
+  if (CommonHeader->ChassisInfoStartingOffset != 0) {
+    Status = ReadFruArea (InventoryAreaSize, CommonHeader->ChassisInfoStartingOffset, &Area, &AreaLength);
+    if (!EFI_ERROR (Status)) {
+      Inventory->ChassisType = Area[2];
+      Fields[0] = &Inventory->ChassisPartNumber;
+      Fields[1] = &Inventory->ChassisSerialNumber;
+      Status = ParseFruFields (Area, AreaLength, FRU_CHASSIS_FIELDS_OFFSET, 2, Fields);
+      FreePool (Area);
+    }
+    DEBUG ((DEBUG_INFO, "IpmiFru: chassis area %r\n", Status));
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+  }
+
+  if (CommonHeader->BoardAreaStartingOffset != 0) {
+    Status = ReadFruArea (InventoryAreaSize, CommonHeader->BoardAreaStartingOffset, &Area, &AreaLength);
+    if (!EFI_ERROR (Status)) {
+      Fields[0] = &Inventory->BoardManufacturer;
+      Fields[1] = &Inventory->BoardProductName;
+      Fields[2] = &Inventory->BoardSerialNumber;
+      Fields[3] = &Inventory->BoardPartNumber;
+      Status = ParseFruFields (Area, AreaLength, FRU_BOARD_FIELDS_OFFSET, 4, Fields);
+      FreePool (Area);
+    }
+    DEBUG ((DEBUG_INFO, "IpmiFru: board area %r\n", Status));
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+  }
+
+  if (CommonHeader->ProductInfoStartingOffset != 0) {
+    Status = ReadFruArea (InventoryAreaSize, CommonHeader->ProductInfoStartingOffset, &Area, &AreaLength);
+    if (!EFI_ERROR (Status)) {
+      Fields[0] = &Inventory->ProductManufacturer;
+      Fields[1] = &Inventory->ProductName;
+      Fields[2] = &Inventory->ProductPartModelNumber;
+      Fields[3] = &Inventory->ProductVersion;
+      Fields[4] = &Inventory->ProductSerialNumber;
+      Fields[5] = &Inventory->ProductAssetTag;
+      Status = ParseFruFields (Area, AreaLength, FRU_PRODUCT_FIELDS_OFFSET, 6, Fields);
+      FreePool (Area);
+    }
+    DEBUG ((DEBUG_INFO, "IpmiFru: product area %r\n", Status));
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+  }
+
+  return EFI_SUCCESS;
+}
+
 EFI_STATUS
 EFIAPI
 InitializeFru (
@@ -41,6 +460,8 @@ Returns:
   IPMI_GET_DEVICE_ID_RESPONSE                ControllerInfo;
   IPMI_GET_FRU_INVENTORY_AREA_INFO_REQUEST   GetFruInventoryAreaInfoRequest;
   IPMI_GET_FRU_INVENTORY_AREA_INFO_RESPONSE  GetFruInventoryAreaInfoResponse;
+  IPMI_FRU_COMMON_HEADER                     CommonHeader;
+  FRU_INVENTORY                              *Inventory;
 
   //
   //  Get all the SDR Records from BMC and retrieve the Record ID from the structure for future use.
@@ -61,6 +482,32 @@ Returns:
       return Status;
     }
     DEBUG((DEBUG_ERROR, "!!! IpmiFru  InventoryAreaSize=%x\n", GetFruInventoryAreaInfoResponse.InventoryAreaSize));
+
+    if (GetFruInventoryAreaInfoResponse.InventoryAreaSize < sizeof (CommonHeader)) {
+      return EFI_SUCCESS;
+    }
+
+    Status = ReadFruBuffer (0, sizeof (CommonHeader), (UINT8 *)&CommonHeader);
+    if (EFI_ERROR (Status) || !IsFruChecksumValid ((UINT8 *)&CommonHeader, sizeof (CommonHeader))) {
+      DEBUG((DEBUG_ERROR, "IpmiFru: invalid FRU common header Status=%r\n", Status));
+      return EFI_SUCCESS;
+    }
+
+    Inventory = AllocateZeroPool (sizeof (*Inventory));
+    if (Inventory == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+
+    Status = ParseFruInventory (GetFruInventoryAreaInfoResponse.InventoryAreaSize, &CommonHeader, Inventory);
+    if (EFI_ERROR (Status)) {
+      DEBUG ((DEBUG_ERROR, "IpmiFru: invalid FRU info area Status=%r\n", Status));
+    } else {
+      DEBUG ((DEBUG_INFO, "IpmiFru: board %a %a SN %a\n",
+        Inventory->BoardManufacturer, Inventory->BoardProductName, Inventory->BoardSerialNumber));
+      DEBUG ((DEBUG_INFO, "IpmiFru: product %a %a SN %a\n",
+        Inventory->ProductManufacturer, Inventory->ProductName, Inventory->ProductSerialNumber));
+    }
+    FreePool (Inventory);
   }
 
   return EFI_SUCCESS;
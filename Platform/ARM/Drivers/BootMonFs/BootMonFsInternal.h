@@ -35,6 +35,7 @@ typedef struct {
   LIST_ENTRY            Link;
   VOID*                 Buffer;
   UINTN                 Size;
+  UINTN                 AllocatedSize; // Size of Buffer, may be larger than Size
   UINT64                Offset; // Offset from the start of the file
 } BOOTMON_FS_FILE_REGION;
 
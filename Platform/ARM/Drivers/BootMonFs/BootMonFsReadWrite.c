@@ -14,6 +14,117 @@
 
 #include "BootMonFsInternal.h"
 
+/**
+  Overlay the data of the pending write regions of a file onto a buffer.
+
+  The regions are applied in the order they were written so that the most
+  recent data wins where regions overlap.
+
+  @param[in]      File      The file whose pending regions are copied.
+  @param[in]      Offset    Offset in the file of the first byte of Buffer.
+  @param[in]      Size      Size of Buffer in bytes.
+  @param[in out]  Buffer    The buffer to update.
+
+**/
+STATIC
+VOID
+BootMonFsReadPendingRegions (
+  IN     BOOTMON_FS_FILE  *File,
+  IN     UINT64           Offset,
+  IN     UINTN            Size,
+  IN OUT UINT8            *Buffer
+  )
+{
+  LIST_ENTRY              *RegionToFlushLink;
+  BOOTMON_FS_FILE_REGION  *Region;
+  UINT64                  Start;
+  UINT64                  End;
+
+  for (RegionToFlushLink = GetFirstNode (&File->RegionToFlushLink);
+       !IsNull (&File->RegionToFlushLink, RegionToFlushLink);
+       RegionToFlushLink = GetNextNode (&File->RegionToFlushLink, RegionToFlushLink)
+       )
+  {
+    Region = (BOOTMON_FS_FILE_REGION*)RegionToFlushLink;
+
+    Start = MAX (Offset, Region->Offset);
+    End   = MIN (Offset + Size, Region->Offset + Region->Size);
+    if (Start >= End) {
+      continue;
+    }
+
+    CopyMem (
+      Buffer + (Start - Offset),
+      (UINT8*)Region->Buffer + (Start - Region->Offset),
+      (UINTN)(End - Start)
+      );
+  }
+}
+
+/**
+  Try to merge a write with the most recent pending region of a file.
+
+  The write is merged when it starts within or right at the end of the last
+  region written. As it is the most recent write, its data can replace the
+  data of that region without breaking the ordering of the regions. The
+  region buffer grows geometrically so that a sequence of small sequential
+  writes ends up as a single region, flushed with a single disk write.
+
+  @param[in]  File        The file being written.
+  @param[in]  BufferSize  Size of the data to write.
+  @param[in]  Buffer      The data to write.
+
+  @retval  EFI_SUCCESS            The data was merged in the last region.
+  @retval  EFI_NOT_FOUND          The write cannot be merged.
+  @retval  EFI_OUT_OF_RESOURCES   Unable to grow the region buffer.
+
+**/
+STATIC
+EFI_STATUS
+BootMonFsMergeRegion (
+  IN BOOTMON_FS_FILE  *File,
+  IN UINTN            BufferSize,
+  IN VOID             *Buffer
+  )
+{
+  BOOTMON_FS_FILE_REGION  *Region;
+  UINTN                   RegionOffset;
+  UINTN                   NewSize;
+  UINTN                   NewAllocatedSize;
+  VOID                    *NewBuffer;
+
+  if (IsListEmpty (&File->RegionToFlushLink)) {
+    return EFI_NOT_FOUND;
+  }
+
+  Region = (BOOTMON_FS_FILE_REGION*)GetPreviousNode (
+                                      &File->RegionToFlushLink,
+                                      &File->RegionToFlushLink
+                                      );
+  if ((File->Position < Region->Offset) ||
+      (File->Position > Region->Offset + Region->Size)) {
+    return EFI_NOT_FOUND;
+  }
+
+  RegionOffset = (UINTN)(File->Position - Region->Offset);
+  NewSize      = MAX (Region->Size, RegionOffset + BufferSize);
+
+  if (NewSize > Region->AllocatedSize) {
+    NewAllocatedSize = MAX (NewSize, 2 * Region->AllocatedSize);
+    NewBuffer = ReallocatePool (Region->Size, NewAllocatedSize, Region->Buffer);
+    if (NewBuffer == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+    Region->Buffer        = NewBuffer;
+    Region->AllocatedSize = NewAllocatedSize;
+  }
+
+  CopyMem ((UINT8*)Region->Buffer + RegionOffset, Buffer, BufferSize);
+  Region->Size = NewSize;
+
+  return EFI_SUCCESS;
+}
+
 /**
   Read data from an open file.
 
@@ -47,6 +158,8 @@ BootMonFsReadFile (
   UINT64                FileStart;
   EFI_STATUS            Status;
   UINTN                 RemainingFileSize;
+  UINT64                DataSize;
+  UINTN                 DiskReadSize;
 
   if ((This == NULL)       ||
       (BufferSize == NULL) ||
@@ -58,10 +171,6 @@ BootMonFsReadFile (
     return EFI_INVALID_PARAMETER;
   }
 
-  // Ensure the file has been written in Flash before reading it.
-  // This keeps the code simple and avoids having to manage a non-flushed file.
-  BootMonFsFlushFile (This);
-
   Instance  = File->Instance;
   DiskIo    = Instance->DiskIo;
   Media     = Instance->Media;
@@ -86,17 +195,38 @@ BootMonFsReadFile (
     *BufferSize = RemainingFileSize;
   }
 
-  Status = DiskIo->ReadDisk (
-                    DiskIo,
-                    Media->MediaId,
-                    FileStart + File->Position,
-                    *BufferSize,
-                    Buffer
-                    );
-  if (EFI_ERROR (Status)) {
-    *BufferSize = 0;
+  // The file is not flushed before being read. The data already in Flash is
+  // read from the media, then the pending regions are applied on top of it.
+  // Bytes covered by neither (a gap left by a seek past the end of the file)
+  // read as zero.
+  DataSize = 0;
+  if (File->HwDescription.RegionCount > 0) {
+    DataSize = MIN (File->HwDescription.Region[0].Size, File->Info->FileSize);
   }
 
+  DiskReadSize = 0;
+  if (File->Position < DataSize) {
+    DiskReadSize = (UINTN)MIN (*BufferSize, DataSize - File->Position);
+  }
+
+  Status = EFI_SUCCESS;
+  if (DiskReadSize > 0) {
+    Status = DiskIo->ReadDisk (
+                      DiskIo,
+                      Media->MediaId,
+                      FileStart + File->Position,
+                      DiskReadSize,
+                      Buffer
+                      );
+    if (EFI_ERROR (Status)) {
+      *BufferSize = 0;
+      return Status;
+    }
+  }
+  ZeroMem ((UINT8*)Buffer + DiskReadSize, *BufferSize - DiskReadSize);
+
+  BootMonFsReadPendingRegions (File, File->Position, *BufferSize, Buffer);
+
   File->Position += *BufferSize;
 
   return Status;
@@ -106,7 +236,9 @@ BootMonFsReadFile (
   Write data to an open file.
 
   The data is not written to the flash yet. It will be written when the file
-  will be either read, closed or flushed.
+  will be either closed or flushed. A write which starts within or right after
+  the previous one is merged with it, so that sequential writes are flushed
+  as a single region.
 
   @param[in]      This        A pointer to the EFI_FILE_PROTOCOL instance that
                               is the file handle to write data to.
@@ -132,6 +264,7 @@ BootMonFsWriteFile (
 {
   BOOTMON_FS_FILE         *File;
   BOOTMON_FS_FILE_REGION  *Region;
+  EFI_STATUS              Status;
 
   if (This == NULL) {
     return EFI_INVALID_PARAMETER;
@@ -145,6 +278,19 @@ BootMonFsWriteFile (
     return EFI_ACCESS_DENIED;
   }
 
+  Status = BootMonFsMergeRegion (File, *BufferSize, Buffer);
+  if (Status == EFI_OUT_OF_RESOURCES) {
+    *BufferSize = 0;
+    return Status;
+  }
+  if (!EFI_ERROR (Status)) {
+    File->Position += *BufferSize;
+    if (File->Position > File->Info->FileSize) {
+      File->Info->FileSize = File->Position;
+    }
+    return EFI_SUCCESS;
+  }
+
   // Allocate and initialize the memory region
   Region = (BOOTMON_FS_FILE_REGION*)AllocateZeroPool (sizeof (BOOTMON_FS_FILE_REGION));
   if (Region == NULL) {
@@ -159,8 +305,9 @@ BootMonFsWriteFile (
     return EFI_OUT_OF_RESOURCES;
   }
 
-  Region->Size   = *BufferSize;
-  Region->Offset = File->Position;
+  Region->Size          = *BufferSize;
+  Region->AllocatedSize = *BufferSize;
+  Region->Offset        = File->Position;
 
   InsertTailList (&File->RegionToFlushLink, &Region->Link);
 
@@ -0,0 +1,125 @@
+/** @file
+*
+*  Token index for the Configuration Manager platform repositories.
+*
+*  Copyright (c) 2021, ARM Limited. All rights reserved.
+*
+*  SPDX-License-Identifier: BSD-2-Clause-Patent
+*
+**/
+
+#ifndef _CM_TOKEN_INDEX_LIB_H_
+#define _CM_TOKEN_INDEX_LIB_H_
+
+#include <ConfigurationManagerObject.h>
+#include <Protocol/ConfigurationManagerProtocol.h>
+
+/** An opaque token index.
+
+  The index maps the tokens handed out by a Configuration Manager to the
+  objects they reference, so that token references are resolved in constant
+  time rather than by scanning the platform repository. It also accumulates
+  the time spent in the GetObject () calls made while generating the ACPI
+  tables, which is reported at ReadyToBoot.
+*/
+typedef struct CmTokenIndex CM_TOKEN_INDEX;
+
+/** Create an empty token index.
+
+  @param [in]  MaxEntries  Maximum number of tokens to be added.
+  @param [out] Index       The created index.
+
+  @retval EFI_SUCCESS            Success.
+  @retval EFI_INVALID_PARAMETER  A parameter is invalid.
+  @retval EFI_OUT_OF_RESOURCES   Failed to allocate the index.
+**/
+EFI_STATUS
+EFIAPI
+CmTokenIndexCreate (
+  IN  UINTN                 MaxEntries,
+  OUT CM_TOKEN_INDEX     ** Index
+  );
+
+/** Free a token index.
+
+  The pending ReadyToBoot statistics report of the index is cancelled.
+
+  @param [in]  Index  The token index, may be NULL.
+**/
+VOID
+EFIAPI
+CmTokenIndexFree (
+  IN  CM_TOKEN_INDEX      * Index
+  );
+
+/** Add the object(s) referenced by a token to the index.
+
+  @param [in]  Index       The token index.
+  @param [in]  CmObjectId  The Configuration Manager Object ID of the object(s).
+  @param [in]  Token       The token referencing the object(s).
+  @param [in]  Data        Pointer to the object(s).
+  @param [in]  Size        Total size of the object(s).
+  @param [in]  Count       Number of objects.
+
+  @retval EFI_SUCCESS            Success.
+  @retval EFI_INVALID_PARAMETER  A parameter is invalid.
+  @retval EFI_ALREADY_STARTED    The token is already in the index.
+  @retval EFI_OUT_OF_RESOURCES   The index is full.
+**/
+EFI_STATUS
+EFIAPI
+CmTokenIndexAdd (
+  IN  CM_TOKEN_INDEX      * Index,
+  IN  CM_OBJECT_ID          CmObjectId,
+  IN  CM_OBJECT_TOKEN       Token,
+  IN  VOID                * Data,
+  IN  UINTN                 Size,
+  IN  UINTN                 Count
+  );
+
+/** Look up the object(s) referenced by a token.
+
+  @param [in]      Index         The token index.
+  @param [in]      CmObjectId    The Configuration Manager Object ID requested.
+  @param [in]      Token         The token referencing the object(s).
+  @param [in, out] CmObjectDesc  Pointer to the Configuration Manager Object
+                                 descriptor describing the object(s).
+
+  @retval EFI_SUCCESS            Success.
+  @retval EFI_INVALID_PARAMETER  A parameter is invalid.
+  @retval EFI_NOT_FOUND          No object of this ID matches the token.
+**/
+EFI_STATUS
+EFIAPI
+CmTokenIndexFind (
+  IN  CONST CM_TOKEN_INDEX    * Index,
+  IN  CONST CM_OBJECT_ID        CmObjectId,
+  IN  CONST CM_OBJECT_TOKEN     Token,
+  IN  OUT   CM_OBJ_DESCRIPTOR * CONST CmObjectDesc
+  );
+
+/** Start timing a GetObject () request.
+
+  @return The current performance counter value.
+**/
+UINT64
+EFIAPI
+CmTokenIndexProfileStart (
+  VOID
+  );
+
+/** Account the time spent in a GetObject () request.
+
+  @param [in]  Index       The token index, may be NULL.
+  @param [in]  CmObjectId  The Configuration Manager Object ID requested.
+  @param [in]  Start       The value returned by CmTokenIndexProfileStart ().
+**/
+VOID
+EFIAPI
+CmTokenIndexProfileEnd (
+  IN  CM_TOKEN_INDEX      * Index,
+  IN  CM_OBJECT_ID          CmObjectId,
+  IN  UINT64                Start
+  );
+
+#endif // _CM_TOKEN_INDEX_LIB_H_
@@ -14,6 +14,7 @@
 #include <IndustryStandard/MemoryMappedConfigurationSpaceAccessTable.h>
 #include <IndustryStandard/SerialPortConsoleRedirectionTable.h>
 #include <Library/ArmLib.h>
+#include <Library/CmTokenIndexLib.h>
 #include <Library/DebugLib.h>
 #include <Library/IoLib.h>
 #include <Library/PcdLib.h>
@@ -589,6 +590,11 @@ HandleCmObject (
   return EFI_SUCCESS;
 }
 
+/** Index of the tokens referenced by the platform repository objects,
+    NULL if it could not be built.
+*/
+STATIC CM_TOKEN_INDEX  * mCmTokenIndex;
+
 /** A helper function for returning the Configuration Manager Objects that
     match the token.
 
@@ -628,6 +634,8 @@ HandleCmObjectRefByToken (
     CmObjectDesc->Data = (VOID*)Object;
     CmObjectDesc->Count = ObjectCount;
     Status = EFI_SUCCESS;
+  } else if (mCmTokenIndex != NULL) {
+    Status = CmTokenIndexFind (mCmTokenIndex, CmObjectId, Token, CmObjectDesc);
   } else {
     Status = HandlerProc (This, CmObjectId, Token, CmObjectDesc);
   }
@@ -682,7 +690,12 @@ HandleCmObjectSearchPlatformRepo (
     return EFI_INVALID_PARAMETER;
   }
 
-  Status = HandlerProc (This, CmObjectId, Token, CmObjectDesc);
+  if (mCmTokenIndex != NULL) {
+    Status = CmTokenIndexFind (mCmTokenIndex, CmObjectId, Token, CmObjectDesc);
+  } else {
+    Status = HandlerProc (This, CmObjectId, Token, CmObjectDesc);
+  }
+
   DEBUG ((
     DEBUG_INFO,
     "INFO: Token = 0x%p, CmObjectId = %x, Ptr = 0x%p, Size = %d, Count = %d\n",
@@ -695,6 +708,120 @@ HandleCmObjectSearchPlatformRepo (
   return Status;
 }
 
+/** Add the object(s) referenced by a token to the token index.
+
+  The token is the address of the object(s).
+
+  @param [in]  ObjectId  The ARM namespace object ID of the object(s).
+  @param [in]  Object    Pointer to the object(s).
+  @param [in]  Size      Total size of the object(s).
+  @param [in]  Count     Number of objects.
+
+  @retval EFI_SUCCESS   Success.
+  @retval Others        Failed to add the token.
+**/
+STATIC
+EFI_STATUS
+AddArmObjectToken (
+  IN  EARM_OBJECT_ID    ObjectId,
+  IN  VOID            * Object,
+  IN  UINTN             Size,
+  IN  UINTN             Count
+  )
+{
+  return CmTokenIndexAdd (
+           mCmTokenIndex,
+           CREATE_CM_ARM_OBJECT_ID (ObjectId),
+           (CM_OBJECT_TOKEN)Object,
+           Object,
+           Size,
+           Count
+           );
+}
+
+/** Build the index of the tokens referenced by the platform repository.
+
+  @param [in]  PlatformRepo  Pointer to the platform repository.
+
+  @retval EFI_SUCCESS   Success.
+  @retval Others        Failed to build the index.
+**/
+STATIC
+EFI_STATUS
+InitializeTokenIndex (
+  IN  EDKII_PLATFORM_REPOSITORY_INFO  * PlatformRepo
+  )
+{
+  EFI_STATUS  Status;
+  UINTN       Index;
+
+  Status = CmTokenIndexCreate (
+             1 + ARRAY_SIZE (PlatformRepo->GicCInfo) + 4,
+             &mCmTokenIndex
+             );
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  Status = AddArmObjectToken (
+             EArmObjGTBlockTimerFrameInfo,
+             PlatformRepo->GTBlock0TimerInfo,
+             sizeof (PlatformRepo->GTBlock0TimerInfo),
+             ARRAY_SIZE (PlatformRepo->GTBlock0TimerInfo)
+             );
+
+  for (Index = 0;
+       !EFI_ERROR (Status) && (Index < ARRAY_SIZE (PlatformRepo->GicCInfo));
+       Index++) {
+    Status = AddArmObjectToken (
+               EArmObjGicCInfo,
+               &PlatformRepo->GicCInfo[Index],
+               sizeof (PlatformRepo->GicCInfo[Index]),
+               1
+               );
+  }
+
+  if (!EFI_ERROR (Status)) {
+    Status = AddArmObjectToken (
+               EArmObjCmRef,
+               PlatformRepo->BigClusterResources,
+               sizeof (PlatformRepo->BigClusterResources),
+               ARRAY_SIZE (PlatformRepo->BigClusterResources)
+               );
+  }
+  if (!EFI_ERROR (Status)) {
+    Status = AddArmObjectToken (
+               EArmObjCmRef,
+               PlatformRepo->BigCoreResources,
+               sizeof (PlatformRepo->BigCoreResources),
+               ARRAY_SIZE (PlatformRepo->BigCoreResources)
+               );
+  }
+  if (!EFI_ERROR (Status)) {
+    Status = AddArmObjectToken (
+               EArmObjCmRef,
+               PlatformRepo->LittleClusterResources,
+               sizeof (PlatformRepo->LittleClusterResources),
+               ARRAY_SIZE (PlatformRepo->LittleClusterResources)
+               );
+  }
+  if (!EFI_ERROR (Status)) {
+    Status = AddArmObjectToken (
+               EArmObjCmRef,
+               PlatformRepo->LittleCoreResources,
+               sizeof (PlatformRepo->LittleCoreResources),
+               ARRAY_SIZE (PlatformRepo->LittleCoreResources)
+               );
+  }
+
+  if (EFI_ERROR (Status)) {
+    // Fall back to searching the platform repository
+    CmTokenIndexFree (mCmTokenIndex);
+    mCmTokenIndex = NULL;
+  }
+  return Status;
+}
+
 /** Initialize the platform configuration repository.
 
   @param [in]  This        Pointer to the Configuration Manager Protocol.
@@ -709,11 +836,21 @@ InitializePlatformRepository (
   )
 {
   EDKII_PLATFORM_REPOSITORY_INFO  * PlatformRepo;
+  EFI_STATUS                        Status;
 
   PlatformRepo = This->PlatRepoInfo;
 
   GetJunoRevision (PlatformRepo->JunoRevision);
   DEBUG ((DEBUG_INFO, "Juno Rev = 0x%x\n", PlatformRepo->JunoRevision));
+
+  Status = InitializeTokenIndex (PlatformRepo);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((
+      DEBUG_WARN,
+      "WARNING: Failed to build the token index. Status = %r\n",
+      Status
+      ));
+  }
   return EFI_SUCCESS;
 }
 
@@ -1229,6 +1366,7 @@ ArmJunoPlatformGetObject (
   )
 {
   EFI_STATUS  Status;
+  UINT64      ProfileStart;
 
   if ((This == NULL) || (CmObject == NULL)) {
     ASSERT (This != NULL);
@@ -1236,6 +1374,8 @@ ArmJunoPlatformGetObject (
     return EFI_INVALID_PARAMETER;
   }
 
+  ProfileStart = CmTokenIndexProfileStart ();
+
   switch (GET_CM_NAMESPACE_ID (CmObjectId)) {
     case EObjNameSpaceStandard:
       Status = GetStandardNameSpaceObject (This, CmObjectId, Token, CmObject);
@@ -1258,6 +1398,7 @@ ArmJunoPlatformGetObject (
     }
   }
 
+  CmTokenIndexProfileEnd (mCmTokenIndex, CmObjectId, ProfileStart);
   return Status;
 }
 
@@ -54,8 +54,10 @@ SataSiI3132PortConstructor (
   Port->RegBase  = Index * 0x2000;
   Port->Instance = SataSiI3132Instance;
   InitializeListHead (&(Port->Devices));
+  InitializeListHead (&(Port->PendingRequests));
 
-  NumberOfBytes = sizeof (SATA_SI3132_PRB);
+  // Allocate a command block for each slot to issue several commands at once
+  NumberOfBytes = SII3132_PORT_SLOT_COUNT * sizeof (SATA_SI3132_CMD_BLOCK);
   Status = SataSiI3132Instance->PciIo->AllocateBuffer (
              SataSiI3132Instance->PciIo, AllocateAnyPages, EfiBootServicesData,
              EFI_SIZE_TO_PAGES (NumberOfBytes), &HostPRB, 0
@@ -90,6 +92,7 @@ SataSiI3132Constructor (
 {
   SATA_SI3132_INSTANCE    *Instance;
   EFI_ATA_PASS_THRU_MODE  *AtaPassThruMode;
+  EFI_STATUS              Status;
 
   if (!SataSiI3132Instance) {
     return EFI_INVALID_PARAMETER;
@@ -104,9 +107,24 @@ SataSiI3132Constructor (
   Instance->PciIo               = PciIo;
 
   AtaPassThruMode = (EFI_ATA_PASS_THRU_MODE*)AllocatePool (sizeof (EFI_ATA_PASS_THRU_MODE));
-  AtaPassThruMode->Attributes = EFI_ATA_PASS_THRU_ATTRIBUTES_PHYSICAL | EFI_ATA_PASS_THRU_ATTRIBUTES_LOGICAL;
+  AtaPassThruMode->Attributes = EFI_ATA_PASS_THRU_ATTRIBUTES_PHYSICAL | EFI_ATA_PASS_THRU_ATTRIBUTES_LOGICAL |
+                                EFI_ATA_PASS_THRU_ATTRIBUTES_NONBLOCKIO;
   AtaPassThruMode->IoAlign = 0x1000;
 
+  // Non-blocking requests are completed by polling the slots from a timer
+  Status = gBS->CreateEvent (
+                  EVT_TIMER | EVT_NOTIFY_SIGNAL,
+                  TPL_NOTIFY,
+                  SiI3132PollRequests,
+                  Instance,
+                  &Instance->PollEvent
+                  );
+  if (EFI_ERROR (Status)) {
+    FreePool (AtaPassThruMode);
+    FreePool (Instance);
+    return Status;
+  }
+
   // Initialize SiI3132 ports
   SataSiI3132PortConstructor (Instance, 0);
   SataSiI3132PortConstructor (Instance, 1);
@@ -205,6 +223,7 @@ SataSiI3132PortInitialization (
       Device->Index     = Port->Index; //TODO: Could need to be fixed when SATA Port Multiplier support
       Device->Port      = Port;
       Device->BlockSize = 0;
+      Device->QueueDepth = 0;
 
       // Attached the device to the Sata Port
       InsertTailList (&Port->Devices, &Device->Link);
@@ -70,8 +70,30 @@
 #define SII3132_PORT_INT_CMDERR                 (1 << 1)
 #define SII3132_PORT_INT_PORTRDY                (1 << 2)
 
+#define SII3132_PORT_SLOTSTATUS_ATTENTION       0x80000000
+
 #define SATA_SII3132_MAXPORT    2
 
+// Each port has 31 command slots, each with its own 128 byte window in LRAM
+#define SII3132_PORT_SLOT_COUNT         31
+#define SII3132_PORT_SLOT_MASK          ((1U << SII3132_PORT_SLOT_COUNT) - 1)
+#define SII3132_PORT_SLOT_SIZE          0x80
+#define SII3132_PORT_SLOT_ASB_OFFSET    0x08
+
+// NCQ commands, the tag is in bits [7:3] of the sector count
+#define SATA_CMD_READ_FPDMA_QUEUED      0x60
+#define SATA_CMD_WRITE_FPDMA_QUEUED     0x61
+#define SATA_NCQ_TAG_SHIFT              3
+
+// Identify data word 76
+#define SATA_CAPABILITY_NCQ             BIT8
+
+// Period of the timer completing the non-blocking requests, in 100ns units
+#define SII3132_POLL_PERIOD             EFI_TIMER_PERIOD_MICROSECONDS (100)
+
+// Polling interval of the blocking requests, in microseconds
+#define SII3132_BLOCKING_POLL_US        1
+
 #define PRB_CTRL_ATA            0x0
 #define PRB_CTRL_PROT_OVERRIDE  0x1
 #define PRB_CTRL_RESTRANSMIT    0x2
@@ -94,6 +116,13 @@
 #define SGE_LNK     (1 << 30)
 #define SGE_TRM     0x80000000
 
+// The scatter-gather tables are made of groups of 4 SGEs, where the last entry
+// of a group links to the next group
+#define SGT_GROUP_SIZE          4
+#define SII3132_SGT_ENTRIES     (3 * SGT_GROUP_SIZE)
+// Sge[0] of the PRB, plus the scatter-gather table less the links between groups
+#define SII3132_MAX_SEGMENTS    (1 + SII3132_SGT_ENTRIES - (SII3132_SGT_ENTRIES / SGT_GROUP_SIZE - 1))
+
 typedef struct _SATA_SI3132_SGE {
     UINT32      DataAddressLow;
     UINT32      DataAddressHigh;
@@ -117,13 +146,38 @@ typedef struct _SATA_SI3132_PRB {
     SATA_SI3132_SGE     Sge[2];
 } SATA_SI3132_PRB;
 
+//
+// Command block of a slot: the PRB followed by its scatter-gather table
+//
+typedef struct _SATA_SI3132_CMD_BLOCK {
+    SATA_SI3132_PRB     Prb;
+    SATA_SI3132_SGE     Sgt[SII3132_SGT_ENTRIES];
+} SATA_SI3132_CMD_BLOCK;
+
 typedef struct _SATA_SI3132_DEVICE {
     LIST_ENTRY                  Link; // This attribute must be the first entry of this structure (to avoid pointer computation)
     UINTN                       Index;
     struct _SATA_SI3132_PORT    *Port;  //Parent Port
     UINT32                      BlockSize;
+    UINT32                      QueueDepth; // NCQ queue depth, 0 if NCQ is not supported
 } SATA_SI3132_DEVICE;
 
+//
+// ATA Pass Thru request, queued on its port until a slot is available
+//
+typedef struct _SATA_SI3132_REQUEST {
+    LIST_ENTRY                          Link; // This attribute must be the first entry of this structure (to avoid pointer computation)
+    SATA_SI3132_DEVICE                  *Device;
+    UINT16                              PortMultiplierPort;
+    EFI_ATA_PASS_THRU_COMMAND_PACKET    *Packet;
+    EFI_EVENT                           Event;
+    EFI_STATUS                          Status;
+    BOOLEAN                             Queued;   // Issued as an NCQ command
+    UINT64                              Deadline; // In 100ns units, 0 if no timeout
+    UINTN                               MappingCount;
+    VOID                                *Mapping[SII3132_MAX_SEGMENTS];
+} SATA_SI3132_REQUEST;
+
 typedef struct _SATA_SI3132_PORT {
     UINTN                           Index;
     UINTN                           RegBase;
@@ -132,9 +186,16 @@ typedef struct _SATA_SI3132_PORT {
     //TODO: Support Port multiplier
     LIST_ENTRY                      Devices;
 
-    SATA_SI3132_PRB*                HostPRB;
+    // One command block per slot
+    SATA_SI3132_CMD_BLOCK*          HostPRB;
     EFI_PHYSICAL_ADDRESS            PhysAddrHostPRB;
     VOID*                           PciAllocMappingPRB;
+
+    // Requests issued in each slot, and requests waiting for a slot
+    SATA_SI3132_REQUEST*            Slots[SII3132_PORT_SLOT_COUNT];
+    UINT32                          ActiveSlots;
+    BOOLEAN                         ExclusiveActive; // A non-queued or blocking request owns the port
+    LIST_ENTRY                      PendingRequests;
 } SATA_SI3132_PORT;
 
 typedef struct _SATA_SI3132_INSTANCE {
@@ -145,6 +206,10 @@ typedef struct _SATA_SI3132_INSTANCE {
     EFI_ATA_PASS_THRU_PROTOCOL  AtaPassThruProtocol;
 
     EFI_PCI_IO_PROTOCOL         *PciIo;
+
+    // Completion of the non-blocking requests
+    EFI_EVENT                   PollEvent;
+    BOOLEAN                     PollEventArmed;
 } SATA_SI3132_INSTANCE;
 
 #define SATA_SII3132_SIGNATURE              SIGNATURE_32('s', 'i', '3', '2')
@@ -184,6 +249,13 @@ SataSiI3132ComponentNameGetControllerName (
 
 EFI_STATUS SiI3132HwResetPort (SATA_SI3132_PORT *Port);
 
+VOID
+EFIAPI
+SiI3132PollRequests (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  );
+
 /*
  * Driver Binding Protocol Functions
  */
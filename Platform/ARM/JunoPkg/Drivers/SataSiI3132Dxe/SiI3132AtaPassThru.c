@@ -16,7 +16,10 @@
 #include "SataSiI3132.h"
 
 #include <IndustryStandard/Atapi.h>
+#include <Library/BaseLib.h>
 #include <Library/DevicePathLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/TimerLib.h>
 
 SATA_SI3132_DEVICE*
 GetSataDevice (
@@ -45,32 +48,209 @@ GetSataDevice (
   return NULL;
 }
 
+STATIC
+VOID
+SiI3132SetSge (
+  OUT SATA_SI3132_SGE       *Sge,
+  IN  EFI_PHYSICAL_ADDRESS  Address,
+  IN  UINT32                Count,
+  IN  UINT32                Attributes
+  )
+{
+  Sge->DataAddressLow  = (UINT32)Address;
+  Sge->DataAddressHigh = (UINT32)(Address >> 32);
+  Sge->DataCount       = Count;
+  Sge->Attributes      = Attributes;
+}
+
+STATIC
+VOID
+SiI3132UnmapRequest (
+  IN     EFI_PCI_IO_PROTOCOL  *PciIo,
+  IN OUT SATA_SI3132_REQUEST  *Request
+  )
+{
+  EFI_STATUS  Status;
+
+  while (Request->MappingCount > 0) {
+    Request->MappingCount--;
+    Status = PciIo->Unmap (PciIo, Request->Mapping[Request->MappingCount]);
+    ASSERT_EFI_ERROR (Status);
+  }
+}
+
+/**
+  Map a data buffer for DMA and describe it with the SGEs of a command block.
+
+  The buffer is mapped in as many pieces as the PCI I/O protocol returns, and
+  each piece gets its own SGE, rather than requiring a single mapping that
+  could only be satisfied with a bounce buffer.
+
+  @param[in]     PciIo             PCI I/O protocol of the controller.
+  @param[in]     Operation         Direction of the transfer.
+  @param[in]     Buffer            Data buffer.
+  @param[in]     Length            Size of the data buffer in bytes.
+  @param[in]     CmdBlock          Command block to fill the SGEs of.
+  @param[in]     PhysAddrCmdBlock  Bus address of the command block.
+  @param[in,out] Request           Request recording the mappings.
+
+  @retval EFI_SUCCESS          The buffer was mapped.
+  @retval EFI_BAD_BUFFER_SIZE  The buffer needs more SGEs than available.
+  @return                      Error returned by PciIo->Map().
+**/
+STATIC
 EFI_STATUS
-EFIAPI
-SiI3132AtaPassThruCommand (
-  IN     SATA_SI3132_INSTANCE             *SataSiI3132Instance,
-  IN     SATA_SI3132_PORT                 *SataPort,
-  IN     UINT16                           PortMultiplierPort,
-  IN OUT EFI_ATA_PASS_THRU_COMMAND_PACKET *Packet,
-  IN     EFI_EVENT                        Event OPTIONAL
+SiI3132MapDataBuffer (
+  IN     EFI_PCI_IO_PROTOCOL            *PciIo,
+  IN     EFI_PCI_IO_PROTOCOL_OPERATION  Operation,
+  IN     VOID                           *Buffer,
+  IN     UINTN                          Length,
+  IN     SATA_SI3132_CMD_BLOCK          *CmdBlock,
+  IN     EFI_PHYSICAL_ADDRESS           PhysAddrCmdBlock,
+  IN OUT SATA_SI3132_REQUEST            *Request
   )
 {
-  SATA_SI3132_DEVICE      *SataDevice;
-  EFI_PHYSICAL_ADDRESS    PhysInDataBuffer;
-  UINTN                   InDataBufferLength = 0;
-  EFI_PHYSICAL_ADDRESS    PhysOutDataBuffer;
-  UINTN                   OutDataBufferLength;
-  CONST UINTN             EmptySlot = 0;
-  UINTN                   Control = PRB_CTRL_ATA;
-  UINTN                   Protocol = 0;
-  UINT32                  Value32, Error, Timeout = 0;
-  CONST UINT32            IrqMask = (SII3132_PORT_INT_CMDCOMPL | SII3132_PORT_INT_CMDERR) << 16;
+  EFI_PHYSICAL_ADDRESS    SegmentAddress[SII3132_MAX_SEGMENTS];
+  UINT32                  SegmentLength[SII3132_MAX_SEGMENTS];
+  EFI_PHYSICAL_ADDRESS    SgtAddress;
+  SATA_SI3132_SGE         *Sge;
+  UINTN                   Count;
+  UINTN                   Index;
+  UINTN                   Mapped;
   EFI_STATUS              Status;
-  VOID*                   PciAllocMapping = NULL;
-  EFI_PCI_IO_PROTOCOL     *PciIo;
 
-  PciIo = SataSiI3132Instance->PciIo;
-  ZeroMem (SataPort->HostPRB, sizeof (SATA_SI3132_PRB));
+  for (Count = 0; Length > 0; Count++) {
+    if (Count == SII3132_MAX_SEGMENTS) {
+      return EFI_BAD_BUFFER_SIZE;
+    }
+
+    Mapped = Length;
+    Status = PciIo->Map (
+               PciIo, Operation, Buffer, &Mapped, &SegmentAddress[Count],
+               &Request->Mapping[Request->MappingCount]
+               );
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+    Request->MappingCount++;
+    if (Mapped == 0) {
+      return EFI_DEVICE_ERROR;
+    }
+
+    SegmentLength[Count] = (UINT32)Mapped;
+    Buffer = (UINT8 *)Buffer + Mapped;
+    Length -= Mapped;
+  }
+
+  if (Count == 0) {
+    return EFI_SUCCESS;
+  }
+
+  if (Count <= ARRAY_SIZE (CmdBlock->Prb.Sge)) {
+    // The PRB holds the SGEs
+    Sge = CmdBlock->Prb.Sge;
+    for (Index = 0; Index < Count; Index++) {
+      SiI3132SetSge (Sge++, SegmentAddress[Index], SegmentLength[Index], 0);
+    }
+  } else {
+    // The second SGE of the PRB links to the scatter-gather table
+    SgtAddress = PhysAddrCmdBlock + OFFSET_OF (SATA_SI3132_CMD_BLOCK, Sgt);
+    SiI3132SetSge (&CmdBlock->Prb.Sge[0], SegmentAddress[0], SegmentLength[0], 0);
+    SiI3132SetSge (&CmdBlock->Prb.Sge[1], SgtAddress, 0, SGE_LNK);
+
+    Sge = CmdBlock->Sgt;
+    for (Index = 1; Index < Count; Index++) {
+      // The last entry of a group links to the next one if more are needed
+      if ((((Sge - CmdBlock->Sgt) % SGT_GROUP_SIZE) == SGT_GROUP_SIZE - 1) &&
+          (Index < Count - 1)) {
+        SgtAddress += SGT_GROUP_SIZE * sizeof (SATA_SI3132_SGE);
+        SiI3132SetSge (Sge++, SgtAddress, 0, SGE_LNK);
+      }
+      SiI3132SetSge (Sge++, SegmentAddress[Index], SegmentLength[Index], 0);
+    }
+  }
+  Sge[-1].Attributes |= SGE_TRM;
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Return whether a request is issued as a Native Command Queuing command.
+
+  Non-blocking READ/WRITE DMA EXT commands are turned into their FPDMA QUEUED
+  equivalent when the device supports NCQ, so that the device can have several
+  of them in flight.
+**/
+STATIC
+BOOLEAN
+SiI3132IsQueuedRequest (
+  IN SATA_SI3132_DEVICE                *SataDevice,
+  IN EFI_ATA_PASS_THRU_COMMAND_PACKET  *Packet,
+  IN EFI_EVENT                         Event
+  )
+{
+  if (Packet->Protocol == EFI_ATA_PASS_THRU_PROTOCOL_FPDMA) {
+    return TRUE;
+  }
+
+  if ((Event == NULL) || (SataDevice == NULL) || (SataDevice->QueueDepth <= 1)) {
+    return FALSE;
+  }
+
+  return ((Packet->Protocol == EFI_ATA_PASS_THRU_PROTOCOL_UDMA_DATA_IN) &&
+          (Packet->Acb->AtaCommand == ATA_CMD_READ_DMA_EXT)) ||
+         ((Packet->Protocol == EFI_ATA_PASS_THRU_PROTOCOL_UDMA_DATA_OUT) &&
+          (Packet->Acb->AtaCommand == ATA_CMD_WRITE_DMA_EXT));
+}
+
+/**
+  Return the slots a request can be issued in.
+
+  The slot number is the NCQ tag, so queued requests must use the slots below
+  the queue depth of the device.
+**/
+STATIC
+UINT32
+SiI3132RequestSlotMask (
+  IN SATA_SI3132_REQUEST  *Request
+  )
+{
+  UINT32  QueueDepth;
+
+  QueueDepth = (Request->Device != NULL) ? Request->Device->QueueDepth : 0;
+  if (Request->Queued && (QueueDepth != 0) && (QueueDepth < SII3132_PORT_SLOT_COUNT)) {
+    return (1U << QueueDepth) - 1;
+  }
+  return SII3132_PORT_SLOT_MASK;
+}
+
+STATIC
+EFI_STATUS
+SiI3132BuildCommand (
+  IN     SATA_SI3132_PORT     *SataPort,
+  IN     UINTN                Slot,
+  IN OUT SATA_SI3132_REQUEST  *Request
+  )
+{
+  EFI_ATA_PASS_THRU_COMMAND_PACKET  *Packet;
+  SATA_SI3132_DEVICE                *SataDevice;
+  SATA_SI3132_CMD_BLOCK             *CmdBlock;
+  EFI_PHYSICAL_ADDRESS              PhysAddrCmdBlock;
+  EFI_ATA_COMMAND_BLOCK             Acb;
+  EFI_PCI_IO_PROTOCOL               *PciIo;
+  UINTN                             Control = PRB_CTRL_ATA;
+  UINTN                             Protocol = 0;
+  UINTN                             DataLength;
+  BOOLEAN                           DataIn;
+  BOOLEAN                           HasData = FALSE;
+  EFI_STATUS                        Status = EFI_SUCCESS;
+
+  PciIo            = SataPort->Instance->PciIo;
+  Packet           = Request->Packet;
+  SataDevice       = Request->Device;
+  CmdBlock         = &SataPort->HostPRB[Slot];
+  PhysAddrCmdBlock = SataPort->PhysAddrHostPRB + (Slot * sizeof (SATA_SI3132_CMD_BLOCK));
+  ZeroMem (CmdBlock, sizeof (SATA_SI3132_CMD_BLOCK));
 
   // Construct Si3132 PRB
   switch (Packet->Protocol) {
@@ -82,7 +262,7 @@ SiI3132AtaPassThruCommand (
     Control = PRB_CTRL_SRST;
 
     if (FeaturePcdGet (PcdSataSiI3132FeaturePMPSupport)) {
-        SataPort->HostPRB->Fis.Control = 0x0F;
+        CmdBlock->Prb.Fis.Control = 0x0F;
     }
     break;
   case EFI_ATA_PASS_THRU_PROTOCOL_ATA_NON_DATA:
@@ -92,77 +272,64 @@ SiI3132AtaPassThruCommand (
   // There is no difference for SiI3132 between PIO and DMA invokation
   case EFI_ATA_PASS_THRU_PROTOCOL_UDMA_DATA_IN:
   case EFI_ATA_PASS_THRU_PROTOCOL_PIO_DATA_IN:
+  case EFI_ATA_PASS_THRU_PROTOCOL_UDMA_DATA_OUT:
+  case EFI_ATA_PASS_THRU_PROTOCOL_PIO_DATA_OUT:
+  case EFI_ATA_PASS_THRU_PROTOCOL_FPDMA:
+    HasData = TRUE;
+    if (Packet->Protocol == EFI_ATA_PASS_THRU_PROTOCOL_FPDMA) {
+      // The direction of a queued command follows the buffer it was given
+      DataIn = (Packet->InTransferLength != 0);
+    } else {
+      DataIn = (Packet->Protocol == EFI_ATA_PASS_THRU_PROTOCOL_UDMA_DATA_IN) ||
+               (Packet->Protocol == EFI_ATA_PASS_THRU_PROTOCOL_PIO_DATA_IN);
+    }
+
     // Fixup the size for block transfer. Following UEFI Specification, 'InTransferLength' should
     // be in number of bytes. But for most data transfer commands, the value is in number of blocks
-    if (Packet->Acb->AtaCommand == ATA_CMD_IDENTIFY_DRIVE) {
-      InDataBufferLength = Packet->InTransferLength;
+    if (DataIn && (Packet->Acb->AtaCommand == ATA_CMD_IDENTIFY_DRIVE)) {
+      DataLength = Packet->InTransferLength;
     } else {
-      SataDevice = GetSataDevice (SataSiI3132Instance, SataPort->Index, PortMultiplierPort);
       if (!SataDevice || (SataDevice->BlockSize == 0)) {
         return EFI_INVALID_PARAMETER;
       }
-
-      InDataBufferLength = Packet->InTransferLength * SataDevice->BlockSize;
+      DataLength = (DataIn ? Packet->InTransferLength : Packet->OutTransferLength) * SataDevice->BlockSize;
     }
 
-    Status = PciIo->Map (
-               PciIo, EfiPciIoOperationBusMasterWrite,
-               Packet->InDataBuffer, &InDataBufferLength, &PhysInDataBuffer, &PciAllocMapping
-               );
-    if (EFI_ERROR (Status)) {
-      return Status;
-    }
-
-    // Construct SGEs (32-bit system)
-    SataPort->HostPRB->Sge[0].DataAddressLow = (UINT32)PhysInDataBuffer;
-    SataPort->HostPRB->Sge[0].DataAddressHigh = (UINT32)(PhysInDataBuffer >> 32);
-    SataPort->HostPRB->Sge[0].Attributes = SGE_TRM; // Only one SGE
-    SataPort->HostPRB->Sge[0].DataCount = InDataBufferLength;
-
-    // Copy the Ata Command Block
-    CopyMem (&SataPort->HostPRB->Fis, Packet->Acb, sizeof (EFI_ATA_COMMAND_BLOCK));
-
-    // Fixup the FIS
-    SataPort->HostPRB->Fis.FisType = 0x27; // Register - Host to Device FIS
-    SataPort->HostPRB->Fis.Control = 1 << 7; // Is a command
-    if (FeaturePcdGet (PcdSataSiI3132FeaturePMPSupport)) {
-      SataPort->HostPRB->Fis.Control |= PortMultiplierPort & 0xFF;
-    }
-    break;
-  case EFI_ATA_PASS_THRU_PROTOCOL_UDMA_DATA_OUT:
-  case EFI_ATA_PASS_THRU_PROTOCOL_PIO_DATA_OUT:
-    SataDevice = GetSataDevice (SataSiI3132Instance, SataPort->Index, PortMultiplierPort);
-    if (!SataDevice || (SataDevice->BlockSize == 0)) {
-      return EFI_INVALID_PARAMETER;
+    if (DataIn) {
+      Status = SiI3132MapDataBuffer (
+                 PciIo, EfiPciIoOperationBusMasterWrite, Packet->InDataBuffer, DataLength,
+                 CmdBlock, PhysAddrCmdBlock, Request
+                 );
+    } else {
+      Status = SiI3132MapDataBuffer (
+                 PciIo, EfiPciIoOperationBusMasterRead, Packet->OutDataBuffer, DataLength,
+                 CmdBlock, PhysAddrCmdBlock, Request
+                 );
     }
-
-    // Fixup the size for block transfer. Following UEFI Specification, 'InTransferLength' should
-    // be in number of bytes. But for most data transfer commands, the value is in number of blocks
-    OutDataBufferLength = Packet->OutTransferLength * SataDevice->BlockSize;
-
-    Status = PciIo->Map (
-               PciIo, EfiPciIoOperationBusMasterRead,
-               Packet->OutDataBuffer, &OutDataBufferLength, &PhysOutDataBuffer, &PciAllocMapping
-               );
     if (EFI_ERROR (Status)) {
       return Status;
     }
 
-    // Construct SGEs (32-bit system)
-    SataPort->HostPRB->Sge[0].DataAddressLow  = (UINT32)PhysOutDataBuffer;
-    SataPort->HostPRB->Sge[0].DataAddressHigh = (UINT32)(PhysOutDataBuffer >> 32);
-    SataPort->HostPRB->Sge[0].Attributes      = SGE_TRM; // Only one SGE
-    SataPort->HostPRB->Sge[0].DataCount       = OutDataBufferLength;
-
     // Copy the Ata Command Block
-    CopyMem (&SataPort->HostPRB->Fis, Packet->Acb, sizeof (EFI_ATA_COMMAND_BLOCK));
+    CopyMem (&Acb, Packet->Acb, sizeof (EFI_ATA_COMMAND_BLOCK));
+
+    if (Request->Queued) {
+      if (Packet->Protocol != EFI_ATA_PASS_THRU_PROTOCOL_FPDMA) {
+        // FPDMA QUEUED commands take the sector count in the features
+        Acb.AtaCommand        = DataIn ? SATA_CMD_READ_FPDMA_QUEUED : SATA_CMD_WRITE_FPDMA_QUEUED;
+        Acb.AtaFeatures       = Acb.AtaSectorCount;
+        Acb.AtaFeaturesExp    = Acb.AtaSectorCountExp;
+        Acb.AtaSectorCountExp = 0;
+        Acb.AtaDeviceHead     = BIT6; // LBA mode
+      }
+      // The tag of the command is its slot
+      Acb.AtaSectorCount = (UINT8)(Slot << SATA_NCQ_TAG_SHIFT);
 
-    // Fixup the FIS
-    SataPort->HostPRB->Fis.FisType = 0x27; // Register - Host to Device FIS
-    SataPort->HostPRB->Fis.Control = 1 << 7; // Is a command
-    if (FeaturePcdGet (PcdSataSiI3132FeaturePMPSupport)) {
-      SataPort->HostPRB->Fis.Control |= PortMultiplierPort & 0xFF;
+      Control  = PRB_CTRL_PROT_OVERRIDE;
+      Protocol = PRB_PROT_NATIVE_QUEUE | (DataIn ? PRB_PROT_READ : PRB_PROT_WRITE);
     }
+
+    CopyMem (&CmdBlock->Prb.Fis, &Acb, sizeof (EFI_ATA_COMMAND_BLOCK));
     break;
   case EFI_ATA_PASS_THRU_PROTOCOL_DMA:
     ASSERT (0); //TODO: Implement me!
@@ -176,9 +343,6 @@ SiI3132AtaPassThruCommand (
   case EFI_ATA_PASS_THRU_PROTOCOL_DEVICE_RESET:
     ASSERT (0); //TODO: Implement me!
     break;
-  case EFI_ATA_PASS_THRU_PROTOCOL_FPDMA:
-    ASSERT (0); //TODO: Implement me!
-    break;
   case EFI_ATA_PASS_THRU_PROTOCOL_RETURN_RESPONSE:
     ASSERT (0); //TODO: Implement me!
     break;
@@ -187,105 +351,530 @@ SiI3132AtaPassThruCommand (
     break;
   }
 
-  SataPort->HostPRB->Control = Control;
-  SataPort->HostPRB->ProtocolOverride = Protocol;
+  if (HasData) {
+    // Fixup the FIS
+    CmdBlock->Prb.Fis.FisType = 0x27; // Register - Host to Device FIS
+    CmdBlock->Prb.Fis.Control = 1 << 7; // Is a command
+    if (FeaturePcdGet (PcdSataSiI3132FeaturePMPSupport)) {
+      CmdBlock->Prb.Fis.Control |= Request->PortMultiplierPort & 0xFF;
+    }
+  }
 
-  // Clear IRQ
-  SATA_PORT_WRITE32 (SataPort->RegBase + SII3132_PORT_INTSTATUS_REG, IrqMask);
+  CmdBlock->Prb.Control = Control;
+  CmdBlock->Prb.ProtocolOverride = Protocol;
 
-  if (!FeaturePcdGet (PcdSataSiI3132FeatureDirectCommandIssuing)) {
-    // Indirect Command Issuance
+  return Status;
+}
 
-    //TODO: Find which slot is free (maybe use the Cmd FIFO)
-    //SATA_PORT_READ32 (SataPort->RegBase + SII3132_PORT_CMDEXECFIFO_REG, &EmptySlot);
+STATIC
+VOID
+SiI3132IssueSlot (
+  IN SATA_SI3132_PORT  *SataPort,
+  IN UINTN             Slot
+  )
+{
+  EFI_PCI_IO_PROTOCOL     *PciIo;
+  EFI_PHYSICAL_ADDRESS    PhysAddrCmdBlock;
+  EFI_STATUS              Status;
+
+  PciIo = SataPort->Instance->PciIo;
+  PhysAddrCmdBlock = SataPort->PhysAddrHostPRB + (Slot * sizeof (SATA_SI3132_CMD_BLOCK));
 
-    SATA_PORT_WRITE32 (SataPort->RegBase + SII3132_PORT_CMDACTIV_REG + (EmptySlot * 8),
-                     (UINT32)(SataPort->PhysAddrHostPRB & 0xFFFFFFFF));
-    SATA_PORT_WRITE32 (SataPort->RegBase + SII3132_PORT_CMDACTIV_REG + (EmptySlot * 8) + 4,
-                     (UINT32)((SataPort->PhysAddrHostPRB >> 32) & 0xFFFFFFFF));
+  if (!FeaturePcdGet (PcdSataSiI3132FeatureDirectCommandIssuing)) {
+    // Indirect Command Issuance
+    SATA_PORT_WRITE32 (SataPort->RegBase + SII3132_PORT_CMDACTIV_REG + (Slot * 8),
+                     (UINT32)(PhysAddrCmdBlock & 0xFFFFFFFF));
+    SATA_PORT_WRITE32 (SataPort->RegBase + SII3132_PORT_CMDACTIV_REG + (Slot * 8) + 4,
+                     (UINT32)((PhysAddrCmdBlock >> 32) & 0xFFFFFFFF));
   } else {
     // Direct Command Issuance
     Status = PciIo->Mem.Write (PciIo, EfiPciIoWidthUint32, 1, // Bar 1
-        SataPort->RegBase + (EmptySlot * 0x80),
+        SataPort->RegBase + (Slot * SII3132_PORT_SLOT_SIZE),
         sizeof (SATA_SI3132_PRB) / 4,
-        SataPort->HostPRB);
+        &SataPort->HostPRB[Slot].Prb);
     ASSERT_EFI_ERROR (Status);
 
-    SATA_PORT_WRITE32 (SataPort->RegBase + SII3132_PORT_CMDEXECFIFO_REG, EmptySlot);
+    SATA_PORT_WRITE32 (SataPort->RegBase + SII3132_PORT_CMDEXECFIFO_REG, Slot);
+  }
+}
+
+/**
+  Return the current time in 100ns units, the unit of Packet->Timeout.
+
+  The poll timer fires at the granularity of the system tick rather than at
+  the period it is armed with, so the deadlines are not derived from it.
+**/
+STATIC
+UINT64
+SiI3132GetTime (
+  VOID
+  )
+{
+  return DivU64x32 (GetTimeInNanoSecond (GetPerformanceCounter ()), 100);
+}
+
+/**
+  Build a request in a free slot and issue it.
+
+  NCQ and non-NCQ commands cannot be outstanding at the same time, so a
+  non-queued request needs an idle port, and a queued request can only join
+  other queued requests. Blocking requests also need an idle port, so that a
+  timeout of a blocking request never affects other requests.
+
+  @retval EFI_SUCCESS    The request was issued in Slot.
+  @retval EFI_NOT_READY  The request cannot be issued yet.
+  @return                The request could not be built.
+**/
+STATIC
+EFI_STATUS
+SiI3132StartRequest (
+  IN     SATA_SI3132_PORT     *SataPort,
+  IN OUT SATA_SI3132_REQUEST  *Request,
+  OUT    UINTN                *Slot
+  )
+{
+  UINT32      FreeSlots;
+  BOOLEAN     Exclusive;
+  EFI_STATUS  Status;
+
+  Exclusive = !Request->Queued || (Request->Event == NULL);
+  FreeSlots = ~SataPort->ActiveSlots & SiI3132RequestSlotMask (Request);
+  if ((SataPort->ActiveSlots != 0) &&
+      (Exclusive || SataPort->ExclusiveActive || (FreeSlots == 0))) {
+    return EFI_NOT_READY;
+  }
+
+  *Slot = (UINTN)LowBitSet32 (FreeSlots);
+  Status = SiI3132BuildCommand (SataPort, *Slot, Request);
+  if (EFI_ERROR (Status)) {
+    SiI3132UnmapRequest (SataPort->Instance->PciIo, Request);
+    return Status;
+  }
+
+  // A request issued again after a port reset keeps its original deadline
+  if ((Request->Packet->Timeout != 0) && (Request->Deadline == 0)) {
+    Request->Deadline = SiI3132GetTime () + Request->Packet->Timeout;
+  }
+
+  SataPort->Slots[*Slot] = Request;
+  SataPort->ActiveSlots |= 1U << *Slot;
+  SataPort->ExclusiveActive = Exclusive;
+
+  SiI3132IssueSlot (SataPort, *Slot);
+  return EFI_SUCCESS;
+}
+
+STATIC
+VOID
+SiI3132UpdateDevice (
+  IN SATA_SI3132_DEVICE  *SataDevice,
+  IN ATA_IDENTIFY_DATA   *IdentifyData
+  )
+{
+  // Check logical block size
+  if ((IdentifyData->phy_logic_sector_support & BIT12) != 0) {
+    SataDevice->BlockSize = (UINT32) (((IdentifyData->logic_sector_size_hi << 16) |
+                                        IdentifyData->logic_sector_size_lo) * sizeof (UINT16));
+  } else {
+    SataDevice->BlockSize = 0x200;
   }
 
-#if 0
-  // Could need to be implemented if we run multiple command in parallel to know which slot has been completed
-  SATA_PORT_READ32 (SataPort->RegBase + SII3132_PORT_SLOTSTATUS_REG, &Value32);
-  Timeout = Packet->Timeout;
-  while (!Timeout && !Value32) {
+  // Check the NCQ support and queue depth
+  if ((IdentifyData->serial_ata_capabilities & SATA_CAPABILITY_NCQ) != 0) {
+    SataDevice->QueueDepth = (IdentifyData->queue_depth & 0x1F) + 1;
+  } else {
+    SataDevice->QueueDepth = 0;
+  }
+}
+
+/**
+  Complete the request issued in a slot, and release the slot.
+
+  Non-blocking requests report their completion by signaling their event, with
+  the error bit of the ATA status set if the request failed.
+**/
+STATIC
+VOID
+SiI3132CompleteSlot (
+  IN SATA_SI3132_PORT  *SataPort,
+  IN UINTN             Slot,
+  IN EFI_STATUS        Status
+  )
+{
+  SATA_SI3132_REQUEST               *Request;
+  EFI_ATA_PASS_THRU_COMMAND_PACKET  *Packet;
+  EFI_PCI_IO_PROTOCOL               *PciIo;
+  EFI_STATUS                        ReadStatus;
+
+  PciIo   = SataPort->Instance->PciIo;
+  Request = SataPort->Slots[Slot];
+  Packet  = Request->Packet;
+
+  // Fill Packet Ata Status Block
+  ReadStatus = PciIo->Mem.Read (PciIo, EfiPciIoWidthUint32, 1, // Bar 1
+      SataPort->RegBase + (Slot * SII3132_PORT_SLOT_SIZE) + SII3132_PORT_SLOT_ASB_OFFSET,
+      sizeof (EFI_ATA_STATUS_BLOCK) / 4,
+      Packet->Asb);
+  ASSERT_EFI_ERROR (ReadStatus);
+
+  SiI3132UnmapRequest (PciIo, Request);
+
+  SataPort->Slots[Slot] = NULL;
+  SataPort->ActiveSlots &= ~(1U << Slot);
+  if (SataPort->ActiveSlots == 0) {
+    SataPort->ExclusiveActive = FALSE;
+  }
+
+  if (EFI_ERROR (Status)) {
+    Packet->Asb->AtaStatus |= ATA_STSREG_ERR;
+  } else if ((Packet->Acb->AtaCommand == ATA_CMD_IDENTIFY_DRIVE) && (Request->Device != NULL)) {
+    // If the command was ATA_CMD_IDENTIFY_DRIVE then we need to update the BlockSize
+    SiI3132UpdateDevice (Request->Device, (ATA_IDENTIFY_DATA*)Packet->InDataBuffer);
+  }
+
+  Request->Status = Status;
+  if (Request->Event != NULL) {
+    gBS->SignalEvent (Request->Event);
+    FreePool (Request);
+  }
+}
+
+/**
+  Re-initialize a port, which flushes all its slots.
+
+  The requests of the active slots are left in place. They can only be
+  released once this returns, as the port no longer accesses their buffers.
+**/
+STATIC
+VOID
+SiI3132ResetPort (
+  IN SATA_SI3132_PORT  *SataPort
+  )
+{
+  EFI_PCI_IO_PROTOCOL     *PciIo;
+  UINT32                  Value32;
+  UINT32                  SlotStatus;
+  UINTN                   Timeout;
+
+  PciIo = SataPort->Instance->PciIo;
+
+  // Port Initialize flushes the slots, wait for them to drain and for the
+  // port to be ready again
+  SATA_PORT_WRITE32 (SataPort->RegBase + SII3132_PORT_CONTROLSET_REG, SII3132_PORT_CONTROL_INT);
+  SATA_PORT_READ32 (SataPort->RegBase + SII3132_PORT_STATUS_REG, &Value32);
+  SATA_PORT_READ32 (SataPort->RegBase + SII3132_PORT_SLOTSTATUS_REG, &SlotStatus);
+  Timeout = 1000;
+  while ((Timeout > 0) &&
+         (((Value32 & SII3132_PORT_STATUS_PORTREADY) == 0) ||
+          ((SlotStatus & SataPort->ActiveSlots) != 0))) {
     gBS->Stall (1);
-    SATA_PORT_READ32 (SataPort->RegBase + SII3132_PORT_SLOTSTATUS_REG, &Value32);
     Timeout--;
+    SATA_PORT_READ32 (SataPort->RegBase + SII3132_PORT_STATUS_REG, &Value32);
+    SATA_PORT_READ32 (SataPort->RegBase + SII3132_PORT_SLOTSTATUS_REG, &SlotStatus);
+  }
+  if (Timeout == 0) {
+    DEBUG ((EFI_D_ERROR, "SiI3132AtaPassThru() Port %d did not reset\n", (UINT32)SataPort->Index));
   }
-#else
+
+  // Clear IRQ
+  SATA_PORT_WRITE32 (SataPort->RegBase + SII3132_PORT_INTSTATUS_REG,
+                     (SII3132_PORT_INT_CMDCOMPL | SII3132_PORT_INT_CMDERR) << 16);
+}
+
+/**
+  Fail all the requests issued on a port, and re-initialize the port.
+
+  An error stops the port, and the device aborts all its outstanding NCQ
+  commands, so none of the issued requests can complete.
+**/
+STATIC
+VOID
+SiI3132FailActiveSlots (
+  IN SATA_SI3132_PORT  *SataPort
+  )
+{
+  EFI_PCI_IO_PROTOCOL     *PciIo;
+  UINT32                  Value32;
+  UINT32                  Error;
+
+  PciIo = SataPort->Instance->PciIo;
+
   SATA_PORT_READ32 (SataPort->RegBase + SII3132_PORT_INTSTATUS_REG, &Value32);
-  if (!Packet->Timeout) {
-    while (!(Value32 & IrqMask)) {
-      gBS->Stall (1);
-      SATA_PORT_READ32 (SataPort->RegBase + SII3132_PORT_INTSTATUS_REG, &Value32);
+  SATA_PORT_READ32 (SataPort->RegBase + SII3132_PORT_CMDERROR_REG, &Error);
+  DEBUG ((EFI_D_ERROR, "SiI3132AtaPassThru() CmdErr:0x%X (SiI3132 Err:0x%X)\n", Value32, Error));
+
+  SiI3132ResetPort (SataPort);
+
+  while (SataPort->ActiveSlots != 0) {
+    SiI3132CompleteSlot (SataPort, (UINTN)LowBitSet32 (SataPort->ActiveSlots), EFI_DEVICE_ERROR);
+  }
+}
+
+/**
+  Fail the request of a slot that did not complete in time.
+
+  The port has to be re-initialized to take the slot back, which flushes the
+  other slots too. Their requests did not fail, so they are put back at the
+  head of the pending requests to be issued again.
+**/
+STATIC
+VOID
+SiI3132TimeoutSlot (
+  IN SATA_SI3132_PORT  *SataPort,
+  IN UINTN             Slot
+  )
+{
+  SATA_SI3132_REQUEST     *Request;
+  UINTN                   Index;
+
+  DEBUG ((EFI_D_ERROR, "SiI3132AtaPassThru() Err:Timeout\n"));
+
+  // The port may still transfer to the buffers of the slot until it is reset
+  SiI3132ResetPort (SataPort);
+
+  SiI3132CompleteSlot (SataPort, Slot, EFI_TIMEOUT);
+
+  // Blocking requests own the port, so only non-blocking requests are left
+  for (Index = SII3132_PORT_SLOT_COUNT; Index > 0; Index--) {
+    if ((SataPort->ActiveSlots & (1U << (Index - 1))) == 0) {
+      continue;
     }
-  } else {
-    Timeout = Packet->Timeout;
-    while (Timeout && !(Value32 & IrqMask)) {
-      gBS->Stall (1);
-      SATA_PORT_READ32 (SataPort->RegBase + SII3132_PORT_INTSTATUS_REG, &Value32);
-      Timeout--;
+    Request = SataPort->Slots[Index - 1];
+    SiI3132UnmapRequest (SataPort->Instance->PciIo, Request);
+    SataPort->Slots[Index - 1] = NULL;
+    InsertHeadList (&SataPort->PendingRequests, &Request->Link);
+  }
+  SataPort->ActiveSlots = 0;
+  SataPort->ExclusiveActive = FALSE;
+}
+
+STATIC
+VOID
+SiI3132StartPendingRequests (
+  IN SATA_SI3132_PORT  *SataPort
+  )
+{
+  SATA_SI3132_REQUEST     *Request;
+  UINTN                   Slot;
+  EFI_STATUS              Status;
+
+  while (!IsListEmpty (&SataPort->PendingRequests)) {
+    Request = (SATA_SI3132_REQUEST*)GetFirstNode (&SataPort->PendingRequests);
+    Status = SiI3132StartRequest (SataPort, Request, &Slot);
+    if (Status == EFI_NOT_READY) {
+      break;
+    }
+
+    RemoveEntryList (&Request->Link);
+    if (EFI_ERROR (Status)) {
+      // The request could not be built, report the error to its owner
+      ZeroMem (Request->Packet->Asb, sizeof (EFI_ATA_STATUS_BLOCK));
+      Request->Packet->Asb->AtaStatus = ATA_STSREG_ERR;
+      gBS->SignalEvent (Request->Event);
+      FreePool (Request);
     }
   }
-#endif
-  // Fill Packet Ata Status Block
-  Status = PciIo->Mem.Read (PciIo, EfiPciIoWidthUint32, 1, // Bar 1
-      SataPort->RegBase + 0x08,
-      sizeof (EFI_ATA_STATUS_BLOCK) / 4,
-      Packet->Asb);
-  ASSERT_EFI_ERROR (Status);
+}
 
+/**
+  Complete the requests of a port whose slot is no longer active, and issue
+  the pending requests in the slots released.
+**/
+STATIC
+VOID
+SiI3132PollPort (
+  IN SATA_SI3132_PORT  *SataPort
+  )
+{
+  EFI_PCI_IO_PROTOCOL     *PciIo;
+  UINT32                  SlotStatus;
+  UINT32                  Completed;
+  UINTN                   Slot;
 
-  if ((Packet->Timeout != 0) && (Timeout == 0)) {
-    DEBUG ((EFI_D_ERROR, "SiI3132AtaPassThru() Err:Timeout\n"));
-    //ASSERT (0);
-    return EFI_TIMEOUT;
-  } else if (Value32 & (SII3132_PORT_INT_CMDERR << 16)) {
-    SATA_PORT_READ32 (SataPort->RegBase + SII3132_PORT_CMDERROR_REG, &Error);
-    DEBUG ((EFI_D_ERROR, "SiI3132AtaPassThru() CmdErr:0x%X (SiI3132 Err:0x%X)\n", Value32, Error));
-    ASSERT (0);
-    return EFI_DEVICE_ERROR;
-  } else if (Value32 & (SII3132_PORT_INT_CMDCOMPL << 16)) {
+  PciIo = SataPort->Instance->PciIo;
+
+  if (SataPort->ActiveSlots != 0) {
     // Clear Command Complete
     SATA_PORT_WRITE32 (SataPort->RegBase + SII3132_PORT_INTSTATUS_REG, SII3132_PORT_INT_CMDCOMPL << 16);
 
-    if (PciAllocMapping) {
-      Status = PciIo->Unmap (PciIo, PciAllocMapping);
-      ASSERT (!EFI_ERROR (Status));
+    SATA_PORT_READ32 (SataPort->RegBase + SII3132_PORT_SLOTSTATUS_REG, &SlotStatus);
+    if (SlotStatus & SII3132_PORT_SLOTSTATUS_ATTENTION) {
+      SiI3132FailActiveSlots (SataPort);
+    } else {
+      Completed = SataPort->ActiveSlots & ~SlotStatus;
+      while (Completed != 0) {
+        Slot = (UINTN)LowBitSet32 (Completed);
+        Completed &= ~(1U << Slot);
+        SiI3132CompleteSlot (SataPort, Slot, EFI_SUCCESS);
+      }
     }
+  }
 
-    // If the command was ATA_CMD_IDENTIFY_DRIVE then we need to update the BlockSize
-    if (Packet->Acb->AtaCommand == ATA_CMD_IDENTIFY_DRIVE) {
-      ATA_IDENTIFY_DATA *IdentifyData = (ATA_IDENTIFY_DATA*)Packet->InDataBuffer;
+  SiI3132StartPendingRequests (SataPort);
+}
 
-      // Get the corresponding Block Device
-      SataDevice = GetSataDevice (SataSiI3132Instance, SataPort->Index, PortMultiplierPort);
+/**
+  Timer notification completing the non-blocking requests.
 
-      // Check logical block size
-      if ((IdentifyData->phy_logic_sector_support & BIT12) != 0) {
-        ASSERT (SataDevice != NULL);
-        SataDevice->BlockSize = (UINT32) (((IdentifyData->logic_sector_size_hi << 16) |
-                                            IdentifyData->logic_sector_size_lo) * sizeof (UINT16));
-      } else {
-        SataDevice->BlockSize = 0x200;
+  @param[in] Event    The poll timer.
+  @param[in] Context  The SiI3132 instance.
+**/
+VOID
+EFIAPI
+SiI3132PollRequests (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  SATA_SI3132_INSTANCE    *SataSiI3132Instance;
+  SATA_SI3132_PORT        *SataPort;
+  SATA_SI3132_REQUEST     *Request;
+  UINTN                   Index;
+  UINT32                  Slots;
+  UINTN                   Slot;
+  UINT64                  Now;
+  BOOLEAN                 Idle;
+
+  SataSiI3132Instance = (SATA_SI3132_INSTANCE*)Context;
+  Now = SiI3132GetTime ();
+  Idle = TRUE;
+
+  for (Index = 0; Index < SATA_SII3132_MAXPORT; Index++) {
+    SataPort = &SataSiI3132Instance->Ports[Index];
+    SiI3132PollPort (SataPort);
+
+    // Fail the requests that did not complete in time
+    for (Slots = SataPort->ActiveSlots; Slots != 0; Slots &= ~(1U << Slot)) {
+      Slot = (UINTN)LowBitSet32 (Slots);
+      Request = SataPort->Slots[Slot];
+      if ((Request->Deadline != 0) && (Now >= Request->Deadline)) {
+        // The other requests are issued again, and time out on their own
+        SiI3132TimeoutSlot (SataPort, Slot);
+        SiI3132StartPendingRequests (SataPort);
+        break;
       }
     }
-    return EFI_SUCCESS;
+
+    if ((SataPort->ActiveSlots != 0) || !IsListEmpty (&SataPort->PendingRequests)) {
+      Idle = FALSE;
+    }
+  }
+
+  if (Idle) {
+    gBS->SetTimer (Event, TimerCancel, 0);
+    SataSiI3132Instance->PollEventArmed = FALSE;
+  }
+}
+
+EFI_STATUS
+EFIAPI
+SiI3132AtaPassThruCommand (
+  IN     SATA_SI3132_INSTANCE             *SataSiI3132Instance,
+  IN     SATA_SI3132_PORT                 *SataPort,
+  IN     UINT16                           PortMultiplierPort,
+  IN OUT EFI_ATA_PASS_THRU_COMMAND_PACKET *Packet,
+  IN     EFI_EVENT                        Event OPTIONAL
+  )
+{
+  SATA_SI3132_REQUEST     BlockingRequest;
+  SATA_SI3132_REQUEST     *Request;
+  UINTN                   Slot;
+  EFI_TPL                 OldTpl;
+  EFI_STATUS              Status;
+
+  if (Event != NULL) {
+    Request = AllocateZeroPool (sizeof (SATA_SI3132_REQUEST));
+    if (Request == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+    }
   } else {
-    ASSERT (0);
-    return EFI_DEVICE_ERROR;
+    Request = &BlockingRequest;
+    ZeroMem (Request, sizeof (SATA_SI3132_REQUEST));
+  }
+
+  Request->Device             = GetSataDevice (SataSiI3132Instance, SataPort->Index, PortMultiplierPort);
+  Request->PortMultiplierPort = PortMultiplierPort;
+  Request->Packet             = Packet;
+  Request->Event              = Event;
+  Request->Queued             = SiI3132IsQueuedRequest (Request->Device, Packet, Event);
+
+  // The poll timer also completes requests, keep it out while the slots are updated
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+
+  if (Event != NULL) {
+    // Issue the request straight away if it does not have to wait for a slot.
+    // Otherwise queue it, the poll timer issues it when a slot is released.
+    Status = EFI_NOT_READY;
+    if (IsListEmpty (&SataPort->PendingRequests)) {
+      Status = SiI3132StartRequest (SataPort, Request, &Slot);
+    }
+    if (Status == EFI_NOT_READY) {
+      InsertTailList (&SataPort->PendingRequests, &Request->Link);
+      Status = EFI_SUCCESS;
+    }
+
+    if (EFI_ERROR (Status)) {
+      FreePool (Request);
+    } else if (!SataSiI3132Instance->PollEventArmed) {
+      Status = gBS->SetTimer (SataSiI3132Instance->PollEvent, TimerPeriodic, SII3132_POLL_PERIOD);
+      ASSERT_EFI_ERROR (Status);
+      SataSiI3132Instance->PollEventArmed = TRUE;
+    }
+
+    gBS->RestoreTPL (OldTpl);
+    return Status;
   }
+
+  //
+  // Blocking requests poll at the caller's TPL. The TPL is only raised while
+  // the slots are updated. The deadline covers the wait for the port as well
+  // as the command.
+  //
+  if (Packet->Timeout != 0) {
+    Request->Deadline = SiI3132GetTime () + Packet->Timeout;
+  }
+
+  // Blocking requests wait for the outstanding non-blocking requests
+  while ((SataPort->ActiveSlots != 0) || !IsListEmpty (&SataPort->PendingRequests)) {
+    gBS->RestoreTPL (OldTpl);
+    if ((Request->Deadline != 0) && (SiI3132GetTime () >= Request->Deadline)) {
+      return EFI_NOT_READY;
+    }
+    gBS->Stall (SII3132_BLOCKING_POLL_US);
+
+    OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+    SiI3132PollPort (SataPort);
+  }
+
+  Status = SiI3132StartRequest (SataPort, Request, &Slot);
+  gBS->RestoreTPL (OldTpl);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  //
+  // The slot is released once the request completed, either here or by the
+  // poll timer if non-blocking requests are submitted in the meantime.
+  //
+  while (TRUE) {
+    OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+    SiI3132PollPort (SataPort);
+    if (SataPort->Slots[Slot] != Request) {
+      gBS->RestoreTPL (OldTpl);
+      break;
+    }
+    if ((Request->Deadline != 0) && (SiI3132GetTime () >= Request->Deadline)) {
+      SiI3132TimeoutSlot (SataPort, Slot);
+      SiI3132StartPendingRequests (SataPort);
+      gBS->RestoreTPL (OldTpl);
+      break;
+    }
+    gBS->RestoreTPL (OldTpl);
+
+    gBS->Stall (SII3132_BLOCKING_POLL_US);
+  }
+
+  return Request->Status;
 }
 
 /**
@@ -28,8 +28,47 @@ typedef struct {
   UINTN       FileOffset; // Where the data is from, Src
   BOOLEAN     Zeroes;     // A section of Zeroes. Like .bss in ELF
   UINTN       Length;     // Number of bytes.
+  UINTN       Pages;      // Pages allocated at Src, 0 if none
 } RUNAXF_LOAD_LIST;
 
+// Number of bytes read from the file to identify its type. This must be large
+// enough for both the ELF32 and ELF64 file headers.
+#define RUNAXF_FILE_HEADER_SIZE   64
+
+// Segments are read in chunks of this size, and hashed as they are read.
+#define RUNAXF_READ_CHUNK_SIZE    SIZE_1MB
+
+/**
+  Read a region of a file that must be loaded at a given address, and add it
+  to the load list.
+
+  The region is read straight to its load address when that memory is free.
+  Otherwise it is read to a staging buffer and copied in place after
+  ExitBootServices(), when overwriting UEFI memory no longer matters.
+
+  When DEBUG_INFO messages are enabled, the SHA-256 digest of the region is
+  computed while it is read and logged.
+
+  @param[in] FileHandle   Handle of the file to read from.
+  @param[in] FileOffset   Offset of the region in the file.
+  @param[in] LoadAddress  Address the region must be loaded at.
+  @param[in] Length       Size of the region in bytes.
+  @param[in] LoadList     Load list to add the region to.
+
+  @retval EFI_SUCCESS           The region was read.
+  @retval EFI_OUT_OF_RESOURCES  Failed to allocate memory.
+  @retval EFI_END_OF_FILE       The region extends past the end of the file.
+  @return                       Error returned when reading the file.
+**/
+EFI_STATUS
+RunAxfLoadRegion (
+  IN  SHELL_FILE_HANDLE  FileHandle,
+  IN  UINT64             FileOffset,
+  IN  UINTN              LoadAddress,
+  IN  UINTN              Length,
+  IN  LIST_ENTRY        *LoadList
+  );
+
 
 /**
   This is the shell command handler function pointer callback type. This
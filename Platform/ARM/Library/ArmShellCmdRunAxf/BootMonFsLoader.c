@@ -81,8 +81,6 @@ BootMonFsCheckFile (
 
   @param[in]  FileHandle    Handle of the file to load.
 
-  @param[in]  FileData      Address  of the file data in memory.
-
   @param[out] EntryPoint    Will be filled with the ELF entry point address.
 
   @param[out] ImageSize     Will be filled with the file size in memory. This
@@ -98,7 +96,6 @@ BootMonFsCheckFile (
 EFI_STATUS
 BootMonFsLoadFile (
   IN  CONST EFI_FILE_HANDLE   FileHandle,
-  IN  CONST VOID             *FileData,
   OUT VOID                  **EntryPoint,
   OUT LIST_ENTRY             *LoadList
   )
@@ -108,10 +105,8 @@ BootMonFsLoadFile (
   UINTN                 InfoSize;
   UINTN                 Index;
   UINTN                 ImageSize;
-  RUNAXF_LOAD_LIST     *LoadNode;
 
   ASSERT (FileHandle != NULL);
-  ASSERT (FileData   != NULL);
   ASSERT (EntryPoint != NULL);
   ASSERT (LoadList   != NULL);
 
@@ -123,20 +118,18 @@ BootMonFsLoadFile (
 
   if (!EFI_ERROR (Status)) {
     *EntryPoint = (VOID*)((UINTN)Info.EntryPoint);
-    // Load all the regions to run-time memory
+    // Read all the regions from the file
     for (Index = 0; Index < Info.RegionCount; Index++) {
-      LoadNode = AllocateRuntimeZeroPool (sizeof (RUNAXF_LOAD_LIST));
-      if (LoadNode == NULL) {
-        Status = EFI_OUT_OF_RESOURCES;
+      Status = RunAxfLoadRegion ((SHELL_FILE_HANDLE)FileHandle,
+                                 Info.Region[Index].Offset,
+                                 (UINTN)Info.Region[Index].LoadAddress,
+                                 (UINTN)Info.Region[Index].Size,
+                                 LoadList);
+      if (EFI_ERROR (Status)) {
         break;
       }
 
-      LoadNode->MemOffset  = (UINTN)Info.Region[Index].LoadAddress;
-      LoadNode->FileOffset = (UINTN)FileData + Info.Region[Index].Offset;
-      LoadNode->Length     = (UINTN)Info.Region[Index].Size;
-      InsertTailList (LoadList, &LoadNode->Link);
-
-      ImageSize += LoadNode->Length;
+      ImageSize += (UINTN)Info.Region[Index].Size;
     }
   }
 
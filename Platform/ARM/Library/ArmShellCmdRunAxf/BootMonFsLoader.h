@@ -35,8 +35,6 @@ BootMonFsCheckFile (
 
   @param[in]  FileHandle    Handle of the file to load.
 
-  @param[in]  FileData      Address  of the file data in memory.
-
   @param[out] EntryPoint    Will be filled with the ELF entry point address.
 
   @param[out] ImageSize     Will be filled with the file size in memory. This
@@ -52,7 +50,6 @@ BootMonFsCheckFile (
 EFI_STATUS
 BootMonFsLoadFile (
   IN  CONST EFI_FILE_HANDLE   FileHandle,
-  IN  CONST VOID             *FileData,
   OUT VOID                  **EntryPoint,
   OUT LIST_ENTRY             *LoadList
   );
@@ -140,12 +140,12 @@ ElfCheckHeader (
 STATIC
 EFI_STATUS
 ElfLoadSegment (
-  IN  CONST VOID  *ElfImage,
-  IN  CONST VOID  *PHdr,
-  IN  LIST_ENTRY  *LoadList
+  IN  SHELL_FILE_HANDLE  FileHandle,
+  IN  CONST VOID        *PHdr,
+  IN  LIST_ENTRY        *LoadList
   )
 {
-  VOID             *FileSegment;
+  EFI_STATUS        Status;
   VOID             *MemSegment;
   UINTN             ExtraZeroes;
   UINTN             ExtraZeroesCount;
@@ -159,10 +159,9 @@ ElfLoadSegment (
   ProgramHdr = (Elf64_Phdr *)PHdr;
 #endif
 
-  ASSERT (ElfImage != NULL);
+  ASSERT (FileHandle != NULL);
   ASSERT (ProgramHdr != NULL);
 
-  FileSegment = (VOID *)((UINTN)ElfImage + ProgramHdr->p_offset);
   MemSegment = (VOID *)ProgramHdr->p_vaddr;
 
   // If the segment's memory size p_memsz is larger than the file size p_filesz,
@@ -175,19 +174,17 @@ ElfLoadSegment (
     return EFI_INVALID_PARAMETER;
   }
 
-  // Load the segment in memory.
+  // Read the segment from the file.
   if (ProgramHdr->p_filesz != 0) {
-    DEBUG ((EFI_D_INFO, "Loading segment from 0x%lx to 0x%lx (size = %ld)\n",
-                 FileSegment, MemSegment, ProgramHdr->p_filesz));
-
-    LoadNode = AllocateRuntimeZeroPool (sizeof (RUNAXF_LOAD_LIST));
-    if (LoadNode == NULL) {
-      return EFI_OUT_OF_RESOURCES;
+    DEBUG ((EFI_D_INFO, "Loading segment from file offset 0x%lx to 0x%lx (size = %ld)\n",
+                 (UINT64)ProgramHdr->p_offset, MemSegment, (UINT64)ProgramHdr->p_filesz));
+
+    Status = RunAxfLoadRegion (FileHandle, ProgramHdr->p_offset,
+                               (UINTN)MemSegment, (UINTN)ProgramHdr->p_filesz,
+                               LoadList);
+    if (EFI_ERROR (Status)) {
+      return Status;
     }
-    LoadNode->MemOffset  = (UINTN)MemSegment;
-    LoadNode->FileOffset = (UINTN)FileSegment;
-    LoadNode->Length     = (UINTN)ProgramHdr->p_filesz;
-    InsertTailList (LoadList, &LoadNode->Link);
   }
 
   ExtraZeroes = ((UINTN)MemSegment + ProgramHdr->p_filesz);
@@ -255,7 +252,13 @@ ElfCheckFile (
 /**
   Load a ELF file.
 
-  @param[in] ElfImage       Address of the ELF file in memory.
+  The program headers are read first, then every loadable segment is read
+  on its own. Sections that are not part of a segment, such as the debug
+  information, are never read.
+
+  @param[in] FileHandle     Handle of the ELF file.
+
+  @param[in] ElfImage       Address of the ELF file header in memory.
 
   @param[out] EntryPoint    Will be filled with the ELF entry point address.
 
@@ -270,13 +273,17 @@ ElfCheckFile (
 **/
 EFI_STATUS
 ElfLoadFile (
-  IN  CONST VOID   *ElfImage,
-  OUT VOID        **EntryPoint,
-  OUT LIST_ENTRY   *LoadList
+  IN  SHELL_FILE_HANDLE   FileHandle,
+  IN  CONST VOID         *ElfImage,
+  OUT VOID              **EntryPoint,
+  OUT LIST_ENTRY         *LoadList
   )
 {
   EFI_STATUS    Status;
+  UINT8        *ProgramHdrs;
   UINT8        *ProgramHdr;
+  UINTN         ProgramHdrsSize;
+  UINTN         ReadSize;
   UINTN         Index;
   UINTN         ImageSize;
 
@@ -292,13 +299,38 @@ ElfLoadFile (
   ElfHdr = (Elf64_Ehdr*)ElfImage;
 #endif
 
+  ASSERT (FileHandle != NULL);
   ASSERT (ElfImage   != NULL);
   ASSERT (EntryPoint != NULL);
   ASSERT (LoadList   != NULL);
 
-  ProgramHdr = (UINT8*)ElfImage + ElfHdr->e_phoff;
-  DEBUG ((EFI_D_INFO, "ELF program header entry : 0x%lx\n", ProgramHdr));
+  // Read the program header table.
+  ProgramHdrsSize = (UINTN)ElfHdr->e_phnum * ElfHdr->e_phentsize;
+  if (ElfHdr->e_phentsize < sizeof (*ProgramHdrPtr)) {
+    ShellPrintHiiEx (-1, -1, NULL, STRING_TOKEN (STR_RUNAXF_ELFBADHEADER), gRunAxfHiiHandle);
+    return EFI_INVALID_PARAMETER;
+  }
+
+  ProgramHdrs = AllocatePool (ProgramHdrsSize);
+  if (ProgramHdrs == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
 
+  ReadSize = ProgramHdrsSize;
+  Status = ShellSetFilePosition (FileHandle, ElfHdr->e_phoff);
+  if (!EFI_ERROR (Status)) {
+    Status = ShellReadFile (FileHandle, &ReadSize, ProgramHdrs);
+  }
+  if (EFI_ERROR (Status) || (ReadSize != ProgramHdrsSize)) {
+    ShellPrintHiiEx (-1, -1, NULL, STRING_TOKEN (STR_RUNAXF_ELFNOPROG), gRunAxfHiiHandle);
+    FreePool (ProgramHdrs);
+    return EFI_INVALID_PARAMETER;
+  }
+
+  DEBUG ((EFI_D_INFO, "ELF program headers read from file offset 0x%lx\n",
+          (UINT64)ElfHdr->e_phoff));
+
+  ProgramHdr = ProgramHdrs;
   ImageSize = 0;
 
   // Load every loadable ELF segment into memory.
@@ -312,9 +344,10 @@ ElfLoadFile (
 
     // Only consider PT_LOAD type segments, ignore others.
     if (ProgramHdrPtr->p_type == PT_LOAD) {
-      Status = ElfLoadSegment (ElfImage, (VOID *)ProgramHdrPtr, LoadList);
+      Status = ElfLoadSegment (FileHandle, (VOID *)ProgramHdrPtr, LoadList);
       if (EFI_ERROR (Status)) {
         ShellPrintHiiEx (-1, -1, NULL, STRING_TOKEN (STR_RUNAXF_ELFFAILSEG), gRunAxfHiiHandle);
+        FreePool (ProgramHdrs);
         return EFI_INVALID_PARAMETER;
       }
       ImageSize += ProgramHdrPtr->p_memsz;
@@ -322,6 +355,8 @@ ElfLoadFile (
     ProgramHdr += ElfHdr->e_phentsize;
   }
 
+  FreePool (ProgramHdrs);
+
   if (ImageSize == 0) {
     ShellPrintHiiEx (-1, -1, NULL, STRING_TOKEN (STR_RUNAXF_ELFNOSEG), gRunAxfHiiHandle);
     return EFI_INVALID_PARAMETER;
@@ -30,7 +30,11 @@ ElfCheckFile (
 /**
   Load a ELF file.
 
-  @param[in]  ElfImage      Address of the ELF file in memory.
+  Only the program headers and the loadable segments are read from the file.
+
+  @param[in]  FileHandle    Handle of the ELF file.
+
+  @param[in]  ElfImage      Address of the ELF file header in memory.
 
   @param[out] EntryPoint    Will be filled with the ELF entry point address.
 
@@ -50,9 +54,10 @@ ElfCheckFile (
 **/
 EFI_STATUS
 ElfLoadFile (
-  IN  CONST VOID   *ElfImage,
-  OUT VOID        **EntryPoint,
-  OUT LIST_ENTRY   *LoadList
+  IN  SHELL_FILE_HANDLE   FileHandle,
+  IN  CONST VOID         *ElfImage,
+  OUT VOID              **EntryPoint,
+  OUT LIST_ENTRY         *LoadList
   );
 
 #endif // ELF_LOADER_H
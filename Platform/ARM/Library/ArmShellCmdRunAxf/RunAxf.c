@@ -16,8 +16,10 @@
 #include <Library/DevicePathLib.h>
 #include <Library/BaseLib.h>
 #include <Library/BaseMemoryLib.h>
+#include <Library/BaseCryptLib.h>
 #include <Library/MemoryAllocationLib.h>
 #include <Library/DebugLib.h>
+#include <Library/TimerLib.h>
 
 #include <Library/ArmLib.h>
 
@@ -88,6 +90,113 @@ ShutdownUefiBootServices (
   return Status;
 }
 
+/**
+  Read a region of a file that must be loaded at a given address, and add it
+  to the load list.
+
+  The region is read straight to its load address when that memory is free.
+  Otherwise it is read to a staging buffer and copied in place after
+  ExitBootServices(), when overwriting UEFI memory no longer matters.
+
+  When DEBUG_INFO messages are enabled, the SHA-256 digest of the region is
+  computed while it is read and logged.
+
+  @param[in] FileHandle   Handle of the file to read from.
+  @param[in] FileOffset   Offset of the region in the file.
+  @param[in] LoadAddress  Address the region must be loaded at.
+  @param[in] Length       Size of the region in bytes.
+  @param[in] LoadList     Load list to add the region to.
+
+  @retval EFI_SUCCESS           The region was read.
+  @retval EFI_OUT_OF_RESOURCES  Failed to allocate memory.
+  @retval EFI_END_OF_FILE       The region extends past the end of the file.
+  @return                       Error returned when reading the file.
+**/
+EFI_STATUS
+RunAxfLoadRegion (
+  IN  SHELL_FILE_HANDLE  FileHandle,
+  IN  UINT64             FileOffset,
+  IN  UINTN              LoadAddress,
+  IN  UINTN              Length,
+  IN  LIST_ENTRY        *LoadList
+  )
+{
+  EFI_STATUS            Status;
+  RUNAXF_LOAD_LIST     *LoadNode;
+  EFI_PHYSICAL_ADDRESS  PageBase;
+  UINTN                 Pages;
+  UINT8                *Buffer;
+  UINTN                 Offset;
+  UINTN                 ReadSize;
+  VOID                 *HashContext;
+  UINT8                 Digest[SHA256_DIGEST_SIZE];
+  UINTN                 Index;
+
+  LoadNode = AllocateRuntimeZeroPool (sizeof (RUNAXF_LOAD_LIST));
+  if (LoadNode == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  // Try to claim the load address, so that the data does not need to be
+  // staged and copied again after ExitBootServices().
+  PageBase = LoadAddress & ~(UINTN)EFI_PAGE_MASK;
+  Pages = EFI_SIZE_TO_PAGES ((LoadAddress & EFI_PAGE_MASK) + Length);
+  Status = gBS->AllocatePages (AllocateAddress, EfiLoaderData, Pages, &PageBase);
+  if (!EFI_ERROR (Status)) {
+    Buffer = (UINT8 *)LoadAddress;
+  } else {
+    Pages = EFI_SIZE_TO_PAGES (Length);
+    Buffer = AllocateRuntimePages (Pages);
+    if (Buffer == NULL) {
+      FreePool (LoadNode);
+      return EFI_OUT_OF_RESOURCES;
+    }
+  }
+
+  // Add the node now so that the caller releases the buffer on error.
+  LoadNode->MemOffset  = LoadAddress;
+  LoadNode->FileOffset = (UINTN)Buffer;
+  LoadNode->Length     = Length;
+  LoadNode->Pages      = Pages;
+  InsertTailList (LoadList, &LoadNode->Link);
+
+  HashContext = NULL;
+  if (DebugPrintLevelEnabled (DEBUG_INFO)) {
+    HashContext = AllocatePool (Sha256GetContextSize ());
+    if ((HashContext != NULL) && !Sha256Init (HashContext)) {
+      FreePool (HashContext);
+      HashContext = NULL;
+    }
+  }
+
+  // Hash each chunk right after reading it, while it is still in the cache.
+  Status = ShellSetFilePosition (FileHandle, FileOffset);
+  for (Offset = 0; !EFI_ERROR (Status) && (Offset < Length); Offset += ReadSize) {
+    ReadSize = MIN (Length - Offset, RUNAXF_READ_CHUNK_SIZE);
+    Status = ShellReadFile (FileHandle, &ReadSize, Buffer + Offset);
+    if (!EFI_ERROR (Status) && (ReadSize == 0)) {
+      Status = EFI_END_OF_FILE;
+    }
+    if (!EFI_ERROR (Status) && (HashContext != NULL)) {
+      Sha256Update (HashContext, Buffer + Offset, ReadSize);
+    }
+  }
+
+  if (HashContext != NULL) {
+    if (!EFI_ERROR (Status) && Sha256Final (HashContext, Digest)) {
+      DEBUG ((EFI_D_INFO, "Region 0x%lx-0x%lx SHA-256: ", (UINT64)LoadAddress,
+              (UINT64)(LoadAddress + Length - 1)));
+      for (Index = 0; Index < SHA256_DIGEST_SIZE; Index++) {
+        DEBUG ((EFI_D_INFO, "%02x", Digest[Index]));
+      }
+      DEBUG ((EFI_D_INFO, "\n"));
+    }
+    FreePool (HashContext);
+  }
+
+  return Status;
+}
+
 // Process arguments to pass to AXF?
 STATIC CONST SHELL_PARAM_ITEM ParamList[] = {
   {NULL, TypeMax}
@@ -135,6 +244,12 @@ ShellDynCmdRunAxfHandler (
   EFI_FILE_INFO               *Info;
   UINTN                       FileSize;
   VOID                        *FileData;
+  UINTN                       ReadSize;
+  UINTN                       LoadedSize;
+  UINT64                      LoadStart;
+  UINT64                      LoadTicks;
+  UINT64                      CounterStart;
+  UINT64                      CounterEnd;
   VOID                        *Entrypoint;
   LIST_ENTRY                  LoadList;
   LIST_ENTRY                  *Node;
@@ -219,18 +334,19 @@ ShellDynCmdRunAxfHandler (
         FreePool (Info);
 
         //
-        // Allocate buffer to read file. 'Runtime' so we can access it after
-        // ExitBootServices().
+        // Only read the file header here. The loaders read the parts of the
+        // file they need.
         //
-        FileData = AllocateRuntimeZeroPool (FileSize);
+        FileData = AllocateZeroPool (RUNAXF_FILE_HEADER_SIZE);
         if (FileData == NULL) {
           ShellPrintHiiEx (-1, -1, NULL, STRING_TOKEN (STR_RUNAXF_NO_MEM), gRunAxfHiiHandle);
           ShellStatus = SHELL_OUT_OF_RESOURCES;
         } else {
           //
-          // Read file into Buffer
+          // Read file header into Buffer
           //
-          Status = ShellReadFile (FileHandle, &FileSize, FileData);
+          ReadSize = MIN (FileSize, RUNAXF_FILE_HEADER_SIZE);
+          Status = ShellReadFile (FileHandle, &ReadSize, FileData);
           if (EFI_ERROR (Status)) {
             ShellPrintHiiEx (-1, -1, NULL, STRING_TOKEN (STR_RUNAXF_READ_FAIL), gRunAxfHiiHandle);
             SHELL_FREE_NON_NULL (FileData);
@@ -247,39 +363,61 @@ ShellDynCmdRunAxfHandler (
     ShellCommandLineFreeVarList (ParamPackage);
   }
 
-  // We have a file in memory. Try to work out if we can use it.
+  // We have the file header in memory. Try to work out if we can use it.
   // It can either be in ELF format or BootMonFS format.
   if (FileData != NULL) {
     // Do some validation on the file before we try to load it. The file can
     // either be an proper ELF file or one processed by the FlashLoader.
     // Since the data might need to go to various locations in memory we cannot
-    // load the data directly while UEFI is running. We use the file loaders to
-    // populate a linked list of data and load addresses. This is processed and
-    // data copied to where it needs to go after calling ExitBootServices. At
-    // that stage we've reached the point of no return, so overwriting UEFI code
-    // does not make a difference.
+    // always load the data directly while UEFI is running. The file loaders
+    // read each region straight to its load address when that memory is free,
+    // and to a staging buffer otherwise. They populate a linked list of data
+    // and load addresses. This is processed and staged data copied to where it
+    // needs to go after calling ExitBootServices. At that stage we've reached
+    // the point of no return, so overwriting UEFI code does not make a
+    // difference.
+    LoadStart = GetPerformanceCounter ();
     Status = ElfCheckFile (FileData);
     if (!EFI_ERROR (Status)) {
       // Load program into memory
-      Status = ElfLoadFile ((VOID*)FileData, &Entrypoint, &LoadList);
+      Status = ElfLoadFile (FileHandle, (VOID*)FileData, &Entrypoint, &LoadList);
     } else {
       // Try to see if it is a BootMonFs executable
       Status = BootMonFsCheckFile ((EFI_FILE_HANDLE)FileHandle);
       if (!EFI_ERROR (Status)) {
         // Load program into memory
         Status = BootMonFsLoadFile ((EFI_FILE_HANDLE)FileHandle,
-                                    (VOID*)FileData, &Entrypoint, &LoadList);
+                                    &Entrypoint, &LoadList);
       } else {
         ShellPrintHiiEx (-1, -1, NULL, STRING_TOKEN (STR_RUNAXF_BAD_FILE),
                          gRunAxfHiiHandle);
-        SHELL_FREE_NON_NULL (FileData);
         ShellStatus = SHELL_UNSUPPORTED;
       }
     }
-  }
 
-  WriteBackDataCacheRange (FileData, FileSize);
-  InvalidateInstructionCacheRange (FileData, FileSize);
+    if (!EFI_ERROR (Status)) {
+      GetPerformanceCounterProperties (&CounterStart, &CounterEnd);
+      if (CounterStart > CounterEnd) {
+        LoadTicks = LoadStart - GetPerformanceCounter ();
+      } else {
+        LoadTicks = GetPerformanceCounter () - LoadStart;
+      }
+
+      LoadedSize = 0;
+      for (Node = GetFirstNode (&LoadList);
+           !IsNull (&LoadList, Node);
+           Node = GetNextNode (&LoadList, Node)) {
+        LoadNode = (RUNAXF_LOAD_LIST *)Node;
+        if (!LoadNode->Zeroes) {
+          LoadedSize += LoadNode->Length;
+        }
+      }
+
+      DEBUG ((EFI_D_INFO, "Read %ld of %ld file bytes in %ld us\n",
+              (UINT64)LoadedSize, (UINT64)FileSize,
+              DivU64x32 (GetTimeInNanoSecond (LoadTicks), 1000)));
+    }
+  }
 
   // Program load list created.
   // Shutdown UEFI, copy and jump to code.
@@ -291,17 +429,21 @@ ShellDynCmdRunAxfHandler (
       DEBUG ((EFI_D_ERROR,"Can not shutdown UEFI boot services. Status=0x%X\n",
               Status));
     } else {
-      // Process linked list. Copy data to Memory.
+      // Process linked list. Copy staged data to Memory.
       Node = GetFirstNode (&LoadList);
       while (!IsNull (&LoadList, Node)) {
         LoadNode = (RUNAXF_LOAD_LIST *)Node;
         // Do we have data to copy or do we need to set Zeroes (.bss)?
         if (LoadNode->Zeroes) {
           ZeroMem ((VOID*)LoadNode->MemOffset, LoadNode->Length);
-        } else {
+        } else if (LoadNode->FileOffset != LoadNode->MemOffset) {
           CopyMem ((VOID *)LoadNode->MemOffset, (VOID *)LoadNode->FileOffset,
                    LoadNode->Length);
         }
+        // The image runs with the MMU and caches off
+        WriteBackDataCacheRange ((VOID *)LoadNode->MemOffset, LoadNode->Length);
+        InvalidateInstructionCacheRange ((VOID *)LoadNode->MemOffset,
+                                         LoadNode->Length);
         Node = GetNextNode (&LoadList, Node);
       }
 
@@ -327,6 +469,11 @@ ShellDynCmdRunAxfHandler (
   // Free file related information as we are returning to UEFI.
   Node = GetFirstNode (&LoadList);
   while (!IsNull (&LoadList, Node)) {
+    LoadNode = (RUNAXF_LOAD_LIST *)Node;
+    if (LoadNode->Pages != 0) {
+      FreePages ((VOID *)(LoadNode->FileOffset & ~(UINTN)EFI_PAGE_MASK),
+                 LoadNode->Pages);
+    }
     NextNode = RemoveEntryList (Node);
     FreePool (Node);
     Node = NextNode;
@@ -0,0 +1,361 @@
+/** @file
+*
+*  Token index for the Configuration Manager platform repositories.
+*
+*  Tokens are the addresses of the objects in the platform repository, so the
+*  index is a small open addressing hash table keyed on the token value. It is
+*  populated once when the platform repository is initialised and is only read
+*  afterwards.
+*
+*  Copyright (c) 2021, ARM Limited. All rights reserved.
+*
+*  SPDX-License-Identifier: BSD-2-Clause-Patent
+*
+**/
+
+#include <Library/BaseLib.h>
+#include <Library/CmTokenIndexLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/TimerLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+
+typedef struct {
+  CM_OBJECT_TOKEN   Token;
+  CM_OBJECT_ID      CmObjectId;
+  VOID            * Data;
+  UINT32            Size;
+  UINT32            Count;
+} CM_TOKEN_INDEX_ENTRY;
+
+struct CmTokenIndex {
+  /// Number of slots in Entries, a power of two
+  UINTN                   Capacity;
+  UINTN                   Used;
+  CM_TOKEN_INDEX_ENTRY  * Entries;
+
+  /// GetObject () statistics, per namespace
+  UINT64                  Calls[EObjNameSpaceMax];
+  UINT64                  Ticks[EObjNameSpaceMax];
+  UINT64                  MaxTicks;
+  CM_OBJECT_ID            MaxTicksObjectId;
+  BOOLEAN                 CountDown;
+
+  /// ReadyToBoot event reporting the statistics, NULL once closed
+  EFI_EVENT               ProfileEvent;
+};
+
+/** Return the first slot to probe for a token.
+
+  @param [in]  Index  The token index.
+  @param [in]  Token  The token.
+
+  @return The slot number.
+**/
+STATIC
+UINTN
+CmTokenIndexHash (
+  IN  CONST CM_TOKEN_INDEX  * Index,
+  IN  CM_OBJECT_TOKEN         Token
+  )
+{
+  UINT64  Hash;
+
+  // Objects are at least 4 byte aligned, discard the low bits
+  Hash = (UINT64)Token >> 2;
+  Hash *= 0x9E3779B97F4A7C15ULL;
+  return (UINTN)(Hash >> 32) & (Index->Capacity - 1);
+}
+
+/** Report the GetObject () statistics.
+
+  @param [in]  Event    The ReadyToBoot event.
+  @param [in]  Context  The token index.
+**/
+STATIC
+VOID
+EFIAPI
+CmTokenIndexReportProfile (
+  IN  EFI_EVENT   Event,
+  IN  VOID      * Context
+  )
+{
+  CM_TOKEN_INDEX  * Index;
+  UINTN             NameSpace;
+
+  Index = Context;
+
+  for (NameSpace = 0; NameSpace < EObjNameSpaceMax; NameSpace++) {
+    if (Index->Calls[NameSpace] == 0) {
+      continue;
+    }
+    DEBUG ((
+      DEBUG_INFO,
+      "INFO: CM namespace %d: %ld GetObject calls, %ld us\n",
+      (UINT32)NameSpace,
+      Index->Calls[NameSpace],
+      DivU64x32 (GetTimeInNanoSecond (Index->Ticks[NameSpace]), 1000)
+      ));
+  }
+
+  DEBUG ((
+    DEBUG_INFO,
+    "INFO: CM slowest GetObject: CmObjectId = %x, %ld us\n",
+    Index->MaxTicksObjectId,
+    DivU64x32 (GetTimeInNanoSecond (Index->MaxTicks), 1000)
+    ));
+
+  gBS->CloseEvent (Event);
+  Index->ProfileEvent = NULL;
+}
+
+/** Create an empty token index.
+
+  @param [in]  MaxEntries  Maximum number of tokens to be added.
+  @param [out] Index       The created index.
+
+  @retval EFI_SUCCESS            Success.
+  @retval EFI_INVALID_PARAMETER  A parameter is invalid.
+  @retval EFI_OUT_OF_RESOURCES   Failed to allocate the index.
+**/
+EFI_STATUS
+EFIAPI
+CmTokenIndexCreate (
+  IN  UINTN                 MaxEntries,
+  OUT CM_TOKEN_INDEX     ** Index
+  )
+{
+  CM_TOKEN_INDEX  * NewIndex;
+  EFI_STATUS        Status;
+  UINT64            CounterStart;
+  UINT64            CounterEnd;
+
+  if ((MaxEntries == 0) || (Index == NULL)) {
+    ASSERT (MaxEntries != 0);
+    ASSERT (Index != NULL);
+    return EFI_INVALID_PARAMETER;
+  }
+
+  NewIndex = AllocateZeroPool (sizeof (CM_TOKEN_INDEX));
+  if (NewIndex == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  // Keep the load factor at or below 50% to bound the probe length
+  NewIndex->Capacity = (UINTN)GetPowerOfTwo64 ((MaxEntries << 1) - 1) << 1;
+  NewIndex->Entries = AllocateZeroPool (
+                        NewIndex->Capacity * sizeof (CM_TOKEN_INDEX_ENTRY)
+                        );
+  if (NewIndex->Entries == NULL) {
+    FreePool (NewIndex);
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  GetPerformanceCounterProperties (&CounterStart, &CounterEnd);
+  NewIndex->CountDown = (CounterStart > CounterEnd);
+
+  Status = EfiCreateEventReadyToBootEx (
+             TPL_CALLBACK,
+             CmTokenIndexReportProfile,
+             NewIndex,
+             &NewIndex->ProfileEvent
+             );
+  if (EFI_ERROR (Status)) {
+    DEBUG ((
+      DEBUG_WARN,
+      "WARNING: Failed to create CM profile event. Status = %r\n",
+      Status
+      ));
+    NewIndex->ProfileEvent = NULL;
+  }
+
+  *Index = NewIndex;
+  return EFI_SUCCESS;
+}
+
+/** Free a token index.
+
+  The pending ReadyToBoot statistics report of the index is cancelled.
+
+  @param [in]  Index  The token index, may be NULL.
+**/
+VOID
+EFIAPI
+CmTokenIndexFree (
+  IN  CM_TOKEN_INDEX      * Index
+  )
+{
+  if (Index == NULL) {
+    return;
+  }
+
+  if (Index->ProfileEvent != NULL) {
+    gBS->CloseEvent (Index->ProfileEvent);
+  }
+  FreePool (Index->Entries);
+  FreePool (Index);
+}
+
+/** Add the object(s) referenced by a token to the index.
+
+  @param [in]  Index       The token index.
+  @param [in]  CmObjectId  The Configuration Manager Object ID of the object(s).
+  @param [in]  Token       The token referencing the object(s).
+  @param [in]  Data        Pointer to the object(s).
+  @param [in]  Size        Total size of the object(s).
+  @param [in]  Count       Number of objects.
+
+  @retval EFI_SUCCESS            Success.
+  @retval EFI_INVALID_PARAMETER  A parameter is invalid.
+  @retval EFI_ALREADY_STARTED    The token is already in the index.
+  @retval EFI_OUT_OF_RESOURCES   The index is full.
+**/
+EFI_STATUS
+EFIAPI
+CmTokenIndexAdd (
+  IN  CM_TOKEN_INDEX      * Index,
+  IN  CM_OBJECT_ID          CmObjectId,
+  IN  CM_OBJECT_TOKEN       Token,
+  IN  VOID                * Data,
+  IN  UINTN                 Size,
+  IN  UINTN                 Count
+  )
+{
+  UINTN   Slot;
+
+  if ((Index == NULL) || (Token == CM_NULL_TOKEN) || (Data == NULL)) {
+    ASSERT (Index != NULL);
+    ASSERT (Token != CM_NULL_TOKEN);
+    ASSERT (Data != NULL);
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if ((Index->Used << 1) >= Index->Capacity) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Slot = CmTokenIndexHash (Index, Token);
+  while (Index->Entries[Slot].Token != CM_NULL_TOKEN) {
+    if (Index->Entries[Slot].Token == Token) {
+      return EFI_ALREADY_STARTED;
+    }
+    Slot = (Slot + 1) & (Index->Capacity - 1);
+  }
+
+  Index->Entries[Slot].Token = Token;
+  Index->Entries[Slot].CmObjectId = CmObjectId;
+  Index->Entries[Slot].Data = Data;
+  Index->Entries[Slot].Size = (UINT32)Size;
+  Index->Entries[Slot].Count = (UINT32)Count;
+  Index->Used++;
+  return EFI_SUCCESS;
+}
+
+/** Look up the object(s) referenced by a token.
+
+  @param [in]      Index         The token index.
+  @param [in]      CmObjectId    The Configuration Manager Object ID requested.
+  @param [in]      Token         The token referencing the object(s).
+  @param [in, out] CmObjectDesc  Pointer to the Configuration Manager Object
+                                 descriptor describing the object(s).
+
+  @retval EFI_SUCCESS            Success.
+  @retval EFI_INVALID_PARAMETER  A parameter is invalid.
+  @retval EFI_NOT_FOUND          No object of this ID matches the token.
+**/
+EFI_STATUS
+EFIAPI
+CmTokenIndexFind (
+  IN  CONST CM_TOKEN_INDEX    * Index,
+  IN  CONST CM_OBJECT_ID        CmObjectId,
+  IN  CONST CM_OBJECT_TOKEN     Token,
+  IN  OUT   CM_OBJ_DESCRIPTOR * CONST CmObjectDesc
+  )
+{
+  UINTN                         Slot;
+  CONST CM_TOKEN_INDEX_ENTRY  * Entry;
+
+  if ((Index == NULL) || (CmObjectDesc == NULL)) {
+    ASSERT (Index != NULL);
+    ASSERT (CmObjectDesc != NULL);
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (Token == CM_NULL_TOKEN) {
+    return EFI_NOT_FOUND;
+  }
+
+  Slot = CmTokenIndexHash (Index, Token);
+  for (Entry = &Index->Entries[Slot];
+       Entry->Token != CM_NULL_TOKEN;
+       Entry = &Index->Entries[Slot]) {
+    if (Entry->Token == Token) {
+      if (Entry->CmObjectId != CmObjectId) {
+        break;
+      }
+      CmObjectDesc->ObjectId = CmObjectId;
+      CmObjectDesc->Size = Entry->Size;
+      CmObjectDesc->Data = Entry->Data;
+      CmObjectDesc->Count = Entry->Count;
+      return EFI_SUCCESS;
+    }
+    Slot = (Slot + 1) & (Index->Capacity - 1);
+  }
+
+  return EFI_NOT_FOUND;
+}
+
+/** Start timing a GetObject () request.
+
+  @return The current performance counter value.
+**/
+UINT64
+EFIAPI
+CmTokenIndexProfileStart (
+  VOID
+  )
+{
+  return GetPerformanceCounter ();
+}
+
+/** Account the time spent in a GetObject () request.
+
+  @param [in]  Index       The token index, may be NULL.
+  @param [in]  CmObjectId  The Configuration Manager Object ID requested.
+  @param [in]  Start       The value returned by CmTokenIndexProfileStart ().
+**/
+VOID
+EFIAPI
+CmTokenIndexProfileEnd (
+  IN  CM_TOKEN_INDEX      * Index,
+  IN  CM_OBJECT_ID          CmObjectId,
+  IN  UINT64                Start
+  )
+{
+  UINT64  Ticks;
+  UINTN   NameSpace;
+
+  if (Index == NULL) {
+    return;
+  }
+
+  NameSpace = GET_CM_NAMESPACE_ID (CmObjectId);
+  if (NameSpace >= EObjNameSpaceMax) {
+    return;
+  }
+
+  Ticks = GetPerformanceCounter ();
+  if (Index->CountDown) {
+    Ticks = Start - Ticks;
+  } else {
+    Ticks = Ticks - Start;
+  }
+
+  Index->Calls[NameSpace]++;
+  Index->Ticks[NameSpace] += Ticks;
+  if (Ticks > Index->MaxTicks) {
+    Index->MaxTicks = Ticks;
+    Index->MaxTicksObjectId = CmObjectId;
+  }
+}
@@ -0,0 +1,466 @@
+/** @file
+*  SRAT, SLIT and HMAT generation for multichip platforms.
+*
+*  The NUMA description is built at boot from the platform descriptor HOB and
+*  the system memory resource descriptor HOBs instead of being hardcoded per
+*  platform, so that the tables always match the chips and memory that were
+*  actually brought up.
+*
+*  Copyright (c) 2021, ARM Limited. All rights reserved.
+*
+*  SPDX-License-Identifier: BSD-2-Clause-Patent
+*
+**/
+
+#include <IndustryStandard/Acpi.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/HobLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Protocol/AcpiTable.h>
+
+#include <SgiAcpiHeader.h>
+#include <SgiPlatform.h>
+
+#define CPUS_PER_CHIP   (FixedPcdGet32 (PcdCoreCount) * \
+                         FixedPcdGet32 (PcdClusterCount))
+
+// Base unit for the HMAT latency matrix entries, in picoseconds
+#define HMAT_LATENCY_BASE_UNIT  100
+
+// Relative distance of a proximity domain to itself, as mandated for SLIT
+#define SLIT_LOCAL_DISTANCE     10
+
+typedef struct {
+  UINT64  Base;
+  UINT64  Length;
+  UINT32  Chip;
+} SGI_NUMA_MEMORY_RANGE;
+
+STATIC CONST EFI_ACPI_DESCRIPTION_HEADER mNumaTableHeader =
+  ARM_ACPI_HEADER (0, EFI_ACPI_DESCRIPTION_HEADER, 0);
+
+/**
+  Collect the system memory ranges described by the resource descriptor HOBs
+  and assign each of them to the chip it is attached to.
+
+  @param[in]  ChipCount   Number of chips on the platform.
+  @param[out] RangeCount  Number of entries in the returned array.
+
+  @return     Pool allocated array of memory ranges, or NULL if none were
+              found or the allocation failed.
+**/
+STATIC
+SGI_NUMA_MEMORY_RANGE *
+GetNumaMemoryRanges (
+  IN  UINTN   ChipCount,
+  OUT UINTN   *RangeCount
+  )
+{
+  EFI_PEI_HOB_POINTERS    Hob;
+  SGI_NUMA_MEMORY_RANGE   *Ranges;
+  UINTN                   Count;
+  UINTN                   Chip;
+
+  Count = 0;
+  for (Hob.Raw = GetFirstHob (EFI_HOB_TYPE_RESOURCE_DESCRIPTOR);
+       Hob.Raw != NULL;
+       Hob.Raw = GetNextHob (EFI_HOB_TYPE_RESOURCE_DESCRIPTOR,
+                   GET_NEXT_HOB (Hob))) {
+    if (Hob.ResourceDescriptor->ResourceType == EFI_RESOURCE_SYSTEM_MEMORY) {
+      Count++;
+    }
+  }
+
+  *RangeCount = 0;
+  if (Count == 0) {
+    return NULL;
+  }
+
+  Ranges = AllocatePool (Count * sizeof (SGI_NUMA_MEMORY_RANGE));
+  if (Ranges == NULL) {
+    return NULL;
+  }
+
+  for (Hob.Raw = GetFirstHob (EFI_HOB_TYPE_RESOURCE_DESCRIPTOR);
+       Hob.Raw != NULL;
+       Hob.Raw = GetNextHob (EFI_HOB_TYPE_RESOURCE_DESCRIPTOR,
+                   GET_NEXT_HOB (Hob))) {
+    if (Hob.ResourceDescriptor->ResourceType != EFI_RESOURCE_SYSTEM_MEMORY) {
+      continue;
+    }
+
+    // Each chip decodes its DRAM within its own remote chip memory window
+    Chip = (UINTN)(Hob.ResourceDescriptor->PhysicalStart /
+                   SGI_REMOTE_CHIP_MEM_OFFSET (1));
+    if (Chip >= ChipCount) {
+      DEBUG ((DEBUG_WARN, "%a: Memory at 0x%lx is outside of chip range\n",
+        __FUNCTION__, Hob.ResourceDescriptor->PhysicalStart));
+      continue;
+    }
+
+    Ranges[*RangeCount].Base = Hob.ResourceDescriptor->PhysicalStart;
+    Ranges[*RangeCount].Length = Hob.ResourceDescriptor->ResourceLength;
+    Ranges[*RangeCount].Chip = (UINT32)Chip;
+    (*RangeCount)++;
+  }
+
+  return Ranges;
+}
+
+/**
+  Return the configured memory access latency between two chips.
+
+  @param[in]  Initiator  Chip issuing the access.
+  @param[in]  Target     Chip the memory is attached to.
+
+  @return     Latency, relative to the other chip-to-chip latencies.
+**/
+STATIC
+UINT16
+GetChipLatency (
+  IN  UINTN   Initiator,
+  IN  UINTN   Target
+  )
+{
+  if (Initiator == Target) {
+    return FixedPcdGet16 (PcdChipLocalLatency);
+  }
+
+  return FixedPcdGet16 (PcdChipRemoteLatency);
+}
+
+/**
+  Initialise the common header of a generated ACPI table.
+
+  @param[out] Header     Table header to initialise.
+  @param[in]  Signature  Table signature.
+  @param[in]  Length     Total length of the table.
+  @param[in]  Revision   Table revision.
+**/
+STATIC
+VOID
+InitNumaTableHeader (
+  OUT EFI_ACPI_DESCRIPTION_HEADER   *Header,
+  IN  UINT32                        Signature,
+  IN  UINTN                         Length,
+  IN  UINT8                         Revision
+  )
+{
+  CopyMem (Header, &mNumaTableHeader, sizeof (EFI_ACPI_DESCRIPTION_HEADER));
+  Header->Signature = Signature;
+  Header->Length = (UINT32)Length;
+  Header->Revision = Revision;
+}
+
+/**
+  Build the System Resource Affinity Table.
+
+  @param[in]  ChipCount   Number of chips on the platform.
+  @param[in]  Ranges      Memory ranges and the chip they belong to.
+  @param[in]  RangeCount  Number of entries in Ranges.
+
+  @return     Pool allocated table, or NULL on allocation failure.
+**/
+STATIC
+EFI_ACPI_DESCRIPTION_HEADER *
+BuildSrat (
+  IN  UINTN                         ChipCount,
+  IN  CONST SGI_NUMA_MEMORY_RANGE   *Ranges,
+  IN  UINTN                         RangeCount
+  )
+{
+  EFI_ACPI_6_3_SYSTEM_RESOURCE_AFFINITY_TABLE_HEADER  *Srat;
+  EFI_ACPI_6_3_MEMORY_AFFINITY_STRUCTURE              *Memory;
+  EFI_ACPI_6_3_GICC_AFFINITY_STRUCTURE                *Gicc;
+  UINTN                                               Length;
+  UINTN                                               Index;
+  UINTN                                               Chip;
+  UINTN                                               Cpu;
+
+  Length = sizeof (EFI_ACPI_6_3_SYSTEM_RESOURCE_AFFINITY_TABLE_HEADER) +
+           (RangeCount * sizeof (EFI_ACPI_6_3_MEMORY_AFFINITY_STRUCTURE)) +
+           (ChipCount * CPUS_PER_CHIP *
+            sizeof (EFI_ACPI_6_3_GICC_AFFINITY_STRUCTURE));
+
+  Srat = AllocateZeroPool (Length);
+  if (Srat == NULL) {
+    return NULL;
+  }
+
+  InitNumaTableHeader (&Srat->Header,
+    EFI_ACPI_6_3_SYSTEM_RESOURCE_AFFINITY_TABLE_SIGNATURE, Length,
+    EFI_ACPI_6_3_SYSTEM_RESOURCE_AFFINITY_TABLE_REVISION);
+  // Reserved, must be 1 for backward compatibility
+  Srat->Reserved1 = 0x00000001;
+
+  Memory = (EFI_ACPI_6_3_MEMORY_AFFINITY_STRUCTURE *)(Srat + 1);
+  for (Index = 0; Index < RangeCount; Index++, Memory++) {
+    EFI_ACPI_6_3_MEMORY_AFFINITY_STRUCTURE  Entry =
+      EFI_ACPI_6_3_MEMORY_AFFINITY_STRUCTURE_INIT (
+        Ranges[Index].Chip, Ranges[Index].Base, Ranges[Index].Length,
+        0x00000001);
+
+    CopyMem (Memory, &Entry, sizeof (Entry));
+  }
+
+  // ACPI processor UIDs are assigned sequentially across the chips
+  Gicc = (EFI_ACPI_6_3_GICC_AFFINITY_STRUCTURE *)Memory;
+  for (Chip = 0; Chip < ChipCount; Chip++) {
+    for (Cpu = 0; Cpu < CPUS_PER_CHIP; Cpu++, Gicc++) {
+      EFI_ACPI_6_3_GICC_AFFINITY_STRUCTURE  Entry =
+        EFI_ACPI_6_3_GICC_AFFINITY_STRUCTURE_INIT (
+          (UINT32)Chip, (UINT32)((Chip * CPUS_PER_CHIP) + Cpu), 0x00000001,
+          0x00000000);
+
+      CopyMem (Gicc, &Entry, sizeof (Entry));
+    }
+  }
+
+  return &Srat->Header;
+}
+
+/**
+  Build the System Locality Information Table.
+
+  The relative distances are the configured chip latencies scaled so that
+  the local distance is 10, as required by the ACPI specification.
+
+  @param[in]  ChipCount   Number of chips on the platform.
+
+  @return     Pool allocated table, or NULL on allocation failure.
+**/
+STATIC
+EFI_ACPI_DESCRIPTION_HEADER *
+BuildSlit (
+  IN  UINTN   ChipCount
+  )
+{
+  EFI_ACPI_6_3_SYSTEM_LOCALITY_DISTANCE_INFORMATION_TABLE_HEADER  *Slit;
+  UINT8                                                           *Distance;
+  UINTN                                                           Length;
+  UINTN                                                           Initiator;
+  UINTN                                                           Target;
+  UINTN                                                           Value;
+
+  Length = sizeof (EFI_ACPI_6_3_SYSTEM_LOCALITY_DISTANCE_INFORMATION_TABLE_HEADER) +
+           (ChipCount * ChipCount);
+
+  Slit = AllocateZeroPool (Length);
+  if (Slit == NULL) {
+    return NULL;
+  }
+
+  InitNumaTableHeader (&Slit->Header,
+    EFI_ACPI_6_3_SYSTEM_LOCALITY_INFORMATION_TABLE_SIGNATURE, Length,
+    EFI_ACPI_6_3_SYSTEM_LOCALITY_DISTANCE_INFORMATION_TABLE_REVISION);
+  Slit->NumberOfSystemLocalities = ChipCount;
+
+  Distance = (UINT8 *)(Slit + 1);
+  for (Initiator = 0; Initiator < ChipCount; Initiator++) {
+    for (Target = 0; Target < ChipCount; Target++) {
+      if (Initiator == Target) {
+        Value = SLIT_LOCAL_DISTANCE;
+      } else {
+        Value = (GetChipLatency (Initiator, Target) * SLIT_LOCAL_DISTANCE) /
+                FixedPcdGet16 (PcdChipLocalLatency);
+        // 0xFF means unreachable, remote chips must stay below it
+        Value = MIN (MAX (Value, SLIT_LOCAL_DISTANCE + 1), 0xFE);
+      }
+      *Distance++ = (UINT8)Value;
+    }
+  }
+
+  return &Slit->Header;
+}
+
+/**
+  Build the Heterogeneous Memory Attribute Table.
+
+  Each chip is both an initiator and a memory proximity domain. A memory side
+  cache structure is added per chip when PcdMemorySideCacheSize is not zero.
+
+  @param[in]  ChipCount   Number of chips on the platform.
+
+  @return     Pool allocated table, or NULL on allocation failure.
+**/
+STATIC
+EFI_ACPI_DESCRIPTION_HEADER *
+BuildHmat (
+  IN  UINTN   ChipCount
+  )
+{
+  EFI_ACPI_6_3_HETEROGENEOUS_MEMORY_ATTRIBUTE_TABLE_HEADER  *Hmat;
+  UINT8                                                     *Ptr;
+  UINT32                                                    *Domain;
+  UINT16                                                    *Matrix;
+  UINTN                                                     Length;
+  UINTN                                                     Chip;
+  UINTN                                                     Target;
+  BOOLEAN                                                   HasCache;
+
+  HasCache = (FixedPcdGet64 (PcdMemorySideCacheSize) != 0);
+
+  Length = sizeof (EFI_ACPI_6_3_HETEROGENEOUS_MEMORY_ATTRIBUTE_TABLE_HEADER) +
+           (ChipCount *
+            sizeof (EFI_ACPI_6_3_HMAT_STRUCTURE_MEMORY_PROXIMITY_DOMAIN_ATTRIBUTES)) +
+           sizeof (EFI_ACPI_6_3_HMAT_STRUCTURE_SYSTEM_LOCALITY_LATENCY_AND_BANDWIDTH_INFO) +
+           (2 * ChipCount * sizeof (UINT32)) +
+           (ChipCount * ChipCount * sizeof (UINT16));
+  if (HasCache) {
+    Length += ChipCount *
+              sizeof (EFI_ACPI_6_3_HMAT_STRUCTURE_MEMORY_SIDE_CACHE_INFO);
+  }
+
+  Hmat = AllocateZeroPool (Length);
+  if (Hmat == NULL) {
+    return NULL;
+  }
+
+  InitNumaTableHeader (&Hmat->Header,
+    EFI_ACPI_6_3_HETEROGENEOUS_MEMORY_ATTRIBUTE_TABLE_SIGNATURE, Length,
+    EFI_ACPI_6_3_HETEROGENEOUS_MEMORY_ATTRIBUTE_TABLE_REVISION);
+
+  Ptr = (UINT8 *)(Hmat + 1);
+
+  // Memory Proximity Domain
+  for (Chip = 0; Chip < ChipCount; Chip++) {
+    EFI_ACPI_6_3_HMAT_STRUCTURE_MEMORY_PROXIMITY_DOMAIN_ATTRIBUTES  Proximity =
+      EFI_ACPI_6_3_HMAT_STRUCTURE_MEMORY_PROXIMITY_DOMAIN_ATTRIBUTES_INIT (
+        1, (UINT32)Chip, (UINT32)Chip);
+
+    CopyMem (Ptr, &Proximity, sizeof (Proximity));
+    Ptr += sizeof (Proximity);
+  }
+
+  // Latency Info
+  {
+    EFI_ACPI_6_3_HMAT_STRUCTURE_SYSTEM_LOCALITY_LATENCY_AND_BANDWIDTH_INFO  Info =
+      EFI_ACPI_6_3_HMAT_STRUCTURE_SYSTEM_LOCALITY_LATENCY_AND_BANDWIDTH_INFO_INIT (
+        0, 0, (UINT32)ChipCount, (UINT32)ChipCount, HMAT_LATENCY_BASE_UNIT);
+
+    CopyMem (Ptr, &Info, sizeof (Info));
+    Ptr += sizeof (Info);
+  }
+
+  // Initiator and target proximity domain lists
+  Domain = (UINT32 *)Ptr;
+  for (Chip = 0; Chip < ChipCount; Chip++) {
+    Domain[Chip] = (UINT32)Chip;
+    Domain[ChipCount + Chip] = (UINT32)Chip;
+  }
+
+  Matrix = (UINT16 *)(Domain + (2 * ChipCount));
+  for (Chip = 0; Chip < ChipCount; Chip++) {
+    for (Target = 0; Target < ChipCount; Target++) {
+      *Matrix++ = GetChipLatency (Chip, Target);
+    }
+  }
+  Ptr = (UINT8 *)Matrix;
+
+  // Memory Side Cache
+  if (HasCache) {
+    for (Chip = 0; Chip < ChipCount; Chip++) {
+      EFI_ACPI_6_3_HMAT_STRUCTURE_MEMORY_SIDE_CACHE_INFO  Cache =
+        EFI_ACPI_6_3_HMAT_STRUCTURE_MEMORY_SIDE_CACHE_INFO_INIT (
+          (UINT32)Chip,
+          FixedPcdGet64 (PcdMemorySideCacheSize),
+          HMAT_STRUCTURE_MEMORY_SIDE_CACHE_INFO_CACHE_ATTRIBUTES_INIT (
+            1,
+            1,
+            2,
+            2,
+            64 // 64 bytes cache line length
+            ),
+          0);
+
+      CopyMem (Ptr, &Cache, sizeof (Cache));
+      Ptr += sizeof (Cache);
+    }
+  }
+
+  ASSERT ((UINTN)(Ptr - (UINT8 *)Hmat) == Length);
+
+  return &Hmat->Header;
+}
+
+/**
+  Generate and install the SRAT, SLIT and HMAT for a multichip platform.
+
+  The tables are installed as a set: if one of them cannot be installed, the
+  ones already installed are uninstalled again.
+
+  @param[in]  PlatformDesc  Platform descriptor HOB data.
+
+  @retval EFI_SUCCESS           The tables were installed.
+  @retval EFI_NOT_FOUND         No system memory was described by the HOBs.
+  @retval EFI_OUT_OF_RESOURCES  A table could not be allocated.
+  @retval Others                ACPI table protocol errors.
+**/
+EFI_STATUS
+InstallNumaTables (
+  IN CONST SGI_PLATFORM_DESCRIPTOR  *PlatformDesc
+  )
+{
+  EFI_ACPI_TABLE_PROTOCOL       *AcpiTable;
+  EFI_ACPI_DESCRIPTION_HEADER   *Tables[3];
+  SGI_NUMA_MEMORY_RANGE         *Ranges;
+  UINTN                         RangeCount;
+  UINTN                         TableKeys[ARRAY_SIZE (Tables)];
+  UINTN                         Index;
+  UINTN                         Installed;
+  EFI_STATUS                    Status;
+
+  Status = gBS->LocateProtocol (&gEfiAcpiTableProtocolGuid, NULL,
+                  (VOID **)&AcpiTable);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  Ranges = GetNumaMemoryRanges (PlatformDesc->ChipCount, &RangeCount);
+  if (Ranges == NULL) {
+    return EFI_NOT_FOUND;
+  }
+
+  Tables[0] = BuildSrat (PlatformDesc->ChipCount, Ranges, RangeCount);
+  Tables[1] = BuildSlit (PlatformDesc->ChipCount);
+  Tables[2] = BuildHmat (PlatformDesc->ChipCount);
+  FreePool (Ranges);
+
+  Status = EFI_SUCCESS;
+  for (Index = 0; Index < ARRAY_SIZE (Tables); Index++) {
+    if (Tables[Index] == NULL) {
+      Status = EFI_OUT_OF_RESOURCES;
+    }
+  }
+
+  Installed = 0;
+  if (!EFI_ERROR (Status)) {
+    for (Installed = 0; Installed < ARRAY_SIZE (Tables); Installed++) {
+      Status = AcpiTable->InstallAcpiTable (AcpiTable, Tables[Installed],
+                            Tables[Installed]->Length, &TableKeys[Installed]);
+      if (EFI_ERROR (Status)) {
+        break;
+      }
+    }
+  }
+
+  if (EFI_ERROR (Status)) {
+    while (Installed > 0) {
+      Installed--;
+      AcpiTable->UninstallAcpiTable (AcpiTable, TableKeys[Installed]);
+    }
+  }
+
+  for (Index = 0; Index < ARRAY_SIZE (Tables); Index++) {
+    if (Tables[Index] != NULL) {
+      FreePool (Tables[Index]);
+    }
+  }
+
+  DEBUG ((DEBUG_INFO, "%a: %d chips, %d memory ranges: %r\n", __FUNCTION__,
+    (UINT32)PlatformDesc->ChipCount, (UINT32)RangeCount, Status));
+
+  return Status;
+}
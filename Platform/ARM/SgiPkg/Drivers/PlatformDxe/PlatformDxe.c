@@ -16,6 +16,11 @@ InitVirtioDevices (
   VOID
   );
 
+EFI_STATUS
+InstallNumaTables (
+  IN CONST SGI_PLATFORM_DESCRIPTOR  *PlatformDesc
+  );
+
 EFI_STATUS
 EFIAPI
 ArmSgiPkgEntryPoint (
@@ -24,6 +29,8 @@ ArmSgiPkgEntryPoint (
   )
 {
   EFI_STATUS              Status;
+  VOID                    *PlatformIdHob;
+  SGI_PLATFORM_DESCRIPTOR *PlatformDesc;
 
   Status = LocateAndInstallAcpiFromFv (&gArmSgiAcpiTablesGuid);
   if (EFI_ERROR (Status)) {
@@ -31,7 +38,19 @@ ArmSgiPkgEntryPoint (
     return Status;
   }
 
+  PlatformIdHob = GetFirstGuidHob (&gArmSgiPlatformIdDescriptorGuid);
+  if (PlatformIdHob != NULL) {
+    PlatformDesc = (SGI_PLATFORM_DESCRIPTOR *)GET_GUID_HOB_DATA (PlatformIdHob);
+    if (PlatformDesc->ChipCount > 1) {
+      Status = InstallNumaTables (PlatformDesc);
+      if (EFI_ERROR (Status)) {
+        DEBUG ((DEBUG_ERROR, "%a: Failed to install NUMA tables, Status: %r\n",
+          __FUNCTION__, Status));
+      }
+    }
+  }
+
   InitVirtioDevices ();
 
-  return Status;
+  return EFI_SUCCESS;
 }
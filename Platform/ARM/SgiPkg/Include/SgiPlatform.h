@@ -62,6 +62,7 @@ typedef struct {
   UINTN  PlatformId;
   UINTN  ConfigId;
   UINTN  MultiChipMode;
+  UINTN  ChipCount;       // Number of chips populated, 1 if not multichip
 } SGI_PLATFORM_DESCRIPTOR;
 
 #endif // __SGI_PLATFORM_H__
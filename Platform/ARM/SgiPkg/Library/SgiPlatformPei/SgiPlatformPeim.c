@@ -83,6 +83,12 @@ GetSgiSystemId (
     HobData->MultiChipMode = fdt32_to_cpu (*Property);
   }
 
+  if (HobData->MultiChipMode != 0) {
+    HobData->ChipCount = FixedPcdGet32 (PcdChipCount);
+  } else {
+    HobData->ChipCount = 1;
+  }
+
   return EFI_SUCCESS;
 }
 
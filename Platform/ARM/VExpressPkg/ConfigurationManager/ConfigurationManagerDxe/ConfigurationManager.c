@@ -15,6 +15,7 @@
 #include <IndustryStandard/IoRemappingTable.h>
 #include <IndustryStandard/MemoryMappedConfigurationSpaceAccessTable.h>
 #include <Library/ArmLib.h>
+#include <Library/CmTokenIndexLib.h>
 #include <Library/DebugLib.h>
 #include <Library/IoLib.h>
 #include <Library/PcdLib.h>
@@ -396,6 +397,11 @@ HandleCmObject (
   return EFI_SUCCESS;
 }
 
+/** Index of the tokens referenced by the platform repository objects,
+    NULL if it could not be built.
+*/
+STATIC CM_TOKEN_INDEX  * mCmTokenIndex;
+
 /** A helper function for returning the Configuration Manager Objects that
     match the token.
 
@@ -435,6 +441,8 @@ HandleCmObjectRefByToken (
     CmObjectDesc->Data = (VOID*)Object;
     CmObjectDesc->Count = ObjectCount;
     Status = EFI_SUCCESS;
+  } else if (mCmTokenIndex != NULL) {
+    Status = CmTokenIndexFind (mCmTokenIndex, CmObjectId, Token, CmObjectDesc);
   } else {
     Status = HandlerProc (This, CmObjectId, Token, CmObjectDesc);
   }
@@ -451,6 +459,97 @@ HandleCmObjectRefByToken (
   return Status;
 }
 
+/** Add the object(s) referenced by a token to the token index.
+
+  The token is the address of the object(s).
+
+  @param [in]  ObjectId  The ARM namespace object ID of the object(s).
+  @param [in]  Object    Pointer to the object(s).
+  @param [in]  Size      Total size of the object(s).
+  @param [in]  Count     Number of objects.
+
+  @retval EFI_SUCCESS   Success.
+  @retval Others        Failed to add the token.
+**/
+STATIC
+EFI_STATUS
+AddArmObjectToken (
+  IN  EARM_OBJECT_ID    ObjectId,
+  IN  VOID            * Object,
+  IN  UINTN             Size,
+  IN  UINTN             Count
+  )
+{
+  return CmTokenIndexAdd (
+           mCmTokenIndex,
+           CREATE_CM_ARM_OBJECT_ID (ObjectId),
+           (CM_OBJECT_TOKEN)Object,
+           Object,
+           Size,
+           Count
+           );
+}
+
+/** Build the index of the tokens referenced by the platform repository.
+
+  @param [in]  PlatformRepo  Pointer to the platform repository.
+
+  @retval EFI_SUCCESS   Success.
+  @retval Others        Failed to build the index.
+**/
+STATIC
+EFI_STATUS
+InitializeTokenIndex (
+  IN  EDKII_PLATFORM_REPOSITORY_INFO  * PlatformRepo
+  )
+{
+  EFI_STATUS  Status;
+  UINTN       Index;
+
+  Status = CmTokenIndexCreate (
+             2 + ARRAY_SIZE (PlatformRepo->DeviceIdMapping),
+             &mCmTokenIndex
+             );
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  Status = AddArmObjectToken (
+             EArmObjGTBlockTimerFrameInfo,
+             PlatformRepo->GTBlock0TimerInfo,
+             sizeof (PlatformRepo->GTBlock0TimerInfo),
+             ARRAY_SIZE (PlatformRepo->GTBlock0TimerInfo)
+             );
+  if (!EFI_ERROR (Status)) {
+    Status = AddArmObjectToken (
+               EArmObjGicItsIdentifierArray,
+               PlatformRepo->ItsIdentifierArray,
+               sizeof (PlatformRepo->ItsIdentifierArray),
+               ARRAY_SIZE (PlatformRepo->ItsIdentifierArray)
+               );
+  }
+
+  // Each device ID mapping is referenced individually
+  for (Index = 0;
+       !EFI_ERROR (Status) &&
+       (Index < ARRAY_SIZE (PlatformRepo->DeviceIdMapping));
+       Index++) {
+    Status = AddArmObjectToken (
+               EArmObjIdMappingArray,
+               &PlatformRepo->DeviceIdMapping[Index],
+               sizeof (PlatformRepo->DeviceIdMapping[Index]),
+               1
+               );
+  }
+
+  if (EFI_ERROR (Status)) {
+    // Fall back to searching the platform repository
+    CmTokenIndexFree (mCmTokenIndex);
+    mCmTokenIndex = NULL;
+  }
+  return Status;
+}
+
 /** Initialize the platform configuration repository.
 
   @param [in]  This        Pointer to the Configuration Manager Protocol.
@@ -466,6 +565,7 @@ InitializePlatformRepository (
   )
 {
   EDKII_PLATFORM_REPOSITORY_INFO  * PlatformRepo;
+  EFI_STATUS                        Status;
 
   PlatformRepo = This->PlatRepoInfo;
 
@@ -483,6 +583,15 @@ InitializePlatformRepository (
     PlatformRepo->GicCInfo[6].MPIDR = GET_MPID_MT (1, 2, 0);
     PlatformRepo->GicCInfo[7].MPIDR = GET_MPID_MT (1, 3, 0);
   }
+
+  Status = InitializeTokenIndex (PlatformRepo);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((
+      DEBUG_WARN,
+      "WARNING: Failed to build the token index. Status = %r\n",
+      Status
+      ));
+  }
   return EFI_SUCCESS;
 }
 
@@ -1042,6 +1151,7 @@ ArmVExpressPlatformGetObject (
   )
 {
   EFI_STATUS  Status;
+  UINT64      ProfileStart;
 
   if ((This == NULL) || (CmObject == NULL)) {
     ASSERT (This != NULL);
@@ -1049,6 +1159,8 @@ ArmVExpressPlatformGetObject (
     return EFI_INVALID_PARAMETER;
   }
 
+  ProfileStart = CmTokenIndexProfileStart ();
+
   switch (GET_CM_NAMESPACE_ID (CmObjectId)) {
     case EObjNameSpaceStandard:
       Status = GetStandardNameSpaceObject (This, CmObjectId, Token, CmObject);
@@ -1071,6 +1183,7 @@ ArmVExpressPlatformGetObject (
     }
   }
 
+  CmTokenIndexProfileEnd (mCmTokenIndex, CmObjectId, ProfileStart);
   return Status;
 }
 
@@ -1121,7 +1121,6 @@ SnpTransmit (
   LAN9118_DRIVER *LanDriver;
   UINT32 TxFreeSpace;
   UINT32 TxStatusSpace;
-  INT32 Count;
   UINT32 CommandA;
   UINT32 CommandB;
   UINT16 LocalProtocol;
@@ -1256,9 +1255,7 @@ SnpTransmit (
     Lan9118MmioWrite32 (LAN9118_TX_DATA, CommandB);
 
     // Write the payload
-    for (Count = 0; Count < ((BuffSize + 3) >> 2) - 3; Count++) {
-      Lan9118MmioWrite32 (LAN9118_TX_DATA, LocalData[Count + 3]);
-    }
+    Lan9118WriteTxFifo (&LocalData[3], ((BuffSize + 3) >> 2) - 3);
   } else {
     // Format pointer
     LocalData = (UINT32*) Data;
@@ -1272,9 +1269,7 @@ SnpTransmit (
     Lan9118MmioWrite32 (LAN9118_TX_DATA, CommandB);
 
     // Write all the data
-    for (Count = 0; Count < ((BuffSize + 3) >> 2); Count++) {
-      Lan9118MmioWrite32 (LAN9118_TX_DATA, LocalData[Count]);
-    }
+    Lan9118WriteTxFifo (LocalData, (BuffSize + 3) >> 2);
   }
 
   // Save the address of the submitted packet so we can notify the consumer that
@@ -1316,7 +1311,6 @@ SnpReceive (
   UINT32          RxCfgValue;
   UINT32          PLength; // Packet length
   UINT32          ReadLimit;
-  UINT32          Count;
   UINT32          Padding;
   UINT32          *RawData;
   EFI_MAC_ADDRESS Dst;
@@ -1361,19 +1355,27 @@ SnpReceive (
   // explain those errors has been found so far and everything seems to
   // work perfectly when they are just ignored.
   //
-  IntSts = Lan9118MmioRead32 (LAN9118_INT_STS);
-  if ((IntSts & INSTS_RXE) && (!(IntSts & INSTS_RSFF))) {
-    Lan9118MmioWrite32 (LAN9118_INT_STS, INSTS_RXE);
-  }
+  // The FIFO housekeeping below only needs doing once per batch of received
+  // frames: the frames found in the Rx status FIFO are then drained by the
+  // following calls without polling the FIFO levels again.
+  //
+  if (LanDriver->RxPendingFrames == 0) {
+    IntSts = Lan9118MmioRead32 (LAN9118_INT_STS);
+    if ((IntSts & INSTS_RXE) && (!(IntSts & INSTS_RSFF))) {
+      Lan9118MmioWrite32 (LAN9118_INT_STS, INSTS_RXE);
+    }
 
-  // Count dropped frames
-  DroppedFrames = Lan9118MmioRead32 (LAN9118_RX_DROP);
-  LanDriver->Stats.RxDroppedFrames += DroppedFrames;
+    // Count dropped frames
+    DroppedFrames = Lan9118MmioRead32 (LAN9118_RX_DROP);
+    LanDriver->Stats.RxDroppedFrames += DroppedFrames;
 
-  NumPackets = RxStatusUsedSpace (0, Snp) / 4;
-  if (!NumPackets) {
-    return EFI_NOT_READY;
+    NumPackets = RxStatusUsedSpace (0, Snp) / 4;
+    if (!NumPackets) {
+      return EFI_NOT_READY;
+    }
+    LanDriver->RxPendingFrames = NumPackets;
   }
+  LanDriver->RxPendingFrames--;
 
   // Read Rx Status (only if not empty)
   RxFifoStatus = Lan9118MmioRead32 (LAN9118_RX_STATUS);
@@ -1469,9 +1471,7 @@ SnpReceive (
   RawData = (UINT32*)Data;
 
   // Read Rx Packet
-  for (Count = 0; Count < ReadLimit; Count++) {
-    RawData[Count] = Lan9118MmioRead32 (LAN9118_RX_DATA);
-  }
+  Lan9118ReadRxFifo (RawData, ReadLimit);
 
   // Get the destination address
   if (DstAddr != NULL) {
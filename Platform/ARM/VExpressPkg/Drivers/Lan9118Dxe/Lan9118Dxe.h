@@ -70,6 +70,9 @@ typedef struct {
   // Saved transmitted buffers so we can notify consumers when packets have been sent.
   UINT16  NextPacketTag;
   VOID    *TxRing[LAN9118_TX_RING_NUM_ENTRIES];
+
+  // Number of received frames known to be waiting in the Rx status FIFO
+  UINT32  RxPendingFrames;
 } LAN9118_DRIVER;
 
 #define LAN9118_SIGNATURE                       SIGNATURE_32('l', 'a', 'n', '9')
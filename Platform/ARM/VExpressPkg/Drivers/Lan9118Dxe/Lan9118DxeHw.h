@@ -31,6 +31,10 @@
 #define LAN9118_TX_STATUS                     (0x00000048 + LAN9118_BA)
 #define LAN9118_TX_STATUS_PEEK                (0x0000004C + LAN9118_BA)
 
+// The Rx and Tx data FIFO ports are each aliased over 8 consecutive words,
+// so that the host can access them with incrementing-address bursts.
+#define LAN9118_DATA_PORT_ALIASES             8
+
 /* ------------- System Control and Status Registers -------------------------*/
 #define LAN9118_ID_REV                        (0x00000050 + LAN9118_BA)    // Chip ID and Revision
 #define LAN9118_IRQ_CFG                       (0x00000054 + LAN9118_BA)    // Interrupt Configuration
@@ -17,6 +17,21 @@
 
 STATIC EFI_MAC_ADDRESS mZeroMac = { { 0 } };
 
+//
+// Shadow copies of the MAC CSRs that are only ever modified by the driver.
+// Reading a MAC CSR takes a command and busy-wait round trip through the CSR
+// synchronizer, so once known the value of these registers is served from
+// the shadow copy. The shadow is dropped whenever the device is reset.
+//
+#define MAC_CSR_SHADOWED    ((1 << INDIRECT_MAC_INDEX_CR)    | \
+                             (1 << INDIRECT_MAC_INDEX_ADDRH) | \
+                             (1 << INDIRECT_MAC_INDEX_ADDRL) | \
+                             (1 << INDIRECT_MAC_INDEX_HASHH) | \
+                             (1 << INDIRECT_MAC_INDEX_HASHL))
+
+STATIC UINT32 mMacCsrShadow[13];
+STATIC UINT32 mMacCsrShadowValid;
+
 /**
   This internal function reverses bits for 32bit data.
 
@@ -94,10 +109,16 @@ IndirectMACRead32 (
   )
 {
   UINT32 MacCSR;
+  UINT32 Value;
 
   // Check index is in the range
   ASSERT(Index <= 12);
 
+  // Serve the registers only the driver writes from their shadow copy
+  if ((mMacCsrShadowValid & (1 << Index)) != 0) {
+    return mMacCsrShadow[Index];
+  }
+
   // Wait until CSR busy bit is cleared
   while ((Lan9118MmioRead32 (LAN9118_MAC_CSR_CMD) & MAC_CSR_BUSY) == MAC_CSR_BUSY);
 
@@ -113,7 +134,14 @@ IndirectMACRead32 (
   while ((Lan9118MmioRead32 (LAN9118_MAC_CSR_CMD) & MAC_CSR_BUSY) == MAC_CSR_BUSY);
 
   // Now read from data register to get read value
-  return Lan9118MmioRead32 (LAN9118_MAC_CSR_DATA);
+  Value = Lan9118MmioRead32 (LAN9118_MAC_CSR_DATA);
+
+  if ((MAC_CSR_SHADOWED & (1 << Index)) != 0) {
+    mMacCsrShadow[Index] = Value;
+    mMacCsrShadowValid |= 1 << Index;
+  }
+
+  return Value;
 }
 
 /*
@@ -194,9 +222,53 @@ IndirectMACWrite32 (
   // Wait until CSR busy bit is cleared
   while ((Lan9118MmioRead32 (LAN9118_MAC_CSR_CMD) & MAC_CSR_BUSY) == MAC_CSR_BUSY);
 
+  if ((MAC_CSR_SHADOWED & (1 << Index)) != 0) {
+    mMacCsrShadow[Index] = ValueWritten;
+    mMacCsrShadowValid |= 1 << Index;
+  }
+
   return ValueWritten;
 }
 
+/*
+ * The dummy reads required after an Rx data FIFO read only apply to the
+ * access that follows the last read of a sequence, not in between successive
+ * data FIFO reads. So the whole transfer is done back to back, going through
+ * the data port aliases, and the delay is applied once at the end.
+ */
+VOID
+Lan9118ReadRxFifo (
+  OUT UINT32  *Buffer,
+  IN  UINTN   Count
+  )
+{
+  UINTN Alias;
+
+  for (Alias = 0; Count > 0; Count--) {
+    *Buffer++ = MmioRead32 (LAN9118_RX_DATA + (Alias * sizeof (UINT32)));
+    Alias = (Alias + 1) % LAN9118_DATA_PORT_ALIASES;
+  }
+
+  WaitDummyReads (LAN9118_RX_DATA_RD_DELAY);
+}
+
+// Write words to the Tx data FIFO, see Lan9118ReadRxFifo()
+VOID
+Lan9118WriteTxFifo (
+  IN  UINT32  *Buffer,
+  IN  UINTN   Count
+  )
+{
+  UINTN Alias;
+
+  for (Alias = 0; Count > 0; Count--) {
+    MmioWrite32 (LAN9118_TX_DATA + (Alias * sizeof (UINT32)), *Buffer++);
+    Alias = (Alias + 1) % LAN9118_DATA_PORT_ALIASES;
+  }
+
+  WaitDummyReads (LAN9118_TX_DATA_WR_DELAY);
+}
+
 // Function to read from MII register (PHY Access)
 UINT32
 IndirectPHYRead32 (
@@ -405,6 +477,9 @@ Lan9118Initialize (
   UINTN  Retries;
   UINT64 DefaultMacAddress;
 
+  // The device may have been reset while in a lower power state
+  mMacCsrShadowValid = 0;
+
   // Attempt to wake-up the device if it is in a lower power state
   if (((Lan9118MmioRead32 (LAN9118_PMT_CTRL) & MPTCTRL_PM_MODE_MASK) >> 12) != 0) {
     DEBUG ((DEBUG_NET, "Waking from reduced power state.\n"));
@@ -494,6 +569,9 @@ SoftReset (
   // Write the configuration
   Lan9118MmioWrite32 (LAN9118_HW_CFG, HwConf);
 
+  // The MAC CSRs are back to their reset values
+  mMacCsrShadowValid = 0;
+
   // Wait for reset to complete
   while (Lan9118MmioRead32 (LAN9118_HW_CFG) & HWCFG_SRST) {
 
@@ -770,6 +848,8 @@ StopRx (
     Lan9118MmioWrite32 (LAN9118_RX_CFG, RxCfg);
 
     while (Lan9118MmioRead32 (LAN9118_RX_CFG) & RXCFG_RX_DUMP);
+
+    INSTANCE_FROM_SNP_THIS (Snp)->RxPendingFrames = 0;
   }
 
   return EFI_SUCCESS;
@@ -841,6 +921,8 @@ StartRx (
       Lan9118MmioWrite32 (LAN9118_RX_CFG, RxCfg);
 
       while (Lan9118MmioRead32 (LAN9118_RX_CFG) & RXCFG_RX_DUMP);
+
+      INSTANCE_FROM_SNP_THIS (Snp)->RxPendingFrames = 0;
     }
 
     MacCsr |= MACCR_RX_EN;
@@ -73,6 +73,23 @@ IndirectMACWrite32 (
   );
 
 
+/* ---------------- Data FIFO Access ------------------ */
+
+// Read words from the Rx data FIFO
+VOID
+Lan9118ReadRxFifo (
+  OUT UINT32  *Buffer,
+  IN  UINTN   Count
+  );
+
+// Write words to the Tx data FIFO
+VOID
+Lan9118WriteTxFifo (
+  IN  UINT32  *Buffer,
+  IN  UINTN   Count
+  );
+
+
 /* --------------- PHY Registers Access ---------------- */
 
 // Read from MII register (PHY Access)
@@ -36,6 +36,7 @@
 #include <Library/PcdLib.h>
 #include <Library/NetLib.h>
 #include <Library/DevicePathLib.h>
+#include <Library/TimerLib.h>
 
 // Hardware register definitions
 #include "Lan91xDxeHw.h"
@@ -44,6 +45,7 @@
 //#define LAN91X_PRINT_REGISTERS 1
 //#define LAN91X_PRINT_PACKET_HEADERS 1
 //#define LAN91X_PRINT_RECEIVE_FILTERS 1
+//#define LAN91X_PRINT_PACKET_RATE 1
 
 // Chip power-down option -- UNTESTED
 //#define LAN91X_POWER_DOWN 1
@@ -74,6 +76,14 @@ typedef struct _LAN91X_DRIVER {
   UINT8             Revision;           // Chip Revision Number
   INT8              PhyAd;              // Phy Address
   UINT8             BankSel;            // Currently selected register bank
+  UINT16            DataOffset;         // FIFO offset of the next DATA access
+
+#if LAN91X_PRINT_PACKET_RATE
+  // Packet rate measurement
+  UINT64            RateStart;          // Performance counter at window start
+  UINTN             RateTxFrames;       // Frames sent in the current window
+  UINTN             RateRxFrames;       // Frames received in the current window
+#endif
 
 } LAN91X_DRIVER;
 
@@ -83,8 +93,11 @@ typedef struct _LAN91X_DRIVER {
 #define INSTANCE_FROM_SNP_THIS(a)               CR(a, LAN91X_DRIVER, Snp, LAN91X_SIGNATURE)
 
 #define LAN91X_STALL              2
+#define LAN91X_MMU_SPIN_POLLS     32    // Polls of the MMU busy bit before stalling
 #define LAN91X_MEMORY_ALLOC_POLLS 100   // Max times to poll for memory allocation
 #define LAN91X_PKT_OVERHEAD       6     // Overhead bytes in packet buffer
+#define LAN91X_TX_MAX_PAGES       7     // MMU pages for the largest frame accepted
+#define LAN91X_RATE_FRAMES        1024  // Frames per packet rate report
 
 // Synchronization TPLs
 #define LAN91X_TPL  TPL_CALLBACK
@@ -735,29 +748,70 @@ SetCurrentMacAddress (
   return EFI_SUCCESS;
 }
 
+// Wait for the MMU to finish the previous command
 STATIC
 EFI_STATUS
-MmuOperation (
-  IN  LAN91X_DRIVER *LanDriver,
-  IN  UINTN          MmuOp
+MmuWaitIdle (
+  IN  LAN91X_DRIVER *LanDriver
   )
 {
   UINTN   Polls;
 
-  WriteIoReg16 (LanDriver, LAN91X_MMUCR, MmuOp);
-  Polls = 100;
+  // MMU commands normally complete within a few register accesses, so spin
+  // on the busy bit before falling back to stalling between polls.
+  Polls = LAN91X_MMU_SPIN_POLLS + 100;
   while ((ReadIoReg16 (LanDriver, LAN91X_MMUCR) & MMUCR_BUSY) != 0) {
     if (--Polls == 0) {
-      DEBUG ((DEBUG_ERROR, "LAN91x: MMU operation %04x timed-out\n", MmuOp));
       return EFI_TIMEOUT;
     }
-    gBS->Stall (LAN91X_STALL);
+    if (Polls < 100) {
+      gBS->Stall (LAN91X_STALL);
+    }
+  }
+
+  return EFI_SUCCESS;
+}
+
+// Issue an MMU command
+//
+// The command is not waited for: the next MMU command, or an explicit
+// MmuWaitIdle(), waits for it. This lets a Tx push or an Rx release run in
+// the background while the driver returns to its caller. SnpReceive() waits
+// for the previous Rx release before it looks at the Rx FIFO again.
+STATIC
+EFI_STATUS
+MmuOperation (
+  IN  LAN91X_DRIVER *LanDriver,
+  IN  UINTN          MmuOp
+  )
+{
+  if (EFI_ERROR (MmuWaitIdle (LanDriver))) {
+    DEBUG ((DEBUG_ERROR, "LAN91x: MMU busy, operation %04x timed-out\n", MmuOp));
+    return EFI_TIMEOUT;
   }
 
+  WriteIoReg16 (LanDriver, LAN91X_MMUCR, MmuOp);
+
   return EFI_SUCCESS;
 }
 
+// Set the Pointer register and rewind the tracked DATA register FIFO offset
+STATIC
+VOID
+SetDataPointer (
+  IN  LAN91X_DRIVER *LanDriver,
+  IN  UINT16         Pointer
+  )
+{
+  WriteIoReg16 (LanDriver, LAN91X_PTR, Pointer);
+  LanDriver->DataOffset = Pointer & PTR_POINTER;
+}
+
 // Read bytes from the DATA register
+//
+// Whole 32-bit words are moved through the DATA register once the FIFO
+// pointer is word aligned. The head bytes needed to reach that alignment and
+// the tail bytes are moved one at a time.
 STATIC
 EFI_STATUS
 ReadIoData (
@@ -767,10 +821,23 @@ ReadIoData (
   )
 {
   UINT8     *Ptr;
+  UINTN      DataReg;
+
+  SelectIoBank (LanDriver, LAN91X_DATA0);
+  DataReg = LanDriver->IoBase + RegisterToOffset (LAN91X_DATA0);
+  LanDriver->DataOffset += BufLen;
 
   Ptr = Buffer;
+  for (; (BufLen > 0) && (((LanDriver->DataOffset - BufLen) & 3) != 0); --BufLen) {
+    *Ptr = MmioRead8 (DataReg);
+    ++Ptr;
+  }
+  for (; BufLen >= sizeof (UINT32); BufLen -= sizeof (UINT32)) {
+    WriteUnaligned32 ((UINT32 *)Ptr, MmioRead32 (DataReg));
+    Ptr += sizeof (UINT32);
+  }
   for (; BufLen > 0; --BufLen) {
-    *Ptr = ReadIoReg8 (LanDriver, LAN91X_DATA0);
+    *Ptr = MmioRead8 (DataReg);
     ++Ptr;
   }
 
@@ -778,6 +845,8 @@ ReadIoData (
 }
 
 // Write bytes to the DATA register
+//
+// See ReadIoData() for how the transfer is split.
 STATIC
 EFI_STATUS
 WriteIoData (
@@ -787,16 +856,69 @@ WriteIoData (
   )
 {
   UINT8     *Ptr;
+  UINTN      DataReg;
+
+  SelectIoBank (LanDriver, LAN91X_DATA0);
+  DataReg = LanDriver->IoBase + RegisterToOffset (LAN91X_DATA0);
+  LanDriver->DataOffset += BufLen;
 
   Ptr = Buffer;
+  for (; (BufLen > 0) && (((LanDriver->DataOffset - BufLen) & 3) != 0); --BufLen) {
+    MmioWrite8 (DataReg, *Ptr);
+    ++Ptr;
+  }
+  for (; BufLen >= sizeof (UINT32); BufLen -= sizeof (UINT32)) {
+    MmioWrite32 (DataReg, ReadUnaligned32 ((UINT32 *)Ptr));
+    Ptr += sizeof (UINT32);
+  }
   for (; BufLen > 0; --BufLen) {
-    WriteIoReg8 (LanDriver, LAN91X_DATA0, *Ptr);
+    MmioWrite8 (DataReg, *Ptr);
     ++Ptr;
   }
 
   return EFI_SUCCESS;
 }
 
+#if LAN91X_PRINT_PACKET_RATE
+// Account for a sent or received frame and report the packet rate
+STATIC
+VOID
+UpdatePacketRate (
+  IN  LAN91X_DRIVER *LanDriver,
+  IN  BOOLEAN        Transmit
+  )
+{
+  UINT64    Now;
+  UINT64    ElapsedNs;
+
+  Now = GetPerformanceCounter ();
+  if (LanDriver->RateStart == 0) {
+    LanDriver->RateStart = Now;
+  }
+
+  if (Transmit) {
+    LanDriver->RateTxFrames += 1;
+  } else {
+    LanDriver->RateRxFrames += 1;
+  }
+
+  if (LanDriver->RateTxFrames + LanDriver->RateRxFrames < LAN91X_RATE_FRAMES) {
+    return;
+  }
+
+  ElapsedNs = GetTimeInNanoSecond (Now - LanDriver->RateStart);
+  if (ElapsedNs != 0) {
+    DEBUG ((DEBUG_ERROR, "LAN91x: %Lu Tx frames/s, %Lu Rx frames/s\n",
+        DivU64x64Remainder (MultU64x32 (LanDriver->RateTxFrames, 1000000000), ElapsedNs, NULL),
+        DivU64x64Remainder (MultU64x32 (LanDriver->RateRxFrames, 1000000000), ElapsedNs, NULL)));
+  }
+
+  LanDriver->RateStart = Now;
+  LanDriver->RateTxFrames = 0;
+  LanDriver->RateRxFrames = 0;
+}
+#endif
+
 // Disable the interface
 STATIC
 EFI_STATUS
@@ -876,6 +998,7 @@ SoftReset (
 
   // Reset the MMU
   MmuOperation (LanDriver, MMUCR_OP_RESET_MMU);
+  MmuWaitIdle (LanDriver);
 
   return EFI_SUCCESS;
 }
@@ -1716,6 +1839,7 @@ SnpTransmit (
   UINTN            Retries;
   UINT16           Proto;
   UINT8            PktNum;
+  UINT16           PktHeader[2];
   MSK_LINKED_SYSTEM_BUF   *LinkedTXRecycleBuff;
 
 
@@ -1771,7 +1895,7 @@ SnpTransmit (
   // Calculate the request size in 256-byte "pages" minus 1
   // The 91C111 ignores this, but some older devices need it.
   MmuPages = ((BufSize & ~1) + LAN91X_PKT_OVERHEAD - 1) >> 8;
-  if (MmuPages > 7) {
+  if (MmuPages > LAN91X_TX_MAX_PAGES) {
     DEBUG ((DEBUG_WARN, "LAN91x: Tx buffer too large (%d bytes)\n", BufSize));
     LanDriver->Stats.TxOversizeFrames += 1;
     LanDriver->Stats.TxDroppedFrames += 1;
@@ -1819,15 +1943,16 @@ SnpTransmit (
 
   // Set the Packet Number and Pointer registers
   WriteIoReg8 (LanDriver, LAN91X_PNR, PktNum);
-  WriteIoReg16 (LanDriver, LAN91X_PTR, PTR_AUTO_INCR);
+  SetDataPointer (LanDriver, PTR_AUTO_INCR);
 
   // Set up mutable buffer information variables
   Ptr = BufAddr;
   Len = BufSize;
 
   // Write Status and Byte Count first
-  WriteIoReg16 (LanDriver, LAN91X_DATA0, 0);
-  WriteIoReg16 (LanDriver, LAN91X_DATA0, (Len + LAN91X_PKT_OVERHEAD) & BCW_COUNT);
+  PktHeader[0] = 0;
+  PktHeader[1] = (Len + LAN91X_PKT_OVERHEAD) & BCW_COUNT;
+  WriteIoData (LanDriver, PktHeader, sizeof (PktHeader));
 
   // This packet may come with a preconfigured Ethernet header.
   // If not, we need to construct one from optional parameters.
@@ -1845,7 +1970,7 @@ SnpTransmit (
 
     // Write the Protocol word
     Proto = HTONS (*Protocol);
-    WriteIoReg16 (LanDriver, LAN91X_DATA0, Proto);
+    WriteIoData (LanDriver, &Proto, sizeof (Proto));
 
     // Adjust the data start and length
     Ptr += sizeof(ETHER_HEAD);
@@ -1868,6 +1993,10 @@ SnpTransmit (
     ReturnUnlock (EFI_DEVICE_ERROR);
   }
 
+#if LAN91X_PRINT_PACKET_RATE
+  UpdatePacketRate (LanDriver, TRUE);
+#endif
+
   // Update the Tx statistics
   LanDriver->Stats.TxTotalBytes += BufSize;
   LanDriver->Stats.TxGoodFrames += 1;
@@ -1928,6 +2057,7 @@ SnpReceive (
   EFI_STATUS     Status;
   LAN91X_DRIVER *LanDriver;
   UINT8         *DataPtr;
+  UINT16         PktHeader[2];
   UINT16         PktStatus;
   UINT16         PktLength;
   UINT16         PktControl;
@@ -1960,6 +2090,13 @@ SnpReceive (
   // Find the LanDriver structure
   LanDriver = INSTANCE_FROM_SNP_THIS(Snp);
 
+  // Let the release of the previous frame complete, so that the Rx FIFO and
+  // the interrupt status reflect the next one
+  if (EFI_ERROR (MmuWaitIdle (LanDriver))) {
+    DEBUG ((DEBUG_ERROR, "LAN91x: MMU busy, Rx release timed-out\n"));
+    ReturnUnlock (EFI_DEVICE_ERROR);
+  }
+
   // Check for Rx Overrun
   IstReg = ReadIoReg8 (LanDriver, LAN91X_IST);
   if ((IstReg & IST_RX_OVRN) != 0) {
@@ -1975,11 +2112,12 @@ SnpReceive (
   }
 
   // Configure the PTR register for reading
-  WriteIoReg16 (LanDriver, LAN91X_PTR, PTR_RCV | PTR_AUTO_INCR | PTR_READ);
+  SetDataPointer (LanDriver, PTR_RCV | PTR_AUTO_INCR | PTR_READ);
 
   // Read the Packet Status and Packet Length words
-  PktStatus = ReadIoReg16 (LanDriver, LAN91X_DATA0);
-  PktLength = ReadIoReg16 (LanDriver, LAN91X_DATA0) & BCW_COUNT;
+  ReadIoData (LanDriver, PktHeader, sizeof (PktHeader));
+  PktStatus = PktHeader[0];
+  PktLength = PktHeader[1] & BCW_COUNT;
 
   // Check for valid received packet
   if ((PktStatus == 0) && (PktLength == 0)) {
@@ -2085,6 +2223,10 @@ SnpReceive (
   LanDriver->Stats.RxGoodFrames += 1;
   Status = EFI_SUCCESS;
 
+#if LAN91X_PRINT_PACKET_RATE
+  UpdatePacketRate (LanDriver, FALSE);
+#endif
+
 #if LAN91X_PRINT_PACKET_HEADERS
   // Dump the packet header
   DEBUG ((DEBUG_ERROR, "LAN91X:SnpReceive()\n"));
@@ -2094,7 +2236,8 @@ SnpReceive (
   PrintIpDgram (&DataPtr[0], &DataPtr[6], &DataPtr[12], &DataPtr[14]);
 #endif
 
-  // Release the FIFO buffer
+  // Release the FIFO buffer. The release completes in the background and is
+  // waited for by the next MMU command.
 exit_release:
   MmuOperation (LanDriver, MMUCR_OP_RX_POP_REL);
 
@@ -45,6 +45,7 @@
   @retval EFI_INVALID_PARAMETER  VendorGuid is NULL.
   @retval EFI_INVALID_PARAMETER  DataSize is NULL.
   @retval EFI_INVALID_PARAMETER  The DataSize is not too small and Data is NULL.
+  @retval EFI_INVALID_PARAMETER  VariableName contains a '#' character.
   @retval EFI_DEVICE_ERROR       The variable could not be retrieved due to a hardware error.
   @retval EFI_SECURITY_VIOLATION The variable could not be retrieved due to an authentication failure.
 
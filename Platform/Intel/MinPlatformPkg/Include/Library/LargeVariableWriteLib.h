@@ -47,6 +47,7 @@
                                  DataSize exceeds the maximum allowed.
   @retval EFI_INVALID_PARAMETER  VariableName is an empty string.
   @retval EFI_INVALID_PARAMETER  DataSize is zero and LockVariable is TRUE
+  @retval EFI_INVALID_PARAMETER  VariableName contains a '#' character.
   @retval EFI_OUT_OF_RESOURCES   Not enough storage is available to hold the variable and its data.
   @retval EFI_OUT_OF_RESOURCES   The VariableName is longer than 1018 characters
   @retval EFI_DEVICE_ERROR       The variable could not be retrieved due to a hardware error.
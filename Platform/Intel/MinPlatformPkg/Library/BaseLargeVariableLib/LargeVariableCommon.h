@@ -9,7 +9,7 @@
   In the case where more than one variable is needed to store the data, an
   integer number will be added to the end of the variable name. This number
   will be incremented for each variable as needed to retrieve the entire data
-  set.
+  set. An index variable records how many variables hold the data set.
 
   Copyright (c) 2021, Intel Corporation. All rights reserved.<BR>
   SPDX-License-Identifier: BSD-2-Clause-Patent
@@ -44,4 +44,39 @@
 //
 #define MAX_VARIABLE_SPLIT_DIGITS   6
 
+//
+// When more than one variable is needed, an index variable named
+// "<VariableName>#Index" is stored after all the data variables. It records the
+// number of data variables and the total data size, so readers can size their
+// buffer and read every data variable directly into it in a single pass. Data
+// sets written before the index variable existed are still read by probing for
+// data variables until one is not found.
+//
+// VariableName may not contain LARGE_VARIABLE_INDEX_SEPARATOR, so the name of
+// the index variable can never be the name of a caller's variable.
+//
+#define LARGE_VARIABLE_INDEX_SEPARATOR      L"#"
+#define LARGE_VARIABLE_INDEX_SUFFIX         LARGE_VARIABLE_INDEX_SEPARATOR L"Index"
+#define LARGE_VARIABLE_INDEX_SUFFIX_LENGTH  ((sizeof (LARGE_VARIABLE_INDEX_SUFFIX) / sizeof (CHAR16)) - 1)
+#define LARGE_VARIABLE_INDEX_SIGNATURE      SIGNATURE_32 ('L', 'V', 'I', 'X')
+
+//
+// The longest string which is appended to VariableName, either the number of a
+// data variable or the index variable suffix.
+//
+#define MAX_VARIABLE_NAME_SUFFIX_LENGTH  MAX (MAX_VARIABLE_SPLIT_DIGITS, LARGE_VARIABLE_INDEX_SUFFIX_LENGTH)
+
+//
+// Space reserved in each variable beyond VariableName itself: the longest
+// suffix appended to it, plus up to 8 bytes of alignment padding the UEFI
+// Variable Services implementation may add after the variable name.
+//
+#define MAX_VARIABLE_NAME_PAD_SIZE  ((MAX_VARIABLE_NAME_SUFFIX_LENGTH * sizeof (CHAR16)) + 8)
+
+typedef struct {
+  UINT32    Signature;
+  UINT32    VariableCount;
+  UINT64    TotalSize;
+} LARGE_VARIABLE_INDEX;
+
 #endif  // _LARGE_VARIABLE_COMMON_H_
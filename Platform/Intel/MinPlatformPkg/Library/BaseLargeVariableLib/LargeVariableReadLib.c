@@ -9,7 +9,8 @@
   In the case where more than one variable is needed to store the data, an
   integer number will be added to the end of the variable name. This number
   will be incremented for each variable as needed to retrieve the entire data
-  set.
+  set. An index variable records how many variables hold the data set, so they
+  can be read in a single pass.
 
   Copyright (c) 2021, Intel Corporation. All rights reserved.<BR>
   SPDX-License-Identifier: BSD-2-Clause-Patent
@@ -19,11 +20,43 @@
 #include <Library/BaseLib.h>
 #include <Library/BaseMemoryLib.h>
 #include <Library/DebugLib.h>
-#include <Library/PrintLib.h>
 #include <Library/VariableReadLib.h>
 
 #include "LargeVariableCommon.h"
 
+/**
+  Replaces the decimal number at the end of a data variable name.
+
+  Only the suffix is rewritten, so walking the data variables does not need to
+  format the whole variable name for every variable.
+
+  @param[out]  Suffix            Location of the number in the variable name.
+  @param[in]   Index             The number of the data variable.
+
+**/
+VOID
+SetVariableNameSuffix (
+  OUT CHAR16                      *Suffix,
+  IN  UINTN                       Index
+  )
+{
+  CHAR16        Digits[MAX_VARIABLE_SPLIT_DIGITS];
+  UINTN         Count;
+
+  ASSERT (Index < MAX_VARIABLE_SPLIT);
+
+  Count = 0;
+  do {
+    Digits[Count++] = (CHAR16) (L'0' + (Index % 10));
+    Index /= 10;
+  } while (Index != 0);
+
+  while (Count > 0) {
+    *Suffix++ = Digits[--Count];
+  }
+  *Suffix = L'\0';
+}
+
 /**
   Returns the value of a large variable.
 
@@ -42,8 +75,10 @@
   @retval EFI_INVALID_PARAMETER  VendorGuid is NULL.
   @retval EFI_INVALID_PARAMETER  DataSize is NULL.
   @retval EFI_INVALID_PARAMETER  The DataSize is not too small and Data is NULL.
+  @retval EFI_INVALID_PARAMETER  VariableName contains a '#' character.
   @retval EFI_DEVICE_ERROR       The variable could not be retrieved due to a hardware error.
   @retval EFI_SECURITY_VIOLATION The variable could not be retrieved due to an authentication failure.
+  @retval EFI_VOLUME_CORRUPTED   The data variables do not match the index variable.
 
 **/
 EFI_STATUS
@@ -55,119 +90,136 @@ GetLargeVariable (
   OUT    VOID                        *Data           OPTIONAL
   )
 {
-  CHAR16        TempVariableName[MAX_VARIABLE_NAME_SIZE];
-  EFI_STATUS    Status;
-  UINTN         TotalSize;
-  UINTN         VarDataSize;
-  UINTN         Index;
-  UINTN         VariableSize;
-  UINTN         BytesRemaining;
-  UINT8         *OffsetPtr;
+  CHAR16                TempVariableName[MAX_VARIABLE_NAME_SIZE];
+  CHAR16                *Suffix;
+  LARGE_VARIABLE_INDEX  VariableIndex;
+  EFI_STATUS            Status;
+  UINTN                 TotalSize;
+  UINTN                 VariableNameLength;
+  UINTN                 Index;
+  UINTN                 VariableCount;
+  BOOLEAN               HasIndex;
+  UINTN                 VariableSize;
+  UINTN                 BytesRemaining;
+  UINT8                 *OffsetPtr;
+
+  if (VariableName == NULL || VendorGuid == NULL || DataSize == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
 
-  VarDataSize = 0;
+  if (StrStr (VariableName, LARGE_VARIABLE_INDEX_SEPARATOR) != NULL) {
+    DEBUG ((DEBUG_ERROR, "GetLargeVariable: Variable name may not contain %s\n", LARGE_VARIABLE_INDEX_SEPARATOR));
+    return EFI_INVALID_PARAMETER;
+  }
 
   //
-  // First check if a variable with the given name exists
+  // First try a single variable with the given name, reading it straight into
+  // the caller's buffer. Variable Services return the size needed or reject a
+  // NULL buffer the same way this function does.
   //
-  Status = VarLibGetVariable (VariableName, VendorGuid, NULL, &VarDataSize, NULL);
-  if (Status == EFI_BUFFER_TOO_SMALL) {
-    if (*DataSize >= VarDataSize) {
-      if (Data == NULL) {
-        Status = EFI_INVALID_PARAMETER;
-        goto Done;
-      }
-      DEBUG ((DEBUG_VERBOSE, "GetLargeVariable: Single Variable Found\n"));
-      Status = VarLibGetVariable (VariableName, VendorGuid, NULL, DataSize, Data);
-      goto Done;
-    } else {
-      *DataSize = VarDataSize;
+  Status = VarLibGetVariable (VariableName, VendorGuid, NULL, DataSize, Data);
+  if (Status != EFI_NOT_FOUND) {
+    DEBUG ((DEBUG_VERBOSE, "GetLargeVariable: Single Variable Found\n"));
+    goto Done;
+  }
+
+  //
+  // Check if a multi-variable set exists
+  //
+  VariableNameLength = StrLen (VariableName);
+  if (VariableNameLength >= (MAX_VARIABLE_NAME_SIZE - MAX_VARIABLE_NAME_SUFFIX_LENGTH)) {
+    DEBUG ((DEBUG_ERROR, "GetLargeVariable: Variable name too long\n"));
+    Status = EFI_OUT_OF_RESOURCES;
+    goto Done;
+  }
+
+  ZeroMem (TempVariableName, sizeof (TempVariableName));
+  CopyMem (TempVariableName, VariableName, VariableNameLength * sizeof (CHAR16));
+  Suffix = &TempVariableName[VariableNameLength];
+
+  //
+  // The index variable gives the total size and number of data variables
+  // up front. Without it, probe for data variables until one is not found.
+  //
+  CopyMem (Suffix, LARGE_VARIABLE_INDEX_SUFFIX, sizeof (LARGE_VARIABLE_INDEX_SUFFIX));
+  VariableSize = sizeof (VariableIndex);
+  Status = VarLibGetVariable (TempVariableName, VendorGuid, NULL, &VariableSize, &VariableIndex);
+  if (!EFI_ERROR (Status) &&
+      (VariableSize == sizeof (VariableIndex)) &&
+      (VariableIndex.Signature == LARGE_VARIABLE_INDEX_SIGNATURE) &&
+      (VariableIndex.VariableCount <= MAX_VARIABLE_SPLIT) &&
+      (VariableIndex.TotalSize <= MAX_UINTN)) {
+    DEBUG ((DEBUG_VERBOSE, "GetLargeVariable: Index Variable Found\n"));
+    HasIndex      = TRUE;
+    VariableCount = VariableIndex.VariableCount;
+    if (*DataSize < VariableIndex.TotalSize) {
+      *DataSize = (UINTN) VariableIndex.TotalSize;
       Status = EFI_BUFFER_TOO_SMALL;
       goto Done;
     }
-
-  } else if (Status == EFI_NOT_FOUND) {
-    //
-    // Check if the first variable of a multi-variable set exists
-    //
-    if (StrLen (VariableName) >= (MAX_VARIABLE_NAME_SIZE - MAX_VARIABLE_SPLIT_DIGITS)) {
-      DEBUG ((DEBUG_ERROR, "GetLargeVariable: Variable name too long\n"));
-      Status = EFI_OUT_OF_RESOURCES;
+    if (Data == NULL) {
+      Status = EFI_INVALID_PARAMETER;
       goto Done;
     }
+  } else {
+    HasIndex      = FALSE;
+    VariableCount = MAX_VARIABLE_SPLIT;
+    ZeroMem (&VariableIndex, sizeof (VariableIndex));
+  }
 
-    VarDataSize = 0;
-    Index       = 0;
-    ZeroMem (TempVariableName, MAX_VARIABLE_NAME_SIZE);
-    UnicodeSPrint (TempVariableName, MAX_VARIABLE_NAME_SIZE, L"%s%d", VariableName, Index);
-    Status = VarLibGetVariable (TempVariableName, VendorGuid, NULL, &VarDataSize, NULL);
-
-    if (Status == EFI_BUFFER_TOO_SMALL) {
-      //
-      // The first variable exists. Calculate the total size of all the variables.
-      //
-      DEBUG ((DEBUG_VERBOSE, "GetLargeVariable: Multiple Variables Found\n"));
-      TotalSize = 0;
-      for (Index = 0; Index < MAX_VARIABLE_SPLIT; Index++) {
-        VarDataSize = 0;
-        ZeroMem (TempVariableName, MAX_VARIABLE_NAME_SIZE);
-        UnicodeSPrint (TempVariableName, MAX_VARIABLE_NAME_SIZE, L"%s%d", VariableName, Index);
-        Status = VarLibGetVariable (TempVariableName, VendorGuid, NULL, &VarDataSize, NULL);
-        if (Status != EFI_BUFFER_TOO_SMALL) {
-          break;
-        }
-        TotalSize += VarDataSize;
-      }
-      DEBUG ((DEBUG_VERBOSE, "TotalSize = %d, NumVariables = %d\n", TotalSize, Index));
-
-      //
-      // Check if the user provided a large enough buffer
-      //
-      if (*DataSize >= TotalSize) {
-        if (Data == NULL) {
-          Status = EFI_INVALID_PARAMETER;
-          goto Done;
-        }
-
-        //
-        // Read the data from all variables
-        //
-        OffsetPtr       = (UINT8 *) Data;
-        BytesRemaining  = *DataSize;
-        for (Index = 0; Index < MAX_VARIABLE_SPLIT; Index++) {
-          VarDataSize = 0;
-          ZeroMem (TempVariableName, MAX_VARIABLE_NAME_SIZE);
-          UnicodeSPrint (TempVariableName, MAX_VARIABLE_NAME_SIZE, L"%s%d", VariableName, Index);
-          VariableSize = BytesRemaining;
-          DEBUG ((DEBUG_INFO, "Reading %s, Guid = %g,", TempVariableName, VendorGuid));
-          Status = VarLibGetVariable (TempVariableName, VendorGuid, NULL, &VariableSize, (VOID *) OffsetPtr);
-          DEBUG ((DEBUG_INFO, " Size %d\n", VariableSize));
-          if (EFI_ERROR (Status)) {
-            if (Status == EFI_NOT_FOUND) {
-              DEBUG ((DEBUG_VERBOSE, "No more variables found\n"));
-              Status = EFI_SUCCESS;   // The end has been reached
-            }
-            goto Done;
-          }
-
-          if (VariableSize < BytesRemaining) {
-            BytesRemaining -= VariableSize;
-            OffsetPtr += VariableSize;
-          } else {
-            DEBUG ((DEBUG_VERBOSE, "All data has been read\n"));
-            BytesRemaining = 0;
-            break;
-          }
-        }   //End of for loop
-
-        goto Done;
-      } else {
-        *DataSize = TotalSize;
-        Status = EFI_BUFFER_TOO_SMALL;
-        goto Done;
-      }
+  //
+  // Read the data variables directly into the caller's buffer. Once the buffer
+  // is exhausted, keep going with a zero size buffer to learn the total size.
+  //
+  OffsetPtr       = (UINT8 *) Data;
+  BytesRemaining  = (Data == NULL) ? 0 : *DataSize;
+  TotalSize       = 0;
+  Status          = EFI_SUCCESS;
+  for (Index = 0; Index < VariableCount; Index++) {
+    SetVariableNameSuffix (Suffix, Index);
+    VariableSize = BytesRemaining;
+    Status = VarLibGetVariable (
+               TempVariableName,
+               VendorGuid,
+               NULL,
+               &VariableSize,
+               (BytesRemaining > 0) ? (VOID *) OffsetPtr : NULL
+               );
+    DEBUG ((DEBUG_VERBOSE, "Reading %s, Guid = %g, Size %d, Status = %r\n", TempVariableName, VendorGuid, VariableSize, Status));
+    if (Status == EFI_NOT_FOUND) {
+      break;
+    } else if (Status == EFI_BUFFER_TOO_SMALL) {
+      BytesRemaining = 0;
+    } else if (EFI_ERROR (Status)) {
+      goto Done;
     } else {
-      Status = EFI_NOT_FOUND;
+      BytesRemaining -= VariableSize;
+      OffsetPtr      += VariableSize;
     }
+    TotalSize += VariableSize;
+  }
+  DEBUG ((DEBUG_VERBOSE, "TotalSize = %d, NumVariables = %d\n", TotalSize, Index));
+
+  if (Index == 0) {
+    Status = EFI_NOT_FOUND;
+    goto Done;
+  }
+
+  if (HasIndex &&
+      (Index != VariableCount || TotalSize != VariableIndex.TotalSize)) {
+    DEBUG ((DEBUG_ERROR, "GetLargeVariable: Data variables do not match the index variable\n"));
+    Status = EFI_VOLUME_CORRUPTED;
+    goto Done;
+  }
+
+  if (TotalSize > *DataSize) {
+    *DataSize = TotalSize;
+    Status = EFI_BUFFER_TOO_SMALL;
+  } else if (Data == NULL) {
+    Status = EFI_INVALID_PARAMETER;
+  } else {
+    *DataSize = TotalSize;
+    Status = EFI_SUCCESS;
   }
 
 Done:
@@ -9,6 +9,8 @@
   In the case where more than one variable is needed to store the data, an
   integer number will be added to the end of the variable name. This number
   will be incremented for each variable as needed to store the entire data set.
+  An index variable is stored after the data variables, recording how many
+  variables hold the data set so readers can retrieve it in a single pass.
 
   Copyright (c) 2021, Intel Corporation. All rights reserved.<BR>
   SPDX-License-Identifier: BSD-2-Clause-Patent
@@ -118,6 +120,36 @@ GetVariableSplitSize (
   return VariableSplitSize;
 }
 
+/**
+  Deletes the index variable of a multi-variable data set.
+
+  @param[in]  VariableName       A Null-terminated string that is the name of the vendor's variable.
+  @param[in]  VendorGuid         A unique identifier for the vendor.
+
+  @retval EFI_SUCCESS            The index variable was deleted.
+  @retval EFI_NOT_FOUND          The index variable does not exist.
+  @retval Others                 The index variable could not be deleted.
+
+**/
+EFI_STATUS
+DeleteLargeVariableIndex (
+  IN  CHAR16                       *VariableName,
+  IN  EFI_GUID                     *VendorGuid
+  )
+{
+  CHAR16        TempVariableName[MAX_VARIABLE_NAME_SIZE];
+
+  ZeroMem (TempVariableName, MAX_VARIABLE_NAME_SIZE);
+  UnicodeSPrint (TempVariableName, MAX_VARIABLE_NAME_SIZE, L"%s%s", VariableName, LARGE_VARIABLE_INDEX_SUFFIX);
+  return VarLibSetVariable (
+           TempVariableName,
+           VendorGuid,
+           EFI_VARIABLE_NON_VOLATILE | EFI_VARIABLE_BOOTSERVICE_ACCESS | EFI_VARIABLE_RUNTIME_ACCESS,
+           0,
+           NULL
+           );
+}
+
 /**
   Deletes a large variable.
 
@@ -149,11 +181,24 @@ DeleteLargeVariableInternal (
   CHAR16        TempVariableName[MAX_VARIABLE_NAME_SIZE];
   EFI_STATUS    Status;
   EFI_STATUS    Status2;
+  EFI_STATUS    IndexStatus;
   UINTN         VarDataSize;
   UINTN         Index;
 
   VarDataSize = 0;
 
+  //
+  // Delete the index variable whatever else is found, so it never outlives
+  // the data variables it describes.
+  //
+  IndexStatus = EFI_NOT_FOUND;
+  if (StrLen (VariableName) < (MAX_VARIABLE_NAME_SIZE - MAX_VARIABLE_NAME_SUFFIX_LENGTH)) {
+    IndexStatus = DeleteLargeVariableIndex (VariableName, VendorGuid);
+    if (EFI_ERROR (IndexStatus) && (IndexStatus != EFI_NOT_FOUND)) {
+      DEBUG ((DEBUG_ERROR, "DeleteLargeVariableInternal: Error deleting index variable: Status = %r\n", IndexStatus));
+    }
+  }
+
   //
   // First check if a variable with the given name exists
   //
@@ -167,13 +212,16 @@ DeleteLargeVariableInternal (
                 0,
                 NULL
                 );
+    if (!EFI_ERROR (Status) && EFI_ERROR (IndexStatus) && (IndexStatus != EFI_NOT_FOUND)) {
+      Status = IndexStatus;
+    }
     goto Done;
   } else if (Status == EFI_NOT_FOUND) {
 
     //
     // Check if the first variable of a multi-variable set exists
     //
-    if (StrLen (VariableName) >= (MAX_VARIABLE_NAME_SIZE - MAX_VARIABLE_SPLIT_DIGITS)) {
+    if (StrLen (VariableName) >= (MAX_VARIABLE_NAME_SIZE - MAX_VARIABLE_NAME_SUFFIX_LENGTH)) {
       DEBUG ((DEBUG_ERROR, "DeleteLargeVariableInternal: Variable name too long\n"));
       Status = EFI_OUT_OF_RESOURCES;
       goto Done;
@@ -190,6 +238,9 @@ DeleteLargeVariableInternal (
       //
       DEBUG ((DEBUG_VERBOSE, "DeleteLargeVariableInternal: Multiple Variables Found\n"));
       Status = EFI_SUCCESS;
+      if (EFI_ERROR (IndexStatus) && (IndexStatus != EFI_NOT_FOUND)) {
+        Status = IndexStatus;
+      }
       for (Index = 0; Index < MAX_VARIABLE_SPLIT; Index++) {
         VarDataSize = 0;
         ZeroMem (TempVariableName, MAX_VARIABLE_NAME_SIZE);
@@ -211,7 +262,10 @@ DeleteLargeVariableInternal (
         }
       }   // End of for loop
     } else {
-      Status = EFI_NOT_FOUND;
+      //
+      // Only the index variable, if any, was left of the data set
+      //
+      Status = IndexStatus;
     }
   }
 Done:
@@ -240,6 +294,7 @@ Done:
                                  DataSize exceeds the maximum allowed.
   @retval EFI_INVALID_PARAMETER  VariableName is an empty string.
   @retval EFI_INVALID_PARAMETER  DataSize is zero and LockVariable is TRUE
+  @retval EFI_INVALID_PARAMETER  VariableName contains a '#' character.
   @retval EFI_OUT_OF_RESOURCES   Not enough storage is available to hold the variable and its data.
   @retval EFI_OUT_OF_RESOURCES   The VariableName is longer than 1018 characters
   @retval EFI_DEVICE_ERROR       The variable could not be retrieved due to a hardware error.
@@ -270,6 +325,7 @@ SetLargeVariable (
   UINT8         *OffsetPtr;
   UINTN         BytesRemaining;
   UINTN         SizeToSave;
+  LARGE_VARIABLE_INDEX  VariableIndex;
 
   //
   // Check input parameters.
@@ -278,6 +334,11 @@ SetLargeVariable (
     return EFI_INVALID_PARAMETER;
   }
 
+  if (StrStr (VariableName, LARGE_VARIABLE_INDEX_SEPARATOR) != NULL) {
+    DEBUG ((DEBUG_ERROR, "SetLargeVariable: Variable name may not contain %s\n", LARGE_VARIABLE_INDEX_SEPARATOR));
+    return EFI_INVALID_PARAMETER;
+  }
+
   if (DataSize != 0 && Data == NULL) {
     return EFI_INVALID_PARAMETER;
   }
@@ -333,7 +394,7 @@ SetLargeVariable (
     // Check the length of the variable name is short enough to allow an integer
     // to be appended.
     //
-    if (VariableNameLength >= (MAX_VARIABLE_NAME_SIZE - MAX_VARIABLE_SPLIT_DIGITS)) {
+    if (VariableNameLength >= (MAX_VARIABLE_NAME_SIZE - MAX_VARIABLE_NAME_SUFFIX_LENGTH)) {
       Status = EFI_OUT_OF_RESOURCES;
       DEBUG ((DEBUG_ERROR, "SetLargeVariable: Variable name too long\n"));
       goto Done;
@@ -365,6 +426,19 @@ SetLargeVariable (
     }
 
     DEBUG ((DEBUG_VERBOSE, "SetLargeVariable: Saving using multiple variables.\n"));
+
+    //
+    // Delete the index variable first, so it never describes data variables
+    // from two different updates. This does not make an interrupted update
+    // safe: readers fall back to probing for data variables when there is no
+    // index, as for data sets written before the index variable existed, and
+    // would reassemble the chunks left behind.
+    //
+    Status = DeleteLargeVariableIndex (VariableName, VendorGuid);
+    if (EFI_ERROR (Status) && (Status != EFI_NOT_FOUND)) {
+      goto Done;
+    }
+
     OffsetPtr         = (UINT8 *) Data;
     BytesRemaining    = DataSize;
     VariablesSaved    = 0;
@@ -402,16 +476,44 @@ SetLargeVariable (
         DEBUG ((DEBUG_ERROR, "SetLargeVariable: Error writting variable: Status = %r\n", Status));
         goto Done;
       }
-      VariablesSaved  = Index;
+      VariablesSaved  = Index + 1;
       BytesRemaining -= SizeToSave;
       OffsetPtr += SizeToSave;
     }   // End of for loop
 
+    //
+    // Record the data set in the index variable now that all data is saved.
+    //
+    VariableIndex.Signature     = LARGE_VARIABLE_INDEX_SIGNATURE;
+    VariableIndex.VariableCount = (UINT32) VariablesSaved;
+    VariableIndex.TotalSize     = DataSize;
+    ZeroMem (TempVariableName, MAX_VARIABLE_NAME_SIZE);
+    UnicodeSPrint (TempVariableName, MAX_VARIABLE_NAME_SIZE, L"%s%s", VariableName, LARGE_VARIABLE_INDEX_SUFFIX);
+    DEBUG ((DEBUG_INFO, "Saving %s, Guid = %g, Count %d\n", TempVariableName, VendorGuid, VariablesSaved));
+    Status = VarLibSetVariable (
+              TempVariableName,
+              VendorGuid,
+              EFI_VARIABLE_NON_VOLATILE | EFI_VARIABLE_BOOTSERVICE_ACCESS | EFI_VARIABLE_RUNTIME_ACCESS,
+              sizeof (VariableIndex),
+              &VariableIndex
+              );
+    if (EFI_ERROR (Status)) {
+      DEBUG ((DEBUG_ERROR, "SetLargeVariable: Error writting index variable: Status = %r\n", Status));
+      goto Done;
+    }
+
     //
     // If the user requested that the variables be locked, lock them now that
     // all data is saved.
     //
     if (LockVariable) {
+      DEBUG ((DEBUG_INFO, "Locking %s, Guid = %g\n", TempVariableName, VendorGuid));
+      Status = VarLibVariableRequestToLock (TempVariableName, VendorGuid);
+      if (EFI_ERROR (Status)) {
+        DEBUG ((DEBUG_ERROR, "SetLargeVariable: Error locking variable: Status = %r\n", Status));
+        goto Done;
+      }
+
       for (Index = 0; Index < VariablesSaved; Index++) {
         ZeroMem (TempVariableName, MAX_VARIABLE_NAME_SIZE);
         UnicodeSPrint (TempVariableName, MAX_VARIABLE_NAME_SIZE, L"%s%d", VariableName, Index);
@@ -430,6 +532,7 @@ SetLargeVariable (
 Done:
   if (EFI_ERROR (Status) && VariablesSaved > 0) {
     DEBUG ((DEBUG_ERROR, "SetLargeVariable: An error was encountered, deleting variables with partially stored data\n"));
+    DeleteLargeVariableIndex (VariableName, VendorGuid);
     for (Index = 0; Index < VariablesSaved; Index++) {
       ZeroMem (TempVariableName, MAX_VARIABLE_NAME_SIZE);
       UnicodeSPrint (TempVariableName, MAX_VARIABLE_NAME_SIZE, L"%s%d", VariableName, Index);
@@ -32,6 +32,7 @@
 #include <Protocol/SaPolicy.h>
 #include <Protocol/DxeTbtPolicy.h>
 #include <Library/PchPmcLib.h>
+#include <Library/TimerLib.h>
 #define P2P_BRIDGE                    (((PCI_CLASS_BRIDGE) << 8) | (PCI_CLASS_BRIDGE_P2P))
 
 #define CMD_BM_MEM_IO                 (CMD_BUS_MASTER | BIT1 | BIT0)
@@ -48,6 +49,42 @@
 #define LTR_MAX_SNOOP_LATENCY_VALUE             0x0846    ///< Intel recommended maximum value for Snoop Latency  can we put like this ?
 #define LTR_MAX_NON_SNOOP_LATENCY_VALUE         0x0846    ///< Intel recommended maximum value for Non-Snoop Latency can we put like this ?
 
+#define TBT_MAX_CACHED_FUNCTIONS      128
+
+//
+// TBT_PCI_FUNCTION caches a PCI function below the TBT root port and the
+// capability offsets used by the power management passes, so every pass does
+// not need to scan the whole bus range and walk the capability lists again.
+//
+typedef struct {
+  UINT8   Bus;
+  UINT8   Dev;
+  UINT8   Fun;
+  UINT8   HeaderType;
+  UINT8   ClassCode[3];
+  UINT8   SecBus;                 ///< Secondary bus of a P2P bridge, 0 for other functions
+  UINT8   PcieCapOffset;          ///< PCI Express capability, 0 if not present
+  UINT16  DevicePortType;
+  UINT32  LinkCap;
+  UINT32  DevCap2;
+  UINT16  LtrCapOffset;           ///< LTR extended capability, 0 if not present
+  UINT16  PtmCapOffset;           ///< PTM extended capability, 0 if not present
+} TBT_PCI_FUNCTION;
+
+//
+// TBT_TOPOLOGY is built once per SMI by TbtBuildTopology, before the
+// power management passes run. Hot-plug changes the topology between SMIs,
+// so the cache is not kept across SMIs.
+//
+typedef struct {
+  TBT_PCI_FUNCTION  RootPort;
+  UINTN             Count;
+  TBT_PCI_FUNCTION  Function[TBT_MAX_CACHED_FUNCTIONS];
+} TBT_TOPOLOGY;
+
+#define TBT_FUNCTION_BDF(Function)      (((UINT16) (Function)->Bus << 8) | ((Function)->Dev << 3) | (Function)->Fun)
+#define TBT_FUNCTION_ADDRESS(Function)  PCI_SEGMENT_LIB_ADDRESS (TbtSegment, (Function)->Bus, (Function)->Dev, (Function)->Fun, 0)
+
 
 GLOBAL_REMOVE_IF_UNREFERENCED TBT_NVS_AREA                *mTbtNvsAreaPtr;
 GLOBAL_REMOVE_IF_UNREFERENCED UINT8                       gCurrentDiscreteTbtRootPort;
@@ -58,6 +95,7 @@ GLOBAL_REMOVE_IF_UNREFERENCED UINT8                       gDTbtPcieRstSupport;
 GLOBAL_REMOVE_IF_UNREFERENCED TBT_INFO_HOB                *gTbtInfoHob = NULL;
 STATIC UINTN                                              mPciExpressBaseAddress;
 STATIC UINT8                TbtSegment        = 0;
+STATIC TBT_TOPOLOGY         mTbtTopology;
 VOID
 GpioWrite (
   IN  UINT32         GpioNumber,
@@ -365,52 +403,234 @@ RootportL1sSupport (
   }
 }
 
+/**
+  Read the configuration of a PCI function which is used by the TBT power
+  management passes. Only registers which do not change while the function
+  is present are cached, control registers are always accessed directly.
+
+  @param[in]  Bus                 Pci Bus Number
+  @param[in]  Dev                 Pci Device Number
+  @param[in]  Fun                 Pci Function Number
+  @param[out] Function            Cached function data
+**/
+STATIC
+VOID
+TbtCacheFunction (
+  IN  UINT8             Bus,
+  IN  UINT8             Dev,
+  IN  UINT8             Fun,
+  OUT TBT_PCI_FUNCTION  *Function
+  )
+{
+  UINT64  DeviceBaseAddress;
+
+  DeviceBaseAddress = PCI_SEGMENT_LIB_ADDRESS (TbtSegment, Bus, Dev, Fun, 0);
+
+  ZeroMem (Function, sizeof (TBT_PCI_FUNCTION));
+  Function->Bus        = Bus;
+  Function->Dev        = Dev;
+  Function->Fun        = Fun;
+  Function->HeaderType = PciSegmentRead8 (DeviceBaseAddress + PCI_HEADER_TYPE_OFFSET);
+  PciSegmentReadBuffer (DeviceBaseAddress + PCI_CLASSCODE_OFFSET, sizeof (Function->ClassCode), Function->ClassCode);
+  if ((Function->HeaderType & HEADER_LAYOUT_CODE) == HEADER_TYPE_PCI_TO_PCI_BRIDGE) {
+    Function->SecBus = PciSegmentRead8 (DeviceBaseAddress + PCI_BRIDGE_SECONDARY_BUS_REGISTER_OFFSET);
+  }
+
+  Function->PcieCapOffset = PcieFindCapId (TbtSegment, Bus, Dev, Fun, 0x10);
+  if (Function->PcieCapOffset == 0) {
+    return;
+  }
+  Function->DevicePortType = (PciSegmentRead16 (DeviceBaseAddress + Function->PcieCapOffset + 0x002) >> 4) & 0xF;
+  Function->LinkCap        = PciSegmentRead32 (DeviceBaseAddress + Function->PcieCapOffset + 0x00C);
+  Function->DevCap2        = PciSegmentRead32 (DeviceBaseAddress + Function->PcieCapOffset + 0x024);
+  Function->LtrCapOffset   = PcieFindExtendedCapId (Bus, Dev, Fun, 0x0018);
+  Function->PtmCapOffset   = PcieFindExtendedCapId (Bus, Dev, Fun, 0x001F /*V_PCIE_EX_PTM_CID*/);
+}
+
+/**
+  Walk the bridge tree below a TBT root port and cache every present function
+  together with its capability offsets. Only the secondary bus of the root port
+  and the secondary buses of bridges found during the walk are scanned, unused
+  bus numbers of the root port bus range are not accessed.
+  The cache is sorted by Bus/Device/Function so the passes below visit the
+  functions in the same order as a scan of the whole bus range would.
+
+  @param[in] RpSegment            Root port Segment Number
+  @param[in] RpBus                Root port Bus Number
+  @param[in] RpDevice             Root port Device Number
+  @param[in] RpFunction           Root port Function Number
+
+  @retval TRUE                    Topology cache is built
+  @retval FALSE                   No TBT host router below the root port
+**/
+STATIC
+BOOLEAN
+TbtBuildTopology (
+  IN   UINTN      RpSegment,
+  IN   UINTN      RpBus,
+  IN   UINTN      RpDevice,
+  IN   UINTN      RpFunction
+  )
+{
+  UINT8             BusQueue[PCI_MAX_BUS + 1];
+  UINT32            BusFound[(PCI_MAX_BUS + 1) / 32];
+  UINTN             Head;
+  UINTN             Tail;
+  UINT8             Bus;
+  UINT8             Dev;
+  UINT8             Fun;
+  UINT8             MinBus;
+  UINT8             MaxBus;
+  UINT16            DeviceId;
+  UINT64            DeviceBaseAddress;
+  TBT_PCI_FUNCTION  *Function;
+  TBT_PCI_FUNCTION  Entry;
+  UINTN             Index;
+  UINTN             Index2;
+
+  mTbtTopology.Count = 0;
+
+  MinBus    = PciSegmentRead8 (PCI_SEGMENT_LIB_ADDRESS (RpSegment, RpBus, RpDevice, RpFunction, PCI_BRIDGE_SECONDARY_BUS_REGISTER_OFFSET));
+  MaxBus    = PciSegmentRead8 (PCI_SEGMENT_LIB_ADDRESS (RpSegment, RpBus, RpDevice, RpFunction, PCI_BRIDGE_SUBORDINATE_BUS_REGISTER_OFFSET));
+  DeviceId  = PciSegmentRead16 (PCI_SEGMENT_LIB_ADDRESS (RpSegment, MinBus, 0x00, 0x00, PCI_DEVICE_ID_OFFSET));
+  if (!(IsTbtHostRouter (DeviceId))) {
+    return FALSE;
+  }
+
+  TbtSegment = (UINT8)RpSegment;
+
+  TbtCacheFunction ((UINT8) RpBus, (UINT8) RpDevice, (UINT8) RpFunction, &mTbtTopology.RootPort);
+
+  ZeroMem (BusFound, sizeof (BusFound));
+  Head = 0;
+  Tail = 0;
+  BusQueue[Tail++] = MinBus;
+  BusFound[MinBus / 32] |= (UINT32) 1 << (MinBus % 32);
+
+  while (Head < Tail) {
+    Bus = BusQueue[Head++];
+    for (Dev = 0; Dev <= PCI_MAX_DEVICE; ++Dev) {
+      for (Fun = 0; Fun <= PCI_MAX_FUNC; ++Fun) {
+        //
+        // Check for Device availability
+        //
+        DeviceBaseAddress = PCI_SEGMENT_LIB_ADDRESS (TbtSegment, Bus, Dev, Fun, 0);
+        if (PciSegmentRead16 (DeviceBaseAddress + PCI_DEVICE_ID_OFFSET) == 0xFFFF) {
+          if (Fun == 0) {
+            //
+            // IF Fun is zero, stop enumerating other functions of the particular device
+            //
+            break;
+          }
+          continue;
+        }
+
+        if (mTbtTopology.Count >= TBT_MAX_CACHED_FUNCTIONS) {
+          DEBUG ((DEBUG_ERROR, "TbtBuildTopology: cache full, %02x:%02x.%x is not configured\n", Bus, Dev, Fun));
+          continue;
+        }
+
+        Function = &mTbtTopology.Function[mTbtTopology.Count++];
+        TbtCacheFunction (Bus, Dev, Fun, Function);
+
+        //
+        // Queue the secondary bus of a bridge which is within the root port bus range
+        //
+        if ((Function->SecBus > Bus) && (Function->SecBus <= MaxBus) &&
+            ((BusFound[Function->SecBus / 32] & ((UINT32) 1 << (Function->SecBus % 32))) == 0)) {
+          BusFound[Function->SecBus / 32] |= (UINT32) 1 << (Function->SecBus % 32);
+          BusQueue[Tail++] = Function->SecBus;
+        }
+
+        if ((Fun == 0) && ((Function->HeaderType & HEADER_TYPE_MULTI_FUNCTION) == 0)) {
+          //
+          // Not a multi-function device
+          //
+          break;
+        }
+      } //Fun
+    } //Dev
+  } //Bus
+
+  //
+  // Sort the cache by Bus/Device/Function
+  //
+  for (Index = 1; Index < mTbtTopology.Count; Index++) {
+    CopyMem (&Entry, &mTbtTopology.Function[Index], sizeof (Entry));
+    for (Index2 = Index; Index2 > 0; Index2--) {
+      if (TBT_FUNCTION_BDF (&mTbtTopology.Function[Index2 - 1]) <= TBT_FUNCTION_BDF (&Entry)) {
+        break;
+      }
+      CopyMem (&mTbtTopology.Function[Index2], &mTbtTopology.Function[Index2 - 1], sizeof (Entry));
+    }
+    CopyMem (&mTbtTopology.Function[Index2], &Entry, sizeof (Entry));
+  }
+
+  return TRUE;
+}
+
+/**
+  Find a function in the TBT topology cache.
+
+  @param[in] Bus                  Pci Bus Number
+  @param[in] Dev                  Pci Device Number
+  @param[in] Fun                  Pci Function Number
+
+  @retval NULL                    Function is not present
+  @retval Other                   Cached function data
+**/
+STATIC
+TBT_PCI_FUNCTION *
+TbtFindFunction (
+  IN UINT8   Bus,
+  IN UINT8   Dev,
+  IN UINT8   Fun
+  )
+{
+  UINTN  Index;
+
+  for (Index = 0; Index < mTbtTopology.Count; Index++) {
+    if ((mTbtTopology.Function[Index].Bus == Bus) &&
+        (mTbtTopology.Function[Index].Dev == Dev) &&
+        (mTbtTopology.Function[Index].Fun == Fun)) {
+      return &mTbtTopology.Function[Index];
+    }
+  }
+
+  return NULL;
+}
+
 VOID
 MultiFunctionDeviceAspm (
   IN UINT8   Bus,
   IN UINT8   Dev
   )
 {
-  UINT16  LowerAspm;
-  UINT16  AspmVal;
-  UINT8   Fun;
-  UINT64  DeviceBaseAddress;
-  UINT8   CapHeaderOffset;
+  UINT16            LowerAspm;
+  UINT16            AspmVal;
+  UINTN             Index;
+  TBT_PCI_FUNCTION  *Function;
 
   LowerAspm = 3; // L0s and L1 Supported
-  for (Fun = 0; Fun <= PCI_MAX_FUNC; ++Fun) {
-    //
-    // Check for Device availability
-    //
-    DeviceBaseAddress = PCI_SEGMENT_LIB_ADDRESS (TbtSegment, Bus, Dev, Fun, 0);
-    if (PciSegmentRead16 (DeviceBaseAddress + PCI_DEVICE_ID_OFFSET) == 0xFFFF) {
-      // Device not present
+  for (Index = 0; Index < mTbtTopology.Count; Index++) {
+    Function = &mTbtTopology.Function[Index];
+    if ((Function->Bus != Bus) || (Function->Dev != Dev) || (Function->PcieCapOffset == 0)) {
       continue;
     }
 
-    CapHeaderOffset = PcieFindCapId (TbtSegment, Bus, Dev, Fun, 0x10);
-
-    AspmVal = (PciSegmentRead16 (DeviceBaseAddress + CapHeaderOffset + 0x00C) >> 10) & 3;
+    AspmVal = (Function->LinkCap >> 10) & 3;
     if (LowerAspm > AspmVal) {
       LowerAspm = AspmVal;
     }
   } //Fun
 
-  for (Fun = 0; Fun <= PCI_MAX_FUNC; ++Fun) {
-    //
-    // Check for Device availability
-    //
-    DeviceBaseAddress = PCI_SEGMENT_LIB_ADDRESS (TbtSegment, Bus, Dev, Fun, 0);
-    if (PciSegmentRead16 (DeviceBaseAddress + PCI_DEVICE_ID_OFFSET) == 0xFFFF) {
-      //
-      // Device not present
-      //
+  for (Index = 0; Index < mTbtTopology.Count; Index++) {
+    Function = &mTbtTopology.Function[Index];
+    if ((Function->Bus != Bus) || (Function->Dev != Dev) || (Function->PcieCapOffset == 0)) {
       continue;
     }
 
-    CapHeaderOffset = PcieFindCapId (TbtSegment, Bus, Dev, Fun, 0x10);
-
-    PciSegmentAndThenOr16 (DeviceBaseAddress + CapHeaderOffset + 0x10, 0xFFFC, LowerAspm);
+    PciSegmentAndThenOr16 (TBT_FUNCTION_ADDRESS (Function) + Function->PcieCapOffset + 0x10, 0xFFFC, LowerAspm);
   } //Fun
 }
 
@@ -440,360 +660,232 @@ FindOptimalAspm (
 
 UINT16
 FindComponentBaspm (
-  IN UINT8   Bus,
-  IN UINT8   MaxBus
+  IN UINT8   Bus
   )
 {
-  UINT8   BusNo;
-  UINT8   DevNo;
-  UINT8   FunNo;
-  UINT64  DevBaseAddress;
-  UINT8   RegVal;
-  UINT8   SecBusNo;
-  UINT16  SelectedAspm; // No ASPM Support
-  UINT8   CapHeaderOffset_B;
-  BOOLEAN AspmFound;
-
-  SelectedAspm  = 0;
-  AspmFound     = FALSE;
-
-  for (BusNo = MaxBus; (BusNo != 0xFF) && (!AspmFound); --BusNo) {
-    for (DevNo = 0; (DevNo <= PCI_MAX_DEVICE) && (!AspmFound); ++DevNo) {
-      for (FunNo = 0; (FunNo <= PCI_MAX_FUNC) && (!AspmFound); ++FunNo) {
-        //
-        // Check for Device availability
-        //
-        DevBaseAddress = PCI_SEGMENT_LIB_ADDRESS (TbtSegment, BusNo, DevNo, FunNo, 0);
-        if (PciSegmentRead16 (DevBaseAddress + PCI_DEVICE_ID_OFFSET) == 0xFFFF) {
-          //
-          // Device not present
-          //
-          continue;
-        }
+  UINTN             Index;
+  TBT_PCI_FUNCTION  *Function;
 
-        RegVal = PciSegmentRead8 (DevBaseAddress + PCI_HEADER_TYPE_OFFSET);
-        if ((RegVal & (BIT0 + BIT1 + BIT2 + BIT3 + BIT4 + BIT5 + BIT6)) != 0x01) {
-          //
-          // Not a PCI-to-PCI bridges device
-          //
-          continue;
-        }
-
-        SecBusNo = PciSegmentRead8 (DevBaseAddress + PCI_BRIDGE_SECONDARY_BUS_REGISTER_OFFSET);
+  //
+  // Look for the bridge whose secondary bus is the given 'Bus', starting from
+  // the highest bus. The root port is the bridge of the first TBT bus.
+  //
+  for (Index = mTbtTopology.Count; Index > 0; Index--) {
+    Function = &mTbtTopology.Function[Index - 1];
+    if (((Function->HeaderType & HEADER_LAYOUT_CODE) == HEADER_TYPE_PCI_TO_PCI_BRIDGE) &&
+        (Function->SecBus == Bus)) {
+      return (Function->LinkCap >> 10) & 3;
+    }
+  }
 
-        if (SecBusNo == Bus) {
-          //
-          // This is the Rootbridge for the given 'Bus' device
-          //
-          CapHeaderOffset_B = PcieFindCapId (TbtSegment, BusNo, DevNo, FunNo, 0x10);
-          SelectedAspm      = (PciSegmentRead16 (DevBaseAddress + CapHeaderOffset_B + 0x00C) >> 10) & 3;
-          AspmFound         = TRUE;
-        }
-      } //FunNo
-    } //DevNo
-  } //BusNo
+  if (mTbtTopology.RootPort.SecBus == Bus) {
+    return (mTbtTopology.RootPort.LinkCap >> 10) & 3;
+  }
 
-  return (SelectedAspm);
+  return 0; // No ASPM Support
 }
 
 VOID
 NoAspmSupport (
-  IN UINT8   Bus,
-  IN UINT8   Dev,
-  IN UINT8   Fun,
-  IN UINT8   CapHeaderOffset
+  IN TBT_PCI_FUNCTION  *Function
   )
 {
-  UINT64 DeviceBaseAddress;
-
-  DeviceBaseAddress = PCI_SEGMENT_LIB_ADDRESS (TbtSegment, Bus, Dev, Fun, 0);
-  PciSegmentAndThenOr16 (DeviceBaseAddress + CapHeaderOffset + 0x10, 0xFFFC, 0x00);
+  PciSegmentAndThenOr16 (TBT_FUNCTION_ADDRESS (Function) + Function->PcieCapOffset + 0x10, 0xFFFC, 0x00);
 }
 
 VOID
 EndpointAspmSupport (
-  IN UINT8   Bus,
-  IN UINT8   Dev,
-  IN UINT8   Fun,
-  IN UINT8   CapHeaderOffset,
-  IN UINT8   MaxBus,
-  IN UINT16  MaxAspmLevel
+  IN TBT_PCI_FUNCTION  *Function,
+  IN UINT16            MaxAspmLevel
   )
 {
-  UINT64  DeviceBaseAddress;
   UINT16  ComponentAaspm;
   UINT16  ComponentBaspm;
   UINT16  SelectedAspm;
 
-  DeviceBaseAddress = PCI_SEGMENT_LIB_ADDRESS (TbtSegment, Bus, Dev, Fun, 0);
-  ComponentAaspm    = (PciSegmentRead16 (DeviceBaseAddress + CapHeaderOffset + 0x00C) >> 10) & 3;
-  ComponentBaspm    = FindComponentBaspm (Bus, MaxBus);
+  ComponentAaspm    = (Function->LinkCap >> 10) & 3;
+  ComponentBaspm    = FindComponentBaspm (Function->Bus);
   SelectedAspm      = FindOptimalAspm (ComponentAaspm, ComponentBaspm);
   SelectedAspm      = LimitAspmLevel (SelectedAspm, MaxAspmLevel);
-  PciSegmentAndThenOr16 (DeviceBaseAddress + CapHeaderOffset + 0x10, 0xFFFC, SelectedAspm);
+  PciSegmentAndThenOr16 (TBT_FUNCTION_ADDRESS (Function) + Function->PcieCapOffset + 0x10, 0xFFFC, SelectedAspm);
 }
 
 VOID
 UpstreamAspmSupport (
-  IN UINT8   Bus,
-  IN UINT8   Dev,
-  IN UINT8   Fun,
-  IN UINT8   CapHeaderOffset,
-  IN UINT8   MaxBus,
-  IN UINT16  MaxAspmLevel
+  IN TBT_PCI_FUNCTION  *Function,
+  IN UINT16            MaxAspmLevel
   )
 {
-  UINT64  DeviceBaseAddress;
   UINT16  ComponentAaspm;
   UINT16  ComponentBaspm;
   UINT16  SelectedAspm;
 
-  DeviceBaseAddress = PCI_SEGMENT_LIB_ADDRESS (TbtSegment, Bus, Dev, Fun, 0);
-  ComponentAaspm    = (PciSegmentRead16 (DeviceBaseAddress + CapHeaderOffset + 0x00C) >> 10) & 3;
-  ComponentBaspm    = FindComponentBaspm (Bus, MaxBus);
+  ComponentAaspm    = (Function->LinkCap >> 10) & 3;
+  ComponentBaspm    = FindComponentBaspm (Function->Bus);
   SelectedAspm      = FindOptimalAspm (ComponentAaspm, ComponentBaspm);
   SelectedAspm      = LimitAspmLevel (SelectedAspm, MaxAspmLevel);
-  PciSegmentAndThenOr16 (DeviceBaseAddress + CapHeaderOffset + 0x10, 0xFFFC, SelectedAspm);
+  PciSegmentAndThenOr16 (TBT_FUNCTION_ADDRESS (Function) + Function->PcieCapOffset + 0x10, 0xFFFC, SelectedAspm);
 }
 
 VOID
 DownstreamAspmSupport (
-  IN UINT8   Bus,
-  IN UINT8   Dev,
-  IN UINT8   Fun,
-  IN UINT8   CapHeaderOffset,
-  IN UINT16  MaxAspmLevel
+  IN TBT_PCI_FUNCTION  *Function,
+  IN UINT16            MaxAspmLevel
   )
 {
-  UINT64  ComponentABaseAddress;
-  UINT64  ComponentBBaseAddress;
-  UINT16  ComponentAaspm;
-  UINT16  ComponentBaspm;
-  UINT16  SelectedAspm;
-  UINT8   SecBus;
-  UINT8   CapHeaderOffset_B;
+  TBT_PCI_FUNCTION  *ComponentB;
+  UINT16            ComponentAaspm;
+  UINT16            ComponentBaspm;
+  UINT16            SelectedAspm;
 
-  ComponentABaseAddress = PCI_SEGMENT_LIB_ADDRESS (TbtSegment, Bus, Dev, Fun, 0);
-  ComponentAaspm        = (PciSegmentRead16 (ComponentABaseAddress + CapHeaderOffset + 0x00C) >> 10) & 3;
+  ComponentAaspm        = (Function->LinkCap >> 10) & 3;
 
-  SecBus                = PciSegmentRead8 (ComponentABaseAddress + PCI_BRIDGE_SECONDARY_BUS_REGISTER_OFFSET);
-  ComponentBBaseAddress = PCI_SEGMENT_LIB_ADDRESS (TbtSegment, SecBus, 0, 0, 0);
+  ComponentB            = TbtFindFunction (Function->SecBus, 0, 0);
   ComponentBaspm        = 0; // No ASPM Support
-  if (PciSegmentRead16 (ComponentBBaseAddress + PCI_DEVICE_ID_OFFSET) != 0xFFFF) {
-    CapHeaderOffset_B = PcieFindCapId (TbtSegment, SecBus, 0, 0, 0x10);
-    ComponentBaspm    = (PciSegmentRead16 (ComponentBBaseAddress + CapHeaderOffset_B + 0x00C) >> 10) & 3;
+  if (ComponentB != NULL) {
+    ComponentBaspm      = (ComponentB->LinkCap >> 10) & 3;
   }
 
   SelectedAspm = FindOptimalAspm (ComponentAaspm, ComponentBaspm);
   SelectedAspm = LimitAspmLevel (SelectedAspm, MaxAspmLevel);
-  PciSegmentAndThenOr16 (ComponentABaseAddress + CapHeaderOffset + 0x10, 0xFFFC, SelectedAspm);
+  PciSegmentAndThenOr16 (TBT_FUNCTION_ADDRESS (Function) + Function->PcieCapOffset + 0x10, 0xFFFC, SelectedAspm);
 }
 
 VOID
 RootportAspmSupport (
-  IN UINT8   Bus,
-  IN UINT8   Dev,
-  IN UINT8   Fun,
-  IN UINT8   CapHeaderOffset,
-  IN UINT16  MaxAspmLevel
+  IN TBT_PCI_FUNCTION  *Function,
+  IN UINT16            MaxAspmLevel
   )
 {
-  UINT64  ComponentABaseAddress;
-  UINT64  ComponentBBaseAddress;
-  UINT16  ComponentAaspm;
-  UINT16  ComponentBaspm;
-  UINT16  SelectedAspm;
-  UINT8   SecBus;
-  UINT8   CapHeaderOffset_B;
+  TBT_PCI_FUNCTION  *ComponentB;
+  UINT16            ComponentAaspm;
+  UINT16            ComponentBaspm;
+  UINT16            SelectedAspm;
 
-  ComponentABaseAddress = PCI_SEGMENT_LIB_ADDRESS (TbtSegment, Bus, Dev, Fun, 0);
-  ComponentAaspm        = (PciSegmentRead16 (ComponentABaseAddress + CapHeaderOffset + 0x00C) >> 10) & 3;
+  ComponentAaspm        = (Function->LinkCap >> 10) & 3;
 
-  SecBus                = PciSegmentRead8 (ComponentABaseAddress + PCI_BRIDGE_SECONDARY_BUS_REGISTER_OFFSET);
-  ComponentBBaseAddress = PCI_SEGMENT_LIB_ADDRESS (TbtSegment, SecBus, 0, 0, 0);
+  ComponentB            = TbtFindFunction (Function->SecBus, 0, 0);
   ComponentBaspm        = 0; // No ASPM Support
-  if (PciSegmentRead16 (ComponentBBaseAddress + PCI_DEVICE_ID_OFFSET) != 0xFFFF) {
-    CapHeaderOffset_B = PcieFindCapId (TbtSegment, SecBus, 0, 0, 0x10);
-    ComponentBaspm    = (PciSegmentRead16 (ComponentBBaseAddress + CapHeaderOffset_B + 0x00C) >> 10) & 3;
+  if (ComponentB != NULL) {
+    ComponentBaspm      = (ComponentB->LinkCap >> 10) & 3;
   }
 
   SelectedAspm = FindOptimalAspm (ComponentAaspm, ComponentBaspm);
   SelectedAspm = LimitAspmLevel (SelectedAspm, MaxAspmLevel);
-  PciSegmentAndThenOr16 (ComponentABaseAddress + CapHeaderOffset + 0x10, 0xFFFC, SelectedAspm);
+  PciSegmentAndThenOr16 (TBT_FUNCTION_ADDRESS (Function) + Function->PcieCapOffset + 0x10, 0xFFFC, SelectedAspm);
 }
 
+/**
+  Enable ASPM on all functions of the cached TBT topology and on its root port.
+
+  @param[in] MaxAspmLevel         Maximum ASPM level to enable
+**/
 VOID
 ThunderboltEnableAspmWithoutLtr (
-  IN   UINT16     MaxAspmLevel,
-  IN   UINTN      RpSegment,
-  IN   UINTN      RpBus,
-  IN   UINTN      RpDevice,
-  IN   UINTN      RpFunction
+  IN   UINT16     MaxAspmLevel
   )
 {
-  UINT8   Bus;
-  UINT8   Dev;
-  UINT8   Fun;
-  UINT8   RootBus;
-  UINT8   RootDev;
-  UINT8   RootFun;
-  UINT8   MinBus;
-  UINT8   MaxBus;
-  UINT16  DeviceId;
-  UINT64  DeviceBaseAddress;
-  UINT8   RegVal;
-  UINT8   CapHeaderOffset;
-  UINT16  DevicePortType;
-
-  MinBus  = 0;
-  MaxBus  = 0;
-
-  MinBus    = PciSegmentRead8 (PCI_SEGMENT_LIB_ADDRESS (RpSegment, RpBus, RpDevice, RpFunction, PCI_BRIDGE_SECONDARY_BUS_REGISTER_OFFSET));
-  MaxBus    = PciSegmentRead8 (PCI_SEGMENT_LIB_ADDRESS (RpSegment, RpBus, RpDevice, RpFunction, PCI_BRIDGE_SUBORDINATE_BUS_REGISTER_OFFSET));
-  DeviceId  = PciSegmentRead16 (PCI_SEGMENT_LIB_ADDRESS (RpSegment, MinBus, 0x00, 0x00, PCI_DEVICE_ID_OFFSET));
-  if (!(IsTbtHostRouter (DeviceId))) {
-    return;
-  }
-
-  TbtSegment = (UINT8)RpSegment;
-
-  RootBus = (UINT8)RpBus;
-  RootDev = (UINT8)RpDevice;
-  RootFun = (UINT8)RpFunction;
+  UINTN             Index;
+  TBT_PCI_FUNCTION  *Function;
 
   //
-  //  Enumerate all the bridges and devices which are available on TBT host controller
+  //  Align ASPM of all functions of multi-function devices on TBT host controller
   //
-  for (Bus = MinBus; Bus <= MaxBus; ++Bus) {
-    for (Dev = 0; Dev <= PCI_MAX_DEVICE; ++Dev) {
+  for (Index = 0; Index < mTbtTopology.Count; Index++) {
+    Function = &mTbtTopology.Function[Index];
+    if ((Function->Fun != 0) || ((Function->HeaderType & HEADER_TYPE_MULTI_FUNCTION) == 0)) {
       //
-      // Check for Device availability
+      // Not a multi-function device
       //
-      DeviceBaseAddress = PCI_SEGMENT_LIB_ADDRESS (TbtSegment, Bus, Dev, 0, 0);
-      if (PciSegmentRead16 (DeviceBaseAddress + PCI_DEVICE_ID_OFFSET) == 0xFFFF) {
-        //
-        // Device not present
-        //
-        continue;
-      }
-
-      RegVal = PciSegmentRead8 (DeviceBaseAddress + PCI_HEADER_TYPE_OFFSET);
-      if ((RegVal & BIT7) == 0) {
-        //
-        // Not a multi-function device
-        //
-        continue;
-      }
-
-      MultiFunctionDeviceAspm(Bus, Dev);
-    } //Dev
-  } //Bus
-
+      continue;
+    }
 
-  for (Bus = MinBus; Bus <= MaxBus; ++Bus) {
-    for (Dev = 0; Dev <= PCI_MAX_DEVICE; ++Dev) {
-      for (Fun = 0; Fun <= PCI_MAX_FUNC; ++Fun) {
-        //
-        // Check for Device availability
-        //
-        DeviceBaseAddress = PCI_SEGMENT_LIB_ADDRESS (TbtSegment, Bus, Dev, Fun, 0);
-        if (PciSegmentRead16 (DeviceBaseAddress + PCI_DEVICE_ID_OFFSET) == 0xFFFF) {
-          //
-          // Device not present
-          //
-          continue;
-        }
+    MultiFunctionDeviceAspm (Function->Bus, Function->Dev);
+  }
 
-        CapHeaderOffset = PcieFindCapId (TbtSegment, Bus, Dev, Fun, 0x10);
-        DevicePortType  = (PciSegmentRead16 (DeviceBaseAddress + CapHeaderOffset + 0x002) >> 4) & 0xF;
-        if(PciSegmentRead8 (DeviceBaseAddress + PCI_CLASSCODE_OFFSET) == PCI_CLASS_SERIAL) {
-          MaxAspmLevel = (UINT16) 0x1;
-        }
+  for (Index = 0; Index < mTbtTopology.Count; Index++) {
+    Function = &mTbtTopology.Function[Index];
+    if (Function->PcieCapOffset == 0) {
+      continue;
+    }
 
-        switch (DevicePortType) {
-        case 0:
-          //
-          // PCI Express Endpoint
-          //
-          EndpointAspmSupport (Bus, Dev, Fun, CapHeaderOffset, MaxBus, MaxAspmLevel);
-          break;
+    if (Function->ClassCode[0] == PCI_CLASS_SERIAL) {
+      MaxAspmLevel = (UINT16) 0x1;
+    }
 
-        case 1:
-          //
-          // Legacy PCI Express Endpoint
-          //
-          EndpointAspmSupport (Bus, Dev, Fun, CapHeaderOffset, MaxBus, MaxAspmLevel);
-          break;
+    switch (Function->DevicePortType) {
+    case 0:
+      //
+      // PCI Express Endpoint
+      //
+      EndpointAspmSupport (Function, MaxAspmLevel);
+      break;
 
-        case 4:
-          //
-          // Root Port of PCI Express Root Complex
-          //
-          RootportAspmSupport (Bus, Dev, Fun, CapHeaderOffset, MaxAspmLevel);
-          break;
+    case 1:
+      //
+      // Legacy PCI Express Endpoint
+      //
+      EndpointAspmSupport (Function, MaxAspmLevel);
+      break;
 
-        case 5:
-          //
-          // Upstream Port of PCI Express Switch
-          //
-          UpstreamAspmSupport (Bus, Dev, Fun, CapHeaderOffset, MaxBus, MaxAspmLevel);
-          break;
+    case 4:
+      //
+      // Root Port of PCI Express Root Complex
+      //
+      RootportAspmSupport (Function, MaxAspmLevel);
+      break;
 
-        case 6:
-          //
-          // Downstream Port of PCI Express Switch
-          //
-          DownstreamAspmSupport (Bus, Dev, Fun, CapHeaderOffset, MaxAspmLevel);
-          break;
+    case 5:
+      //
+      // Upstream Port of PCI Express Switch
+      //
+      UpstreamAspmSupport (Function, MaxAspmLevel);
+      break;
 
-        case 7:
-          //
-          // PCI Express to PCI/PCI-X Bridge
-          //
-          NoAspmSupport (Bus, Dev, Fun, CapHeaderOffset);
-          break;
+    case 6:
+      //
+      // Downstream Port of PCI Express Switch
+      //
+      DownstreamAspmSupport (Function, MaxAspmLevel);
+      break;
 
-        case 8:
-          //
-          // PCI/PCI-X to PCI Express Bridge
-          //
-          NoAspmSupport (Bus, Dev, Fun, CapHeaderOffset);
-          break;
+    case 7:
+      //
+      // PCI Express to PCI/PCI-X Bridge
+      //
+      NoAspmSupport (Function);
+      break;
 
-        case 9:
-          //
-          // Root Complex Integrated Endpoint
-          //
-          EndpointAspmSupport (Bus, Dev, Fun, CapHeaderOffset, MaxBus, MaxAspmLevel);
-          break;
+    case 8:
+      //
+      // PCI/PCI-X to PCI Express Bridge
+      //
+      NoAspmSupport (Function);
+      break;
 
-        case 10:
-          //
-          // Root Complex Event Collector
-          //
-          EndpointAspmSupport (Bus, Dev, Fun, CapHeaderOffset, MaxBus, MaxAspmLevel);
-          break;
+    case 9:
+      //
+      // Root Complex Integrated Endpoint
+      //
+      EndpointAspmSupport (Function, MaxAspmLevel);
+      break;
 
-        default:
-          break;
-        }
-        //
-        // switch(DevicePortType)
-        //
-      }
+    case 10:
       //
-      // Fun
+      // Root Complex Event Collector
       //
+      EndpointAspmSupport (Function, MaxAspmLevel);
+      break;
+
+    default:
+      break;
     }
     //
-    // Dev
+    // switch(DevicePortType)
     //
   }
-  //
-  // Bus
-  //
-  CapHeaderOffset = PcieFindCapId (TbtSegment, RootBus, RootDev, RootFun, 0x10);
-  RootportAspmSupport (RootBus, RootDev, RootFun, CapHeaderOffset, MaxAspmLevel);
+
+  RootportAspmSupport (&mTbtTopology.RootPort, MaxAspmLevel);
 }
 
 
@@ -815,88 +907,45 @@ ThunderboltEnableL1Sub (
   RootportL1sSupport ((UINT8) RpBus, (UINT8) RpDevice, (UINT8) RpFunction, CapHeaderOffsetExtd, MaxL1Level);
 }
 
+/**
+  Disable ASPM on all functions of the cached TBT topology and on its root port.
+**/
 VOID
 ThunderboltDisableAspmWithoutLtr (
-  IN   UINTN      RpSegment,
-  IN   UINTN      RpBus,
-  IN   UINTN      RpDevice,
-  IN   UINTN      RpFunction
+  VOID
   )
 {
-  UINT8   Bus;
-  UINT8   Dev;
-  UINT8   Fun;
-  UINT8   RootBus;
-  UINT8   RootDev;
-  UINT8   RootFun;
-  UINT8   MinBus;
-  UINT8   MaxBus;
-  UINT16  DeviceId;
-  UINT64  DeviceBaseAddress;
-  UINT8   CapHeaderOffset;
+  UINTN             Index;
+  TBT_PCI_FUNCTION  *Function;
 
-  MinBus  = 0;
-  MaxBus  = 0;
+  for (Index = 0; Index < mTbtTopology.Count; Index++) {
+    Function = &mTbtTopology.Function[Index];
+    if (Function->PcieCapOffset == 0) {
+      continue;
+    }
 
-  MinBus    = PciSegmentRead8 (PCI_SEGMENT_LIB_ADDRESS (RpSegment, RpBus, RpDevice, RpFunction, PCI_BRIDGE_SECONDARY_BUS_REGISTER_OFFSET));
-  MaxBus    = PciSegmentRead8 (PCI_SEGMENT_LIB_ADDRESS (RpSegment, RpBus, RpDevice, RpFunction, PCI_BRIDGE_SUBORDINATE_BUS_REGISTER_OFFSET));
-  DeviceId  = PciSegmentRead16 (PCI_SEGMENT_LIB_ADDRESS (RpSegment, MinBus, 0x00, 0x00, PCI_DEVICE_ID_OFFSET));
-  if (!(IsTbtHostRouter (DeviceId))) {
-    return;
+    NoAspmSupport (Function);
   }
 
-  TbtSegment = (UINT8)RpSegment;
-  RootBus = (UINT8)RpBus;
-  RootDev = (UINT8)RpDevice;
-  RootFun = (UINT8)RpFunction;
-
-  //
-  //  Enumerate all the bridges and devices which are available on TBT host controller
-  //
-  for (Bus = MinBus; Bus <= MaxBus; ++Bus) {
-    for (Dev = 0; Dev <= PCI_MAX_DEVICE; ++Dev) {
-      for (Fun = 0; Fun <= PCI_MAX_FUNC; ++Fun) {
-        //
-        // Check for Device availability
-        //
-        DeviceBaseAddress = PCI_SEGMENT_LIB_ADDRESS (TbtSegment, Bus, Dev, Fun, 0);
-        if (PciSegmentRead16 (DeviceBaseAddress + PCI_DEVICE_ID_OFFSET) == 0xFFFF) {
-          //
-          // Device not present
-          //
-          continue;
-        }
-
-        CapHeaderOffset = PcieFindCapId (TbtSegment, Bus, Dev, Fun, 0x10);
-        PciSegmentAndThenOr16 (DeviceBaseAddress + CapHeaderOffset + 0x10, 0xFFFC, 0x00);
-      } //Fun
-    } //Dev
-  } //Bus
-
-  CapHeaderOffset = PcieFindCapId (TbtSegment, RootBus, RootDev, RootFun, 0x10);
-  NoAspmSupport(RootBus, RootDev, RootFun, CapHeaderOffset);
+  NoAspmSupport (&mTbtTopology.RootPort);
 }
 
 VOID
 TbtProgramClkReq (
-  IN        UINT8  Bus,
-  IN        UINT8  Device,
-  IN        UINT8  Function,
-  IN        UINT8  ClkReqSetup
+  IN        TBT_PCI_FUNCTION  *Function,
+  IN        UINT8             ClkReqSetup
   )
 {
   UINT64  DeviceBaseAddress;
-  UINT8   CapHeaderOffset;
   UINT16  Data16;
 
-  DeviceBaseAddress = PCI_SEGMENT_LIB_ADDRESS (TbtSegment, Bus, Device, Function, 0);
-  CapHeaderOffset   = PcieFindCapId (TbtSegment, Bus, Device, Function, 0x10);
+  DeviceBaseAddress = TBT_FUNCTION_ADDRESS (Function);
 
   //
   // Check if CLKREQ# is supported
   //
-  if ((PciSegmentRead32 (DeviceBaseAddress + CapHeaderOffset + 0x0C) & BIT18) != 0) {
-    Data16 = PciSegmentRead16 (DeviceBaseAddress + CapHeaderOffset + 0x010);
+  if ((Function->PcieCapOffset != 0) && ((Function->LinkCap & BIT18) != 0)) {
+    Data16 = PciSegmentRead16 (DeviceBaseAddress + Function->PcieCapOffset + 0x010);
 
     if (ClkReqSetup) {
       Data16 = Data16 | BIT8; // Enable Clock Power Management
@@ -904,16 +953,14 @@ TbtProgramClkReq (
       Data16 =  Data16 & (UINT16)(~BIT8); // Disable Clock Power Management
     }
 
-    PciSegmentWrite16 (DeviceBaseAddress + CapHeaderOffset + 0x010, Data16);
+    PciSegmentWrite16 (DeviceBaseAddress + Function->PcieCapOffset + 0x010, Data16);
   }
 }
 VOID
 TbtProgramPtm(
-   IN        UINT8  Bus,
-   IN        UINT8  Device,
-   IN        UINT8  Function,
-   IN        UINT8  PtmSetup,
-   IN        BOOLEAN IsRoot
+   IN        TBT_PCI_FUNCTION  *Function,
+   IN        UINT8             PtmSetup,
+   IN        BOOLEAN           IsRoot
 )
 {
    UINT64  DeviceBaseAddress;
@@ -921,8 +968,8 @@ TbtProgramPtm(
    UINT16  PtmControlRegister;
    UINT16  PtmCapabilityRegister;
 
-   DeviceBaseAddress = PCI_SEGMENT_LIB_ADDRESS(TbtSegment, Bus, Device, Function, 0);
-   CapHeaderOffset = PcieFindExtendedCapId(Bus, Device, Function, 0x001F /*V_PCIE_EX_PTM_CID*/);
+   DeviceBaseAddress = TBT_FUNCTION_ADDRESS (Function);
+   CapHeaderOffset = Function->PtmCapOffset;
    if(CapHeaderOffset != 0) {
       PtmCapabilityRegister = PciSegmentRead16(DeviceBaseAddress + CapHeaderOffset + 0x04);
      //
@@ -946,73 +993,41 @@ TbtProgramPtm(
    }
 }
 
+/**
+  Program CLKREQ# or PTM on all functions of the cached TBT topology, starting
+  from the highest bus.
+
+  @param[in] Configuration        1 - Clk Request, 2 - PTM
+**/
 VOID
 ConfigureTbtPm (
-  IN   UINTN      RpSegment,
-  IN   UINTN      RpBus,
-  IN   UINTN      RpDevice,
-  IN   UINTN      RpFunction,
   IN   UINT8      Configuration    // 1- Clk Request , 2- PTM ,
   )
 {
-  UINT8   Bus;
-  UINT8   Dev;
-  UINT8   Fun;
-  UINT8   MinBus;
-  UINT8   MaxBus;
-  UINT16  DeviceId;
-  UINT64  DeviceBaseAddress;
-
-  MinBus  = 0;
-  MaxBus  = 0;
+  UINTN             Index;
+  TBT_PCI_FUNCTION  *Function;
 
   if ((Configuration != 1) && (Configuration != 2)) {
     return;
   }
-  MinBus    = PciSegmentRead8 (PCI_SEGMENT_LIB_ADDRESS (RpSegment, RpBus, RpDevice, RpFunction, PCI_BRIDGE_SECONDARY_BUS_REGISTER_OFFSET));
-  MaxBus    = PciSegmentRead8 (PCI_SEGMENT_LIB_ADDRESS (RpSegment, RpBus, RpDevice, RpFunction, PCI_BRIDGE_SUBORDINATE_BUS_REGISTER_OFFSET));
-  DeviceId  = PciSegmentRead16 (PCI_SEGMENT_LIB_ADDRESS (RpSegment, MinBus, 0x00, 0x00, PCI_DEVICE_ID_OFFSET));
-  if (!(IsTbtHostRouter (DeviceId))) {
-    return;
+
+  for (Index = mTbtTopology.Count; Index > 0; Index--) {
+    Function = &mTbtTopology.Function[Index - 1];
+    switch (Configuration) {
+      case 1:
+        TbtProgramClkReq (Function, (UINT8) mTbtNvsAreaPtr->TbtSetClkReq);
+        break;
+      case 2:
+        TbtProgramPtm (Function, (UINT8) mTbtNvsAreaPtr->TbtPtm, FALSE);
+        break;
+      default:
+        break;
+    }
   }
 
-  TbtSegment = (UINT8)RpSegment;
-  //
-  //  Enumerate all the bridges and devices which are available on TBT host controller
-  //
-  for (Bus = MaxBus; Bus >= MinBus; --Bus) {
-    for (Dev = 0; Dev <= PCI_MAX_DEVICE; ++Dev) {
-      for (Fun = 0; Fun <= PCI_MAX_FUNC; ++Fun) {
-        //
-        // Check for Device availability
-        //
-        DeviceBaseAddress = PCI_SEGMENT_LIB_ADDRESS (TbtSegment, Bus, Dev, Fun, 0);
-        if (PciSegmentRead16 (DeviceBaseAddress + PCI_DEVICE_ID_OFFSET) == 0xFFFF) {
-          if (Fun == 0) {
-            //
-            // IF Fun is zero, stop enumerating other functions of the particular bridge
-            //
-            break;
-          }
-          //
-          // otherwise, just skip checking for CLKREQ support
-          //
-          continue;
-        }
-        switch (Configuration) {
-          case 1:
-            TbtProgramClkReq (Bus, Dev, Fun, (UINT8) mTbtNvsAreaPtr->TbtSetClkReq);
-            break;
-          case 2:
-            TbtProgramPtm (Bus, Dev, Fun, (UINT8) mTbtNvsAreaPtr->TbtPtm, FALSE);
-            TbtProgramPtm((UINT8) RpBus, (UINT8) RpDevice, (UINT8) RpFunction, (UINT8) mTbtNvsAreaPtr->TbtPtm, TRUE);
-            break;
-          default:
-            break;
-        }
-      } //Fun
-    } // Dev
-  } // Bus
+  if (Configuration == 2) {
+    TbtProgramPtm (&mTbtTopology.RootPort, (UINT8) mTbtNvsAreaPtr->TbtPtm, TRUE);
+  }
 }
 
 /**
@@ -1022,24 +1037,20 @@ ConfigureTbtPm (
 **/
 VOID
 TbtProgramLtr (
-  IN        UINT8  Bus,
-  IN        UINT8  Device,
-  IN        UINT8  Function,
-  IN        UINT8  LtrSetup
+  IN        TBT_PCI_FUNCTION  *Function,
+  IN        UINT8             LtrSetup
   )
 {
   UINT64  DeviceBaseAddress;
-  UINT8   CapHeaderOffset;
   UINT16  Data16;
 
-  DeviceBaseAddress = PCI_SEGMENT_LIB_ADDRESS (TbtSegment, Bus, Device, Function, 0);
-  CapHeaderOffset   = PcieFindCapId (TbtSegment, Bus, Device, Function, 0x10);
+  DeviceBaseAddress = TBT_FUNCTION_ADDRESS (Function);
 
   //
   // Check if LTR# is supported
   //
-  if ((PciSegmentRead32 (DeviceBaseAddress + CapHeaderOffset + 0x24) & BIT11) != 0) {
-    Data16 = PciSegmentRead16 (DeviceBaseAddress + CapHeaderOffset + 0x028);
+  if ((Function->PcieCapOffset != 0) && ((Function->DevCap2 & BIT11) != 0)) {
+    Data16 = PciSegmentRead16 (DeviceBaseAddress + Function->PcieCapOffset + 0x028);
 
     if (LtrSetup) {
       Data16 = Data16 | BIT10; // LTR Mechanism Enable
@@ -1047,66 +1058,25 @@ TbtProgramLtr (
       Data16 =  Data16 & (UINT16)(~BIT10); // LTR Mechanism Disable
     }
 
-    PciSegmentWrite16 (DeviceBaseAddress + CapHeaderOffset + 0x028, Data16);
+    PciSegmentWrite16 (DeviceBaseAddress + Function->PcieCapOffset + 0x028, Data16);
   }
 }
 
+/**
+  Program LTR mechanism enable on all functions of the cached TBT topology
+  and on its root port.
+**/
 VOID
 ConfigureLtr (
-  IN   UINTN      RpSegment,
-  IN   UINTN      RpBus,
-  IN   UINTN      RpDevice,
-  IN   UINTN      RpFunction
+  VOID
   )
 {
-  UINT8   Bus;
-  UINT8   Dev;
-  UINT8   Fun;
-  UINT8   MinBus;
-  UINT8   MaxBus;
-  UINT16  DeviceId;
-  UINT64  DeviceBaseAddress;
-
-  MinBus  = 0;
-  MaxBus  = 0;
+  UINTN  Index;
 
-  MinBus    = PciSegmentRead8 (PCI_SEGMENT_LIB_ADDRESS (RpSegment, RpBus, RpDevice, RpFunction, PCI_BRIDGE_SECONDARY_BUS_REGISTER_OFFSET));
-  MaxBus    = PciSegmentRead8 (PCI_SEGMENT_LIB_ADDRESS (RpSegment, RpBus, RpDevice, RpFunction, PCI_BRIDGE_SUBORDINATE_BUS_REGISTER_OFFSET));
-  DeviceId  = PciSegmentRead16 (PCI_SEGMENT_LIB_ADDRESS (RpSegment, MinBus, 0x00, 0x00, PCI_DEVICE_ID_OFFSET));
-  if (!(IsTbtHostRouter (DeviceId))) {
-    return;
+  for (Index = 0; Index < mTbtTopology.Count; Index++) {
+    TbtProgramLtr (&mTbtTopology.Function[Index], (UINT8) mTbtNvsAreaPtr->TbtLtr);
   }
-
-  TbtSegment = (UINT8)RpSegment;
-  //
-  //  Enumerate all the bridges and devices which are available on TBT host controller
-  //
-  for (Bus = MinBus; Bus <= MaxBus; ++Bus) {
-    for (Dev = 0; Dev <= PCI_MAX_DEVICE; ++Dev) {
-      for (Fun = 0; Fun <= PCI_MAX_FUNC; ++Fun) {
-        //
-        // Check for Device availability
-        //
-        DeviceBaseAddress = PCI_SEGMENT_LIB_ADDRESS (TbtSegment, Bus, Dev, Fun, 0);
-        if (PciSegmentRead16 (DeviceBaseAddress + PCI_DEVICE_ID_OFFSET) == 0xFFFF) {
-          if (Fun == 0) {
-            //
-            // IF Fun is zero, stop enumerating other functions of the particular bridge
-            //
-            break;
-          }
-          //
-          // otherwise, just skip checking for LTR support
-          //
-          continue;
-        }
-
-        TbtProgramLtr (Bus, Dev, Fun, (UINT8) mTbtNvsAreaPtr->TbtLtr);
-
-      } //Fun
-    } // Dev
-  } // Bus
-  TbtProgramLtr ((UINT8) RpBus, (UINT8) RpDevice, (UINT8) RpFunction, (UINT8) mTbtNvsAreaPtr->TbtLtr);
+  TbtProgramLtr (&mTbtTopology.RootPort, (UINT8) mTbtNvsAreaPtr->TbtLtr);
 }
 
 /*
@@ -1143,155 +1113,87 @@ ThunderboltGetLatencyLtr (
 
 VOID
 SetLatencyLtr (
-  IN UINT8   Bus,
-  IN UINT8   Dev,
-  IN UINT8   Fun,
-  IN UINT16  CapHeaderOffsetExtd,
-  IN UINT16  LtrMaxSnoopLatency,
-  IN UINT16  LtrMaxNoSnoopLatency
+  IN TBT_PCI_FUNCTION  *Function,
+  IN UINT16            LtrMaxSnoopLatency,
+  IN UINT16            LtrMaxNoSnoopLatency
   )
 {
   UINT64 DeviceBaseAddress;
-  if(CapHeaderOffsetExtd == 0) {
+  if(Function->LtrCapOffset == 0) {
     return;
   }
-  DeviceBaseAddress = PCI_SEGMENT_LIB_ADDRESS (TbtSegment, Bus, Dev, Fun, 0);
-  PciSegmentWrite16 (DeviceBaseAddress + CapHeaderOffsetExtd + 0x004, LtrMaxSnoopLatency);
-  PciSegmentWrite16 (DeviceBaseAddress + CapHeaderOffsetExtd + 0x006, LtrMaxNoSnoopLatency);
+  DeviceBaseAddress = TBT_FUNCTION_ADDRESS (Function);
+  PciSegmentWrite16 (DeviceBaseAddress + Function->LtrCapOffset + 0x004, LtrMaxSnoopLatency);
+  PciSegmentWrite16 (DeviceBaseAddress + Function->LtrCapOffset + 0x006, LtrMaxNoSnoopLatency);
 }
 
+/**
+  Program LTR latency values on endpoints and switch upstream ports of the
+  cached TBT topology.
+**/
 VOID
 ThunderboltSetLatencyLtr (
-  IN   UINTN      RpSegment,
-  IN   UINTN      RpBus,
-  IN   UINTN      RpDevice,
-  IN   UINTN      RpFunction
+  VOID
   )
 {
-  UINT8   Bus;
-  UINT8   Dev;
-  UINT8   Fun;
-  UINT8   MinBus;
-  UINT8   MaxBus;
-  UINT16  DeviceId;
-  UINT64  DeviceBaseAddress;
-  UINT8   CapHeaderOffsetStd;
-  UINT16  CapHeaderOffsetExtd;
-  UINT16  DevicePortType;
-
-  MinBus  = 0;
-  MaxBus  = 0;
-
-  MinBus    = PciSegmentRead8 (PCI_SEGMENT_LIB_ADDRESS (RpSegment, RpBus, RpDevice, RpFunction, PCI_BRIDGE_SECONDARY_BUS_REGISTER_OFFSET));
-  MaxBus    = PciSegmentRead8 (PCI_SEGMENT_LIB_ADDRESS (RpSegment, RpBus, RpDevice, RpFunction, PCI_BRIDGE_SUBORDINATE_BUS_REGISTER_OFFSET));
-  DeviceId  = PciSegmentRead16 (PCI_SEGMENT_LIB_ADDRESS (RpSegment, MinBus, 0x00, 0x00, PCI_DEVICE_ID_OFFSET));
-  if (!(IsTbtHostRouter (DeviceId))) {
-    return;
-  }
-
-  TbtSegment = (UINT8)RpSegment;
-
-  for (Bus = MinBus; Bus <= MaxBus; ++Bus) {
-    for (Dev = 0; Dev <= PCI_MAX_DEVICE; ++Dev) {
-      for (Fun = 0; Fun <= PCI_MAX_FUNC; ++Fun) {
-        //
-        // Check for Device availability
-        //
-        DeviceBaseAddress = PCI_SEGMENT_LIB_ADDRESS (TbtSegment, Bus, Dev, Fun, 0);
-        if (PciSegmentRead16 (DeviceBaseAddress + PCI_DEVICE_ID_OFFSET) == 0xFFFF) {
-          //
-          // Device not present
-          //
-          continue;
-        }
-
-        CapHeaderOffsetStd = PcieFindCapId (TbtSegment, Bus, Dev, Fun, 0x10);
-        DevicePortType  = (PciSegmentRead16 (DeviceBaseAddress + CapHeaderOffsetStd + 0x002) >> 4) & 0xF;
-
-        CapHeaderOffsetExtd = PcieFindExtendedCapId (Bus, Dev, Fun, 0x0018);
-
-        switch (DevicePortType) {
-        case 0:
-          //
-          // PCI Express Endpoint
-          //
-          SetLatencyLtr (Bus, Dev, Fun, CapHeaderOffsetExtd, TbtLtrMaxSnoopLatency, TbtLtrMaxNoSnoopLatency);
-          break;
-
-        case 1:
-          //
-          // Legacy PCI Express Endpoint
-          //
-          SetLatencyLtr (Bus, Dev, Fun, CapHeaderOffsetExtd, TbtLtrMaxSnoopLatency, TbtLtrMaxNoSnoopLatency);
-          break;
-
-        case 4:
-          //
-          // Root Port of PCI Express Root Complex
-          //
-          // Do-nothing
-          break;
-
-        case 5:
-          //
-          // Upstream Port of PCI Express Switch
-          //
-          SetLatencyLtr (Bus, Dev, Fun, CapHeaderOffsetExtd, TbtLtrMaxSnoopLatency, TbtLtrMaxNoSnoopLatency);
-          break;
-
-        case 6:
-          //
-          // Downstream Port of PCI Express Switch
-          //
-          // Do-nothing
-          break;
+  UINTN             Index;
+  TBT_PCI_FUNCTION  *Function;
 
-        case 7:
-          //
-          // PCI Express to PCI/PCI-X Bridge
-          //
-          // Do-nothing
-          break;
+  for (Index = 0; Index < mTbtTopology.Count; Index++) {
+    Function = &mTbtTopology.Function[Index];
+    if (Function->PcieCapOffset == 0) {
+      continue;
+    }
 
-        case 8:
-          //
-          // PCI/PCI-X to PCI Express Bridge
-          //
-          // Do-nothing
-          break;
+    switch (Function->DevicePortType) {
+    case 0:
+      //
+      // PCI Express Endpoint
+      //
+      SetLatencyLtr (Function, TbtLtrMaxSnoopLatency, TbtLtrMaxNoSnoopLatency);
+      break;
 
-        case 9:
-          //
-          // Root Complex Integrated Endpoint
-          //
-          // Do-nothing
-          break;
+    case 1:
+      //
+      // Legacy PCI Express Endpoint
+      //
+      SetLatencyLtr (Function, TbtLtrMaxSnoopLatency, TbtLtrMaxNoSnoopLatency);
+      break;
 
-        case 10:
-          //
-          // Root Complex Event Collector
-          //
-          // Do-nothing
-          break;
+    case 5:
+      //
+      // Upstream Port of PCI Express Switch
+      //
+      SetLatencyLtr (Function, TbtLtrMaxSnoopLatency, TbtLtrMaxNoSnoopLatency);
+      break;
 
-        default:
-          break;
-        }
-        //
-        // switch(DevicePortType)
-        //
-      }
+    default:
       //
-      // Fun
+      // Root ports, downstream ports, bridges, root complex integrated
+      // endpoints and event collectors: do-nothing
       //
+      break;
     }
     //
-    // Dev
+    // switch(DevicePortType)
     //
   }
-  //
-  // Bus
-  //
+}
+
+/**
+  Return the time elapsed since StartTicks in microseconds.
+
+  @param[in] StartTicks           Performance counter value at the start
+
+  @return Elapsed time in microseconds
+**/
+STATIC
+UINT64
+TbtElapsedMicroSeconds (
+  IN UINT64  StartTicks
+  )
+{
+  return DivU64x32 (GetTimeInNanoSecond (GetPerformanceCounter () - StartTicks), 1000);
 }
 
 static
@@ -1713,22 +1615,36 @@ EndOfThunderboltCallback (
   IN   UINTN      RpFunction
   )
 {
+  UINT64  StartTicks;
+
+  StartTicks = GetPerformanceCounter ();
+
   if(mTbtNvsAreaPtr->TbtL1SubStates != 0) {
     ThunderboltEnableL1Sub (mTbtNvsAreaPtr->TbtL1SubStates, RpSegment, RpBus, RpDevice, RpFunction);
   }
-  ConfigureTbtPm(RpSegment, RpBus, RpDevice, RpFunction, 1);
+
+  //
+  // Walk the TBT topology once, all passes below run over the cached functions
+  //
+  if (!TbtBuildTopology (RpSegment, RpBus, RpDevice, RpFunction)) {
+    return;
+  }
+
+  ConfigureTbtPm(1);
   if (!mTbtNvsAreaPtr->TbtAspm) { //Aspm disable case
-    ThunderboltDisableAspmWithoutLtr (RpSegment, RpBus, RpDevice, RpFunction);
+    ThunderboltDisableAspmWithoutLtr ();
   } else { //Aspm enable case
-    ThunderboltEnableAspmWithoutLtr ((UINT16)mTbtNvsAreaPtr->TbtAspm, RpSegment, RpBus, RpDevice, RpFunction);
+    ThunderboltEnableAspmWithoutLtr ((UINT16)mTbtNvsAreaPtr->TbtAspm);
   }
 
   if (mTbtNvsAreaPtr->TbtLtr) {
     ThunderboltGetLatencyLtr ();
-    ThunderboltSetLatencyLtr (RpSegment, RpBus, RpDevice, RpFunction);
+    ThunderboltSetLatencyLtr ();
   }
-  ConfigureLtr (RpSegment, RpBus, RpDevice, RpFunction);
-  ConfigureTbtPm(RpSegment, RpBus, RpDevice, RpFunction, 2);
+  ConfigureLtr ();
+  ConfigureTbtPm(2);
+
+  DEBUG ((DEBUG_INFO, "EndOfThunderboltCallback: %d functions, %ld us\n", (UINT32) mTbtTopology.Count, TbtElapsedMicroSeconds (StartTicks)));
 } // EndOfThunderboltCallback
 
 VOID
@@ -1741,25 +1657,33 @@ ConfigureTbtAspm (
   UINTN                         RpBus = 0;
   UINTN                         RpDevice;
   UINTN                         RpFunction;
+  UINT64                        StartTicks;
 
   if(Type == DTBT_CONTROLLER) {
     if (gCurrentDiscreteTbtRootPort == 0) {
       return;
     }
+    StartTicks = GetPerformanceCounter ();
     GetDTbtRpDevFun(DTBT_CONTROLLER, gCurrentDiscreteTbtRootPort - 1, &RpDevice, &RpFunction);
 
-    ConfigureTbtPm (RpSegment, RpBus, RpDevice, RpFunction, 1);
+    if (!TbtBuildTopology (RpSegment, RpBus, RpDevice, RpFunction)) {
+      return;
+    }
+
+    ConfigureTbtPm (1);
     if (!mTbtNvsAreaPtr->TbtAspm) { //Aspm disable case
-      ThunderboltDisableAspmWithoutLtr (RpSegment, RpBus, RpDevice, RpFunction);
+      ThunderboltDisableAspmWithoutLtr ();
     } else { //Aspm enable case
-      ThunderboltEnableAspmWithoutLtr ((UINT16) Aspm, RpSegment, RpBus, RpDevice, RpFunction);
+      ThunderboltEnableAspmWithoutLtr ((UINT16) Aspm);
     }
 
   if (mTbtNvsAreaPtr->TbtLtr) {
       ThunderboltGetLatencyLtr ();
-      ThunderboltSetLatencyLtr (RpSegment, RpBus, RpDevice, RpFunction);
+      ThunderboltSetLatencyLtr ();
     }
-    ConfigureLtr (RpSegment, RpBus, RpDevice, RpFunction);
+    ConfigureLtr ();
+
+    DEBUG ((DEBUG_INFO, "ConfigureTbtAspm: %d functions, %ld us\n", (UINT32) mTbtTopology.Count, TbtElapsedMicroSeconds (StartTicks)));
   } // EndOfThunderboltCallback
 }
 
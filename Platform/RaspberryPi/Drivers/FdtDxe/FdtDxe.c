@@ -12,6 +12,7 @@
 #include <Library/DebugLib.h>
 #include <Library/DxeServicesLib.h>
 #include <Library/MemoryAllocationLib.h>
+#include <Library/TimerLib.h>
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/UefiLib.h>
 #include <libfdt.h>
@@ -19,10 +20,187 @@
 #include <Guid/Fdt.h>
 #include <ConfigVars.h>
 
+//
+// What the fixups will touch, gathered from the devicetree passed by the
+// firmware before it is copied. Node offsets are not kept, as every edit
+// moves the nodes behind it; the alias targets are kept as paths instead.
+//
+typedef struct {
+  //
+  // Alias targets, pointing into the devicetree passed by the firmware,
+  // which is left untouched.
+  //
+  CONST CHAR8   *EthernetPath;
+  BOOLEAN       HasEthernetAlias;
+  BOOLEAN       HasEthernet0Alias;
+  CONST CHAR8   *UsbPath;
+  CONST CHAR8   *DisplayPath;
+
+  BOOLEAN       HasMemory;
+  BOOLEAN       HasPsci;
+  UINTN         CpuCount;
+
+  //
+  // Upper bound of the growth of the devicetree once all fixups are applied
+  //
+  UINTN         Growth;
+} FDT_FIXUP_PLAN;
+
+typedef
+EFI_STATUS
+(*FDT_FIXUP_FUNCTION) (
+  VOID
+  );
+
+typedef struct {
+  FDT_FIXUP_FUNCTION    Apply;
+  CONST CHAR8           *Name;
+  CONST CHAR16          *Description;
+} FDT_FIXUP;
+
 STATIC VOID                             *mFdtImage;
 
+STATIC FDT_FIXUP_PLAN                   mPlan;
+
 STATIC RASPBERRY_PI_FIRMWARE_PROTOCOL   *mFwProtocol;
 
+STATIC CONST CHAR8                      mUsbCompatible[] = "brcm,bcm2708-usb";
+STATIC CONST CHAR8                      mUsbNewCompatible[] = "brcm,bcm2835-usb";
+
+/**
+  Compare a node name, unit address excluded, the way fdt_path_offset () does.
+**/
+STATIC
+BOOLEAN
+FdtNodeNameIs (
+  IN CONST CHAR8    *Name,
+  IN CONST CHAR8    *Wanted
+  )
+{
+  UINTN Length;
+
+  Length = AsciiStrLen (Wanted);
+  return (AsciiStrnCmp (Name, Wanted, Length) == 0 &&
+          (Name[Length] == '\0' || Name[Length] == '@'));
+}
+
+/**
+  Worst case growth of the devicetree when a property is added: the property
+  itself, and its name in the strings block.
+**/
+STATIC
+UINTN
+FdtPropertySize (
+  IN CONST CHAR8    *Name,
+  IN UINTN          Length
+  )
+{
+  return sizeof (struct fdt_property) + ALIGN_VALUE (Length, FDT_TAGSIZE) +
+         AsciiStrSize (Name);
+}
+
+/**
+  Find everything the fixups need in one walk of the devicetree passed by the
+  firmware, and work out how much it can grow.
+
+  @param  Fdt   The devicetree passed by the firmware.
+
+**/
+STATIC
+VOID
+PlanFixups (
+  IN CONST VOID     *Fdt
+  )
+{
+  INT32         Node;
+  INT32         Depth;
+  INT32         Aliases;
+  INT32         UsbCompatibleSize;
+  BOOLEAN       InCpus;
+  CONST CHAR8   *Name;
+
+  Aliases = -1;
+  InCpus = FALSE;
+  Depth = -1;
+  for (Node = fdt_next_node (Fdt, -1, &Depth);
+       Node >= 0 && Depth >= 0;
+       Node = fdt_next_node (Fdt, Node, &Depth)) {
+    if (Depth == 1) {
+      Name = fdt_get_name (Fdt, Node, NULL);
+      if (Name == NULL) {
+        continue;
+      }
+      InCpus = FdtNodeNameIs (Name, "cpus");
+      if (FdtNodeNameIs (Name, "aliases")) {
+        Aliases = Node;
+      } else if (FdtNodeNameIs (Name, "memory")) {
+        mPlan.HasMemory = TRUE;
+      } else if (FdtNodeNameIs (Name, "psci")) {
+        mPlan.HasPsci = TRUE;
+      }
+    } else if (Depth == 2 && InCpus) {
+      mPlan.CpuCount++;
+    }
+  }
+
+  if (Aliases >= 0) {
+    mPlan.EthernetPath = fdt_getprop (Fdt, Aliases, "ethernet", NULL);
+    mPlan.HasEthernetAlias = (mPlan.EthernetPath != NULL);
+    if (mPlan.EthernetPath == NULL) {
+      mPlan.EthernetPath = fdt_getprop (Fdt, Aliases, "ethernet0", NULL);
+      mPlan.HasEthernet0Alias = (mPlan.EthernetPath != NULL);
+    } else {
+      mPlan.HasEthernet0Alias =
+        (fdt_getprop (Fdt, Aliases, "ethernet0", NULL) != NULL);
+    }
+    mPlan.UsbPath = fdt_getprop (Fdt, Aliases, "usb", NULL);
+    mPlan.DisplayPath = fdt_getprop (Fdt, Aliases, "display0", NULL);
+  }
+
+  //
+  // SanitizePSCI ()
+  //
+  if (!mPlan.HasPsci) {
+    mPlan.Growth += 2 * FDT_TAGSIZE + ALIGN_VALUE (sizeof ("psci"), FDT_TAGSIZE);
+  }
+  mPlan.Growth += FdtPropertySize ("compatible", sizeof ("arm,psci-1.0")) +
+                  FdtPropertySize ("method", sizeof ("smc")) +
+                  mPlan.CpuCount * FdtPropertySize ("enable-method", sizeof ("psci"));
+
+  //
+  // FixEthernetAliases () and UpdateMacAddress ()
+  //
+  if (mPlan.EthernetPath != NULL) {
+    mPlan.Growth += 2 * FdtPropertySize ("ethernet0", AsciiStrSize (mPlan.EthernetPath)) +
+                    FdtPropertySize ("mac-address", sizeof (EFI_MAC_ADDRESS));
+  }
+
+  //
+  // AddUsbCompatibleProperty ()
+  //
+  if (mPlan.UsbPath != NULL &&
+      fdt_getprop (Fdt, fdt_path_offset (Fdt, mPlan.UsbPath), "compatible",
+        &UsbCompatibleSize) != NULL) {
+    mPlan.Growth += ALIGN_VALUE (UsbCompatibleSize + sizeof (mUsbNewCompatible), FDT_TAGSIZE) -
+                    ALIGN_VALUE (UsbCompatibleSize, FDT_TAGSIZE);
+  }
+
+  DEBUG ((DEBUG_INFO, "%a: %Lu CPUs, devicetree may grow by 0x%lx bytes\n",
+    __FUNCTION__, (UINT64)mPlan.CpuCount, mPlan.Growth));
+}
+
+/**
+  Size of the devicetree in use, as opposed to the size of its buffer.
+**/
+STATIC
+UINTN
+FdtUsedSize (
+  IN CONST VOID     *Fdt
+  )
+{
+  return fdt_off_dt_strings (Fdt) + fdt_size_dt_strings (Fdt);
+}
+
 STATIC
 EFI_STATUS
 FixEthernetAliases (
@@ -30,64 +208,50 @@ FixEthernetAliases (
 )
 {
   INTN          Aliases;
-  CONST CHAR8   *Ethernet;
-  CONST CHAR8   *Ethernet0;
-  CONST CHAR8   *Alias;
-  UINTN         CopySize;
-  CHAR8         *Copy;
+  UINTN         AliasSize;
   INTN          Retval;
   EFI_STATUS    Status;
 
-  //
-  // Look up the 'ethernet[0]' aliases
-  //
+  if (mPlan.EthernetPath == NULL) {
+    DEBUG ((DEBUG_ERROR, "%a: failed to locate 'ethernet[0]' alias\n", __FUNCTION__));
+    return EFI_NOT_FOUND;
+  }
+
   Aliases = fdt_path_offset (mFdtImage, "/aliases");
   if (Aliases < 0) {
     DEBUG ((DEBUG_ERROR, "%a: failed to locate '/aliases'\n", __FUNCTION__));
     return EFI_NOT_FOUND;
   }
-  Ethernet = fdt_getprop (mFdtImage, Aliases, "ethernet", NULL);
-  Ethernet0 = fdt_getprop (mFdtImage, Aliases, "ethernet0", NULL);
-  Alias = Ethernet ? Ethernet : Ethernet0;
-  if (!Alias) {
-    DEBUG ((DEBUG_ERROR, "%a: failed to locate 'ethernet[0]' alias\n", __FUNCTION__));
-    return EFI_NOT_FOUND;
-  }
 
   //
-  // Create copy for fdt_setprop
+  // The alias target lives in the devicetree passed by the firmware, so it
+  // stays put while properties are added here.
   //
-  CopySize = AsciiStrSize (Alias);
-  Copy = AllocateCopyPool (CopySize, Alias);
-  if (!Copy) {
-    DEBUG ((DEBUG_ERROR, "%a: failed to copy '%a'\n", __FUNCTION__, Alias));
-    return EFI_OUT_OF_RESOURCES;
-  }
+  AliasSize = AsciiStrSize (mPlan.EthernetPath);
 
   //
   // Create missing aliases
   //
   Status = EFI_SUCCESS;
-  if (!Ethernet) {
-    Retval = fdt_setprop (mFdtImage, Aliases, "ethernet", Copy, CopySize);
+  if (!mPlan.HasEthernetAlias) {
+    Retval = fdt_setprop (mFdtImage, Aliases, "ethernet", mPlan.EthernetPath, AliasSize);
     if (Retval != 0) {
       Status = EFI_NOT_FOUND;
       DEBUG ((DEBUG_ERROR, "%a: failed to create 'ethernet' alias (%d)\n",
         __FUNCTION__, Retval));
     }
-    DEBUG ((DEBUG_INFO, "%a: created 'ethernet' alias '%a'\n", __FUNCTION__, Copy));
+    DEBUG ((DEBUG_INFO, "%a: created 'ethernet' alias '%a'\n", __FUNCTION__, mPlan.EthernetPath));
   }
-  if (!Ethernet0) {
-    Retval = fdt_setprop (mFdtImage, Aliases, "ethernet0", Copy, CopySize);
+  if (!mPlan.HasEthernet0Alias) {
+    Retval = fdt_setprop (mFdtImage, Aliases, "ethernet0", mPlan.EthernetPath, AliasSize);
     if (Retval != 0) {
       Status = EFI_NOT_FOUND;
       DEBUG ((DEBUG_ERROR, "%a: failed to create 'ethernet0' alias (%d)\n",
         __FUNCTION__, Retval));
     }
-    DEBUG ((DEBUG_INFO, "%a: created 'ethernet0' alias '%a'\n", __FUNCTION__, Copy));
+    DEBUG ((DEBUG_INFO, "%a: created 'ethernet0' alias '%a'\n", __FUNCTION__, mPlan.EthernetPath));
   }
 
-  FreePool (Copy);
   return Status;
 }
 
@@ -105,7 +269,11 @@ UpdateMacAddress (
   //
   // Locate the node that the 'ethernet' alias refers to
   //
-  Node = fdt_path_offset (mFdtImage, "ethernet");
+  if (mPlan.EthernetPath == NULL) {
+    DEBUG ((DEBUG_ERROR, "%a: failed to locate 'ethernet' alias\n", __FUNCTION__));
+    return EFI_NOT_FOUND;
+  }
+  Node = fdt_path_offset (mFdtImage, mPlan.EthernetPath);
   if (Node < 0) {
     DEBUG ((DEBUG_ERROR, "%a: failed to locate 'ethernet' alias\n", __FUNCTION__));
     return EFI_NOT_FOUND;
@@ -144,16 +312,16 @@ AddUsbCompatibleProperty (
   VOID
   )
 {
-  CONST CHAR8   Prop[]    = "brcm,bcm2708-usb";
-  CONST CHAR8   NewProp[] = "brcm,bcm2835-usb";
   CONST CHAR8   *List;
-  CHAR8         *NewList;
   INT32         ListSize;
   INTN          Node;
   INTN          Retval;
 
   // Locate the node that the 'usb' alias refers to
-  Node = fdt_path_offset (mFdtImage, "usb");
+  Node = -1;
+  if (mPlan.UsbPath != NULL) {
+    Node = fdt_path_offset (mFdtImage, mPlan.UsbPath);
+  }
   if (Node < 0) {
     DEBUG ((DEBUG_ERROR, "%a: failed to locate 'usb' alias\n", __FUNCTION__));
     return EFI_NOT_FOUND;
@@ -167,34 +335,25 @@ AddUsbCompatibleProperty (
   }
 
   // Check if the compatible value we plan to add is already present
-  if (fdt_stringlist_contains (List, ListSize, NewProp)) {
+  if (fdt_stringlist_contains (List, ListSize, mUsbNewCompatible)) {
     DEBUG ((DEBUG_INFO, "%a: property '%a' is already set.\n",
-      __FUNCTION__, NewProp));
+      __FUNCTION__, mUsbNewCompatible));
     return EFI_SUCCESS;
   }
 
   // Make sure the compatible device is what we expect
-  if (!fdt_stringlist_contains (List, ListSize, Prop)) {
+  if (!fdt_stringlist_contains (List, ListSize, mUsbCompatible)) {
     DEBUG ((DEBUG_ERROR, "%a: property '%a' is missing!\n",
-      __FUNCTION__, Prop));
+      __FUNCTION__, mUsbCompatible));
     return EFI_NOT_FOUND;
   }
 
-  // Add the new NUL terminated entry to our list
+  // Append the new NUL terminated entry to the list, in place
   DEBUG ((DEBUG_INFO, "%a: adding '%a' to the properties\n",
-    __FUNCTION__, NewProp));
+    __FUNCTION__, mUsbNewCompatible));
 
-  NewList = AllocatePool (ListSize + sizeof (NewProp));
-  if (NewList == NULL) {
-    DEBUG ((DEBUG_ERROR, "%a: failed to allocate memory\n", __FUNCTION__));
-    return EFI_OUT_OF_RESOURCES;;
-  }
-  CopyMem (NewList, List, ListSize);
-  CopyMem (&NewList[ListSize], NewProp, sizeof (NewProp));
-
-  Retval = fdt_setprop (mFdtImage, Node, "compatible", NewList,
-             ListSize + sizeof (NewProp));
-  FreePool (NewList);
+  Retval = fdt_appendprop (mFdtImage, Node, "compatible", mUsbNewCompatible,
+             sizeof (mUsbNewCompatible));
   if (Retval != 0) {
     DEBUG ((DEBUG_ERROR, "%a: failed to update properties (%d)\n",
       __FUNCTION__, Retval));
@@ -213,6 +372,10 @@ CleanMemoryNodes (
   INTN Node;
   INT32 Retval;
 
+  if (!mPlan.HasMemory) {
+    return EFI_SUCCESS;
+  }
+
   Node = fdt_path_offset (mFdtImage, "/memory");
   if (Node < 0) {
     return EFI_SUCCESS;
@@ -248,8 +411,9 @@ SanitizePSCI (
     return EFI_NOT_FOUND;
   }
 
-  Node = fdt_path_offset (mFdtImage, "/psci");
-  if (Node < 0) {
+  if (mPlan.HasPsci) {
+    Node = fdt_path_offset (mFdtImage, "/psci");
+  } else {
     Node = fdt_add_subnode (mFdtImage, Root, "psci");
   }
 
@@ -303,7 +467,10 @@ CleanSimpleFramebuffer (
    * Should look for nodes by kind and remove aliases
    * by matching against device.
    */
-  Node = fdt_path_offset (mFdtImage, "display0");
+  if (mPlan.DisplayPath == NULL) {
+    return EFI_SUCCESS;
+  }
+  Node = fdt_path_offset (mFdtImage, mPlan.DisplayPath);
   if (Node < 0) {
     return EFI_SUCCESS;
   }
@@ -334,6 +501,51 @@ CleanSimpleFramebuffer (
   return EFI_SUCCESS;
 }
 
+//
+// These are all best-effort, and applied in this order.
+//
+STATIC CONST FDT_FIXUP mFixups[] = {
+  { SanitizePSCI,             "SanitizePSCI",             L"sanitize PSCI" },
+  { CleanMemoryNodes,         "CleanMemoryNodes",         L"clean memory nodes" },
+  { CleanSimpleFramebuffer,   "CleanSimpleFramebuffer",   L"clean frame buffer" },
+  { FixEthernetAliases,       "FixEthernetAliases",       L"fix ethernet aliases" },
+  { UpdateMacAddress,         "UpdateMacAddress",         L"update MAC address" },
+  { AddUsbCompatibleProperty, "AddUsbCompatibleProperty", L"update USB compatible properties" },
+};
+
+/**
+  Apply the fixups in mFixups, logging what each one costs in size and time.
+
+**/
+STATIC
+VOID
+ApplyFixups (
+  VOID
+  )
+{
+  EFI_STATUS  Status;
+  UINTN       Index;
+  UINTN       Size;
+  UINT64      Start;
+  UINT64      Elapsed;
+
+  for (Index = 0; Index < ARRAY_SIZE (mFixups); Index++) {
+    Size = FdtUsedSize (mFdtImage);
+    Start = GetPerformanceCounter ();
+
+    Status = mFixups[Index].Apply ();
+
+    Elapsed = GetTimeInNanoSecond (GetPerformanceCounter () - Start);
+    DEBUG ((DEBUG_INFO, "%a: %a: %Ld bytes, %Lu us\n", __FUNCTION__,
+      mFixups[Index].Name, (INT64)(FdtUsedSize (mFdtImage) - Size),
+      DivU64x32 (Elapsed, 1000)));
+
+    if (EFI_ERROR (Status)) {
+      Print (L"Failed to %s: %r\n", mFixups[Index].Description, Status);
+    }
+  }
+}
+
 /**
   @param  ImageHandle   of the loaded driver
   @param  SystemTable   Pointer to the System Table
@@ -381,9 +593,11 @@ FdtDxeInitialize (
   DEBUG ((DEBUG_INFO, "Devicetree passed via config.txt (0x%lx bytes)\n", FdtSize));
 
   /*
-   * Probably overkill.
+   * Size the copy from the plan, so that it is made once and every fixup
+   * fits in it.
    */
-  FdtSize += EFI_PAGE_SIZE * 2;
+  PlanFixups (FdtImage);
+  FdtSize = ALIGN_VALUE (FdtSize + mPlan.Growth, EFI_PAGE_SIZE);
   Status = gBS->AllocatePages (AllocateAnyPages, EfiBootServicesData,
                   EFI_SIZE_TO_PAGES (FdtSize), (EFI_PHYSICAL_ADDRESS*)&mFdtImage);
   if (EFI_ERROR (Status)) {
@@ -397,39 +611,7 @@ FdtDxeInitialize (
      goto out;
   }
 
-  /*
-   * These are all best-effort.
-   */
-
-  Status = SanitizePSCI ();
-  if (EFI_ERROR (Status)) {
-    Print (L"Failed to sanitize PSCI: %r\n", Status);
-  }
-
-  Status = CleanMemoryNodes ();
-  if (EFI_ERROR (Status)) {
-    Print (L"Failed to clean memory nodes: %r\n", Status);
-  }
-
-  Status = CleanSimpleFramebuffer ();
-  if (EFI_ERROR (Status)) {
-    Print (L"Failed to clean frame buffer: %r\n", Status);
-  }
-
-  Status = FixEthernetAliases ();
-  if (EFI_ERROR (Status)) {
-    Print (L"Failed to fix ethernet aliases: %r\n", Status);
-  }
-
-  Status = UpdateMacAddress ();
-  if (EFI_ERROR (Status)) {
-    Print (L"Failed to update MAC address: %r\n", Status);
-  }
-
-  Status = AddUsbCompatibleProperty ();
-  if (EFI_ERROR (Status)) {
-    Print (L"Failed to update USB compatible properties: %r\n", Status);
-  }
+  ApplyFixups ();
 
   DEBUG ((DEBUG_INFO, "Installed devicetree at address %p\n", mFdtImage));
   Status = gBS->InstallConfigurationTable (&gFdtTableGuid, mFdtImage);
@@ -8,14 +8,26 @@
 #include <Library/BaseMemoryLib.h>
 #include <Library/DebugLib.h>
 #include <Library/IoLib.h>
+#include <Library/MemoryAllocationLib.h>
 #include <Library/PcdLib.h>
 
 #include "RamFlash.h"
 
 VOID *mFlashBase;
 
+RAM_FLASH_BACKING_STORE *mRamFlashStore;
+BOOLEAN                 *mRamFlashDirty;
+
 STATIC UINTN       mFdBlockSize = 0;
 STATIC UINTN       mFdBlockCount = 0;
+STATIC UINTN       mStoreSectorSize = 0;
+
+//
+// Backing stores, probed in order
+//
+STATIC RAM_FLASH_BACKING_STORE *mRamFlashStores[] = {
+  &mRamFlashPflashStore
+};
 
 STATIC
 UINT8*
@@ -27,6 +39,67 @@ RamFlashPtr (
   return mFlashBase + ((UINTN)Lba * mFdBlockSize) + Offset;
 }
 
+/**
+  Rewrite the backing store sectors of a block from the RAM copy.
+
+  @param[in] Lba      The logical block index to write back.
+
+**/
+STATIC
+EFI_STATUS
+RamFlashStoreRewrite (
+  IN        EFI_LBA                             Lba
+  )
+{
+  EFI_STATUS  Status;
+  UINTN       Start;
+  UINTN       Offset;
+
+  Start = (UINTN)Lba * mFdBlockSize;
+
+  for (Offset = Start; Offset < Start + mFdBlockSize; Offset += mStoreSectorSize) {
+    Status = mRamFlashStore->Erase (Offset);
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+  }
+  Status = mRamFlashStore->Write (Start, mFdBlockSize, RamFlashPtr (Lba, 0));
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  mRamFlashDirty[Lba] = FALSE;
+  return EFI_SUCCESS;
+}
+
+/**
+  Write back the blocks that differ from the backing store.
+
+  A block stays dirty when the backing store fails, and is tried again on the
+  next write or erase. The RAM copy stays authoritative meanwhile.
+
+**/
+STATIC
+VOID
+RamFlashStoreFlush (
+  VOID
+  )
+{
+  EFI_STATUS  Status;
+  EFI_LBA     Lba;
+
+  for (Lba = 0; Lba < mFdBlockCount; Lba++) {
+    if (!mRamFlashDirty[Lba]) {
+      continue;
+    }
+    Status = RamFlashStoreRewrite (Lba);
+    if (EFI_ERROR (Status)) {
+      DEBUG ((DEBUG_ERROR, "%a: %a: block %Lu not written back - %r\n",
+        __FUNCTION__, mRamFlashStore->Name, Lba, Status));
+    }
+  }
+}
+
 /**
   Read from Ram Flash
 
@@ -104,6 +177,19 @@ RamFlashWrite (
      Ptr ++;
   }
 
+  //
+  // Program the same bytes into the backing store. A dirty block is
+  // rewritten as a whole below anyway.
+  //
+  if (mRamFlashStore != NULL) {
+    if (!mRamFlashDirty[Lba] &&
+        EFI_ERROR (mRamFlashStore->Write ((UINTN)Lba * mFdBlockSize + Offset,
+                                          *NumBytes, Buffer))) {
+      mRamFlashDirty[Lba] = TRUE;
+    }
+    RamFlashStoreFlush ();
+  }
+
   return EFI_SUCCESS;
 }
 
@@ -119,6 +205,23 @@ RamFlashEraseBlock (
   IN   EFI_LBA      Lba
   )
 {
+  UINTN  Offset;
+
+  if (Lba >= mFdBlockCount) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  SetMem (RamFlashPtr (Lba, 0), mFdBlockSize, 0xFF);
+
+  if (mRamFlashStore != NULL) {
+    for (Offset = 0; Offset < mFdBlockSize && !mRamFlashDirty[Lba];
+         Offset += mStoreSectorSize) {
+      if (EFI_ERROR (mRamFlashStore->Erase ((UINTN)Lba * mFdBlockSize + Offset))) {
+        mRamFlashDirty[Lba] = TRUE;
+      }
+    }
+    RamFlashStoreFlush ();
+  }
 
   return EFI_SUCCESS;
 }
@@ -136,10 +239,54 @@ RamFlashInitialize (
   VOID
   )
 {
+  EFI_STATUS  Status;
+  UINTN       Index;
+
   mFlashBase = (UINT8*)(UINTN) PcdGet32 (PcdVariableFdBaseAddress);
   mFdBlockSize = PcdGet32 (PcdVariableFdBlockSize);
   ASSERT(PcdGet32 (PcdVariableFdSize) % mFdBlockSize == 0);
   mFdBlockCount = PcdGet32 (PcdVariableFdSize) / mFdBlockSize;
 
+  //
+  // Look for a backing store, and fill the RAM copy from it. The variable
+  // driver reads the variable store straight from memory, so the whole
+  // region has to be there before it starts.
+  //
+  // A store sector may not span several blocks: erasing it would also wipe
+  // the neighbouring blocks, such as the FTW working block when the spare
+  // block is erased, and a power failure would then lose both copies.
+  //
+  for (Index = 0; Index < ARRAY_SIZE (mRamFlashStores); Index++) {
+    Status = mRamFlashStores[Index]->Initialize (&mStoreSectorSize);
+    if (EFI_ERROR (Status)) {
+      continue;
+    }
+    if (mStoreSectorSize == 0 ||
+        mStoreSectorSize > mFdBlockSize ||
+        mFdBlockSize % mStoreSectorSize != 0) {
+      DEBUG ((DEBUG_ERROR, "%a: %a: sector size 0x%x does not fit the variable flash\n",
+        __FUNCTION__, mRamFlashStores[Index]->Name, mStoreSectorSize));
+      continue;
+    }
+
+    mRamFlashDirty = AllocateRuntimeZeroPool (mFdBlockCount * sizeof (BOOLEAN));
+    if (mRamFlashDirty == NULL) {
+      break;
+    }
+    Status = mRamFlashStores[Index]->Read (0, PcdGet32 (PcdVariableFdSize), mFlashBase);
+    if (EFI_ERROR (Status)) {
+      DEBUG ((DEBUG_ERROR, "%a: %a: read failed - %r\n",
+        __FUNCTION__, mRamFlashStores[Index]->Name, Status));
+      FreePool (mRamFlashDirty);
+      mRamFlashDirty = NULL;
+      continue;
+    }
+
+    DEBUG ((DEBUG_INFO, "%a: variables backed by %a\n", __FUNCTION__,
+      mRamFlashStores[Index]->Name));
+    mRamFlashStore = mRamFlashStores[Index];
+    break;
+  }
+
   return EFI_SUCCESS;
 }
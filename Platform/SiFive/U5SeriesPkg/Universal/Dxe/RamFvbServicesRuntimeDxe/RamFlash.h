@@ -14,6 +14,96 @@
 
 extern VOID *mFlashBase;
 
+/**
+  Probe a backing store of the Ram flash.
+
+  Offsets given to the backing store are relative to the start of the
+  variable flash device, PcdVariableFdBaseAddress.
+
+  @param[out] SectorSize  The erase granularity of the backing store.
+
+  @retval EFI_SUCCESS     The backing store is present.
+  @retval EFI_NOT_FOUND   The backing store is not present.
+
+**/
+typedef
+EFI_STATUS
+(*RAM_FLASH_STORE_INITIALIZE) (
+  OUT       UINTN                                *SectorSize
+  );
+
+/**
+  Read from the backing store.
+
+  @param[in]  Offset    Offset of the data.
+  @param[in]  Length    Number of bytes to read.
+  @param[out] Buffer    Buffer receiving the data.
+
+**/
+typedef
+EFI_STATUS
+(*RAM_FLASH_STORE_READ) (
+  IN        UINTN                                Offset,
+  IN        UINTN                                Length,
+  OUT       UINT8                                *Buffer
+  );
+
+/**
+  Program the backing store. The range must have been erased, or hold data
+  that only needs bits cleared.
+
+  @param[in] Offset     Offset of the data.
+  @param[in] Length     Number of bytes to write.
+  @param[in] Buffer     Data to write.
+
+**/
+typedef
+EFI_STATUS
+(*RAM_FLASH_STORE_WRITE) (
+  IN        UINTN                                Offset,
+  IN        UINTN                                Length,
+  IN  CONST UINT8                                *Buffer
+  );
+
+/**
+  Erase one sector of the backing store.
+
+  @param[in] Offset     Offset of the sector, aligned to the sector size.
+
+**/
+typedef
+EFI_STATUS
+(*RAM_FLASH_STORE_ERASE) (
+  IN        UINTN                                Offset
+  );
+
+typedef
+VOID
+(*RAM_FLASH_STORE_CONVERT_POINTERS) (
+  VOID
+  );
+
+typedef struct {
+  CHAR8                                 *Name;
+  RAM_FLASH_STORE_INITIALIZE            Initialize;
+  RAM_FLASH_STORE_READ                  Read;
+  RAM_FLASH_STORE_WRITE                 Write;
+  RAM_FLASH_STORE_ERASE                 Erase;
+  RAM_FLASH_STORE_CONVERT_POINTERS      ConvertPointers;
+} RAM_FLASH_BACKING_STORE;
+
+//
+// The backing store in use, NULL if the variables only live in RAM, and the
+// blocks whose content has not reached it yet.
+//
+extern RAM_FLASH_BACKING_STORE *mRamFlashStore;
+extern BOOLEAN                 *mRamFlashDirty;
+
+//
+// Backing store on a CFI parallel flash, as emulated by QEMU
+//
+extern RAM_FLASH_BACKING_STORE mRamFlashPflashStore;
+
 /**
   Read from Ram Flash
 
@@ -17,4 +17,10 @@ RamFlashConvertPointers (
   )
 {
   EfiConvertPointer (0x0, (VOID **) &mFlashBase);
+
+  if (mRamFlashStore != NULL) {
+    mRamFlashStore->ConvertPointers ();
+    EfiConvertPointer (0x0, (VOID **) &mRamFlashDirty);
+    EfiConvertPointer (0x0, (VOID **) &mRamFlashStore);
+  }
 }
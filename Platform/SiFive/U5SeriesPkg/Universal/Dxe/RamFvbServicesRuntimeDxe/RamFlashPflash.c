@@ -0,0 +1,214 @@
+/** @file
+  CFI parallel flash backing store of the Ram flash, as emulated by the QEMU
+  pflash device.
+
+  Copyright (c) 2019, Hewlett Packard Enterprise Development LP. All rights reserved.<BR>
+
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/DxeServicesTableLib.h>
+#include <Library/IoLib.h>
+#include <Library/PcdLib.h>
+#include <Library/UefiRuntimeLib.h>
+
+#include "RamFlash.h"
+
+#define PFLASH_WRITE_BYTE_CMD           0x10
+#define PFLASH_BLOCK_ERASE_CMD          0x20
+#define PFLASH_CLEAR_STATUS_CMD         0x50
+#define PFLASH_READ_STATUS_CMD          0x70
+#define PFLASH_BLOCK_ERASE_CONFIRM_CMD  0xD0
+#define PFLASH_READ_ARRAY_CMD           0xFF
+
+#define PFLASH_STATUS_READY             BIT7
+#define PFLASH_STATUS_ERROR             (BIT5 | BIT4 | BIT3 | BIT1)
+
+STATIC UINT8       *mPflashBase;
+
+/**
+  Wait for the end of a program or erase operation, and put the flash back
+  into read array mode.
+
+  @param[in] Ptr      Address the operation was issued at.
+
+  @retval EFI_SUCCESS       The operation succeeded.
+  @retval EFI_DEVICE_ERROR  The flash reported an error.
+
+**/
+STATIC
+EFI_STATUS
+PflashWaitReady (
+  IN        UINT8                               *Ptr
+  )
+{
+  UINT8       FlashStatus;
+
+  do {
+    FlashStatus = MmioRead8 ((UINTN)Ptr);
+  } while ((FlashStatus & PFLASH_STATUS_READY) == 0);
+
+  if ((FlashStatus & PFLASH_STATUS_ERROR) != 0) {
+    MmioWrite8 ((UINTN)Ptr, PFLASH_CLEAR_STATUS_CMD);
+    MmioWrite8 ((UINTN)Ptr, PFLASH_READ_ARRAY_CMD);
+    return EFI_DEVICE_ERROR;
+  }
+
+  MmioWrite8 ((UINTN)Ptr, PFLASH_READ_ARRAY_CMD);
+  return EFI_SUCCESS;
+}
+
+/**
+  Probe the parallel flash at PcdVariableBackingStoreBase.
+
+  @param[out] SectorSize  The erase granularity of the flash.
+
+  @retval EFI_SUCCESS     The flash is present.
+  @retval EFI_NOT_FOUND   There is no flash, or RAM or ROM answered instead.
+
+**/
+STATIC
+EFI_STATUS
+PflashInitialize (
+  OUT       UINTN                               *SectorSize
+  )
+{
+  EFI_STATUS  Status;
+  UINT64      Base;
+  UINT64      Length;
+  UINTN       ProbeAddress;
+  UINT8       Original;
+  UINT8       Probe;
+
+  Base = PcdGet64 (PcdVariableBackingStoreBase);
+  if (Base == 0) {
+    return EFI_NOT_FOUND;
+  }
+
+  *SectorSize = PcdGet32 (PcdVariableBackingStoreSectorSize);
+  Length = ALIGN_VALUE (PcdGet32 (PcdVariableFdSize), *SectorSize);
+
+  //
+  // The flash is written at runtime, map it for the OS.
+  //
+  Status = gDS->AddMemorySpace (EfiGcdMemoryTypeMemoryMappedIo, Base, Length,
+                  EFI_MEMORY_UC | EFI_MEMORY_RUNTIME);
+  if (EFI_ERROR (Status) && Status != EFI_ACCESS_DENIED) {
+    return EFI_NOT_FOUND;
+  }
+  Status = gDS->SetMemorySpaceAttributes (Base, Length,
+                  EFI_MEMORY_UC | EFI_MEMORY_RUNTIME);
+  if (EFI_ERROR (Status)) {
+    return EFI_NOT_FOUND;
+  }
+
+  mPflashBase = (UINT8 *)(UINTN)Base;
+
+  //
+  // Tell flash from RAM and ROM: RAM keeps the command byte, ROM ignores the
+  // read status command, and the flash answers it with a clear status. The
+  // last byte of the region is used, the FV header at the start holds zeroes
+  // that would read like a clear status.
+  //
+  ProbeAddress = (UINTN)mPflashBase + PcdGet32 (PcdVariableFdSize) - 1;
+  Original = MmioRead8 (ProbeAddress);
+  MmioWrite8 (ProbeAddress, PFLASH_CLEAR_STATUS_CMD);
+  Probe = MmioRead8 (ProbeAddress);
+  if (Probe != Original) {
+    MmioWrite8 (ProbeAddress, Original);
+    return EFI_NOT_FOUND;
+  }
+
+  MmioWrite8 (ProbeAddress, PFLASH_READ_STATUS_CMD);
+  Probe = MmioRead8 (ProbeAddress);
+  if (Probe == PFLASH_READ_STATUS_CMD) {
+    MmioWrite8 (ProbeAddress, Original);
+    return EFI_NOT_FOUND;
+  }
+  MmioWrite8 (ProbeAddress, PFLASH_READ_ARRAY_CMD);
+  if (Probe == Original || (Probe & ~PFLASH_STATUS_READY) != 0) {
+    return EFI_NOT_FOUND;
+  }
+
+  DEBUG ((DEBUG_INFO, "%a: flash at 0x%Lx, sector size 0x%x\n", __FUNCTION__,
+    Base, *SectorSize));
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+PflashRead (
+  IN        UINTN                               Offset,
+  IN        UINTN                               Length,
+  OUT       UINT8                               *Buffer
+  )
+{
+  CopyMem (Buffer, mPflashBase + Offset, Length);
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+PflashWrite (
+  IN        UINTN                               Offset,
+  IN        UINTN                               Length,
+  IN  CONST UINT8                               *Buffer
+  )
+{
+  EFI_STATUS  Status;
+  UINT8       *Ptr;
+  UINTN       Index;
+
+  Ptr = mPflashBase + Offset;
+  for (Index = 0; Index < Length; Index++, Ptr++) {
+    //
+    // Bytes already holding the data are not programmed again
+    //
+    if (MmioRead8 ((UINTN)Ptr) == Buffer[Index]) {
+      continue;
+    }
+    MmioWrite8 ((UINTN)Ptr, PFLASH_WRITE_BYTE_CMD);
+    MmioWrite8 ((UINTN)Ptr, Buffer[Index]);
+    Status = PflashWaitReady (Ptr);
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+  }
+
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+PflashErase (
+  IN        UINTN                               Offset
+  )
+{
+  UINT8       *Ptr;
+
+  Ptr = mPflashBase + Offset;
+  MmioWrite8 ((UINTN)Ptr, PFLASH_BLOCK_ERASE_CMD);
+  MmioWrite8 ((UINTN)Ptr, PFLASH_BLOCK_ERASE_CONFIRM_CMD);
+  return PflashWaitReady (Ptr);
+}
+
+STATIC
+VOID
+PflashConvertPointers (
+  VOID
+  )
+{
+  EfiConvertPointer (0x0, (VOID **) &mPflashBase);
+}
+
+RAM_FLASH_BACKING_STORE mRamFlashPflashStore = {
+  "pflash",
+  PflashInitialize,
+  PflashRead,
+  PflashWrite,
+  PflashErase,
+  PflashConvertPointers
+};
@@ -13,12 +13,12 @@
 #include <sbi/riscv_encoding.h>
 #include <sbi/riscv_io.h>
 #include <sbi/riscv_atomic.h>
+#include <Library/PcdLib.h>
 #include <U5Clint.h>
 
 STATIC volatile VOID * const p_mtime = (VOID *)CLINT_REG_MTIME;
 #define MTIME          (*p_mtime)
 #define MTIMECMP(i)    (p_mtimecmp[i])
-BOOLEAN TimerHandlerReentry = FALSE;
 
 //
 // The handle onto which the Timer Architectural Protocol will be installed
@@ -47,13 +47,109 @@ EFI_CPU_ARCH_PROTOCOL *mCpu;
 STATIC EFI_TIMER_NOTIFY mTimerNotifyFunction;
 
 //
-// The current period of the timer interrupt
+// The current period of the timer interrupt, in 100 ns units
 //
 STATIC UINT64 mTimerPeriod = 0;
 
+//
+// The current period of the timer interrupt, in mtime ticks
+//
+STATIC UINT64 mTimerTicks = 0;
+
+//
+// The mtime value the next timer interrupt is programmed for
+//
+STATIC UINT64 mTimerDeadline = 0;
+
+//
+// The mtime value of the last call to the notification function
+//
+STATIC UINT64 mTimerLastNotify = 0;
+
+/**
+  Convert a number of mtime ticks to 100 ns units.
+
+  @param Ticks            The number of mtime ticks.
+
+  @return The duration in 100 ns units.
+**/
+STATIC
+UINT64
+TimerTicksToPeriod (
+  IN UINT64   Ticks
+  )
+{
+  return DivU64x64Remainder (
+           MultU64x32 (Ticks, 10000000),
+           PcdGet64 (PcdRiscVMachineTimerFrequencyInHerz),
+           NULL
+           );
+}
+
+/**
+  Convert a duration in 100 ns units to mtime ticks, rounding up.
+
+  @param Period           The duration in 100 ns units.
+
+  @return The number of mtime ticks, at least 1.
+**/
+STATIC
+UINT64
+TimerPeriodToTicks (
+  IN UINT64   Period
+  )
+{
+  UINT64 Ticks;
+
+  Ticks = DivU64x32 (
+            MultU64x64 (Period, PcdGet64 (PcdRiscVMachineTimerFrequencyInHerz)) + 9999999,
+            10000000
+            );
+  return MAX (Ticks, 1);
+}
+
+/**
+  Report the time elapsed since the last report to the notification function.
+
+  Must be called at TPL_HIGH_LEVEL.
+
+  @param Now              The current mtime value.
+**/
+STATIC
+VOID
+TimerNotifyElapsed (
+  IN UINT64   Now
+  )
+{
+  UINT64 Elapsed;
+
+  Elapsed = TimerTicksToPeriod (Now - mTimerLastNotify);
+  if (Elapsed == 0) {
+    return;
+  }
+
+  //
+  // Only consume the ticks accounted for, so that the rounding error is
+  // carried over to the next report instead of being lost.
+  //
+  mTimerLastNotify += DivU64x32 (
+                        MultU64x64 (Elapsed, PcdGet64 (PcdRiscVMachineTimerFrequencyInHerz)),
+                        10000000
+                        );
+  if (mTimerNotifyFunction != NULL) {
+    mTimerNotifyFunction (Elapsed);
+  }
+}
+
 /**
   U5 Series Timer Interrupt Handler.
 
+  The timer is programmed one-shot: each interrupt programs the next deadline
+  as an absolute mtime value, one period after the previous deadline, so the
+  tick does not drift by the interrupt latency. Ticks missed while interrupts
+  were masked are not replayed; the notification function is passed the time
+  actually elapsed instead.
+
   @param InterruptType    The type of interrupt that occured
   @param SystemContext    A pointer to the system context when the interrupt occured
 **/
@@ -66,36 +162,34 @@ TimerInterruptHandler (
   )
 {
   EFI_TPL OriginalTPL;
-  UINT64 RiscvTimer;
-
-  if (TimerHandlerReentry) {
-    //
-    // MMode timer occurred when processing
-    // SMode timer handler.
-    //
-    RiscvTimer = readq_relaxed(p_mtime);
-    SbiSetTimer (RiscvTimer += mTimerPeriod);
-    csr_clear(CSR_SIP, MIP_STIP);
-    return;
-  }
-  TimerHandlerReentry = TRUE;
+  UINT64 Now;
 
   OriginalTPL = gBS->RaiseTPL (TPL_HIGH_LEVEL);
-  csr_clear(CSR_SIE, MIP_STIP); // Disable SMode timer int
-  csr_clear(CSR_SIP, MIP_STIP);
+  Now = readq_relaxed(p_mtime);
   if (mTimerPeriod == 0) {
-    gBS->RestoreTPL (OriginalTPL);
+    //
+    // Programming the comparator to its maximum also clears the pending
+    // interrupt, and keeps M-mode from taking further timer traps.
+    //
+    SbiSetTimer (MAX_UINT64);
     csr_clear(CSR_SIE, MIP_STIP); // Disable SMode timer int
+    gBS->RestoreTPL (OriginalTPL);
     return;
   }
-  if (mTimerNotifyFunction != NULL) {
-      mTimerNotifyFunction (mTimerPeriod);
+
+  //
+  // Program the next deadline before calling the notification function, the
+  // timer events it signals may run for longer than a tick once the TPL is
+  // restored.
+  //
+  mTimerDeadline += mTimerTicks;
+  if (mTimerDeadline <= Now) {
+    mTimerDeadline = Now + mTimerTicks;
   }
-  RiscvTimer = readq_relaxed(p_mtime);
-  SbiSetTimer (RiscvTimer += mTimerPeriod);
+  SbiSetTimer (mTimerDeadline);
+
+  TimerNotifyElapsed (Now);
   gBS->RestoreTPL (OriginalTPL);
-  csr_set(CSR_SIE, MIP_STIP); // enable SMode timer int
-  TimerHandlerReentry = FALSE;
 }
 
 /**
@@ -175,23 +269,35 @@ TimerDriverSetTimerPeriod (
   IN UINT64                   TimerPeriod
   )
 {
-  UINT64 RiscvTimer;
+  EFI_TPL OriginalTPL;
+  UINT64  Now;
 
   DEBUG ((DEBUG_INFO, "TimerDriverSetTimerPeriod(0x%lx)\n", TimerPeriod));
 
   if (TimerPeriod == 0) {
     mTimerPeriod = 0;
     csr_clear(CSR_SIE, MIP_STIP); // disable timer int
+    SbiSetTimer (MAX_UINT64);
     return EFI_SUCCESS;
   }
 
-  mTimerPeriod = TimerPeriod / 10; // convert unit from 100ns to 1us
+  OriginalTPL = gBS->RaiseTPL (TPL_HIGH_LEVEL);
+  Now = readq_relaxed(p_mtime);
+  if (mTimerPeriod == 0) {
+    //
+    // The time spent with the timer disabled is not reported.
+    //
+    mTimerLastNotify = Now;
+  }
 
-  RiscvTimer = readq_relaxed(p_mtime);
-  SbiSetTimer(RiscvTimer + mTimerPeriod);
+  mTimerTicks = TimerPeriodToTicks (TimerPeriod);
+  mTimerPeriod = TimerTicksToPeriod (mTimerTicks);
+  mTimerDeadline = Now + mTimerTicks;
+  SbiSetTimer (mTimerDeadline);
+  csr_set(CSR_SIE, MIP_STIP); // enable timer int
+  gBS->RestoreTPL (OriginalTPL);
 
   mCpu->EnableInterrupt(mCpu);
-  csr_set(CSR_SIE, MIP_STIP); // enable timer int
   return EFI_SUCCESS;
 }
 
@@ -245,6 +351,17 @@ TimerDriverGenerateSoftInterrupt (
   IN EFI_TIMER_ARCH_PROTOCOL  *This
   )
 {
+  EFI_TPL OriginalTPL;
+
+  //
+  // The deadline of the next timer interrupt is left alone, only the time
+  // elapsed since the last interrupt is reported.
+  //
+  if (mTimerPeriod != 0) {
+    OriginalTPL = gBS->RaiseTPL (TPL_HIGH_LEVEL);
+    TimerNotifyElapsed (readq_relaxed(p_mtime));
+    gBS->RestoreTPL (OriginalTPL);
+  }
   return EFI_SUCCESS;
 }
 
@@ -13,6 +13,14 @@
 STATIC EFI_EVENT mFlashFvbVirtualAddrChangeEvent;
 STATIC UINTN     mFlashNvStorageVariableBase;
 
+//
+// RAM copy of the FVB region, kept in sync with the flash. Reads are served
+// from it, and writes or erases that would not change the flash are dropped.
+// NULL until the FVB is initialised, or after the copy was found stale.
+//
+STATIC UINT8*    mFvbShadow;
+STATIC BOOLEAN*  mFvbShadowBlank;   // Per block, the block is erased
+
 
 //
 // Global variable declarations
@@ -102,6 +110,211 @@ FLASH_INSTANCE  mFlashInstanceTemplate =
 
 HISI_SPI_FLASH_PROTOCOL* mFlash;
 
+STATIC
+BOOLEAN
+FvbShadowIsBlank (
+    IN CONST UINT8*   Buffer,
+    IN UINTN          Length
+)
+{
+    for (; Length > 0; Length--)
+    {
+        if (*Buffer++ != 0xFF)
+        {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/**
+  Check whether a range of the flash region is covered by the RAM copy.
+
+  @param[in]  Instance      The flash instance.
+  @param[in]  RegionOffset  Offset of the range in the flash region.
+  @param[in]  Length        Length of the range.
+
+**/
+STATIC
+BOOLEAN
+FvbShadowCovers (
+    IN FLASH_INSTANCE*  Instance,
+    IN UINTN            RegionOffset,
+    IN UINTN            Length
+)
+{
+    return (mFvbShadow != NULL) && Instance->SupportFvb &&
+           (RegionOffset < Instance->Size) && (Length <= Instance->Size - RegionOffset);
+}
+
+/**
+  Read the flash region into the RAM copy, and find the erased blocks.
+
+  @param[in]  Instance      The flash instance supporting the FVB.
+  @param[out] Shadow        The RAM copy of the flash region.
+  @param[out] ShadowBlank   Per block, the block is erased.
+
+  @retval EFI_SUCCESS       The RAM copy matches the flash.
+  @return                   The flash read failed.
+
+**/
+STATIC
+EFI_STATUS
+FvbShadowFill (
+    IN  FLASH_INSTANCE*  Instance,
+    OUT UINT8*           Shadow,
+    OUT BOOLEAN*         ShadowBlank
+)
+{
+    EFI_STATUS  Status;
+    UINTN       NumBlocks;
+    UINTN       Index;
+
+    Status = mFlash->Read (mFlash,
+                           (UINT32)(Instance->RegionBaseAddress - Instance->DeviceBaseAddress),
+                           Shadow,
+                           (UINT32)Instance->Size);
+    if (EFI_ERROR (Status))
+    {
+        return Status;
+    }
+
+    NumBlocks = Instance->Size / Instance->Media.BlockSize;
+    for (Index = 0; Index < NumBlocks; Index++)
+    {
+        ShadowBlank[Index] = FvbShadowIsBlank (Shadow + Index * Instance->Media.BlockSize,
+                                               Instance->Media.BlockSize);
+    }
+
+    return EFI_SUCCESS;
+}
+
+/**
+  Load the RAM copy of the flash region, once the FVB headers are in place.
+
+  The copy is only an optimisation, it is left disabled on failure.
+
+  @param[in]  Instance      The flash instance supporting the FVB.
+
+**/
+STATIC
+VOID
+FvbShadowLoad (
+    IN FLASH_INSTANCE*  Instance
+)
+{
+    EFI_STATUS  Status;
+    UINT8*      Shadow;
+
+    Shadow = AllocateRuntimePool (Instance->Size);
+    mFvbShadowBlank = AllocateRuntimePool ((Instance->Size / Instance->Media.BlockSize) * sizeof (BOOLEAN));
+    if ((Shadow == NULL) || (mFvbShadowBlank == NULL))
+    {
+        DEBUG ((EFI_D_ERROR, "[%a]:[%dL] No FVB shadow, out of resources\n", __FUNCTION__, __LINE__));
+        goto ERROR;
+    }
+
+    Status = FvbShadowFill (Instance, Shadow, mFvbShadowBlank);
+    if (EFI_ERROR (Status))
+    {
+        DEBUG ((EFI_D_ERROR, "[%a]:[%dL] No FVB shadow, Status=%r\n", __FUNCTION__, __LINE__, Status));
+        goto ERROR;
+    }
+
+    mFvbShadow = Shadow;
+    return;
+
+ERROR:
+    if (Shadow != NULL)
+    {
+        FreePool (Shadow);
+    }
+    if (mFvbShadowBlank != NULL)
+    {
+        FreePool (mFvbShadowBlank);
+        mFvbShadowBlank = NULL;
+    }
+}
+
+/**
+  Record in the RAM copy the data just written to, or erased from, the flash.
+
+  @param[in]  Instance      The flash instance.
+  @param[in]  RegionOffset  Offset of the range in the flash region.
+  @param[in]  Buffer        The data written, or NULL for an erase.
+  @param[in]  Length        Length of the range.
+
+**/
+STATIC
+VOID
+FvbShadowUpdate (
+    IN FLASH_INSTANCE*  Instance,
+    IN UINTN            RegionOffset,
+    IN CONST UINT8*     Buffer,
+    IN UINTN            Length
+)
+{
+    UINTN   Block;
+    UINTN   LastBlock;
+
+    Block = RegionOffset / Instance->Media.BlockSize;
+    LastBlock = (RegionOffset + Length - 1) / Instance->Media.BlockSize;
+
+    if (Buffer == NULL)
+    {
+        SetMem (mFvbShadow + RegionOffset, Length, 0xFF);
+        for (; Block <= LastBlock; Block++)
+        {
+            mFvbShadowBlank[Block] = TRUE;
+        }
+        return;
+    }
+
+    CopyMem (mFvbShadow + RegionOffset, Buffer, Length);
+    if (!FvbShadowIsBlank (Buffer, Length))
+    {
+        for (; Block <= LastBlock; Block++)
+        {
+            mFvbShadowBlank[Block] = FALSE;
+        }
+    }
+}
+
+/**
+  Resynchronise the RAM copy after a failed flash access left its content
+  unknown, reusing its buffers.
+
+  The copy is dropped if the flash cannot be read back. Its buffers are then
+  freed, unless this happens at runtime where pool memory cannot be returned.
+
+  @param[in]  Instance      The flash instance supporting the FVB.
+
+**/
+STATIC
+VOID
+FvbShadowInvalidate (
+    IN FLASH_INSTANCE*  Instance
+)
+{
+    EFI_STATUS  Status;
+
+    Status = FvbShadowFill (Instance, mFvbShadow, mFvbShadowBlank);
+    if (!EFI_ERROR (Status))
+    {
+        return;
+    }
+
+    DEBUG ((EFI_D_ERROR, "[%a]:[%dL] FVB shadow dropped, Status=%r\n", __FUNCTION__, __LINE__, Status));
+    if (!EfiAtRuntime ())
+    {
+        FreePool (mFvbShadow);
+        FreePool (mFvbShadowBlank);
+    }
+    mFvbShadow = NULL;
+    mFvbShadowBlank = NULL;
+}
+
 ///
 /// The Firmware Volume Block Protocol is the low-level interface
 /// to a firmware volume. File-level access to a firmware volume
@@ -548,6 +761,12 @@ FvbRead (
                                      );
     ReadAddress = StartAddress - Instance->DeviceBaseAddress + Offset;
 
+    if (FvbShadowCovers (Instance, StartAddress - Instance->RegionBaseAddress + Offset, *NumBytes))
+    {
+        CopyMem (Buffer, mFvbShadow + (StartAddress - Instance->RegionBaseAddress + Offset), *NumBytes);
+        return EFI_SUCCESS;
+    }
+
     Status = mFlash->Read(mFlash, (UINT32)ReadAddress, Buffer, *NumBytes);
     if (EFI_SUCCESS != Status)
     {
@@ -629,6 +848,8 @@ FvbWrite (
     FLASH_INSTANCE*              Instance;
     UINTN                    BlockAddress;
     UINTN                    WriteAddress;
+    UINTN                    RegionOffset;
+    BOOLEAN                      Shadowed;
 
     Instance = INSTANCE_FROM_FVB_THIS(This);
     if (NULL == Instance)
@@ -679,14 +900,32 @@ FvbWrite (
 
     BlockAddress = GET_BLOCK_ADDRESS (Instance->RegionBaseAddress, Lba, BlockSize);
     WriteAddress = BlockAddress - Instance->DeviceBaseAddress + Offset;
+    RegionOffset = BlockAddress - Instance->RegionBaseAddress + Offset;
+
+    // Writes are still flushed to the flash before returning, as required by the
+    // FTW spare/working block protocol; only writes not changing anything are dropped.
+    Shadowed = FvbShadowCovers (Instance, RegionOffset, *NumBytes);
+    if (Shadowed && (CompareMem (mFvbShadow + RegionOffset, Buffer, *NumBytes) == 0))
+    {
+        return EFI_SUCCESS;
+    }
 
     Status = mFlash->Write(mFlash, (UINT32)WriteAddress, (UINT8*)Buffer, *NumBytes);
     if (EFI_SUCCESS != Status)
     {
         DEBUG((EFI_D_ERROR, "%s - %d Status=%r\n", __FILE__, __LINE__, Status));
+        if (Shadowed)
+        {
+            FvbShadowInvalidate (Instance);
+        }
         return Status;
     }
 
+    if (Shadowed)
+    {
+        FvbShadowUpdate (Instance, RegionOffset, Buffer, *NumBytes);
+    }
+
     return Status;
 
 }
@@ -746,6 +985,8 @@ FvbEraseBlocks (
     UINTN       BlockAddress; // Physical address of Lba to erase
     EFI_LBA     StartingLba; // Lba from which we start erasing
     UINTN       NumOfLba; // Number of Lba blocks to erase
+    UINTN       RegionOffset; // Offset of Lba in the flash region
+    BOOLEAN     Shadowed;
     FLASH_INSTANCE* Instance;
 
     Instance = INSTANCE_FROM_FVB_THIS(This);
@@ -817,14 +1058,27 @@ FvbEraseBlocks (
                                Instance->Media.BlockSize
                            );
 
-            // Erase it
-
-            Status = FlashUnlockAndEraseSingleBlock (Instance, BlockAddress);
-            if (EFI_ERROR(Status))
+            // Erase it, unless it is known to be erased already
+            RegionOffset = BlockAddress - Instance->RegionBaseAddress;
+            Shadowed = FvbShadowCovers (Instance, RegionOffset, Instance->Media.BlockSize);
+            if (!Shadowed || !mFvbShadowBlank[RegionOffset / Instance->Media.BlockSize])
             {
-                VA_END (Args);
-                Status = EFI_DEVICE_ERROR;
-                goto EXIT;
+                Status = FlashUnlockAndEraseSingleBlock (Instance, BlockAddress);
+                if (EFI_ERROR(Status))
+                {
+                    if (Shadowed)
+                    {
+                        FvbShadowInvalidate (Instance);
+                    }
+                    VA_END (Args);
+                    Status = EFI_DEVICE_ERROR;
+                    goto EXIT;
+                }
+
+                if (Shadowed)
+                {
+                    FvbShadowUpdate (Instance, RegionOffset, NULL, Instance->Media.BlockSize);
+                }
             }
 
             // Move to the next Lba
@@ -874,6 +1128,8 @@ FvbInitialize (
             return Status;
         }
     }
+
+    FvbShadowLoad (Instance);
     return Status;
 }
 
@@ -1052,6 +1308,7 @@ FlashWriteBlocks (
     UINTN                   BlockAddress;
     UINT32                     NumBlocks;
     UINTN                   WriteAddress;
+    BOOLEAN                     Shadowed;
 
     // The buffer must be valid
     if (Buffer == NULL)
@@ -1087,14 +1344,24 @@ FlashWriteBlocks (
     BlockAddress = GET_BLOCK_ADDRESS (Instance->RegionBaseAddress, Lba, Instance->Media.BlockSize);
 
     WriteAddress = BlockAddress - Instance->DeviceBaseAddress;
+    Shadowed = FvbShadowCovers (Instance, BlockAddress - Instance->RegionBaseAddress, BufferSizeInBytes);
 
     Status = mFlash->Write(mFlash, (UINT32)WriteAddress, (UINT8*)Buffer, BufferSizeInBytes);
     if (EFI_SUCCESS != Status)
     {
         DEBUG((EFI_D_ERROR, "%s - %d Status=%r\n", __FILE__, __LINE__, Status));
+        if (Shadowed)
+        {
+            FvbShadowInvalidate (Instance);
+        }
         return Status;
     }
 
+    if (Shadowed)
+    {
+        FvbShadowUpdate (Instance, BlockAddress - Instance->RegionBaseAddress, Buffer, BufferSizeInBytes);
+    }
+
     return Status;
 }
 
@@ -1146,6 +1413,12 @@ FlashReadBlocks (
 
     ReadAddress = StartAddress - Instance->DeviceBaseAddress;
 
+    if (FvbShadowCovers (Instance, StartAddress - Instance->RegionBaseAddress, BufferSizeInBytes))
+    {
+        CopyMem (Buffer, mFvbShadow + (StartAddress - Instance->RegionBaseAddress), BufferSizeInBytes);
+        return EFI_SUCCESS;
+    }
+
     Status = mFlash->Read(mFlash, (UINT32)ReadAddress, Buffer, BufferSizeInBytes);
     if (EFI_SUCCESS != Status)
     {
@@ -1165,6 +1438,8 @@ FlashFvbVirtualNotifyEvent (
 {
   EfiConvertPointer (0x0, (VOID**)&mFlash);
   EfiConvertPointer (0x0, (VOID**)&mFlashNvStorageVariableBase);
+  EfiConvertPointer (EFI_OPTIONAL_PTR, (VOID**)&mFvbShadow);
+  EfiConvertPointer (EFI_OPTIONAL_PTR, (VOID**)&mFvbShadowBlank);
   return;
 }
 
@@ -13,6 +13,7 @@
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/ArmLib.h>
 #include <Library/PcdLib.h>
+#include <Library/TimerLib.h>
 #include <Protocol/NorFlashProtocol.h>
 #include <Library/DxeServicesTableLib.h>
 #include <Protocol/Cpu.h>
@@ -45,6 +46,13 @@ UNI_NOR_FLASH_PROTOCOL gUniNorFlash = {
     Read
 };
 
+//
+// Staging buffers, allocated once the flash geometry is known: one flash
+// unit for partial unit programs, and one sector for read-modify-erase-write.
+//
+STATIC UINT8 *mUnitBuffer = NULL;
+STATIC UINT8 *mSectorBuffer = NULL;
+
 
 EFI_STATUS
 EFIAPI Read(
@@ -136,10 +144,7 @@ static EFI_STATUS WriteAfterErase_Fill(
     )
 {
     EFI_STATUS Status;
-    UINT32 Loop;
-    UINT32 DataOffset;
     UINT32 NewOffset;
-    UINT8 *NewDataUnit;
 
     UINT32 FlashUnitLength;
 
@@ -156,36 +161,38 @@ static EFI_STATUS WriteAfterErase_Fill(
     }
 
 
-    Status = gBS->AllocatePool(EfiBootServicesData, FlashUnitLength, (VOID *)&NewDataUnit);
-    if (EFI_ERROR(Status))
-    {
-        DEBUG ((EFI_D_ERROR, "[%a]:[%dL]:Allocate Pool failed, %r!\n", __FUNCTION__,__LINE__, Status));
-        return Status;
-    }
-
-
     NewOffset = Offset - (Offset % FlashUnitLength);
 
-    gBS->CopyMem((VOID *)NewDataUnit, (VOID *)(UINTN)(gIndex.Base + NewOffset), FlashUnitLength);
+    gBS->CopyMem((VOID *)mUnitBuffer, (VOID *)(UINTN)(gIndex.Base + NewOffset), FlashUnitLength);
+    gBS->CopyMem((VOID *)(mUnitBuffer + Offset % FlashUnitLength), (VOID *)Buffer, Length);
 
-    DataOffset = Offset % FlashUnitLength;
-    for (Loop = 0; Loop < Length; Loop ++)
-    {
-        NewDataUnit[(UINT32)(DataOffset + Loop)] = Buffer[Loop];
-    }
-
-    Status = BufferWrite(NewOffset, (void *)NewDataUnit, FlashUnitLength);
+    Status = BufferWrite(NewOffset, (void *)mUnitBuffer, FlashUnitLength);
     if (EFI_ERROR(Status))
     {
         DEBUG ((EFI_D_ERROR, "[%a]:[%dL]:BufferWrite %r!\n", __FUNCTION__,__LINE__, Status));
-        return Status;
     }
 
-    (void)gBS->FreePool((VOID *)NewDataUnit);
     return Status;
 }
 
 
+static BOOLEAN IsBlankUnit(
+    IN  const UINT8       *Buffer,
+    IN  UINT32             Length
+    )
+{
+    for (; Length > 0; Length --)
+    {
+        if (*Buffer++ != 0xFF)
+        {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+
 static EFI_STATUS WriteAfterErase_Final(
     IN  UINT32       Offset,
     IN  UINT8       *Buffer,
@@ -213,6 +220,19 @@ static EFI_STATUS WriteAfterErase_Final(
     Loop = Length / FlashUnitLength;
     while (Loop --)
     {
+        //
+        // Programming can only clear bits. The target range has either just
+        // been erased, or the new data only clears bits of its content, so a
+        // unit of all 0xFF leaves the flash as it is and needs no program
+        // and no read back of the flash.
+        //
+        if (IsBlankUnit(Buffer, FlashUnitLength))
+        {
+            Offset += FlashUnitLength;
+            Buffer += FlashUnitLength;
+            continue;
+        }
+
         Status = BufferWrite(Offset, (void *)Buffer, FlashUnitLength);
         if (EFI_ERROR(Status))
         {
@@ -299,20 +319,28 @@ WriteAfterErase(
 }
 
 
+/**
+  Rewrite part of one sector: the sector is read back into the sector staging
+  buffer, the new data is merged in, then the sector is erased and programmed
+  back in whole flash units.
+
+  @param TempBase     Base of the flash chip.
+  @param Offset       Offset of the range in the chip.
+  @param Buffer       New data of the range, or NULL to erase the range.
+  @param Length       Length of the range, within the sector.
+
+**/
 EFI_STATUS
-FlashSectorErase(
+FlashSectorRewrite(
     UINT32      TempBase,
     UINT32      Offset,
+    UINT8      *Buffer,
     UINT32      Length
   )
 {
     EFI_STATUS  Status;
+    UINT32 SectorSize;
     UINT32 SectorOffset;
-    UINT8 *StaticBuffer;
-    UINT8 *Buffer;
-    UINT32 TempOffset;
-    UINT32 TempLength;
-    UINT32 LeftLength;
 
 
     if (0 == Length)
@@ -320,60 +348,38 @@ FlashSectorErase(
         return EFI_SUCCESS;
     }
 
-    LeftLength = gFlashInfo[gIndex.InfIndex].BlockSize * gFlashInfo[gIndex.InfIndex].ParallelNum - (Offset % (gFlashInfo[gIndex.InfIndex].BlockSize * gFlashInfo[gIndex.InfIndex].ParallelNum));
-    if (LeftLength < Length)
+    SectorSize = gFlashInfo[gIndex.InfIndex].BlockSize * gFlashInfo[gIndex.InfIndex].ParallelNum;
+    if (SectorSize - (Offset % SectorSize) < Length)
     {
         return EFI_UNSUPPORTED;
     }
 
+    SectorOffset = Offset - (Offset % SectorSize);
 
-    SectorOffset = Offset - (Offset % (gFlashInfo[gIndex.InfIndex].BlockSize * gFlashInfo[gIndex.InfIndex].ParallelNum));
-
-    Status = gBS->AllocatePool(EfiBootServicesData, gFlashInfo[gIndex.InfIndex].BlockSize * (UINTN)gFlashInfo[gIndex.InfIndex].ParallelNum, (VOID *)&StaticBuffer);
-    if (EFI_ERROR(Status))
+    gBS->CopyMem((VOID *)mSectorBuffer, (VOID *)(UINTN)(TempBase + SectorOffset), SectorSize);
+    if (NULL == Buffer)
     {
-        return Status;
+        gBS->SetMem((VOID *)(mSectorBuffer + Offset % SectorSize), Length, 0xFF);
     }
-
-    Buffer = StaticBuffer;
-
-    gBS->CopyMem((VOID *)Buffer, (VOID *)(UINTN)(TempBase + SectorOffset),
-                 (gFlashInfo[gIndex.InfIndex].BlockSize * (UINTN)gFlashInfo[gIndex.InfIndex].ParallelNum));
-
-
-    Status = SectorErase(TempBase, SectorOffset);
-    if (EFI_ERROR(Status))
+    else
     {
-        goto DO;
+        gBS->CopyMem((VOID *)(mSectorBuffer + Offset % SectorSize), (VOID *)Buffer, Length);
     }
 
 
-    TempOffset = SectorOffset;
-    TempLength = Offset % (gFlashInfo[gIndex.InfIndex].BlockSize * gFlashInfo[gIndex.InfIndex].ParallelNum);
-
-    Status = WriteAfterErase(TempBase, TempOffset, Buffer, TempLength);
+    Status = SectorErase(TempBase, SectorOffset);
     if (EFI_ERROR(Status))
     {
-        goto DO;
+        return Status;
     }
 
 
-    Buffer = Buffer + TempLength + Length;
-    TempOffset = Offset + Length;
-    TempLength = SectorOffset + (gFlashInfo[gIndex.InfIndex].BlockSize * gFlashInfo[gIndex.InfIndex].ParallelNum) - TempOffset;
-
-    Status = WriteAfterErase(TempBase, TempOffset, Buffer, TempLength);
+    Status = WriteAfterErase(TempBase, SectorOffset, mSectorBuffer, SectorSize);
     if (EFI_ERROR(Status))
     {
         DEBUG ((EFI_D_ERROR, "[%a]:[%dL]: %r!\n", __FUNCTION__,__LINE__,Status));
-        goto DO;
     }
 
-    (void)gBS->FreePool((VOID *)StaticBuffer);
-    return EFI_SUCCESS;
-
-DO:
-    (void)gBS->FreePool((VOID *)StaticBuffer);
     return Status;
 }
 
@@ -424,11 +430,17 @@ EFIAPI Erase(
             TempLength = Length;
         }
 
-        Status = FlashSectorErase(TempBase, Offset, TempLength);
-        if (EFI_ERROR(Status))
+        //
+        // Skip the erase cycle when the range is already blank.
+        //
+        if (IsNeedToErase(TempBase, Offset, NULL, TempLength))
         {
-            DEBUG ((EFI_D_ERROR, "[%a]:[%dL]: FlashErase One Sector Error, Status = %r!\n", __FUNCTION__,__LINE__,Status));
-            return Status;
+            Status = FlashSectorRewrite(TempBase, Offset, NULL, TempLength);
+            if (EFI_ERROR(Status))
+            {
+                DEBUG ((EFI_D_ERROR, "[%a]:[%dL]: FlashErase One Sector Error, Status = %r!\n", __FUNCTION__,__LINE__,Status));
+                return Status;
+            }
         }
 
         Offset += TempLength;
@@ -459,6 +471,13 @@ EFIAPI Write(
     UINT32       TempBase;
     UINT32           Loop;
     UINT32        Sectors;
+    UINT32   SectorErases;
+    UINT32    WriteLength;
+    UINT64     StartTicks;
+
+    StartTicks   = GetPerformanceCounter ();
+    SectorErases = 0;
+    WriteLength  = ulLength;
 
     if((Offset + ulLength) > (gFlashInfo[gIndex.InfIndex].SingleChipSize * gFlashInfo[gIndex.InfIndex].ParallelNum))
     {
@@ -495,19 +514,31 @@ EFIAPI Write(
 
         if (TRUE == IsNeedToWrite(TempBase, Offset, Buffer, TempLength))
         {
-            Status = FlashSectorErase(TempBase, Offset, TempLength);
-            if (EFI_ERROR(Status))
+            if (IsNeedToErase(TempBase, Offset, Buffer, TempLength))
             {
-                DEBUG ((EFI_D_ERROR, "[%a]:[%dL]:FlashErase One Sector Error, Status = %r!\n", __FUNCTION__,__LINE__,Status));
-                return Status;
+                //
+                // Merge the new data into the sector and program it back in
+                // one pass.
+                //
+                Status = FlashSectorRewrite(TempBase, Offset, Buffer, TempLength);
+                if (EFI_ERROR(Status))
+                {
+                    DEBUG ((EFI_D_ERROR, "[%a]:[%dL]:FlashSectorRewrite Status = %r!\n", __FUNCTION__,__LINE__,Status));
+                    return Status;
+                }
+                SectorErases ++;
             }
-
-
-            Status = WriteAfterErase(TempBase, Offset, Buffer, TempLength);
-            if (EFI_ERROR(Status))
+            else
             {
-                DEBUG ((EFI_D_ERROR, "[%a]:[%dL]:WriteAfterErase Status = %r!\n", __FUNCTION__,__LINE__,Status));
-                return Status;
+                //
+                // The new data only clears bits, program it in place.
+                //
+                Status = WriteAfterErase(TempBase, Offset, Buffer, TempLength);
+                if (EFI_ERROR(Status))
+                {
+                    DEBUG ((EFI_D_ERROR, "[%a]:[%dL]:WriteAfterErase Status = %r!\n", __FUNCTION__,__LINE__,Status));
+                    return Status;
+                }
             }
         }
 
@@ -523,6 +554,9 @@ EFIAPI Write(
         ulLength -= TempLength;
     }
 
+    DEBUG ((EFI_D_VERBOSE, "[%a]:[%dL]:0x%x bytes, %d sector erases, %ld us\n", __FUNCTION__,__LINE__,
+            WriteLength, SectorErases, DivU64x32 (GetTimeInNanoSecond (GetPerformanceCounter () - StartTicks), 1000)));
+
     return EFI_SUCCESS;
 }
 
@@ -574,6 +608,25 @@ EFIAPI InitializeFlash (
         DEBUG((EFI_D_ERROR, "Init Flash OK!\n"));
     }
 
+    Status = gBS->AllocatePool(EfiBootServicesData,
+                               gFlashInfo[gIndex.InfIndex].BufferProgramSize << gFlashInfo[gIndex.InfIndex].ParallelNum,
+                               (VOID *)&mUnitBuffer);
+    if (EFI_ERROR(Status))
+    {
+        DEBUG ((EFI_D_ERROR, "[%a]:[%dL]:Allocate Pool failed, %r!\n", __FUNCTION__,__LINE__, Status));
+        return Status;
+    }
+
+    Status = gBS->AllocatePool(EfiBootServicesData,
+                               gFlashInfo[gIndex.InfIndex].BlockSize * (UINTN)gFlashInfo[gIndex.InfIndex].ParallelNum,
+                               (VOID *)&mSectorBuffer);
+    if (EFI_ERROR(Status))
+    {
+        DEBUG ((EFI_D_ERROR, "[%a]:[%dL]:Allocate Pool failed, %r!\n", __FUNCTION__,__LINE__, Status));
+        (void)gBS->FreePool((VOID *)mUnitBuffer);
+        return Status;
+    }
+
     Status = gBS->InstallProtocolInterface (
                             &ImageHandle,
                             &gUniNorFlashProtocolGuid,
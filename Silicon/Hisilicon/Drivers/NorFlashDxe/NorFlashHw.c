@@ -533,6 +533,40 @@ EFI_STATUS IsNeedToWrite(
 }
 
 
+//
+// Programming can only clear bits, an erase is needed as soon as one bit of
+// the new data is set where the flash bit is clear. A NULL Buffer checks the
+// range is blank.
+//
+BOOLEAN IsNeedToErase(
+    IN  UINT32         Base,
+    IN  UINT32       Offset,
+    IN  UINT8       *Buffer,
+    IN  UINT32       Length
+  )
+{
+    UINTN NewAddr = Base + Offset;
+    UINT8 FlashData = 0;
+    UINT8 BufferData = 0xFF;
+
+    for(; Length > 0; Length --)
+    {
+        if (NULL != Buffer)
+        {
+            BufferData = *Buffer++;
+        }
+        FlashData = *(UINT8 *)NewAddr;
+        if ((FlashData & BufferData) != BufferData)
+        {
+            return TRUE;
+        }
+        NewAddr ++;
+    }
+
+    return FALSE;
+}
+
+
 EFI_STATUS BufferWrite(UINT32 Offset, void *pData, UINT32 Length)
 {
     EFI_STATUS Status;
@@ -126,7 +126,15 @@
 #define QUEUE_SLOTS                     256
 #define SLOT_ENTRIES                    8192
 #define PHY_CNT                         8
-#define MAX_ITCT_ENTRIES                1
+#define MAX_ITCT_ENTRIES                PHY_CNT
+
+// Phy up detection, in microseconds
+#define PHY_UP_POLL_INTERVAL            1000
+#define PHY_UP_SETTLE_TIME              10000
+#define PHY_UP_TIMEOUT                  100000
+
+// Completion polling period for non-blocking requests, in 100ns units
+#define SAS_ASYNC_POLL_PERIOD           10000
 
 // Completion header
 #define CMPLT_HDR_IPTT_OFF              0
@@ -180,10 +188,21 @@
 
 #define SENSE_DATA_PRES             26
 
+// ITCT entry, qw0
+#define ITCT_HDR_DEV_TYPE_SSP           (1 << 0)
+#define ITCT_HDR_VALID                  BIT2
+#define ITCT_HDR_AWT_CONTROL            BIT4
+#define ITCT_HDR_MAX_CONN_RATE_OFF      5
+#define ITCT_HDR_VALID_LINK_NUM_OFF     9
+#define ITCT_HDR_VALID_LINK_NUM_MSK     (0xf << ITCT_HDR_VALID_LINK_NUM_OFF)
+#define ITCT_HDR_PORT_ID_OFF            28
+#define ITCT_HDR_PORT_ID_MSK            (0xfULL << ITCT_HDR_PORT_ID_OFF)
+
+#define SAS_LINK_RATE_6_0_GBPS          0xa
+
 #define SGE_LIMIT 0x10000
 #define upper_32_bits(n) ((UINT32)(((n) >> 16) >> 16))
 #define lower_32_bits(n) ((UINT32)(n))
-#define MAX_TARGET_ID 4
 
 // Generic HW DMA host memory structures
 struct hisi_sas_cmd_hdr {
@@ -257,6 +276,22 @@ UINT32 status[260];
 
 struct hisi_sas_slot {
     BOOLEAN used;
+    BOOLEAN done;
+    EFI_STATUS status;
+    VOID *buffer_map;
+    struct hisi_sas_sts *sts;
+    EFI_EXT_SCSI_PASS_THRU_SCSI_REQUEST_PACKET *packet;
+    EFI_EVENT event;
+    UINT64 deadline;    // In ns, 0 if no timeout
+    BOOLEAN timed_out;  // Reported to the caller, still owned by the controller
+};
+
+// Directly attached end device, indexed by its ITCT device id
+struct hisi_sas_target {
+    BOOLEAN present;
+    UINT32 phy_map;
+    UINT32 port_id;
+    UINT64 sas_addr;
 };
 
 struct hisi_hba {
@@ -269,11 +304,13 @@ struct hisi_hba {
     struct hisi_sas_itct         *itct;
     struct hisi_sas_breakpoint   *breakpoint;
     struct hisi_sas_slot         *slots;
+    struct hisi_sas_target       targets[MAX_ITCT_ENTRIES];
     UINT32 base;
     int queue;
-    int port_id;
-    UINT32 LatestTargetId;
-    UINT64 LatestLun;
+    UINT32 target_cnt;
+    EFI_EVENT poll_event;
+    UINT32 async_cnt;       // Non-blocking requests in flight
+    UINT64 next_deadline;   // Earliest non-blocking deadline in ns, 0 if none
 };
 
 #pragma pack (1)
@@ -290,15 +327,175 @@ typedef struct {
     EFI_EXT_SCSI_PASS_THRU_PROTOCOL ExtScsiPassThru;
     SAS_V1_TRANSPORT_DEVICE_PATH    *DevicePath;
     struct hisi_hba *hba;
-    EFI_EVENT TimerEvent;
 } SAS_V1_INFO;
 
 #define SAS_DEVICE_SIGNATURE SIGNATURE_32 ('S','A','S','0')
 #define SAS_FROM_PASS_THRU(a) CR (a, SAS_V1_INFO, ExtScsiPassThru, SAS_DEVICE_SIGNATURE)
 
-STATIC EFI_STATUS prepare_cmd (
+STATIC UINT64 sas_now (VOID)
+{
+  return GetTimeInNanoSecond (GetPerformanceCounter ());
+}
+
+// Must be called at TPL_NOTIFY
+STATIC VOID async_done (struct hisi_hba *hba)
+{
+  ASSERT (hba->async_cnt > 0);
+  // The poll timer only runs while non-blocking requests are in flight
+  if (--hba->async_cnt == 0) {
+    gBS->SetTimer (hba->poll_event, TimerCancel, 0);
+    hba->next_deadline = 0;
+  }
+}
+
+// Must be called at TPL_NOTIFY
+STATIC VOID complete_slot (
+  struct hisi_hba *hba,
+  struct hisi_sas_slot *slot,
+  UINT32 data
+  )
+{
+  EFI_SCSI_SENSE_DATA *SensePtr = slot->packet->SenseData;
+  UINT8 *p;
+
+  slot->status = EFI_SUCCESS;
+
+  // Check whether dma transfer error
+  if ((data & CMPLT_HDR_ERR_RCRD_XFRD_MSK) &&
+    !(data & CMPLT_HDR_RSPNS_XFRD_MSK)) {
+    DEBUG ((EFI_D_VERBOSE, "sas retry data=0x%x\n", data));
+    DEBUG ((EFI_D_VERBOSE, "sts[0]=0x%x\n", slot->sts->status[0]));
+    DEBUG ((EFI_D_VERBOSE, "sts[1]=0x%x\n", slot->sts->status[1]));
+    DEBUG ((EFI_D_VERBOSE, "sts[2]=0x%x\n", slot->sts->status[2]));
+    slot->status = EFI_NOT_READY;
+  }
+
+  if (slot->buffer_map) {
+    DmaUnmap (slot->buffer_map);
+    slot->buffer_map = NULL;
+  }
+
+  p = (UINT8 *)&slot->sts->status[0];
+  if (p[SENSE_DATA_PRES] && SensePtr) {
+    // Disk not ready normal return for ScsiDiskTestUnitReady do next try
+    SensePtr->Sense_Key = EFI_SCSI_SK_NOT_READY;
+    SensePtr->Addnl_Sense_Code = EFI_SCSI_ASC_NOT_READY;
+    SensePtr->Addnl_Sense_Code_Qualifier = EFI_SCSI_ASCQ_IN_PROGRESS;
+  }
+
+  // Non-blocking callers only get the outcome through the packet
+  slot->packet->HostAdapterStatus = (slot->status == EFI_SUCCESS) ?
+    EFI_EXT_SCSI_STATUS_HOST_ADAPTER_OK : EFI_EXT_SCSI_STATUS_HOST_ADAPTER_OTHER;
+  slot->packet->TargetStatus = p[SENSE_DATA_PRES] ?
+    EFI_EXT_SCSI_STATUS_TARGET_CHECK_CONDITION : EFI_EXT_SCSI_STATUS_TARGET_GOOD;
+
+  slot->done = TRUE;
+
+  // Non-blocking request, nobody waits on the slot so release it here
+  if (slot->event != NULL) {
+    slot->used = FALSE;
+    gBS->SignalEvent (slot->event);
+    async_done (hba);
+  }
+}
+
+// Must be called at TPL_NOTIFY. Report the request as failed without
+// releasing the slot: the controller may still transfer to the buffer, so
+// the slot and its mapping stay reserved until the completion comes back
+STATIC VOID timeout_slot (
+  struct hisi_hba *hba,
+  struct hisi_sas_slot *slot
+  )
+{
+  DEBUG ((EFI_D_ERROR, "SAS: request timed out\n"));
+
+  slot->status = EFI_TIMEOUT;
+  slot->packet->HostAdapterStatus = EFI_EXT_SCSI_STATUS_HOST_ADAPTER_TIMEOUT_COMMAND;
+  slot->packet->TargetStatus = EFI_EXT_SCSI_STATUS_TARGET_GOOD;
+  slot->done = TRUE;
+  slot->timed_out = TRUE;
+
+  if (slot->event != NULL) {
+    gBS->SignalEvent (slot->event);
+    async_done (hba);
+  }
+}
+
+// Must be called at TPL_NOTIFY
+STATIC VOID release_slot (struct hisi_sas_slot *slot)
+{
+  if (slot->buffer_map) {
+    DmaUnmap (slot->buffer_map);
+    slot->buffer_map = NULL;
+  }
+  slot->timed_out = FALSE;
+  slot->used = FALSE;
+}
+
+// Must be called at TPL_NOTIFY
+STATIC VOID poll_cq (
+  struct hisi_hba *hba,
+  int queue
+  )
+{
+  struct hisi_sas_complete_hdr *complete_hdr;
+  struct hisi_sas_slot *slot;
+  UINT32 base = hba->base;
+  UINT32 data, iptt, rd, wr;
+
+  if (!(READ_REG32(base, OQ_INT_SRC) & BIT(queue))) {
+    return;
+  }
+
+  // Clear int before sampling the write pointer, so a completion
+  // racing with us raises it again
+  WRITE_REG32(base, OQ_INT_SRC, BIT(queue));
+
+  rd = READ_REG32(base, COMPL_Q_0_RD_PTR + (0x14 * queue));
+  wr = READ_REG32(base, COMPL_Q_0_WR_PTR + (0x14 * queue));
+
+  while (rd != wr) {
+    complete_hdr = &hba->complete_hdr[queue][rd];
+    data = complete_hdr->data;
+    iptt = (data & CMPLT_HDR_IPTT_MSK) >> CMPLT_HDR_IPTT_OFF;
+
+    if (iptt < SLOT_ENTRIES) {
+      slot = &hba->slots[iptt];
+      if (slot->timed_out) {
+        // Late completion, the caller has already been told
+        release_slot (slot);
+      } else if (slot->used && !slot->done) {
+        complete_slot (hba, slot, data);
+      }
+    }
+    rd = (rd + 1) % QUEUE_SLOTS;
+  }
+
+  // Update read point
+  WRITE_REG32(base, COMPL_Q_0_RD_PTR + (0x14 * queue), rd);
+}
+
+STATIC VOID poll_all_cq (struct hisi_hba *hba)
+{
+  UINT32 pending;
+  int queue;
+
+  pending = READ_REG32(hba->base, OQ_INT_SRC);
+  for (queue = 0; pending != 0 && queue < QUEUE_CNT; queue++) {
+    if (pending & BIT(queue)) {
+      poll_cq (hba, queue);
+    }
+  }
+}
+
+// Must be called at TPL_NOTIFY
+STATIC EFI_STATUS start_cmd (
   struct hisi_hba *hba,
-  EFI_EXT_SCSI_PASS_THRU_SCSI_REQUEST_PACKET    *Packet
+  UINT32 device_id,
+  EFI_EXT_SCSI_PASS_THRU_SCSI_REQUEST_PACKET    *Packet,
+  EFI_EVENT Event,
+  struct hisi_sas_slot **out_slot,
+  int *out_queue
   )
 {
   struct hisi_sas_slot *slot;
@@ -312,9 +509,8 @@ STATIC EFI_STATUS prepare_cmd (
   int queue = hba->queue;
   UINT32 r, w = 0, slot_idx = 0;
   UINT32 base = hba->base;
-  UINT8 *p;
   EFI_PHYSICAL_ADDRESS  BufferAddress;
-  EFI_STATUS            Status = EFI_SUCCESS;
+  EFI_STATUS            Status;
   VOID                  *BufferMap = NULL;
   DMA_MAP_OPERATION DmaOperation = MapOperationBusMasterCommonBuffer;
 
@@ -344,17 +540,14 @@ STATIC EFI_STATUS prepare_cmd (
   if (SensePtr)
     ZeroMem (SensePtr, sizeof (EFI_SCSI_SENSE_DATA));
 
-  slot->used = TRUE;
-  hba->queue = (queue + 1) % QUEUE_CNT;
-
   // Only consider ssp
   hdr->dw0 = (1 << CMD_HDR_RESP_REPORT_OFF) |
        (0x2 << CMD_HDR_TLR_CTRL_OFF) |
-       (hba->port_id << CMD_HDR_PORT_OFF) |
+       (hba->targets[device_id].port_id << CMD_HDR_PORT_OFF) |
        (1 << CMD_HDR_MODE_OFF) |
        (1 << CMD_HDR_CMD_OFF);
   hdr->dw1 = 1 << CMD_HDR_VERIFY_DTL_OFF;
-  hdr->dw1 |= 0 << CMD_HDR_DEVICE_ID_OFF;
+  hdr->dw1 |= device_id << CMD_HDR_DEVICE_ID_OFF;
   hdr->dw2 = 0x83000d;
   hdr->transfer_tags = slot_idx << CMD_HDR_IPTT_OFF;
 
@@ -410,64 +603,163 @@ STATIC EFI_STATUS prepare_cmd (
     hdr->sg_len = i << CMD_HDR_DATA_SGL_LEN_OFF;
   }
 
+  slot->used = TRUE;
+  slot->done = FALSE;
+  slot->status = EFI_SUCCESS;
+  slot->buffer_map = BufferMap;
+  slot->sts = sts;
+  slot->packet = Packet;
+  slot->event = Event;
+  slot->deadline = 0;
+  slot->timed_out = FALSE;
+  if (Packet->Timeout != 0) {
+    slot->deadline = sas_now () + MultU64x32 (Packet->Timeout, 100);
+  }
+  hba->queue = (queue + 1) % QUEUE_CNT;
+
   // Ensure descriptor effective before start dma
   MemoryFence();
 
   // Start dma
   WRITE_REG32(base, DLVRY_Q_0_WR_PTR + queue * 0x14, ++w % QUEUE_SLOTS);
 
-  // Wait for dma complete
-  while (slot->used) {
-    if (READ_REG32(base, OQ_INT_SRC) & BIT(queue)) {
-      struct hisi_sas_complete_hdr *complete_hdr;
-      UINT32 data, rd;
-      rd = READ_REG32(base, COMPL_Q_0_RD_PTR + (0x14 * queue));
-
-      complete_hdr = &hba->complete_hdr[queue][rd];
-      data = complete_hdr->data;
-
-      // Check whether dma transfer error
-      if ((data & CMPLT_HDR_ERR_RCRD_XFRD_MSK) &&
-        !(data & CMPLT_HDR_RSPNS_XFRD_MSK)) {
-        DEBUG ((EFI_D_VERBOSE, "sas retry data=0x%x\n", data));
-        DEBUG ((EFI_D_VERBOSE, "sts[0]=0x%x\n", sts->status[0]));
-        DEBUG ((EFI_D_VERBOSE, "sts[1]=0x%x\n", sts->status[1]));
-        DEBUG ((EFI_D_VERBOSE, "sts[2]=0x%x\n", sts->status[2]));
-        Status = EFI_NOT_READY;
-        // wait 1 second and retry, some disk need long time to be ready
-        // and ScsiDisk treat retry over 3 times as error
-        MicroSecondDelay(1000000);
-      }
-       // Update read point
-       WRITE_REG32(base, COMPL_Q_0_RD_PTR + (0x14 * queue), w);
-       // Clear int
-       WRITE_REG32(base, OQ_INT_SRC, BIT(queue));
-       slot->used = FALSE;
-       break;
+  *out_slot = slot;
+  *out_queue = queue;
+  return EFI_SUCCESS;
+}
+
+STATIC EFI_STATUS prepare_cmd (
+  struct hisi_hba *hba,
+  UINT32 device_id,
+  EFI_EXT_SCSI_PASS_THRU_SCSI_REQUEST_PACKET    *Packet,
+  EFI_EVENT Event
+  )
+{
+  struct hisi_sas_slot *slot;
+  EFI_STATUS Status;
+  EFI_TPL OldTpl;
+  BOOLEAN done;
+  int queue;
+  UINT8 *p;
+
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+  Status = start_cmd (hba, device_id, Packet, Event, &slot, &queue);
+  if (!EFI_ERROR (Status) && Event != NULL) {
+    // Non-blocking request completes from the poll timer
+    if (hba->async_cnt++ == 0) {
+      gBS->SetTimer (hba->poll_event, TimerPeriodic, SAS_ASYNC_POLL_PERIOD);
+    }
+    if (slot->deadline != 0 &&
+        (hba->next_deadline == 0 || slot->deadline < hba->next_deadline)) {
+      hba->next_deadline = slot->deadline;
     }
-    // Wait for status change in polling
-    NanoSecondDelay (100);
+  }
+  gBS->RestoreTPL (OldTpl);
+  if (EFI_ERROR (Status) || Event != NULL) {
+    return Status;
   }
 
-  if (BufferMap)
-       DmaUnmap (BufferMap);
+  // Wait for dma complete
+  do {
+    OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+    poll_cq (hba, queue);
+    if (!slot->done && slot->deadline != 0 && sas_now () >= slot->deadline) {
+      timeout_slot (hba, slot);
+    }
+    done = slot->done;
+    gBS->RestoreTPL (OldTpl);
+    if (!done) {
+      // Wait for status change in polling
+      NanoSecondDelay (100);
+    }
+  } while (!done);
 
-  p = (UINT8 *)&sts->status[0];
-  if (p[SENSE_DATA_PRES]) {
-    // Disk not ready normal return for ScsiDiskTestUnitReady do next try
-    SensePtr->Sense_Key = EFI_SCSI_SK_NOT_READY;
-    SensePtr->Addnl_Sense_Code = EFI_SCSI_ASC_NOT_READY;
-    SensePtr->Addnl_Sense_Code_Qualifier = EFI_SCSI_ASCQ_IN_PROGRESS;
-    // wait 1 second for disk spin up, refer drivers/scsi/sd.c
+  Status = slot->status;
+  if (Status == EFI_TIMEOUT) {
+    // The slot is released by its late completion
+    return Status;
+  }
+  p = (UINT8 *)&slot->sts->status[0];
+  if (Status == EFI_NOT_READY || p[SENSE_DATA_PRES]) {
+    // wait 1 second and retry, some disk need long time to be ready
+    // and ScsiDisk treat retry over 3 times as error, refer drivers/scsi/sd.c
     MicroSecondDelay(1000000);
   }
+  slot->used = FALSE;
+
   return Status;
 }
 
-STATIC VOID hisi_sas_v1_init(struct hisi_hba *hba, PLATFORM_SAS_PROTOCOL *plat)
+STATIC
+VOID
+EFIAPI
+SasV1PollCompletion (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  struct hisi_hba *hba = Context;
+  struct hisi_sas_slot *slot;
+  UINT64 now, next;
+  UINT32 i;
+
+  poll_all_cq (hba);
+
+  if (hba->next_deadline == 0) {
+    return;
+  }
+  now = sas_now ();
+  if (now < hba->next_deadline) {
+    return;
+  }
+
+  // Time out the expired non-blocking requests and find the next deadline
+  next = 0;
+  for (i = 0; i < SLOT_ENTRIES && hba->async_cnt != 0; i++) {
+    slot = &hba->slots[i];
+    if (!slot->used || slot->done || slot->event == NULL || slot->deadline == 0) {
+      continue;
+    }
+    if (now >= slot->deadline) {
+      timeout_slot (hba, slot);
+    } else if (next == 0 || slot->deadline < next) {
+      next = slot->deadline;
+    }
+  }
+  if (hba->async_cnt != 0) {
+    hba->next_deadline = next;
+  }
+}
+
+// Must be called at TPL_NOTIFY with the protocol uninstalled. Once the phys
+// are held in reset and the DMA engines are idle nothing targets the slot
+// buffers any more, so every outstanding request can be completed
+STATIC VOID sas_abort_slots (struct hisi_hba *hba)
+{
+  struct hisi_sas_slot *slot;
+  UINT32 i;
+
+  for (i = 0; i < SLOT_ENTRIES; i++) {
+    slot = &hba->slots[i];
+    if (!slot->used) {
+      continue;
+    }
+    if (!slot->done && slot->event != NULL) {
+      slot->status = EFI_ABORTED;
+      slot->packet->HostAdapterStatus = EFI_EXT_SCSI_STATUS_HOST_ADAPTER_OTHER;
+      slot->packet->TargetStatus = EFI_EXT_SCSI_STATUS_TARGET_GOOD;
+      slot->done = TRUE;
+      gBS->SignalEvent (slot->event);
+      async_done (hba);
+    }
+    release_slot (slot);
+  }
+}
+
+// Hold the phys in reset and wait for the DMA engines and the bus to go idle
+STATIC VOID hisi_sas_v1_stop(UINT32 base)
 {
   int i, j;
-  UINT32 val, base = hba->base;
 
   // Reset
   for (i = 0; i < PHY_CNT; i++) {
@@ -505,6 +797,14 @@ STATIC VOID hisi_sas_v1_init(struct hisi_hba *hba, PLATFORM_SAS_PROTOCOL *plat)
     // Wait for status change in polling
     NanoSecondDelay (100);
   }
+}
+
+STATIC VOID hisi_sas_v1_init(struct hisi_hba *hba, PLATFORM_SAS_PROTOCOL *plat)
+{
+  int i;
+  UINT32 val, base = hba->base;
+
+  hisi_sas_v1_stop(base);
 
   plat->Init(plat);
 
@@ -605,6 +905,130 @@ STATIC VOID hisi_sas_v1_init(struct hisi_hba *hba, PLATFORM_SAS_PROTOCOL *plat)
   }
 }
 
+// Poll the phy up status instead of sleeping for a fixed time: return once
+// every phy is up, or once the set of phys up has been stable for
+// PHY_UP_SETTLE_TIME
+STATIC UINT32 sas_wait_phy_up (UINT32 base)
+{
+  UINT32 phy_map = 0, new_map, elapsed, stable = 0;
+  int i;
+
+  for (elapsed = 0; elapsed < PHY_UP_TIMEOUT; elapsed += PHY_UP_POLL_INTERVAL) {
+    new_map = 0;
+    for (i = 0; i < PHY_CNT; i++) {
+      if (PHY_READ_REG32(base, CHL_INT2, i) & CHL_INT2_SL_PHY_ENA) {
+        new_map |= BIT(i);
+      }
+    }
+
+    if (new_map == BIT(PHY_CNT) - 1) {
+      return new_map;
+    }
+
+    if (new_map != phy_map) {
+      phy_map = new_map;
+      stable = 0;
+    } else if (phy_map != 0) {
+      stable += PHY_UP_POLL_INTERVAL;
+      if (stable >= PHY_UP_SETTLE_TIME) {
+        break;
+      }
+    }
+
+    MicroSecondDelay (PHY_UP_POLL_INTERVAL);
+  }
+
+  return phy_map;
+}
+
+// Allocate one ITCT entry per attached device, phys of a wide port share
+// the same attached SAS address and therefore the same entry
+STATIC VOID sas_setup_targets (struct hisi_hba *hba, UINT32 phy_map)
+{
+  struct hisi_sas_target *target;
+  struct hisi_sas_itct *itct;
+  UINT32 val, base = hba->base;
+  UINT32 port_id, dev, links;
+  UINT64 sas_addr;
+  int i;
+
+  for (i = 0; i < PHY_CNT; i++) {
+    if (!(phy_map & BIT(i))) {
+      continue;
+    }
+
+    port_id = (READ_REG32(base, PHY_PORT_NUM_MA) >> (4 * i)) & 0xf;
+    sas_addr = PHY_READ_REG32(base, RX_IDAF_DWORD3, i);
+    sas_addr = sas_addr << 32 | PHY_READ_REG32(base, RX_IDAF_DWORD4, i);
+
+    for (dev = 0; dev < hba->target_cnt; dev++) {
+      if (hba->targets[dev].sas_addr == sas_addr) {
+        break;
+      }
+    }
+
+    if (dev == hba->target_cnt) {
+      target = &hba->targets[dev];
+      target->present = TRUE;
+      target->port_id = port_id;
+      target->sas_addr = sas_addr;
+      hba->target_cnt++;
+
+      DEBUG ((EFI_D_INFO, "SAS: phy %d port %d addr 0x%lx -> target %d\n",
+        i, port_id, sas_addr, dev));
+    }
+    hba->targets[dev].phy_map |= BIT(i);
+
+    // Clear phyup
+    PHY_WRITE_REG32(base, CHL_INT2, i, CHL_INT2_SL_PHY_ENA);
+    val = PHY_READ_REG32(base, CHL_INT0, i);
+    val &= ~CHL_INT0_PHYCTRL_NOTRDY;
+    PHY_WRITE_REG32(base, CHL_INT0, i, val);
+    PHY_WRITE_REG32(base, CHL_INT0_MSK, i, 0x3ce3ee);
+
+    // Need notify
+    val = PHY_READ_REG32(base, SL_CONTROL, i);
+    val |= SL_CONTROL_NOTIFY_EN;
+    PHY_WRITE_REG32(base, SL_CONTROL, i, val);
+  }
+
+  if (phy_map == 0) {
+    return;
+  }
+
+  // Setup itct, device_id = dev. The link count covers every phy of a wide
+  // port, so it is only known once all phys have been walked
+  for (dev = 0; dev < hba->target_cnt; dev++) {
+    target = &hba->targets[dev];
+    links = BitFieldCountOnes32 (target->phy_map, 0, PHY_CNT - 1);
+
+    itct = &hba->itct[dev];
+    itct->qw0 = ITCT_HDR_DEV_TYPE_SSP |
+                ITCT_HDR_VALID |
+                ITCT_HDR_AWT_CONTROL |
+                (SAS_LINK_RATE_6_0_GBPS << ITCT_HDR_MAX_CONN_RATE_OFF) |
+                ((links << ITCT_HDR_VALID_LINK_NUM_OFF) & ITCT_HDR_VALID_LINK_NUM_MSK) |
+                (((UINT64)target->port_id << ITCT_HDR_PORT_ID_OFF) & ITCT_HDR_PORT_ID_MSK);
+    itct->sas_addr = target->sas_addr;
+    itct->qw2 = 0;
+  }
+
+  // Ensure itct effective before any command is delivered
+  MemoryFence();
+
+  // wait 100ms required for notify takes effect, refer drivers/scsi/hisi_sas/hisi_sas_v1_hw.c
+  // All phys are notified together so the wait is paid once
+  MicroSecondDelay(100000);
+
+  for (i = 0; i < PHY_CNT; i++) {
+    if (phy_map & BIT(i)) {
+      val = PHY_READ_REG32(base, SL_CONTROL, i);
+      val &= ~SL_CONTROL_NOTIFY_EN;
+      PHY_WRITE_REG32(base, SL_CONTROL, i, val);
+    }
+  }
+}
+
 STATIC VOID sas_init(SAS_V1_INFO *SasV1Info, PLATFORM_SAS_PROTOCOL *plat)
 {
   struct hisi_hba *hba = SasV1Info->hba;
@@ -658,6 +1082,23 @@ STATIC VOID sas_init(SAS_V1_INFO *SasV1Info, PLATFORM_SAS_PROTOCOL *plat)
   hisi_sas_v1_init(hba, plat);
 }
 
+STATIC
+UINT32
+sas_next_target (
+  struct hisi_hba *hba,
+  UINT32 start
+  )
+{
+  UINT32 i;
+
+  for (i = start; i < MAX_ITCT_ENTRIES; i++) {
+    if (hba->targets[i].present) {
+      break;
+    }
+  }
+  return i;
+}
+
 STATIC
 EFI_STATUS
 EFIAPI
@@ -672,7 +1113,15 @@ SasV1ExtScsiPassThruFunction (
   SAS_V1_INFO *SasV1Info = SAS_FROM_PASS_THRU(This);
   struct hisi_hba *hba = SasV1Info->hba;
 
-  return prepare_cmd(hba, Packet);
+  if (Target == NULL || Packet == NULL || Lun != 0) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (Target[0] >= MAX_ITCT_ENTRIES || !hba->targets[Target[0]].present) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  return prepare_cmd(hba, Target[0], Packet, Event);
 }
 
 STATIC
@@ -687,33 +1136,28 @@ SasV1ExtScsiPassThruGetNextTargetLun (
   SAS_V1_INFO *SasV1Info = SAS_FROM_PASS_THRU(This);
   struct hisi_hba *hba = SasV1Info->hba;
   UINT8 ScsiId[TARGET_MAX_BYTES];
-  UINT8 TargetId;
+  UINT32 TargetId;
 
-  if (*Target == NULL || Lun == NULL) {
+  if (Target == NULL || *Target == NULL || Lun == NULL) {
     return EFI_INVALID_PARAMETER;
   }
 
   SetMem (ScsiId, TARGET_MAX_BYTES, 0xFF);
 
-  TargetId = (*Target)[0];
-
-  if (TargetId == MAX_TARGET_ID) {
-    return EFI_NOT_FOUND;
-  }
-
+  // Only LUN 0 is reported, so the next LUN is always on the next target
   if (CompareMem(*Target, ScsiId, TARGET_MAX_BYTES) == 0) {
-    SetMem (*Target, TARGET_MAX_BYTES,0);
+    TargetId = sas_next_target (hba, 0);
   } else {
-    (*Target)[0] = (UINT8) (hba->LatestTargetId + 1);
+    TargetId = sas_next_target (hba, (UINT32)(*Target)[0] + 1);
   }
 
-  *Lun = 0;
+  if (TargetId >= MAX_ITCT_ENTRIES) {
+    return EFI_NOT_FOUND;
+  }
 
-  //
-  // Update the LatestTargetId.
-  //
-  hba->LatestTargetId  = (*Target)[0];
-  hba->LatestLun       = *Lun;
+  SetMem (*Target, TARGET_MAX_BYTES, 0);
+  (*Target)[0] = (UINT8)TargetId;
+  *Lun = 0;
 
   return EFI_SUCCESS;
 }
@@ -729,8 +1173,29 @@ SasV1ExtScsiPassThruBuildDevicePath (
   )
 {
   SAS_V1_INFO *SasV1Info = SAS_FROM_PASS_THRU(This);
+  struct hisi_hba *hba = SasV1Info->hba;
+  SCSI_DEVICE_PATH *ScsiDevicePath;
 
-  *DevicePath  = DuplicateDevicePath ((EFI_DEVICE_PATH_PROTOCOL *)(SasV1Info->DevicePath));
+  if (Target == NULL || DevicePath == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (Target[0] >= MAX_ITCT_ENTRIES || !hba->targets[Target[0]].present ||
+      Lun != 0) {
+    return EFI_NOT_FOUND;
+  }
+
+  ScsiDevicePath = (SCSI_DEVICE_PATH *)CreateDeviceNode (
+                                         MESSAGING_DEVICE_PATH,
+                                         MSG_SCSI_DP,
+                                         sizeof (SCSI_DEVICE_PATH));
+  if (ScsiDevicePath == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+  ScsiDevicePath->Pun = Target[0];
+  ScsiDevicePath->Lun = (UINT16)Lun;
+
+  *DevicePath = (EFI_DEVICE_PATH_PROTOCOL *)ScsiDevicePath;
   return EFI_SUCCESS;
 }
 
@@ -744,7 +1209,30 @@ SasV1ExtScsiPassThruGetTargetLun (
   OUT UINT64                             *Lun
   )
 {
-  return EFI_UNSUPPORTED;
+  SAS_V1_INFO *SasV1Info = SAS_FROM_PASS_THRU(This);
+  struct hisi_hba *hba = SasV1Info->hba;
+  SCSI_DEVICE_PATH *ScsiDevicePath;
+
+  if (DevicePath == NULL || Target == NULL || *Target == NULL || Lun == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (DevicePathType (DevicePath) != MESSAGING_DEVICE_PATH ||
+      DevicePathSubType (DevicePath) != MSG_SCSI_DP ||
+      DevicePathNodeLength (DevicePath) != sizeof (SCSI_DEVICE_PATH)) {
+    return EFI_UNSUPPORTED;
+  }
+
+  ScsiDevicePath = (SCSI_DEVICE_PATH *)DevicePath;
+  if (ScsiDevicePath->Pun >= MAX_ITCT_ENTRIES ||
+      !hba->targets[ScsiDevicePath->Pun].present) {
+    return EFI_NOT_FOUND;
+  }
+
+  SetMem (*Target, TARGET_MAX_BYTES, 0);
+  (*Target)[0] = (UINT8)ScsiDevicePath->Pun;
+  *Lun = ScsiDevicePath->Lun;
+  return EFI_SUCCESS;
 }
 
 STATIC
@@ -779,8 +1267,30 @@ SasV1ExtScsiPassThruGetNextTarget (
   IN OUT UINT8                           **Target
   )
 {
+  SAS_V1_INFO *SasV1Info = SAS_FROM_PASS_THRU(This);
+  struct hisi_hba *hba = SasV1Info->hba;
+  UINT8 ScsiId[TARGET_MAX_BYTES];
+  UINT32 TargetId;
 
-  return EFI_UNSUPPORTED;
+  if (Target == NULL || *Target == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  SetMem (ScsiId, TARGET_MAX_BYTES, 0xFF);
+
+  if (CompareMem(*Target, ScsiId, TARGET_MAX_BYTES) == 0) {
+    TargetId = sas_next_target (hba, 0);
+  } else {
+    TargetId = sas_next_target (hba, (UINT32)(*Target)[0] + 1);
+  }
+
+  if (TargetId >= MAX_ITCT_ENTRIES) {
+    return EFI_NOT_FOUND;
+  }
+
+  SetMem (*Target, TARGET_MAX_BYTES, 0);
+  (*Target)[0] = (UINT8)TargetId;
+  return EFI_SUCCESS;
 }
 
 STATIC EFI_EXT_SCSI_PASS_THRU_PROTOCOL SasV1ExtScsiPassThruProtocolTemplate = {
@@ -845,9 +1355,7 @@ SasDriverBindingStart (
   PLATFORM_SAS_PROTOCOL *plat;
   SAS_V1_INFO *SasV1Info = NULL;
   SAS_V1_TRANSPORT_DEVICE_PATH  *DevicePath;
-  UINT32 val, base;
-  int i, phy_id = 0;
-  struct hisi_sas_itct *itct;
+  UINT32 base;
   struct hisi_hba *hba;
 
   Status = gBS->OpenProtocol (
@@ -877,46 +1385,22 @@ SasDriverBindingStart (
 
   sas_init(SasV1Info, plat);
 
-  // Wait for sas controller phyup happen
-  MicroSecondDelay(100000);
-
-  for (i = 0; i < PHY_CNT; i++) {
-    val = PHY_READ_REG32(base, CHL_INT2, i);
-
-    if (val & CHL_INT2_SL_PHY_ENA) {
-      phy_id = i;
-    }
-  }
+  sas_setup_targets (hba, sas_wait_phy_up (base));
 
-  itct = &hba->itct[0]; //device_id = 0
-
-  hba->port_id = (READ_REG32(base, PHY_PORT_NUM_MA) >> (4 * phy_id)) & 0xf;
-  // Setup itct
-  itct->qw0 = 0x355;
-  itct->sas_addr = PHY_READ_REG32(base, RX_IDAF_DWORD3, phy_id);
-  itct->sas_addr = itct->sas_addr << 32 | PHY_READ_REG32(base, RX_IDAF_DWORD4, phy_id);
-  itct->qw2 = 0;
-
-  // Clear phyup
-  PHY_WRITE_REG32(base, CHL_INT2, phy_id, CHL_INT2_SL_PHY_ENA);
-  val = PHY_READ_REG32(base, CHL_INT0, phy_id);
-  val &= ~CHL_INT0_PHYCTRL_NOTRDY;
-  PHY_WRITE_REG32(base, CHL_INT0, phy_id, val);
-  PHY_WRITE_REG32(base, CHL_INT0_MSK, phy_id, 0x3ce3ee);
-
-  // Need notify
-  val = PHY_READ_REG32(base, SL_CONTROL, phy_id);
-  val |= SL_CONTROL_NOTIFY_EN;
-  PHY_WRITE_REG32(base, SL_CONTROL, phy_id, val);
-  // wait 100ms required for notify takes effect, refer drivers/scsi/hisi_sas/hisi_sas_v1_hw.c
-  MicroSecondDelay(100000);
-  val = PHY_READ_REG32(base, SL_CONTROL, phy_id);
-  val &= ~SL_CONTROL_NOTIFY_EN;
-  PHY_WRITE_REG32(base, SL_CONTROL, phy_id, val);
+  Status = gBS->CreateEvent (
+                  EVT_TIMER | EVT_NOTIFY_SIGNAL,
+                  TPL_NOTIFY,
+                  SasV1PollCompletion,
+                  hba,
+                  &hba->poll_event
+                  );
+  ASSERT_EFI_ERROR (Status);
 
   CopyMem (&SasV1Info->ExtScsiPassThru, &SasV1ExtScsiPassThruProtocolTemplate, sizeof (EFI_EXT_SCSI_PASS_THRU_PROTOCOL));
   SasV1Info->ExtScsiPassThruMode.AdapterId = 2;
-  SasV1Info->ExtScsiPassThruMode.Attributes = EFI_EXT_SCSI_PASS_THRU_ATTRIBUTES_PHYSICAL | EFI_EXT_SCSI_PASS_THRU_ATTRIBUTES_LOGICAL;
+  SasV1Info->ExtScsiPassThruMode.Attributes = EFI_EXT_SCSI_PASS_THRU_ATTRIBUTES_PHYSICAL |
+                                              EFI_EXT_SCSI_PASS_THRU_ATTRIBUTES_LOGICAL |
+                                              EFI_EXT_SCSI_PASS_THRU_ATTRIBUTES_NONBLOCKIO;
   SasV1Info->ExtScsiPassThruMode.IoAlign  = 64; //cache line align
   SasV1Info->ExtScsiPassThru.Mode = &SasV1Info->ExtScsiPassThruMode;
 
@@ -955,6 +1439,7 @@ SasDriverBindingStop (
   SAS_V1_INFO *SasV1Info;
   EFI_STATUS Status;
   EFI_EXT_SCSI_PASS_THRU_PROTOCOL *ExtScsi;
+  EFI_TPL OldTpl;
   int i, s;
 
   Status = gBS->OpenProtocol (
@@ -986,7 +1471,16 @@ SasDriverBindingStop (
            Controller
            );
 
-    gBS->CloseEvent (SasV1Info->TimerEvent);
+    // Quiesce the controller before its queues and the callers' buffers
+    // go away, then fail whatever was still outstanding
+    OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+    WRITE_REG32(SasV1Info->hba->base, DLVRY_QUEUE_ENABLE, 0);
+    hisi_sas_v1_stop(SasV1Info->hba->base);
+    sas_abort_slots (SasV1Info->hba);
+    gBS->RestoreTPL (OldTpl);
+
+    gBS->SetTimer (SasV1Info->hba->poll_event, TimerCancel, 0);
+    gBS->CloseEvent (SasV1Info->hba->poll_event);
 
     for (i = 0; i < QUEUE_CNT; i++) {
       s = sizeof(struct hisi_sas_cmd_hdr) * QUEUE_SLOTS;
@@ -20,17 +20,17 @@ VOID
 SmbiosGetManufacturer (
   IN  UINT8           MfgIdLSB,
   IN  UINT8           MfgIdMSB,
-  OUT CHAR16          *Manufacturer
+  OUT CHAR8           *Manufacturer
 )
 {
     UINT32                  Index = 0;
 
-    (VOID)StrCpyS(Manufacturer, SMBIOS_STRING_MAX_LENGTH - 1, L"Unknown");
+    (VOID)AsciiStrCpyS(Manufacturer, SMBIOS_STRING_MAX_LENGTH, "Unknown");
     while (JEP106[Index].MfgIdLSB != 0xFF && JEP106[Index].MfgIdMSB != 0xFF )
     {
         if (JEP106[Index].MfgIdLSB == MfgIdLSB && JEP106[Index].MfgIdMSB == MfgIdMSB)
         {
-            (VOID)StrCpyS (Manufacturer, SMBIOS_STRING_MAX_LENGTH - 1, JEP106[Index].Name);
+            AsciiSPrint (Manufacturer, SMBIOS_STRING_MAX_LENGTH, "%s", JEP106[Index].Name);
             break;
         }
         Index++;
@@ -39,51 +39,50 @@ SmbiosGetManufacturer (
 
 VOID
 SmbiosGetPartNumber (
-  IN GBL_INTERFACE      *pGblData,
-  IN UINT8              Skt,
-  IN UINT8              Ch,
-  IN UINT8              Dimm,
-  OUT CHAR16             *PartNumber
+  IN  DDR_DIMM_DATA     *DimmData,
+  OUT CHAR8             *PartNumber
   )
 {
-    CHAR16                        StringBuffer2[SMBIOS_STRING_MAX_LENGTH];
-    UINT32                        Index2;
+    UINT8                         *SpdPart;
+    UINT32                        SpdPartLen;
+    UINT32                        Index;
+    UINT32                        Length;
 
-    (VOID)StrCpyS(PartNumber, SMBIOS_STRING_MAX_LENGTH - 1, L"");
-    if (pGblData->Channel[Skt][Ch].Dimm[Dimm].DramType == SPD_TYPE_DDR3)
+    if (DimmData->DramType == SPD_TYPE_DDR3)
     {
-        for (Index2 = 0; Index2 < SPD_MODULE_PART; Index2++)
-        {
-            UnicodeSPrint (StringBuffer2, SMBIOS_STRING_MAX_LENGTH - 1, L"%c", pGblData->Channel[Skt][Ch].Dimm[Dimm].SpdModPart[Index2]);
-            (VOID)StrCatS(PartNumber, SMBIOS_STRING_MAX_LENGTH - 1, StringBuffer2);
-        }
+        SpdPart    = DimmData->SpdModPart;
+        SpdPartLen = SPD_MODULE_PART;
     }
     else
     {
-        for (Index2 = 0; Index2 < SPD_MODULE_PART_DDR4; Index2++)
+        SpdPart    = DimmData->SpdModPartDDR4;
+        SpdPartLen = SPD_MODULE_PART_DDR4;
+    }
+
+    Length = 0;
+    for (Index = 0; Index < SpdPartLen && Length < SMBIOS_STRING_MAX_LENGTH - 1; Index++)
+    {
+        if (SpdPart[Index] != 0)
         {
-            UnicodeSPrint (StringBuffer2, SMBIOS_STRING_MAX_LENGTH - 1, L"%c", pGblData->Channel[Skt][Ch].Dimm[Dimm].SpdModPartDDR4[Index2]);
-            (VOID)StrCatS(PartNumber, SMBIOS_STRING_MAX_LENGTH - 1, StringBuffer2);
+            PartNumber[Length++] = SpdPart[Index];
         }
     }
+    PartNumber[Length] = '\0';
 
     return;
 }
 
 VOID
 SmbiosGetSerialNumber (
-  IN GBL_INTERFACE      *pGblData,
-  IN UINT8              Skt,
-  IN UINT8              Ch,
-  IN UINT8              Dimm,
-  OUT CHAR16            *SerialNumber
+  IN  DDR_DIMM_DATA     *DimmData,
+  OUT CHAR8             *SerialNumber
   )
 {
     UINT32              Temp;
 
-    Temp = SwapBytes32 (pGblData->Channel[Skt][Ch].Dimm[Dimm].SpdSerialNum);
+    Temp = SwapBytes32 (DimmData->SpdSerialNum);
 
-    UnicodeSPrint(SerialNumber, SMBIOS_STRING_MAX_LENGTH, L"0x%08x", Temp);
+    AsciiSPrint(SerialNumber, SMBIOS_STRING_MAX_LENGTH, "0x%08x", Temp);
 
     return;
 }
@@ -109,24 +108,21 @@ IsDimmPresent (
 
 UINT8
 SmbiosGetMemoryType (
-  IN  GBL_INTERFACE      *pGblData,
-  IN  UINT8              Skt,
-  IN  UINT8              Ch,
-  IN  UINT8              Dimm
+  IN  MEMORY_DIMM_INFO   *DimmInfo
 )
 {
     UINT8 MemoryType;
 
-    if(!IsDimmPresent(pGblData, Skt, Ch, Dimm))
+    if(!DimmInfo->Present)
     {
         return MemoryTypeUnknown;
     }
 
-    if (pGblData->Channel[Skt][Ch].Dimm[Dimm].DramType == SPD_TYPE_DDR3)
+    if (DimmInfo->DimmData->DramType == SPD_TYPE_DDR3)
     {
         MemoryType = MemoryTypeDdr3;
     }
-    else if (pGblData->Channel[Skt][Ch].Dimm[Dimm].DramType == SPD_TYPE_DDR4)
+    else if (DimmInfo->DimmData->DramType == SPD_TYPE_DDR4)
     {
         MemoryType = MemoryTypeDdr4;
     }
@@ -140,10 +136,7 @@ SmbiosGetMemoryType (
 
 VOID
 SmbiosGetTypeDetail (
-  IN  GBL_INTERFACE         *pGblData,
-  IN  UINT8                 Skt,
-  IN  UINT8                 Ch,
-  IN  UINT8                 Dimm,
+  IN      MEMORY_DIMM_INFO          *DimmInfo,
   IN  OUT MEMORY_DEVICE_TYPE_DETAIL *TypeDetail
 )
 {
@@ -152,13 +145,13 @@ SmbiosGetTypeDetail (
         return;
     }
 
-    if(!IsDimmPresent(pGblData, Skt, Ch, Dimm))
+    if(!DimmInfo->Present)
     {
         TypeDetail->Unknown = 1;
         return;
     }
 
-    switch (pGblData->Channel[Skt][Ch].Dimm[Dimm].ModuleType)
+    switch (DimmInfo->DimmData->ModuleType)
     {
         case SPD_UDIMM:
           TypeDetail->Unbuffered = 1;
@@ -180,25 +173,22 @@ SmbiosGetTypeDetail (
 
 VOID
 SmbiosGetDimmVoltageInfo (
-  IN     GBL_INTERFACE         *pGblData,
-  IN     UINT8                 Skt,
-  IN     UINT8                 Ch,
-  IN     UINT8                 Dimm,
+  IN     MEMORY_DIMM_INFO      *DimmInfo,
   IN OUT SMBIOS_TABLE_TYPE17   *Type17Record
 
 )
 {
-    if(!IsDimmPresent(pGblData, Skt, Ch, Dimm))
+    if(!DimmInfo->Present)
     {
         return;
     }
 
-    if (pGblData->Channel[Skt][Ch].Dimm[Dimm].DramType == SPD_TYPE_DDR3)
+    if (DimmInfo->DimmData->DramType == SPD_TYPE_DDR3)
     {
         Type17Record->MinimumVoltage                = 1250;
         Type17Record->MaximumVoltage                = 1500;
 
-        switch (pGblData->Channel[Skt][Ch].Dimm[Dimm].SpdVdd)
+        switch (DimmInfo->DimmData->SpdVdd)
         {
             case SPD_VDD_150:
               Type17Record->ConfiguredVoltage = 1500;
@@ -216,11 +206,11 @@ SmbiosGetDimmVoltageInfo (
               break;
         }
     }
-    else if (pGblData->Channel[Skt][Ch].Dimm[Dimm].DramType == SPD_TYPE_DDR4)
+    else if (DimmInfo->DimmData->DramType == SPD_TYPE_DDR4)
     {
         Type17Record->MinimumVoltage                = 1200;
         Type17Record->MaximumVoltage                = 2000;
-        switch (pGblData->Channel[Skt][Ch].Dimm[Dimm].SpdVdd)
+        switch (DimmInfo->DimmData->SpdVdd)
         {
             case SPD_VDD_120:
               Type17Record->ConfiguredVoltage = 1200;
@@ -232,50 +222,109 @@ SmbiosGetDimmVoltageInfo (
     }
 }
 
-VOID
-SmbiosGetMemoryDevicesNumber (
-  IN OUT UINT16 *NumberOfDevices
-)
-{
-    UINT8       Skt, Ch, Dimm;
+/**
+  Build the DIMM inventory in one walk of the memory-init data.
 
-    for(Skt = 0; Skt < mMaxSkt; Skt++)
-    {
-        for(Ch = 0; Ch < mMaxCh; Ch++)
-        {
-            for(Dimm = 0; Dimm < OemGetDimmSlot(Skt, Ch); Dimm++)
-            {
-                (*NumberOfDevices)++;
-            }
-        }
-    }
-}
+  Every slot gets an entry, with its SMBIOS strings already rendered, so
+  that the Type 16/17/19 records can be emitted without going back to the
+  HOB or the HII database.
 
-UINT8
-SmbiosGetPartitionWidth (
-)
+  @param  pGblData          The memory-init data from the HOB.
+  @param  Inventory         On return, the slot entries. Free with FreePool ().
+  @param  NumberOfDevices   On return, the number of entries.
+
+  @retval EFI_SUCCESS            The inventory was built.
+  @retval EFI_OUT_OF_RESOURCES   The inventory could not be allocated.
+
+**/
+EFI_STATUS
+SmbiosBuildDimmInventory (
+  IN  GBL_INTERFACE      *pGblData,
+  OUT MEMORY_DIMM_INFO   **Inventory,
+  OUT UINT16             *NumberOfDevices
+  )
 {
+    MEMORY_DIMM_INFO                *DimmInfo;
+    EFI_STRING_ID                   DeviceLocator;
+    EFI_STRING                      DeviceLocatorStr;
+    UINTN                           DimmSlot;
+    UINT16                          Count;
+    UINT8                           Skt, Ch, Dimm;
 
-    UINT8       Skt, Ch, Dimm;
-    UINT8       PartitionWidth = 0;
+    *Inventory = AllocateZeroPool (sizeof (MEMORY_DIMM_INFO) * MAX_SOCKET * MAX_CHANNEL * MAX_DIMM);
+    if (NULL == *Inventory)
+    {
+        return EFI_OUT_OF_RESOURCES;
+    }
 
+    Count = 0;
     for(Skt = 0; Skt < mMaxSkt; Skt++)
     {
         for(Ch = 0; Ch < mMaxCh; Ch++)
         {
-            for(Dimm = 0; Dimm < OemGetDimmSlot(Skt, Ch); Dimm++)
+            DimmSlot = OemGetDimmSlot(Skt, Ch);
+            for(Dimm = 0; Dimm < DimmSlot; Dimm++)
             {
-                PartitionWidth++;
+                DimmInfo = &(*Inventory)[Count++];
+                DimmInfo->Skt      = Skt;
+                DimmInfo->Ch       = Ch;
+                DimmInfo->Dimm     = Dimm;
+                DimmInfo->Present  = IsDimmPresent(pGblData, Skt, Ch, Dimm);
+                DimmInfo->DimmData = &pGblData->Channel[Skt][Ch].Dimm[Dimm];
+
+                //
+                // DeviceLocator
+                //
+                DeviceLocator = gDimmToDevLocator[Skt][Ch][Dimm];
+                DeviceLocatorStr = NULL;
+                if (DeviceLocator != 0xFFFF)
+                {
+                    DeviceLocatorStr = HiiGetPackageString (&gEfiCallerIdGuid, DeviceLocator, NULL);
+                }
+                if (DeviceLocatorStr != NULL)
+                {
+                    AsciiSPrint(DimmInfo->DeviceLocator, SMBIOS_STRING_MAX_LENGTH, "DIMM%x%x%x %s", Skt, Ch, Dimm, DeviceLocatorStr);
+                    FreePool (DeviceLocatorStr);
+                }
+                else
+                {
+                    AsciiSPrint(DimmInfo->DeviceLocator, SMBIOS_STRING_MAX_LENGTH, "DIMM%x%x%x", Skt, Ch, Dimm);
+                }
+
+                //
+                // BankLocator
+                //
+                AsciiSPrint(DimmInfo->BankLocator, SMBIOS_STRING_MAX_LENGTH, "SOCKET %x CHANNEL %x DIMM %x", Skt, Ch, Dimm);
+
+                if (!DimmInfo->Present)
+                {
+                    (VOID)AsciiStrCpyS(DimmInfo->Manufacturer, SMBIOS_STRING_MAX_LENGTH, "NO DIMM");
+                    (VOID)AsciiStrCpyS(DimmInfo->SerialNumber, SMBIOS_STRING_MAX_LENGTH, "NO DIMM");
+                    (VOID)AsciiStrCpyS(DimmInfo->AssetTag, SMBIOS_STRING_MAX_LENGTH, "NO DIMM");
+                    (VOID)AsciiStrCpyS(DimmInfo->PartNumber, SMBIOS_STRING_MAX_LENGTH, "NO DIMM");
+                    continue;
+                }
+
+                DimmInfo->ConfiguredSpeed = (UINT16)pGblData->Freq;
+                SmbiosGetManufacturer (DimmInfo->DimmData->SpdMMfgId & 0xFF,
+                                       DimmInfo->DimmData->SpdMMfgId >> 8,
+                                       DimmInfo->Manufacturer
+                                       );
+                SmbiosGetSerialNumber (DimmInfo->DimmData, DimmInfo->SerialNumber);
+                (VOID)AsciiStrCpyS(DimmInfo->AssetTag, SMBIOS_STRING_MAX_LENGTH, "Unknown");
+                SmbiosGetPartNumber (DimmInfo->DimmData, DimmInfo->PartNumber);
             }
         }
     }
 
-    return PartitionWidth;
+    *NumberOfDevices = Count;
+    return EFI_SUCCESS;
 }
 
 EFI_STATUS
 SmbiosAddType16Table (
   IN  GBL_INTERFACE      *pGblData,
+  IN  UINT16             NumberOfMemoryDevices,
   OUT EFI_SMBIOS_HANDLE  *MemArraySmbiosHandle
   )
 {
@@ -283,10 +332,6 @@ SmbiosAddType16Table (
     UINT64                          MemoryCapacity;
     SMBIOS_TABLE_TYPE16             *Type16Record;
 
-    UINT16                          NumberOfMemoryDevices = 0;
-
-    SmbiosGetMemoryDevicesNumber (&NumberOfMemoryDevices);
-
     MemoryCapacity = (UINT64) LShiftU64 (NumberOfMemoryDevices * MAX_DIMM_SIZE, 20); // GB to KB.
 
     //
@@ -340,6 +385,7 @@ SmbiosAddType16Table (
 EFI_STATUS
 SmbiosAddType19Table (
   IN GBL_INTERFACE      *pGblData,
+  IN UINT16             NumberOfMemoryDevices,
   IN EFI_SMBIOS_HANDLE  MemArraySmbiosHandle
   )
 {
@@ -373,7 +419,7 @@ SmbiosAddType19Table (
     Type19Record->StartingAddress                   = 0x0;
     Type19Record->EndingAddress                     = (UINT32) (TotalMemorySize - 1); // in KB;
     Type19Record->MemoryArrayHandle                 = MemArraySmbiosHandle;
-    Type19Record->PartitionWidth                    = SmbiosGetPartitionWidth ();
+    Type19Record->PartitionWidth                    = (UINT8)NumberOfMemoryDevices;
     Type19Record->ExtendedStartingAddress           = 0x0;
     Type19Record->ExtendedEndingAddress             = 0x0;
 
@@ -391,122 +437,47 @@ SmbiosAddType19Table (
 
 EFI_STATUS
 SmbiosAddType17Table (
-  IN GBL_INTERFACE      *pGblData,
-  IN UINT8              Skt,
-  IN UINT8              Ch,
-  IN UINT8              Dimm,
-  IN EFI_SMBIOS_HANDLE  MemArraySmbiosHandle
+  IN MEMORY_DIMM_INFO     *DimmInfo,
+  IN EFI_SMBIOS_HANDLE    MemArraySmbiosHandle,
+  IN SMBIOS_TABLE_TYPE17  *Type17Record
   )
 {
     EFI_STATUS                      Status;
-    SMBIOS_TABLE_TYPE17             *Type17Record;
     EFI_SMBIOS_HANDLE               MemDevSmbiosHandle;
-    UINTN                           TableSize;
-
-    UINTN                           StringBufferSize;
-    EFI_STRING                      StringBuffer;
-    UINT16                          MemInfoMemFreq;
-    UINT16                          MemoryTotalWidth;
-    UINT16                          MemoryDataWidth;
     UINT16                          MemoryDeviceSize;
-    UINT16                          MemorySpeed;
-    UINT8                           Attributes;
     UINT32                          MemoryDeviceExtendSize;
-    UINT16                          CfgMemorySpeed;
 
     CHAR8                           *OptionalStrStart;
-    UINTN                           DeviceLocatorStrLen;
-    UINTN                           BankLocatorStrLen;
-    UINTN                           ManufactureStrLen;
-    UINTN                           SerialNumberStrLen;
-    UINTN                           AssertTagStrLen;
-    UINTN                           PartNumberStrLen;
-    EFI_STRING                      DeviceLocatorStr;
-    EFI_STRING                      BankLocatorStr;
-    EFI_STRING                      ManufactureStr;
-    EFI_STRING                      SerialNumberStr;
-    EFI_STRING                      AssertTagStr;
-    EFI_STRING                      PartNumberStr;
-    EFI_STRING_ID                   DeviceLocator;
-
-    Type17Record        = NULL;
-    DeviceLocatorStr    = NULL;
-    BankLocatorStr      = NULL;
-    ManufactureStr      = NULL;
-    SerialNumberStr     = NULL;
-    AssertTagStr        = NULL;
-    PartNumberStr       = NULL;
-
-    MemoryTotalWidth    = 0;
-    MemoryDataWidth     = 0;
-    MemoryDeviceSize    = 0;
-    MemoryDeviceExtendSize = 0;
-    MemorySpeed         = 0;
-    Attributes          = 0;
-    CfgMemorySpeed      = 0;
+    CHAR8                           *OptionalStr[MEMORY_TYPE17_STRING_COUNT];
+    UINTN                           Index;
 
-    //
-    // Allocate Buffers
-    //
-    StringBufferSize = (sizeof (CHAR16)) * SMBIOS_STRING_MAX_LENGTH;
-    StringBuffer = AllocateZeroPool (StringBufferSize);
-    if(NULL == StringBuffer)
-    {
-        return EFI_OUT_OF_RESOURCES;
-    }
-
-
-    //
-    // Manufacture
-    //
-    ManufactureStr = AllocateZeroPool (StringBufferSize);
-    if(NULL == ManufactureStr)
-    {
-        Status = EFI_OUT_OF_RESOURCES;
-        goto FREE_STR_BUF;
-    }
-    UnicodeSPrint(ManufactureStr, SMBIOS_STRING_MAX_LENGTH - 1, L"NO DIMM");
+    ZeroMem (Type17Record, MEMORY_TYPE17_RECORD_SIZE);
 
-    //
-    // SerialNumber
-    //
-    SerialNumberStr = AllocateZeroPool (StringBufferSize);
-    if(NULL == SerialNumberStr)
-    {
-        Status = EFI_OUT_OF_RESOURCES;
-        goto FREE_STR_MAN;
-    }
-    UnicodeSPrint(SerialNumberStr, SMBIOS_STRING_MAX_LENGTH - 1, L"NO DIMM");
+    Type17Record->Hdr.Type                      = EFI_SMBIOS_TYPE_MEMORY_DEVICE;
+    Type17Record->Hdr.Length                    = sizeof (SMBIOS_TABLE_TYPE17);
+    Type17Record->Hdr.Handle                    = 0;
+    Type17Record->MemoryArrayHandle             = MemArraySmbiosHandle;
+    Type17Record->MemoryErrorInformationHandle  = 0xFFFE;
+    Type17Record->FormFactor                    = MemoryFormFactorDimm;
+    Type17Record->DeviceLocator                 = 1;
+    Type17Record->BankLocator                   = 2;
+    Type17Record->MemoryType                    = SmbiosGetMemoryType (DimmInfo);
 
-    //
-    // AssetTag
-    //
-    AssertTagStr = AllocateZeroPool (StringBufferSize);
-    if(NULL == AssertTagStr)
-    {
-        Status = EFI_OUT_OF_RESOURCES;
-        goto FREE_STR_SN;
-    }
-    UnicodeSPrint(AssertTagStr, SMBIOS_STRING_MAX_LENGTH - 1, L"NO DIMM");
+    Type17Record->TypeDetail.Synchronous    = 1;
 
-    //
-    // PartNumber
-    //
-    PartNumberStr = AllocateZeroPool (StringBufferSize);
-    if(NULL == PartNumberStr)
-    {
-        Status = EFI_OUT_OF_RESOURCES;
-        goto FREE_STR_AST;
-    }
-    UnicodeSPrint(PartNumberStr, SMBIOS_STRING_MAX_LENGTH - 1, L"NO DIMM");
+    SmbiosGetTypeDetail (DimmInfo, &(Type17Record->TypeDetail));
 
+    Type17Record->Manufacturer                  = 3;
+    Type17Record->SerialNumber                  = 4;
+    Type17Record->AssetTag                      = 5;
+    Type17Record->PartNumber                    = 6;
 
-    if(IsDimmPresent(pGblData, Skt, Ch, Dimm))
+    if(DimmInfo->Present)
     {
-        MemoryDataWidth = pGblData->Channel[Skt][Ch].Dimm[Dimm].PrimaryBusWidth;
-        MemoryTotalWidth = MemoryDataWidth + pGblData->Channel[Skt][Ch].Dimm[Dimm].ExtensionBusWidth;
+        Type17Record->DataWidth = DimmInfo->DimmData->PrimaryBusWidth;
+        Type17Record->TotalWidth = Type17Record->DataWidth + DimmInfo->DimmData->ExtensionBusWidth;
 
-        MemoryDeviceSize = pGblData->Channel[Skt][Ch].Dimm[Dimm].DimmSize;  //in MB
+        MemoryDeviceSize = DimmInfo->DimmData->DimmSize;  //in MB
         MemoryDeviceExtendSize = 0;
 
         if (MemoryDeviceSize >= 0x7fff)
@@ -515,129 +486,33 @@ SmbiosAddType17Table (
             MemoryDeviceSize = 0x7fff;                    // max value
         }
 
-        MemInfoMemFreq = pGblData->Freq;
-        MemorySpeed = pGblData->Channel[Skt][Ch].Dimm[Dimm].DimmSpeed;
-        Attributes = pGblData->Channel[Skt][Ch].Dimm[Dimm].RankNum;
-        CfgMemorySpeed = MemInfoMemFreq;
-
-        //
-        // Manufacturer
-        //
-        SmbiosGetManufacturer (pGblData->Channel[Skt][Ch].Dimm[Dimm].SpdMMfgId & 0xFF,
-                                        pGblData->Channel[Skt][Ch].Dimm[Dimm].SpdMMfgId >> 8,
-                                        ManufactureStr
-                                        );
-
-        //
-        // SerialNumber
-        //
-        SmbiosGetSerialNumber(pGblData, Skt, Ch, Dimm, SerialNumberStr);
-
-        //
-        // AssetTag
-        //
-        UnicodeSPrint(AssertTagStr, SMBIOS_STRING_MAX_LENGTH - 1, L"Unknown");
-
-        //
-        // PartNumber
-        //
-        SmbiosGetPartNumber(pGblData, Skt, Ch, Dimm, PartNumberStr);
+        Type17Record->Size                          = MemoryDeviceSize;           // in MB
+        Type17Record->ExtendedSize                  = MemoryDeviceExtendSize;
+        Type17Record->Speed                         = DimmInfo->DimmData->DimmSpeed; // in MHZ
+        Type17Record->Attributes                    = DimmInfo->DimmData->RankNum;
+        Type17Record->ConfiguredMemoryClockSpeed    = DimmInfo->ConfiguredSpeed;
     }
 
     //
-    // DeviceLocator
-    //
-    DeviceLocatorStr = AllocateZeroPool ((sizeof (CHAR16)) * SMBIOS_STRING_MAX_LENGTH);
-    if(NULL == DeviceLocatorStr)
-    {
-        Status = EFI_OUT_OF_RESOURCES;
-        goto FREE_STR_PN;
-    }
-    DeviceLocator = gDimmToDevLocator[Skt][Ch][Dimm];
-    if (DeviceLocator != 0xFFFF)
-    {
-        UnicodeSPrint(DeviceLocatorStr, SMBIOS_STRING_MAX_LENGTH, L"DIMM%x%x%x ", Skt, Ch, Dimm);
-        StringBuffer = HiiGetPackageString (&gEfiCallerIdGuid, DeviceLocator, NULL);
-        (VOID)StrCatS(DeviceLocatorStr, SMBIOS_STRING_MAX_LENGTH, StringBuffer);
-    }
-    else
-    {
-    UnicodeSPrint(DeviceLocatorStr, SMBIOS_STRING_MAX_LENGTH, L"DIMM%x%x%x", Skt, Ch, Dimm);
-    }
-    DeviceLocatorStrLen = StrLen (DeviceLocatorStr);
-
-    //
-    // BankLocator
+    // Add for smbios 2.8.0
     //
-    BankLocatorStr = AllocateZeroPool ((sizeof (CHAR16)) * SMBIOS_STRING_MAX_LENGTH);
-    if(NULL == BankLocatorStr)
-    {
-        Status = EFI_OUT_OF_RESOURCES;
-        goto FREE_STR_DEV;
-    }
-    UnicodeSPrint(BankLocatorStr, SMBIOS_STRING_MAX_LENGTH, L"SOCKET %x CHANNEL %x DIMM %x", Skt, Ch, Dimm);
-    BankLocatorStrLen = StrLen (BankLocatorStr);
+    SmbiosGetDimmVoltageInfo (DimmInfo, Type17Record);
 
-    ManufactureStrLen = StrLen (ManufactureStr);
-    SerialNumberStrLen = StrLen (SerialNumberStr);
-    AssertTagStrLen = StrLen (AssertTagStr);
-    PartNumberStrLen = StrLen (PartNumberStr);
+    OptionalStr[0] = DimmInfo->DeviceLocator;
+    OptionalStr[1] = DimmInfo->BankLocator;
+    OptionalStr[2] = DimmInfo->Manufacturer;
+    OptionalStr[3] = DimmInfo->SerialNumber;
+    OptionalStr[4] = DimmInfo->AssetTag;
+    OptionalStr[5] = DimmInfo->PartNumber;
 
-    //
-    // Report Type 17 SMBIOS Record
-    //
-    TableSize = sizeof(SMBIOS_TABLE_TYPE17) + DeviceLocatorStrLen + 1 + BankLocatorStrLen + 1 + ManufactureStrLen + 1 + SerialNumberStrLen + 1 + AssertTagStrLen + 1 + PartNumberStrLen + 1 + 1;
-    Type17Record = AllocateZeroPool (TableSize);
-    if(NULL == Type17Record)
+    OptionalStrStart = (CHAR8 *) (Type17Record + 1);
+    for (Index = 0; Index < ARRAY_SIZE (OptionalStr); Index++)
     {
-        Status = EFI_OUT_OF_RESOURCES;
-        goto FREE_BL;
+        Status = AsciiStrCpyS (OptionalStrStart, SMBIOS_STRING_MAX_LENGTH, OptionalStr[Index]);
+        ASSERT_EFI_ERROR (Status);
+        OptionalStrStart += AsciiStrLen (OptionalStrStart) + 1;
     }
 
-    Type17Record->Hdr.Type                      = EFI_SMBIOS_TYPE_MEMORY_DEVICE;
-    Type17Record->Hdr.Length                    = sizeof (SMBIOS_TABLE_TYPE17);
-    Type17Record->Hdr.Handle                    = 0;
-    Type17Record->MemoryArrayHandle             = MemArraySmbiosHandle;
-    Type17Record->MemoryErrorInformationHandle  = 0xFFFE;
-    Type17Record->TotalWidth                    = MemoryTotalWidth;
-    Type17Record->DataWidth                     = MemoryDataWidth;
-    Type17Record->Size                          = MemoryDeviceSize;           // in MB
-    Type17Record->FormFactor                    = MemoryFormFactorDimm;
-    Type17Record->DeviceLocator                 = 1;
-    Type17Record->BankLocator                   = 2;
-    Type17Record->MemoryType                    = SmbiosGetMemoryType (pGblData, Skt, Ch, Dimm);
-
-    Type17Record->TypeDetail.Synchronous    = 1;
-
-    SmbiosGetTypeDetail (pGblData, Skt, Ch, Dimm, &(Type17Record->TypeDetail));
-
-    Type17Record->Speed                         = MemorySpeed; // in MHZ
-    Type17Record->Manufacturer                  = 3;
-    Type17Record->SerialNumber                  = 4;
-    Type17Record->AssetTag                      = 5;
-    Type17Record->PartNumber                    = 6;
-    Type17Record->Attributes                    = Attributes;
-    Type17Record->ExtendedSize                  = MemoryDeviceExtendSize;
-    Type17Record->ConfiguredMemoryClockSpeed    = CfgMemorySpeed;
-    //
-    // Add for smbios 2.8.0
-    //
-    SmbiosGetDimmVoltageInfo (pGblData, Skt, Ch, Dimm, Type17Record);
-
-    OptionalStrStart = (CHAR8 *) (Type17Record + 1);
-    Status = UnicodeStrToAsciiStrS (DeviceLocatorStr, OptionalStrStart, DeviceLocatorStrLen + 1);
-    ASSERT_EFI_ERROR (Status);
-    Status = UnicodeStrToAsciiStrS (BankLocatorStr, OptionalStrStart + DeviceLocatorStrLen + 1, BankLocatorStrLen + 1);
-    ASSERT_EFI_ERROR (Status);
-    Status = UnicodeStrToAsciiStrS (ManufactureStr, OptionalStrStart + DeviceLocatorStrLen + 1 + BankLocatorStrLen + 1, ManufactureStrLen + 1);
-    ASSERT_EFI_ERROR (Status);
-    Status = UnicodeStrToAsciiStrS (SerialNumberStr, OptionalStrStart + DeviceLocatorStrLen + 1 + BankLocatorStrLen + 1 + ManufactureStrLen + 1, SerialNumberStrLen + 1);
-    ASSERT_EFI_ERROR (Status);
-    Status = UnicodeStrToAsciiStrS (AssertTagStr, OptionalStrStart + DeviceLocatorStrLen + 1 + BankLocatorStrLen + 1 + ManufactureStrLen + 1 + SerialNumberStrLen + 1, AssertTagStrLen + 1);
-    ASSERT_EFI_ERROR (Status);
-    Status = UnicodeStrToAsciiStrS (PartNumberStr, OptionalStrStart + DeviceLocatorStrLen + 1 + BankLocatorStrLen + 1 + ManufactureStrLen + 1 + SerialNumberStrLen + 1 + AssertTagStrLen + 1, PartNumberStrLen + 1);
-    ASSERT_EFI_ERROR (Status);
-
     MemDevSmbiosHandle = SMBIOS_HANDLE_PI_RESERVED;
     Status = mSmbios->Add (mSmbios, NULL, &MemDevSmbiosHandle, (EFI_SMBIOS_TABLE_HEADER*) Type17Record);
     if(EFI_ERROR(Status))
@@ -645,29 +520,6 @@ SmbiosAddType17Table (
         DEBUG((EFI_D_ERROR, "[%a]:[%dL] Smbios Type17 Table Log Failed! %r \n", __FUNCTION__, __LINE__, Status));
     }
 
-    FreePool (Type17Record);
-
-FREE_BL:
-    FreePool (BankLocatorStr);
-
-FREE_STR_DEV:
-    FreePool (DeviceLocatorStr);
-
-FREE_STR_PN:
-    FreePool (PartNumberStr);
-
-FREE_STR_AST:
-    FreePool (AssertTagStr);
-
-FREE_STR_SN:
-    FreePool (SerialNumberStr);
-
-FREE_STR_MAN:
-    FreePool (ManufactureStr);
-
-FREE_STR_BUF:
-    FreePool (StringBuffer);
-
     return Status;
 }
 
@@ -694,7 +546,10 @@ MemorySubClassEntryPoint(
     EFI_HOB_GUID_TYPE               *GuidHob;
     GBL_INTERFACE                   *pGblData;
     EFI_SMBIOS_HANDLE               MemArraySmbiosHandle;
-    UINT8                           Skt, Ch, Dimm;
+    MEMORY_DIMM_INFO                *Inventory;
+    SMBIOS_TABLE_TYPE17             *Type17Record;
+    UINT16                          NumberOfDevices;
+    UINT16                          Index;
 
     GuidHob = GetFirstGuidHob(&gHisiEfiMemoryMapGuid);
     if(NULL == GuidHob)
@@ -729,34 +584,50 @@ MemorySubClassEntryPoint(
     // Get DIMM slot number on Socket 0 Channel 0
     // TODO: Assume all channels have same slot number
 
-    Status = SmbiosAddType16Table (pGblData, &MemArraySmbiosHandle);
+    //
+    // Take one snapshot of every slot, then emit all the records from it.
+    //
+    Status = SmbiosBuildDimmInventory (pGblData, &Inventory, &NumberOfDevices);
+    if(EFI_ERROR(Status))
+    {
+        return Status;
+    }
+
+    Type17Record = AllocatePool (MEMORY_TYPE17_RECORD_SIZE);
+    if(NULL == Type17Record)
+    {
+        Status = EFI_OUT_OF_RESOURCES;
+        goto FREE_INVENTORY;
+    }
+
+    Status = SmbiosAddType16Table (pGblData, NumberOfDevices, &MemArraySmbiosHandle);
     if(EFI_ERROR(Status))
     {
         DEBUG((EFI_D_ERROR, "Smbios Add Type16 Table Failed.  %r\n", Status));
-        return Status;
+        goto FREE_RECORD;
     }
 
-    Status = SmbiosAddType19Table (pGblData, MemArraySmbiosHandle);
+    Status = SmbiosAddType19Table (pGblData, NumberOfDevices, MemArraySmbiosHandle);
     if(EFI_ERROR(Status))
     {
         DEBUG((EFI_D_ERROR, "Smbios Add Type19 Table Failed.  %r\n", Status));
-        return Status;
+        goto FREE_RECORD;
     }
 
-    for(Skt = 0; Skt < mMaxSkt; Skt++)
+    for(Index = 0; Index < NumberOfDevices; Index++)
     {
-        for(Ch = 0; Ch < mMaxCh; Ch++)
+        Status = SmbiosAddType17Table (&Inventory[Index], MemArraySmbiosHandle, Type17Record);
+        if(EFI_ERROR(Status))
         {
-            for(Dimm = 0; Dimm < OemGetDimmSlot(Skt, Ch); Dimm++)
-            {
-                Status = SmbiosAddType17Table (pGblData, Skt, Ch, Dimm, MemArraySmbiosHandle);
-                if(EFI_ERROR(Status))
-                {
-                    DEBUG((EFI_D_ERROR, "Smbios Add Type17 Table Failed.  %r\n", Status));
-                }
-            }
+            DEBUG((EFI_D_ERROR, "Smbios Add Type17 Table Failed.  %r\n", Status));
         }
     }
 
+FREE_RECORD:
+    FreePool (Type17Record);
+
+FREE_INVENTORY:
+    FreePool (Inventory);
+
     return Status;
 }
@@ -38,6 +38,31 @@
 
 extern UINT8 MemorySubClassStrings[];
 
+//
+// Room for a Type 17 record with all of its six strings at full length
+//
+#define MEMORY_TYPE17_STRING_COUNT  6
+#define MEMORY_TYPE17_RECORD_SIZE   (sizeof (SMBIOS_TABLE_TYPE17) + \
+                                     MEMORY_TYPE17_STRING_COUNT * SMBIOS_STRING_MAX_LENGTH + 1)
+
+//
+// One DIMM slot of the inventory, with its SMBIOS strings rendered in ASCII
+//
+typedef struct {
+    UINT8           Skt;
+    UINT8           Ch;
+    UINT8           Dimm;
+    BOOLEAN         Present;
+    DDR_DIMM_DATA   *DimmData;
+    UINT16          ConfiguredSpeed;
+    CHAR8           DeviceLocator[SMBIOS_STRING_MAX_LENGTH];
+    CHAR8           BankLocator[SMBIOS_STRING_MAX_LENGTH];
+    CHAR8           Manufacturer[SMBIOS_STRING_MAX_LENGTH];
+    CHAR8           SerialNumber[SMBIOS_STRING_MAX_LENGTH];
+    CHAR8           AssetTag[SMBIOS_STRING_MAX_LENGTH];
+    CHAR8           PartNumber[SMBIOS_STRING_MAX_LENGTH];
+} MEMORY_DIMM_INFO;
+
 struct SPD_JEDEC_MANUFACTURER
 {
     UINT8  MfgIdLSB;
@@ -12,6 +12,7 @@
 
 #include <Library/PciSegmentLib.h>
 #include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
 #include <Library/DebugLib.h>
 #include <Library/IoLib.h>
 #include <Library/PlatformPciLib.h>
@@ -43,6 +44,33 @@ typedef enum {
   (Register) = ((Address)       & 0xfff);  \
 }
 
+//
+// Segments below this number are resolved through mSegmentTable, higher
+// ones by walking mResAppeture.
+//
+#define PCI_SEGMENT_TABLE_SIZE      (PCIE_MAX_HOSTBRIDGE * PCIE_MAX_ROOTBRIDGE)
+
+//
+// Number of config accesses between two reports of the access counters
+//
+#define PCI_SEGMENT_STATS_INTERVAL  0x1000
+
+typedef struct {
+  PCI_ROOT_BRIDGE_RESOURCE_APPETURE *Appeture;
+  //
+  // The link of the root port was seen up. Only the up state is cached, a
+  // link that is down may still come up later.
+  //
+  BOOLEAN                           LinkUp;
+} PCI_SEGMENT_ENTRY;
+
+STATIC PCI_SEGMENT_ENTRY  mSegmentTable[PCI_SEGMENT_TABLE_SIZE];
+STATIC BOOLEAN            mSegmentTableReady;
+
+STATIC UINTN              mReadCount;
+STATIC UINTN              mWriteCount;
+STATIC UINTN              mLinkCheckCount;
+
 STATIC
 PCI_ROOT_BRIDGE_RESOURCE_APPETURE *
 PciSegmentLibGetAppeture (
@@ -69,6 +97,10 @@ BOOLEAN PcieIsLinkUp (UINTN RbPciBar)
 {
   UINT32 Value;
 
+  DEBUG_CODE (
+    mLinkCheckCount++;
+  );
+
   Value = MmioRead32(RbPciBar + 0x131C);
   if ((Value & 0x3F) == 0x11) {
     return TRUE;
@@ -76,6 +108,127 @@ BOOLEAN PcieIsLinkUp (UINTN RbPciBar)
   return FALSE;
 }
 
+/**
+  Fill mSegmentTable from mResAppeture.
+
+  The first root bridge found for a segment wins, as with
+  PciSegmentLibGetAppeture ().
+
+**/
+STATIC
+VOID
+PciSegmentLibBuildTable (
+  VOID
+  )
+{
+  UINTN Hb;
+  UINTN Rb;
+  UINT32 Segment;
+
+  for (Hb = 0; Hb < PCIE_MAX_HOSTBRIDGE; Hb++) {
+    for (Rb = 0; Rb < PCIE_MAX_ROOTBRIDGE; Rb++) {
+      Segment = mResAppeture[Hb][Rb].Segment;
+      if (Segment < PCI_SEGMENT_TABLE_SIZE &&
+          mSegmentTable[Segment].Appeture == NULL) {
+        mSegmentTable[Segment].Appeture = &mResAppeture[Hb][Rb];
+      }
+    }
+  }
+  mSegmentTableReady = TRUE;
+}
+
+/**
+  Report the config access counters of this module every
+  PCI_SEGMENT_STATS_INTERVAL accesses, so that each phase of the boot shows
+  up under the name of the module doing the accesses.
+
+**/
+STATIC
+VOID
+PciSegmentLibCountAccess (
+  IN  UINTN   *Counter
+  )
+{
+  (*Counter)++;
+  if (((mReadCount + mWriteCount) % PCI_SEGMENT_STATS_INTERVAL) == 0) {
+    DEBUG ((DEBUG_VERBOSE, "%a: %a: PCI config reads %Lu writes %Lu link checks %Lu\n",
+      gEfiCallerBaseName, __FUNCTION__, (UINT64)mReadCount, (UINT64)mWriteCount,
+      (UINT64)mLinkCheckCount));
+  }
+}
+
+/**
+  Translate a PCI Segment address into the MMIO address of the register.
+
+  @param  Address       The address that encodes the PCI Segment, Bus, Device,
+                        Function and Register.
+  @param  Write         The register is about to be written.
+  @param  MmioAddress   On return, the MMIO address of the register, or 0 if
+                        the access must be dropped.
+
+  @retval TRUE          MmioAddress is valid, or the access must be dropped.
+  @retval FALSE         The device cannot be reached.
+
+**/
+STATIC
+BOOLEAN
+PciSegmentLibGetMmioAddress (
+  IN  UINT64                      Address,
+  IN  BOOLEAN                     Write,
+  OUT UINT64                      *MmioAddress
+  )
+{
+  PCI_ROOT_BRIDGE_RESOURCE_APPETURE *Appeture;
+  PCI_SEGMENT_ENTRY *Entry;
+  UINT32    Segment;
+  UINT8     Bus;
+  UINT8     Device;
+  UINT8     Function;
+  UINT32    Register;
+
+  EXTRACT_PCIE_ADDRESS (Address, Segment, Bus, Device, Function, Register);
+
+  if (!mSegmentTableReady) {
+    PciSegmentLibBuildTable ();
+  }
+  Entry = NULL;
+  if (Segment < PCI_SEGMENT_TABLE_SIZE) {
+    Entry = &mSegmentTable[Segment];
+    Appeture = Entry->Appeture;
+    ASSERT (Appeture != NULL);
+  } else {
+    Appeture = PciSegmentLibGetAppeture (Segment);
+  }
+  if (Appeture == NULL) {
+    return FALSE;
+  }
+
+  *MmioAddress = 0;
+  if (Bus == Appeture->BusBase) {
+    // ignore device > 0 or function > 0 on base bus
+    if (Device != 0 || Function != 0) {
+      return !Write;
+    }
+    // Ignore writing to root port BAR registers, in case we get wrong BAR length
+    if (Write && ((Register & ~0x3) == 0x14 || (Register & ~0x3) == 0x10)) {
+      return TRUE;
+    }
+    *MmioAddress = Appeture->RbPciBar + Register;
+  } else {
+    // Cannot read from device under root port when link is not up
+    if (Bus == Appeture->BusBase + 1 && (Entry == NULL || !Entry->LinkUp)) {
+      if (!PcieIsLinkUp (Appeture->RbPciBar)) {
+        return FALSE;
+      }
+      if (Entry != NULL) {
+        Entry->LinkUp = TRUE;
+      }
+    }
+    *MmioAddress = Appeture->Ecam + (UINT32)Address;
+  }
+  return TRUE;
+}
+
 
 STATIC
 UINT32
@@ -155,34 +308,15 @@ PciSegmentLibReadWorker (
   IN  PCI_CFG_WIDTH               Width
   )
 {
-  PCI_ROOT_BRIDGE_RESOURCE_APPETURE *Appeture;
-  UINT32    Segment;
-  UINT8     Bus;
-  UINT8     Device;
-  UINT8     Function;
-  UINT32    Register;
-
   UINT64    MmioAddress;
 
-  EXTRACT_PCIE_ADDRESS (Address, Segment, Bus, Device, Function, Register);
-  Appeture = PciSegmentLibGetAppeture (Segment);
-  if (Appeture == NULL) {
-    return 0xffffffff;
-  }
-
-  if (Bus == Appeture->BusBase) {
-    // ignore device > 0 or function > 0 on base bus
-    if (Device != 0 || Function != 0) {
-      return 0xffffffff;
-    }
-    MmioAddress = Appeture->RbPciBar + Register;
-  } else {
-    // Cannot read from device under root port when link is not up
-    if (Bus == Appeture->BusBase + 1 && !PcieIsLinkUp (Appeture->RbPciBar)) {
-      return 0xffffffff;
-    }
+  DEBUG_CODE (
+    PciSegmentLibCountAccess (&mReadCount);
+  );
 
-    MmioAddress = Appeture->Ecam + (UINT32)Address;
+  if (!PciSegmentLibGetMmioAddress (Address, FALSE, &MmioAddress) ||
+      MmioAddress == 0) {
+    return 0xffffffff;
   }
 
   return CpuMemoryServiceRead (MmioAddress, Width);
@@ -207,37 +341,17 @@ PciSegmentLibWriteWorker (
   IN  UINT32                      Data
   )
 {
-  PCI_ROOT_BRIDGE_RESOURCE_APPETURE *Appeture;
-  UINT32    Segment;
-  UINT8     Bus;
-  UINT8     Device;
-  UINT8     Function;
-  UINT32    Register;
-
   UINT64    MmioAddress;
 
-  EXTRACT_PCIE_ADDRESS (Address, Segment, Bus, Device, Function, Register);
-  Appeture = PciSegmentLibGetAppeture (Segment);
-  if (Appeture == NULL) {
+  DEBUG_CODE (
+    PciSegmentLibCountAccess (&mWriteCount);
+  );
+
+  if (!PciSegmentLibGetMmioAddress (Address, TRUE, &MmioAddress)) {
     return 0xffffffff;
   }
-
-  if (Bus == Appeture->BusBase) {
-    // ignore device > 0 or function > 0 on base bus
-    if (Device != 0 || Function != 0) {
-      return Data;
-    }
-    // Ignore writing to root port BAR registers, in case we get wrong BAR length
-    if ((Register & ~0x3) == 0x14 || (Register & ~0x3) == 0x10) {
-      return Data;
-    }
-    MmioAddress = Appeture->RbPciBar + Register;
-  } else {
-    // Cannot read from device under root port when link is not up
-    if (Bus == Appeture->BusBase + 1 && !PcieIsLinkUp (Appeture->RbPciBar)) {
-      return 0xffffffff;
-    }
-    MmioAddress = Appeture->Ecam + (UINT32)Address;
+  if (MmioAddress == 0) {
+    return Data;
   }
 
   return CpuMemoryServiceWrite (MmioAddress, Width, Data);
@@ -1331,6 +1445,7 @@ PciSegmentReadBuffer (
   )
 {
   UINTN                             ReturnValue;
+  UINT64                            MmioAddress;
 
   ASSERT_INVALID_PCI_SEGMENT_ADDRESS (StartAddress, 0);
   ASSERT (((StartAddress & 0xFFF) + Size) <= 0x1000);
@@ -1346,22 +1461,35 @@ PciSegmentReadBuffer (
   //
   ReturnValue = Size;
 
-  if ((StartAddress & BIT0) != 0) {
+  //
+  // The whole buffer lies in the config space of one function, so resolve
+  // the register address once and read straight from MMIO.
+  //
+  DEBUG_CODE (
+    PciSegmentLibCountAccess (&mReadCount);
+  );
+  if (!PciSegmentLibGetMmioAddress (StartAddress, FALSE, &MmioAddress) ||
+      MmioAddress == 0) {
+    SetMem (Buffer, Size, 0xff);
+    return ReturnValue;
+  }
+
+  if ((MmioAddress & BIT0) != 0) {
     //
-    // Read a byte if StartAddress is byte aligned
+    // Read a byte if MmioAddress is byte aligned
     //
-    *(volatile UINT8 *)Buffer = PciSegmentRead8 (StartAddress);
-    StartAddress += sizeof (UINT8);
+    *(volatile UINT8 *)Buffer = (UINT8)CpuMemoryServiceRead (MmioAddress, PciCfgWidthUint8);
+    MmioAddress += sizeof (UINT8);
     Size -= sizeof (UINT8);
     Buffer = (UINT8*)Buffer + 1;
   }
 
-  if (Size >= sizeof (UINT16) && (StartAddress & BIT1) != 0) {
+  if (Size >= sizeof (UINT16) && (MmioAddress & BIT1) != 0) {
     //
-    // Read a word if StartAddress is word aligned
+    // Read a word if MmioAddress is word aligned
     //
-    WriteUnaligned16 (Buffer, PciSegmentRead16 (StartAddress));
-    StartAddress += sizeof (UINT16);
+    WriteUnaligned16 (Buffer, (UINT16)CpuMemoryServiceRead (MmioAddress, PciCfgWidthUint16));
+    MmioAddress += sizeof (UINT16);
     Size -= sizeof (UINT16);
     Buffer = (UINT16*)Buffer + 1;
   }
@@ -1370,8 +1498,8 @@ PciSegmentReadBuffer (
     //
     // Read as many double words as possible
     //
-    WriteUnaligned32 (Buffer, PciSegmentRead32 (StartAddress));
-    StartAddress += sizeof (UINT32);
+    WriteUnaligned32 (Buffer, CpuMemoryServiceRead (MmioAddress, PciCfgWidthUint32));
+    MmioAddress += sizeof (UINT32);
     Size -= sizeof (UINT32);
     Buffer = (UINT32*)Buffer + 1;
   }
@@ -1380,8 +1508,8 @@ PciSegmentReadBuffer (
     //
     // Read the last remaining word if exist
     //
-    WriteUnaligned16 (Buffer, PciSegmentRead16 (StartAddress));
-    StartAddress += sizeof (UINT16);
+    WriteUnaligned16 (Buffer, (UINT16)CpuMemoryServiceRead (MmioAddress, PciCfgWidthUint16));
+    MmioAddress += sizeof (UINT16);
     Size -= sizeof (UINT16);
     Buffer = (UINT16*)Buffer + 1;
   }
@@ -1390,7 +1518,7 @@ PciSegmentReadBuffer (
     //
     // Read the last remaining byte if exist
     //
-    *(volatile UINT8 *)Buffer = PciSegmentRead8 (StartAddress);
+    *(volatile UINT8 *)Buffer = (UINT8)CpuMemoryServiceRead (MmioAddress, PciCfgWidthUint8);
   }
 
   return ReturnValue;
@@ -25,6 +25,14 @@
 #define I2C_SS_SCLLCNT               0x4fe
 #define I2C_CMD_STOP_BIT             BIT9
 
+// Commands kept in flight, the TX and RX FIFOs hold more than the threshold
+#define I2C_FIFO_BATCH               (I2C_TXRX_THRESHOLD + 1)
+#define I2C_INTR_TX_ABRT             BIT6
+
+// Idle polling, same overall timeout as I2C_READ_TIMEOUT 10ms steps
+#define I2C_IDLE_POLL_DELAY          10
+#define I2C_IDLE_POLLS_PER_DELAY     1000
+
 #define I2C_REG_WRITE(reg,data) \
      MmioWrite32 ((reg), (data))
 
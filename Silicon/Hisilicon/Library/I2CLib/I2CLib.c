@@ -35,32 +35,56 @@ I2C_Delay (
 }
 
 
+/**
+  Wait for the controller to finish the current transfer.
+
+  The status is polled in short steps, a transfer ends within a few bit times
+  of its stop condition.
+
+**/
+STATIC
 EFI_STATUS
-EFIAPI
-I2C_Disable (
+I2C_WaitIdle (
   UINT32 Socket,
   UINT8  Port
   )
 {
-  UINT32                  TimeCnt = I2C_READ_TIMEOUT;
+  UINT32                  TimeCnt = I2C_READ_TIMEOUT * I2C_IDLE_POLLS_PER_DELAY;
   I2C0_STATUS_U           I2cStatusReg;
-  I2C0_ENABLE_U           I2cEnableReg;
-  I2C0_ENABLE_STATUS_U    I2cEnableStatusReg;
 
   UINTN Base = GetI2cBase (Socket, Port);
 
-  I2C_REG_READ ((Base + I2C_STATUS_OFFSET), I2cStatusReg.Val32);
-
+  I2C_REG_READ (Base + I2C_STATUS_OFFSET, I2cStatusReg.Val32);
   while (I2cStatusReg.bits.activity) {
-    I2C_Delay (10000);
+    I2C_Delay (I2C_IDLE_POLL_DELAY);
 
     TimeCnt--;
     I2C_REG_READ (Base + I2C_STATUS_OFFSET, I2cStatusReg.Val32);
     if (TimeCnt == 0) {
-      return EFI_DEVICE_ERROR;
+      return EFI_TIMEOUT;
     }
   }
 
+  return EFI_SUCCESS;
+}
+
+
+EFI_STATUS
+EFIAPI
+I2C_Disable (
+  UINT32 Socket,
+  UINT8  Port
+  )
+{
+  I2C0_ENABLE_U           I2cEnableReg;
+  I2C0_ENABLE_STATUS_U    I2cEnableStatusReg;
+
+  UINTN Base = GetI2cBase (Socket, Port);
+
+  if (I2C_WaitIdle (Socket, Port) != EFI_SUCCESS) {
+    return EFI_DEVICE_ERROR;
+  }
+
   I2C_REG_READ (Base + I2C_ENABLE_OFFSET, I2cEnableReg.Val32);
   I2cEnableReg.bits.enable = 0;
   I2C_REG_WRITE (Base + I2C_ENABLE_OFFSET, I2cEnableReg.Val32);
@@ -91,6 +115,12 @@ I2C_Enable (
   I2cEnableReg.bits.enable = 1;
   I2C_REG_WRITE (Base + I2C_ENABLE_OFFSET, I2cEnableReg.Val32);
 
+  // The controller is usually enabled within a few cycles
+  I2C_REG_READ (Base + I2C_ENABLE_STATUS_OFFSET, I2cEnableStatusReg.Val32);
+  if (I2cEnableStatusReg.bits.ic_en != 0) {
+    return EFI_SUCCESS;
+  }
+
   do {
     // This is a empirical value for I2C delay. MemoryFence is no need here.
     I2C_Delay (10000);
@@ -294,19 +324,60 @@ CheckI2CTimeOut (
 }
 
 
+/**
+  Run one transaction: write the offset and data bytes, then read RxLen bytes
+  after a repeated start, and stop.
+
+  The commands are streamed through the TX FIFO, keeping it filled up to the
+  FIFO threshold and never more reads in flight than the RX FIFO can hold, and
+  the RX FIFO is drained as it fills. The status is only polled with a delay
+  when neither FIFO made progress.
+
+  @param  I2cInfo       The I2C device.
+  @param  OffsetBuf     The offset bytes, sent first.
+  @param  OffsetLen     Number of offset bytes.
+  @param  TxBuf         The data bytes, sent after the offset.
+  @param  TxLen         Number of data bytes.
+  @param  RxBuf         Buffer receiving the bytes read.
+  @param  RxLen         Number of bytes to read.
+
+  @retval EFI_SUCCESS       The transaction completed.
+  @retval EFI_DEVICE_ERROR  The device did not acknowledge.
+  @retval EFI_TIMEOUT       The controller stopped making progress.
+
+**/
+STATIC
 EFI_STATUS
-EFIAPI
-WriteBeforeRead (
+I2C_Transfer (
   I2C_DEVICE *I2cInfo,
-  UINT32     Length,
-  UINT8      *pBuf
+  UINT8      *OffsetBuf,
+  UINT32     OffsetLen,
+  UINT8      *TxBuf,
+  UINT32     TxLen,
+  UINT8      *RxBuf,
+  UINT32     RxLen
   )
 {
-  UINT32 Fifo;
-  UINT32 Count;
-  UINT32 Times = 0;
+  UINTN   Base;
+  UINT32  Total;
+  UINT32  Issued;
+  UINT32  Received;
+  UINT32  Cmd;
+  UINT32  TxLevel;
+  UINT32  RxLevel;
+  UINT32  RawIntr;
+  UINT32  Times;
+  UINT32  Step;
+  BOOLEAN Progress;
 
-  UINTN  Base = GetI2cBase (I2cInfo->Socket, I2cInfo->Port);
+  Base = GetI2cBase (I2cInfo->Socket, I2cInfo->Port);
+  Total = OffsetLen + TxLen + RxLen;
+  Issued = 0;
+  Received = 0;
+  Times = 0;
+
+  // These are empirical values for I2C delay. MemoryFence is no need here.
+  Step = (I2cInfo->Port == I2C_EXTENDER_PORT_HNS) ? 1000 : 2;
 
   I2C_SetTarget (I2cInfo->Socket, I2cInfo->Port, I2cInfo->SlaveDeviceAddress);
 
@@ -314,25 +385,77 @@ WriteBeforeRead (
     return EFI_TIMEOUT;
   }
 
-  Fifo = 0;
-  for (Count = 0; Count < Length; Count++) {
-    Times = 0;
-    while (Fifo > I2C_TXRX_THRESHOLD) {
-      I2C_Delay (2);
+  // Drop an abort left over by an earlier transaction
+  I2C_REG_READ (Base + I2C_CLR_TX_ABRT_OFFSET, RawIntr);
+
+  while ((Issued < Total) || (Received < RxLen)) {
+    Progress = FALSE;
+
+    TxLevel = I2C_GetTxStatus (I2cInfo->Socket, I2cInfo->Port);
+    while ((Issued < Total) && (TxLevel < I2C_FIFO_BATCH)) {
+      if (Issued < OffsetLen) {
+        Cmd = OffsetBuf[Issued];
+      } else if (Issued < OffsetLen + TxLen) {
+        Cmd = TxBuf[Issued - OffsetLen];
+      } else {
+        if (Issued - OffsetLen - TxLen - Received >= I2C_FIFO_BATCH) {
+          break;
+        }
+        Cmd = I2C_READ_SIGNAL;
+      }
+
+      if (Issued == Total - 1) {
+        //Send command stop bit for the last transfer
+        Cmd |= I2C_CMD_STOP_BIT;
+      }
+
+      I2C_REG_WRITE (Base + I2C_DATA_CMD_OFFSET, Cmd);
+      Issued++;
+      TxLevel++;
+      Progress = TRUE;
+    }
+
+    if (Received < RxLen) {
+      RxLevel = I2C_GetRxStatus (I2cInfo->Socket, I2cInfo->Port);
+      while ((RxLevel > 0) && (Received < RxLen)) {
+        I2C_REG_READ (Base + I2C_DATA_CMD_OFFSET, RxBuf[Received++]);
+        RxLevel--;
+        Progress = TRUE;
+      }
+    }
+
+    I2C_REG_READ (Base + I2C_RAW_INTR_STAT_OFFSET, RawIntr);
+    if ((RawIntr & I2C_INTR_TX_ABRT) != 0) {
+      I2C_REG_READ (Base + I2C_CLR_TX_ABRT_OFFSET, RawIntr);
+      return EFI_DEVICE_ERROR;
+    }
+
+    if (Progress) {
+      Times = 0;
+    } else {
       if (++Times > I2C_READ_TIMEOUT) {
         return EFI_TIMEOUT;
       }
-      Fifo = I2C_GetTxStatus (I2cInfo->Socket, I2cInfo->Port);
+      I2C_Delay (Step);
     }
-
-    I2C_REG_WRITE (Base + I2C_DATA_CMD_OFFSET, *pBuf++);
-    Fifo = I2C_GetTxStatus (I2cInfo->Socket, I2cInfo->Port);
   }
 
   if (CheckI2CTimeOut (I2cInfo->Socket, I2cInfo->Port, I2CTx) == EFI_TIMEOUT) {
     return EFI_TIMEOUT;
   }
 
+  if (I2C_WaitIdle (I2cInfo->Socket, I2cInfo->Port) != EFI_SUCCESS) {
+    return EFI_TIMEOUT;
+  }
+
+  // A write has no data phase to fail on, the NACK of its last bytes only
+  // shows once the transaction has ended
+  I2C_REG_READ (Base + I2C_RAW_INTR_STAT_OFFSET, RawIntr);
+  if ((RawIntr & I2C_INTR_TX_ABRT) != 0) {
+    I2C_REG_READ (Base + I2C_CLR_TX_ABRT_OFFSET, RawIntr);
+    return EFI_DEVICE_ERROR;
+  }
+
   return EFI_SUCCESS;
 }
 
@@ -346,63 +469,28 @@ I2CWrite(
   UINT8 *pBuf
   )
 {
-  UINT32 Fifo;
-  UINT32 Times = 0;
-  UINT32  Idx;
-  UINTN  Base;
+  UINT8       I2CWAddr[2];
+  UINT32      AddrLen;
+  EFI_STATUS  Status;
 
   if (I2cInfo->Port >= I2C_PORT_MAX) {
     return EFI_INVALID_PARAMETER;
   }
 
-  Base = GetI2cBase (I2cInfo->Socket, I2cInfo->Port);
-
-  (VOID)I2C_Enable(I2cInfo->Socket, I2cInfo->Port);
-
-  I2C_SetTarget(I2cInfo->Socket, I2cInfo->Port, I2cInfo->SlaveDeviceAddress);
-
-  if (CheckI2CTimeOut (I2cInfo->Socket, I2cInfo->Port, I2CTx) == EFI_TIMEOUT) {
-    return EFI_TIMEOUT;
-  }
-
   if (I2cInfo->DeviceType) {
-    I2C_REG_WRITE (Base + I2C_DATA_CMD_OFFSET, (InfoOffset >> 8) & 0xff);
-    I2C_REG_WRITE (Base + I2C_DATA_CMD_OFFSET, InfoOffset & 0xff);
+    I2CWAddr[0] = (InfoOffset >> 8) & 0xff;
+    I2CWAddr[1] = (InfoOffset & 0xff);
+    AddrLen = 2;
   } else {
-    I2C_REG_WRITE (Base + I2C_DATA_CMD_OFFSET, InfoOffset & 0xff);
-  }
-
-  if (CheckI2CTimeOut (I2cInfo->Socket, I2cInfo->Port, I2CTx) == EFI_TIMEOUT) {
-    return EFI_TIMEOUT;
-  }
-
-  for (Idx = 0; Idx < Length; Idx++) {
-    Times = 0;
-    Fifo = I2C_GetTxStatus (I2cInfo->Socket, I2cInfo->Port);
-    while (Fifo > I2C_TXRX_THRESHOLD) {
-      // This is a empirical value for I2C delay. MemoryFence is no need here.
-      I2C_Delay (1000);
-      if (++Times > I2C_READ_TIMEOUT) {
-        (VOID)I2C_Disable (I2cInfo->Socket, I2cInfo->Port);
-        return EFI_TIMEOUT;
-      }
-      Fifo = I2C_GetTxStatus (I2cInfo->Socket, I2cInfo->Port);
-    }
-
-    if (Idx < Length - 1) {
-      I2C_REG_WRITE (Base + I2C_DATA_CMD_OFFSET, (*pBuf++));
-    } else {
-      //Send command stop bit for the last transfer
-      I2C_REG_WRITE (Base + I2C_DATA_CMD_OFFSET, (*pBuf++) | I2C_CMD_STOP_BIT);
-    }
+    I2CWAddr[0] = (InfoOffset & 0xff);
+    AddrLen = 1;
   }
 
-  if (CheckI2CTimeOut (I2cInfo->Socket, I2cInfo->Port, I2CTx) == EFI_TIMEOUT) {
-    return EFI_TIMEOUT;
-  }
+  (VOID)I2C_Enable(I2cInfo->Socket, I2cInfo->Port);
+  Status = I2C_Transfer (I2cInfo, I2CWAddr, AddrLen, pBuf, Length, NULL, 0);
   (VOID)I2C_Disable (I2cInfo->Socket, I2cInfo->Port);
 
-  return EFI_SUCCESS;
+  return Status;
 }
 
 EFI_STATUS
@@ -415,58 +503,27 @@ I2CRead(
   )
 {
   UINT8       I2CWAddr[2];
+  UINT32      AddrLen;
   EFI_STATUS  Status;
-  UINT32      Idx = 0;
-  UINTN       Base;
 
   if (I2cInfo->Port >= I2C_PORT_MAX) {
     return EFI_INVALID_PARAMETER;
   }
 
-  (VOID)I2C_Enable(I2cInfo->Socket, I2cInfo->Port);
-  Base = GetI2cBase (I2cInfo->Socket, I2cInfo->Port);
   if (I2cInfo->DeviceType) {
     I2CWAddr[0] = (InfoOffset >> 8) & 0xff;
     I2CWAddr[1] = (InfoOffset & 0xff);
-    Status = WriteBeforeRead (I2cInfo, 2,I2CWAddr);
-    if (EFI_ERROR (Status)) {
-      (VOID)I2C_Disable (I2cInfo->Socket, I2cInfo->Port);
-      return EFI_ABORTED;
-    }
+    AddrLen = 2;
   } else {
     I2CWAddr[0] = (InfoOffset & 0xff);
-    Status = WriteBeforeRead (I2cInfo, 1, I2CWAddr);
-    if (EFI_ERROR (Status)) {
-      (VOID)I2C_Disable (I2cInfo->Socket, I2cInfo->Port);
-      return EFI_ABORTED;
-    }
-  }
-
-  I2C_SetTarget (I2cInfo->Socket, I2cInfo->Port, I2cInfo->SlaveDeviceAddress);
-
-  if (CheckI2CTimeOut (I2cInfo->Socket, I2cInfo->Port, I2CTx) == EFI_TIMEOUT) {
-    return EFI_TIMEOUT;
+    AddrLen = 1;
   }
 
-  while (RxLen > 0) {
-    if (RxLen > 1) {
-      I2C_REG_WRITE (Base + I2C_DATA_CMD_OFFSET, I2C_READ_SIGNAL);
-    } else {
-      //Send command stop bit for the last transfer
-      I2C_REG_WRITE (Base + I2C_DATA_CMD_OFFSET, I2C_READ_SIGNAL | I2C_CMD_STOP_BIT);
-    }
-
-    if (CheckI2CTimeOut (I2cInfo->Socket, I2cInfo->Port, I2CRx) == EFI_TIMEOUT) {
-      return EFI_TIMEOUT;
-    }
-
-    I2C_REG_READ (Base + I2C_DATA_CMD_OFFSET, pBuf[Idx++]);
-
-    RxLen --;
-  }
+  (VOID)I2C_Enable(I2cInfo->Socket, I2cInfo->Port);
+  Status = I2C_Transfer (I2cInfo, I2CWAddr, AddrLen, NULL, 0, pBuf, RxLen);
   (VOID)I2C_Disable (I2cInfo->Socket, I2cInfo->Port);
 
-  return EFI_SUCCESS;
+  return Status;
 }
 
 EFI_STATUS
@@ -478,74 +535,39 @@ I2CReadMultiByte (
   UINT8      *pBuf
   )
 {
-  UINT32      Count;
-  UINT16      TotalLen = 0;
   UINT8       I2CWAddr[4];
+  UINT32      AddrLen;
   EFI_STATUS  Status;
-  UINT32      BytesLeft;
-  UINT32      Idx = 0;
-  UINTN       Base;
 
   if (I2cInfo->Port >= I2C_PORT_MAX) {
     return EFI_INVALID_PARAMETER;
   }
 
-  (VOID)I2C_Enable (I2cInfo->Socket, I2cInfo->Port);
-  Base = GetI2cBase (I2cInfo->Socket, I2cInfo->Port);
   if (I2cInfo->DeviceType == DEVICE_TYPE_E2PROM) {
     I2CWAddr[0] = (InfoOffset >> 8) & 0xff;
     I2CWAddr[1] = (InfoOffset & 0xff);
-    Status = WriteBeforeRead (I2cInfo, 2,I2CWAddr);
-    if (EFI_ERROR (Status)) {
-      (VOID)I2C_Disable (I2cInfo->Socket, I2cInfo->Port);
-      return EFI_ABORTED;
-    }
+    AddrLen = 2;
   } else if (I2cInfo->DeviceType == DEVICE_TYPE_CPLD_3BYTE_OPERANDS) {
     I2CWAddr[0] = (InfoOffset >> 16) & 0xff;
     I2CWAddr[1] = (InfoOffset >> 8) & 0xff;
     I2CWAddr[2] = (InfoOffset & 0xff);
-    Status = WriteBeforeRead (I2cInfo, 3, I2CWAddr);
-    if (EFI_ERROR (Status)) {
-      (VOID)I2C_Disable (I2cInfo->Socket, I2cInfo->Port);
-      return EFI_ABORTED;
-    }
+    AddrLen = 3;
   } else if (I2cInfo->DeviceType == DEVICE_TYPE_CPLD_4BYTE_OPERANDS) {
     I2CWAddr[0] = (InfoOffset >> 24) & 0xff;
     I2CWAddr[1] = (InfoOffset >> 16) & 0xff;
     I2CWAddr[2] = (InfoOffset >> 8) & 0xff;
     I2CWAddr[3] = (InfoOffset & 0xff);
-    Status = WriteBeforeRead (I2cInfo, 4,I2CWAddr);
-    if (EFI_ERROR (Status)) {
-      (VOID)I2C_Disable (I2cInfo->Socket, I2cInfo->Port);
-      return EFI_ABORTED;
-    }
+    AddrLen = 4;
   } else {
     I2CWAddr[0] = (InfoOffset & 0xff);
-    Status = WriteBeforeRead (I2cInfo, 1,I2CWAddr);
-    if (EFI_ERROR (Status)) {
-      (VOID)I2C_Disable (I2cInfo->Socket, I2cInfo->Port);
-      return EFI_ABORTED;
-    }
+    AddrLen = 1;
   }
 
-  I2C_SetTarget(I2cInfo->Socket, I2cInfo->Port, I2cInfo->SlaveDeviceAddress);
-  TotalLen = RxLen;
-  BytesLeft = TotalLen;
-
-  for (Count = 0; Count < BytesLeft; Count++) {
-    I2C_REG_WRITE (Base + I2C_DATA_CMD_OFFSET, I2C_READ_SIGNAL);
-  }
-
-  for (Count = 0; Count < BytesLeft; Count++) {
-    if (CheckI2CTimeOut (I2cInfo->Socket, I2cInfo->Port, I2CRx) == EFI_TIMEOUT) {
-      return EFI_TIMEOUT;
-    }
-
-    I2C_REG_READ (Base + I2C_DATA_CMD_OFFSET, pBuf[Idx++]);
-  }
+  (VOID)I2C_Enable (I2cInfo->Socket, I2cInfo->Port);
+  Status = I2C_Transfer (I2cInfo, I2CWAddr, AddrLen, NULL, 0, pBuf, RxLen);
   (VOID)I2C_Disable (I2cInfo->Socket, I2cInfo->Port);
 
-  return EFI_SUCCESS;
+  return Status;
 }
 
 EFI_STATUS
@@ -557,44 +579,33 @@ I2CWriteMultiByte(
   UINT8      *pBuf
   )
 {
-  UINT32  Idx;
-  UINTN  Base;
+  UINT8       I2CWAddr[4];
+  UINT32      AddrLen;
+  EFI_STATUS  Status;
 
   if (I2cInfo->Port >= I2C_PORT_MAX) {
     return EFI_INVALID_PARAMETER;
   }
 
-  Base = GetI2cBase (I2cInfo->Socket, I2cInfo->Port);
-
-  (VOID)I2C_Enable(I2cInfo->Socket, I2cInfo->Port);
-
-  I2C_SetTarget(I2cInfo->Socket, I2cInfo->Port, I2cInfo->SlaveDeviceAddress);
-
-  if (CheckI2CTimeOut (I2cInfo->Socket, I2cInfo->Port, I2CTx) == EFI_TIMEOUT) {
-    return EFI_TIMEOUT;
-  }
-
   if (I2cInfo->DeviceType == DEVICE_TYPE_CPLD_3BYTE_OPERANDS) {
-    I2C_REG_WRITE (Base + I2C_DATA_CMD_OFFSET, (InfoOffset >> 16) & 0xff);
-    I2C_REG_WRITE (Base + I2C_DATA_CMD_OFFSET, (InfoOffset >> 8) & 0xff);
-    I2C_REG_WRITE (Base + I2C_DATA_CMD_OFFSET, InfoOffset & 0xff);
+    I2CWAddr[0] = (InfoOffset >> 16) & 0xff;
+    I2CWAddr[1] = (InfoOffset >> 8) & 0xff;
+    I2CWAddr[2] = (InfoOffset & 0xff);
+    AddrLen = 3;
   } else if (I2cInfo->DeviceType == DEVICE_TYPE_CPLD_4BYTE_OPERANDS) {
-    I2C_REG_WRITE (Base + I2C_DATA_CMD_OFFSET, (InfoOffset >> 24) & 0xff);
-    I2C_REG_WRITE (Base + I2C_DATA_CMD_OFFSET, (InfoOffset >> 16) & 0xff);
-    I2C_REG_WRITE (Base + I2C_DATA_CMD_OFFSET, (InfoOffset >> 8) & 0xff);
-    I2C_REG_WRITE (Base + I2C_DATA_CMD_OFFSET, InfoOffset & 0xff);
+    I2CWAddr[0] = (InfoOffset >> 24) & 0xff;
+    I2CWAddr[1] = (InfoOffset >> 16) & 0xff;
+    I2CWAddr[2] = (InfoOffset >> 8) & 0xff;
+    I2CWAddr[3] = (InfoOffset & 0xff);
+    AddrLen = 4;
   } else {
+    AddrLen = 0;
   }
 
-  for (Idx = 0; Idx < Length; Idx++) {
-    I2C_REG_WRITE (Base + I2C_DATA_CMD_OFFSET, *pBuf++);
-  }
-
-  if (CheckI2CTimeOut (I2cInfo->Socket, I2cInfo->Port, I2CTx) == EFI_TIMEOUT) {
-    return EFI_TIMEOUT;
-  }
+  (VOID)I2C_Enable(I2cInfo->Socket, I2cInfo->Port);
+  Status = I2C_Transfer (I2cInfo, I2CWAddr, AddrLen, pBuf, Length, NULL, 0);
   (VOID)I2C_Disable (I2cInfo->Socket, I2cInfo->Port);
 
-  return EFI_SUCCESS;
+  return Status;
 }
 
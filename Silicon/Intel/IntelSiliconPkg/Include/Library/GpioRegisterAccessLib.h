@@ -0,0 +1,28 @@
+/** @file
+  Header file for GPIO register access library.
+
+  Copyright (c) 2021, Intel Corporation. All rights reserved.<BR>
+
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+**/
+
+#ifndef _GPIO_REGISTER_ACCESS_LIB_H_
+#define _GPIO_REGISTER_ACCESS_LIB_H_
+
+/**
+  Write a GPIO register with bits selected by Mask set to Value.
+  Register is not accessed at all if no bit is to be changed.
+
+  @param[in] Address                    MMIO address of GPIO register
+  @param[in] Mask                       Mask of bits which will change in register
+  @param[in] Value                      Value for bits selected by Mask
+**/
+VOID
+EFIAPI
+GpioWriteRegisterMasked (
+  IN UINTN                     Address,
+  IN UINT32                    Mask,
+  IN UINT32                    Value
+  );
+
+#endif // _GPIO_REGISTER_ACCESS_LIB_H_
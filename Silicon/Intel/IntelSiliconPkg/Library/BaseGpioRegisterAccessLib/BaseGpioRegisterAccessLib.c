@@ -0,0 +1,31 @@
+/** @file
+  Library functions for GPIO register access.
+
+Copyright (c) 2021, Intel Corporation. All rights reserved.<BR>
+SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+#include <Base.h>
+#include <Library/IoLib.h>
+#include <Library/GpioRegisterAccessLib.h>
+
+/**
+  Write a GPIO register with bits selected by Mask set to Value.
+  Register is not accessed at all if no bit is to be changed.
+
+  @param[in] Address                    MMIO address of GPIO register
+  @param[in] Mask                       Mask of bits which will change in register
+  @param[in] Value                      Value for bits selected by Mask
+**/
+VOID
+EFIAPI
+GpioWriteRegisterMasked (
+  IN UINTN                     Address,
+  IN UINT32                    Mask,
+  IN UINT32                    Value
+  )
+{
+  if (Mask != 0) {
+    MmioAndThenOr32 (Address, ~Mask, Value);
+  }
+}
@@ -6,6 +6,8 @@ SPDX-License-Identifier: BSD-2-Clause-Patent
 
 **/
 #include "GpioLibrary.h"
+#include <Library/PerformanceLib.h>
+#include <Library/GpioRegisterAccessLib.h>
 
 /**
   This procedure will handle requirement on gSPIx_CSB pins.
@@ -159,32 +161,29 @@ GpioDwRegValueFromGpioConfig (
 }
 
 /**
-  This SKL PCH specific procedure will initialize multiple SKL PCH GPIO pins
+  This internal procedure will check all records of GPIO initialization table
+  before any GPIO register is touched, so an invalid record does not leave
+  the pads configured only partially.
 
-  @param[in] NumberofItem               Number of GPIO pads to be updated
+  @param[in] NumberOfItem               Number of GPIO pad records in table
   @param[in] GpioInitTableAddress       GPIO initialization table
+  @param[in] GpioGroupInfo              GPIO group table
 
-  @retval EFI_SUCCESS                   The function completed successfully
+  @retval EFI_SUCCESS                   All records are valid
   @retval EFI_INVALID_PARAMETER         Invalid group or pad number
+  @retval EFI_UNSUPPORTED               GpioPad not supported on this chipset
 **/
 STATIC
 EFI_STATUS
-GpioConfigureSklPch (
+GpioCheckInitTable (
   IN UINT32                    NumberOfItems,
-  IN GPIO_INIT_CONFIG          *GpioInitTableAddress
+  IN GPIO_INIT_CONFIG          *GpioInitTableAddress,
+  IN GPIO_GROUP_INFO           *GpioGroupInfo
   )
 {
   UINT32               Index;
-  UINT32               PadCfgDwReg[2];
-  UINT32               PadCfgDwRegMask[2];
-  UINT32               PadCfgReg;
-  GPIO_DW_REG_VALUE    DwRegsValues[GPIO_DW_REG_NUMBER];
-  UINT32               DwNum;
-  GPIO_GROUP_INFO      *GpioGroupInfo;
-  UINTN                GpioGroupInfoLength;
   GPIO_GROUP           GpioGroupOffset;
   UINT32               NumberOfGroups;
-  GPIO_PAD_OWN         PadOwnVal;
   GPIO_INIT_CONFIG     *GpioData;
   GPIO_GROUP           Group;
   UINT32               GroupIndex;
@@ -192,15 +191,11 @@ GpioConfigureSklPch (
   PCH_SERIES           PchSeries;
 
   PchSeries = GetPchSeries ();
-  PadOwnVal = GpioPadOwnHost;
-
-  GpioGroupInfo = GpioGetGroupInfoTable (&GpioGroupInfoLength);
 
   GpioGroupOffset = GpioGetLowestGroup ();
   NumberOfGroups = GpioGetNumberOfGroups ();
 
-  Index = 0;
-  while (Index < NumberOfItems) {
+  for (Index = 0; Index < NumberOfItems; Index++) {
 
     GpioData   = &GpioInitTableAddress[Index];
     Group      = GpioGetGroupFromGpioPad (GpioData->GpioPad);
@@ -208,7 +203,9 @@ GpioConfigureSklPch (
     PadNumber  = GpioGetPadNumberFromGpioPad (GpioData->GpioPad);
 
     if (GroupIndex >= V_PCH_GPIO_GROUP_MAX) {
-      // @todo SKL PCH: one platform code ready we should add this back      ASSERT (FALSE);
+      //
+      // Such records are skipped by GpioConfigureSklPch
+      //
       continue;
     }
 
@@ -229,6 +226,77 @@ GpioConfigureSklPch (
       return EFI_INVALID_PARAMETER;
     }
 
+    //
+    // Check if legal pin number
+    //
+    if (PadNumber >= GpioGroupInfo[GroupIndex].PadPerGroup) {
+      DEBUG ((DEBUG_ERROR, "GPIO ERROR: Pin number (%d) exceeds possible range for group %d\n", PadNumber, GroupIndex));
+      return EFI_INVALID_PARAMETER;
+    }
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  This SKL PCH specific procedure will initialize multiple SKL PCH GPIO pins
+
+  Table is processed in its order. For each run of adjacent records which belong
+  to the same group HOSTSW_OWN, GPI_GPE_EN, GPI_NMI_EN and lock registers are
+  written only once per DW. All records are checked before any register is
+  written.
+
+  @param[in] NumberofItem               Number of GPIO pads to be updated
+  @param[in] GpioInitTableAddress       GPIO initialization table
+
+  @retval EFI_SUCCESS                   The function completed successfully
+  @retval EFI_INVALID_PARAMETER         Invalid group or pad number
+**/
+STATIC
+EFI_STATUS
+GpioConfigureSklPch (
+  IN UINT32                    NumberOfItems,
+  IN GPIO_INIT_CONFIG          *GpioInitTableAddress
+  )
+{
+  EFI_STATUS           Status;
+  UINT32               Index;
+  UINT32               PadCfgDwReg[2];
+  UINT32               PadCfgDwRegMask[2];
+  UINT32               PadCfgReg;
+  GPIO_DW_REG_VALUE    DwRegsValues[GPIO_DW_REG_NUMBER];
+  UINT32               DwNum;
+  GPIO_GROUP_INFO      *GpioGroupInfo;
+  UINTN                GpioGroupInfoLength;
+  GPIO_GROUP           GpioGroupOffset;
+  GPIO_PAD_OWN         PadOwnVal;
+  GPIO_INIT_CONFIG     *GpioData;
+  UINT32               GroupIndex;
+  UINT32               PadNumber;
+
+  PadOwnVal = GpioPadOwnHost;
+
+  GpioGroupInfo = GpioGetGroupInfoTable (&GpioGroupInfoLength);
+
+  GpioGroupOffset = GpioGetLowestGroup ();
+
+  Status = GpioCheckInitTable (NumberOfItems, GpioInitTableAddress, GpioGroupInfo);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  Index = 0;
+  while (Index < NumberOfItems) {
+
+    GpioData   = &GpioInitTableAddress[Index];
+    GroupIndex = GpioGetGroupIndexFromGpioPad (GpioData->GpioPad);
+
+    if (GroupIndex >= V_PCH_GPIO_GROUP_MAX) {
+      // @todo SKL PCH: one platform code ready we should add this back      ASSERT (FALSE);
+      Index++;
+      continue;
+    }
+
     ZeroMem (DwRegsValues, sizeof (DwRegsValues));
     //
     // Loop through pads for one group. If pad belongs to a different group then
@@ -243,13 +311,6 @@ GpioConfigureSklPch (
       }
 
       PadNumber  = GpioGetPadNumberFromGpioPad (GpioData->GpioPad);
-      //
-      // Check if legal pin number
-      //
-      if (PadNumber >= GpioGroupInfo[GroupIndex].PadPerGroup) {
-        DEBUG ((DEBUG_ERROR, "GPIO ERROR: Pin number (%d) exceeds possible range for group %d\n", PadNumber, GroupIndex));
-        return EFI_INVALID_PARAMETER;
-      }
 
       DEBUG_CODE_BEGIN ();
       //
@@ -291,22 +352,11 @@ GpioConfigureSklPch (
       PadCfgReg = PAD_CFG_SIZE * PadNumber + GpioGroupInfo[GroupIndex].PadCfgOffset;
 
       //
-      // Write PADCFG DW0 register
+      // Write PADCFG DW0 and DW1 registers. Registers for which
+      // GpioConfig leaves all fields at hardware default are not accessed.
       //
-      MmioAndThenOr32 (
-        PCH_PCR_ADDRESS (GpioGroupInfo[GroupIndex].Community, PadCfgReg),
-        ~PadCfgDwRegMask[0],
-        PadCfgDwReg[0]
-        );
-
-      //
-      // Write PADCFG DW1 register
-      //
-      MmioAndThenOr32 (
-        PCH_PCR_ADDRESS (GpioGroupInfo[GroupIndex].Community, PadCfgReg + 0x4),
-        ~PadCfgDwRegMask[1],
-        PadCfgDwReg[1]
-        );
+      GpioWriteRegisterMasked (PCH_PCR_ADDRESS (GpioGroupInfo[GroupIndex].Community, PadCfgReg), PadCfgDwRegMask[0], PadCfgDwReg[0]);
+      GpioWriteRegisterMasked (PCH_PCR_ADDRESS (GpioGroupInfo[GroupIndex].Community, PadCfgReg + 0x4), PadCfgDwRegMask[1], PadCfgDwReg[1]);
 
       //
       // Get GPIO DW register values from GPIO config data
@@ -326,9 +376,9 @@ GpioConfigureSklPch (
       // Write HOSTSW_OWN registers
       //
       if (GpioGroupInfo[GroupIndex].HostOwnOffset != NO_REGISTER_FOR_PROPERTY) {
-        MmioAndThenOr32 (
+        GpioWriteRegisterMasked (
           PCH_PCR_ADDRESS (GpioGroupInfo[GroupIndex].Community, GpioGroupInfo[GroupIndex].HostOwnOffset + DwNum * 0x4),
-          ~DwRegsValues[DwNum].HostSoftOwnRegMask,
+          DwRegsValues[DwNum].HostSoftOwnRegMask,
           DwRegsValues[DwNum].HostSoftOwnReg
           );
       }
@@ -337,9 +387,9 @@ GpioConfigureSklPch (
       // Write GPI_GPE_EN registers
       //
       if (GpioGroupInfo[GroupIndex].GpiGpeEnOffset != NO_REGISTER_FOR_PROPERTY) {
-        MmioAndThenOr32 (
+        GpioWriteRegisterMasked (
           PCH_PCR_ADDRESS (GpioGroupInfo[GroupIndex].Community, GpioGroupInfo[GroupIndex].GpiGpeEnOffset + DwNum * 0x4),
-          ~DwRegsValues[DwNum].GpiGpeEnRegMask,
+          DwRegsValues[DwNum].GpiGpeEnRegMask,
           DwRegsValues[DwNum].GpiGpeEnReg
           );
       }
@@ -348,9 +398,9 @@ GpioConfigureSklPch (
       // Write GPI_NMI_EN registers
       //
       if (GpioGroupInfo[GroupIndex].NmiEnOffset != NO_REGISTER_FOR_PROPERTY) {
-        MmioAndThenOr32 (
+        GpioWriteRegisterMasked (
           PCH_PCR_ADDRESS (GpioGroupInfo[GroupIndex].Community, GpioGroupInfo[GroupIndex].NmiEnOffset + DwNum * 0x4),
-          ~DwRegsValues[DwNum].GpiNmiEnRegMask,
+          DwRegsValues[DwNum].GpiNmiEnRegMask,
           DwRegsValues[DwNum].GpiNmiEnReg
           );
       } else if (DwRegsValues[DwNum].GpiNmiEnReg != 0x0) {
@@ -492,8 +542,11 @@ GpioConfigurePads (
   )
 {
   EFI_STATUS   Status;
+
+  PERF_INMODULE_BEGIN ("GpioConfigurePads");
   Status =  GpioConfigureSklPch (NumberOfItems, GpioInitTableAddress);
   GpioClearAllGpioInterrupts ();
+  PERF_INMODULE_END ("GpioConfigurePads");
   return Status;
 }
 
@@ -7,6 +7,8 @@
 #include "GpioLibrary.h"
 #include <Register/PchPcrRegs.h>
 #include <Library/GpioCheckConflictLib.h>
+#include <Library/PerformanceLib.h>
+#include <Library/GpioRegisterAccessLib.h>
 
 //
 // GPIO_GROUP_DW_DATA structure is used by GpioConfigurePch function
@@ -115,6 +117,7 @@ GpioDwRegValueFromGpioConfig (
   @param[in] NumberOfItem               Number of GPIO pad records in table
   @param[in] GpioInitTableAddress       GPIO initialization table
   @param[in] Index                      Index of GPIO Initialization table record
+  @param[in] GpioGroupInfo              GPIO group table
 
   @retval EFI_SUCCESS                   The function completed successfully
   @retval EFI_INVALID_PARAMETER         Invalid group or pad number
@@ -124,21 +127,18 @@ EFI_STATUS
 GpioUnlockPadsForAGroup (
   IN UINT32                    NumberOfItems,
   IN GPIO_INIT_CONFIG          *GpioInitTableAddress,
-  IN UINT32                    Index
+  IN UINT32                    Index,
+  IN CONST GPIO_GROUP_INFO     *GpioGroupInfo
   )
 {
   UINT32                 PadsToUnlock[GPIO_GROUP_DW_NUMBER];
   UINT32                 DwNum;
   UINT32                 PadBitPosition;
-  CONST GPIO_GROUP_INFO  *GpioGroupInfo;
-  UINT32                 GpioGroupInfoLength;
   CONST GPIO_INIT_CONFIG *GpioData;
   GPIO_GROUP             Group;
   UINT32                 GroupIndex;
   UINT32                 PadNumber;
 
-  GpioGroupInfo = GpioGetGroupInfoTable (&GpioGroupInfoLength);
-
   GpioData   = &GpioInitTableAddress[Index];
   Group      = GpioGetGroupFromGpioPad (GpioData->GpioPad);
   GroupIndex = GpioGetGroupIndexFromGpioPad (GpioData->GpioPad);
@@ -194,9 +194,85 @@ GpioUnlockPadsForAGroup (
   return EFI_SUCCESS;
 }
 
+/**
+  This internal procedure will check all records of GPIO initialization table
+  before any GPIO register is touched, so an invalid record does not leave
+  the pads configured only partially.
+
+  @param[in] NumberOfItem               Number of GPIO pad records in table
+  @param[in] GpioInitTableAddress       GPIO initialization table
+  @param[in] GpioGroupInfo              GPIO group table
+  @param[in] GpioGroupInfoLength        Number of entries in GPIO group table
+
+  @retval EFI_SUCCESS                   All records are valid
+  @retval EFI_INVALID_PARAMETER         Invalid group or pad number
+  @retval EFI_UNSUPPORTED               GpioPad not supported on this chipset
+**/
+STATIC
+EFI_STATUS
+GpioCheckInitTable (
+  IN UINT32                    NumberOfItems,
+  IN GPIO_INIT_CONFIG          *GpioInitTableAddress,
+  IN CONST GPIO_GROUP_INFO     *GpioGroupInfo,
+  IN UINT32                    GpioGroupInfoLength
+  )
+{
+  UINT32                 Index;
+  CONST GPIO_INIT_CONFIG *GpioData;
+  UINT32                 GroupIndex;
+  UINT32                 PadNumber;
+
+  for (Index = 0; Index < NumberOfItems; Index++) {
+
+    GpioData   = &GpioInitTableAddress[Index];
+    GroupIndex = GpioGetGroupIndexFromGpioPad (GpioData->GpioPad);
+    PadNumber  = GpioGetPadNumberFromGpioPad (GpioData->GpioPad);
+
+    DEBUG_CODE_BEGIN();
+    if (!GpioIsCorrectPadForThisChipset (GpioData->GpioPad)) {
+      DEBUG ((DEBUG_ERROR, "GPIO ERROR: Incorrect GpioPad (0x%08x) used on this chipset!\n", GpioData->GpioPad));
+      ASSERT (FALSE);
+      return EFI_UNSUPPORTED;
+    }
+    DEBUG_CODE_END ();
+
+    //
+    // Check if legal group and pin number
+    //
+    if (GroupIndex >= GpioGroupInfoLength) {
+      DEBUG ((DEBUG_ERROR, "GPIO ERROR: Invalid group %d\n", GroupIndex));
+      return EFI_INVALID_PARAMETER;
+    }
+
+    if (PadNumber >= GpioGroupInfo[GroupIndex].PadPerGroup) {
+      DEBUG ((DEBUG_ERROR, "GPIO ERROR: Pin number (%d) exceeds possible range for group %d\n", PadNumber, GroupIndex));
+      return EFI_INVALID_PARAMETER;
+    }
+
+    DEBUG_CODE_BEGIN ();
+    //
+    // Check if Pad enabled for SCI is to be in unlocked state
+    //
+    if (((GpioData->GpioConfig.InterruptConfig & GpioIntSci) == GpioIntSci) &&
+        ((GpioData->GpioConfig.LockConfig & B_GPIO_LOCK_CONFIG_PAD_CONF_LOCK_MASK) != GpioPadConfigUnlock)){
+      DEBUG ((DEBUG_ERROR, "GPIO ERROR: %a used for SCI is not unlocked!\n", GpioName (GpioData->GpioPad)));
+      ASSERT (FALSE);
+      return EFI_INVALID_PARAMETER;
+    }
+    DEBUG_CODE_END ();
+  }
+
+  return EFI_SUCCESS;
+}
+
 /**
   This procedure will initialize multiple PCH GPIO pins
 
+  Table is processed in its order. For each run of adjacent records which belong
+  to the same group HOSTSW_OWN, GPI_GPE_EN, GPI_NMI_EN and GPI_SMI_EN registers
+  are written only once per DW. All records are checked before any register is
+  written.
+
   @param[in] NumberofItem               Number of GPIO pads to be updated
   @param[in] GpioInitTableAddress       GPIO initialization table
 
@@ -210,6 +286,7 @@ GpioConfigurePch (
   IN GPIO_INIT_CONFIG          *GpioInitTableAddress
   )
 {
+  EFI_STATUS             Status;
   UINT32                 Index;
   UINT32                 PadCfgDwReg[GPIO_PADCFG_DW_REG_NUMBER];
   UINT32                 PadCfgDwRegMask[GPIO_PADCFG_DW_REG_NUMBER];
@@ -228,6 +305,11 @@ GpioConfigurePch (
 
   GpioGroupInfo = GpioGetGroupInfoTable (&GpioGroupInfoLength);
 
+  Status = GpioCheckInitTable (NumberOfItems, GpioInitTableAddress, GpioGroupInfo, GpioGroupInfoLength);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
   Index = 0;
   while (Index < NumberOfItems) {
 
@@ -235,14 +317,6 @@ GpioConfigurePch (
     GroupIndex = GpioGetGroupIndexFromGpioPad (GpioData->GpioPad);
     GpioCom    = GpioGroupInfo[GroupIndex].Community;
 
-    DEBUG_CODE_BEGIN();
-    if (!GpioIsCorrectPadForThisChipset (GpioData->GpioPad)) {
-      DEBUG ((DEBUG_ERROR, "GPIO ERROR: Incorrect GpioPad (0x%08x) used on this chipset!\n", GpioData->GpioPad));
-      ASSERT (FALSE);
-      return EFI_UNSUPPORTED;
-    }
-    DEBUG_CODE_END ();
-
     //
     // Unlock pads for a given group which are going to be reconfigured
     //
@@ -253,7 +327,7 @@ GpioConfigurePch (
     // PadRstCfg != Powergood GpioPad will have its configuration locked despite it being not the
     // one desired by BIOS. Before reconfiguring all pads they will get unlocked.
     //
-    GpioUnlockPadsForAGroup (NumberOfItems, GpioInitTableAddress, Index);
+    GpioUnlockPadsForAGroup (NumberOfItems, GpioInitTableAddress, Index, GpioGroupInfo);
 
     ZeroMem (GroupDwData, sizeof (GroupDwData));
     //
@@ -271,14 +345,6 @@ GpioConfigurePch (
       PadNumber  = GpioGetPadNumberFromGpioPad (GpioData->GpioPad);
 
       DEBUG_CODE_BEGIN ();
-      //
-      // Check if legal pin number
-      //
-      if (PadNumber >= GpioGroupInfo[GroupIndex].PadPerGroup) {
-        DEBUG ((DEBUG_ERROR, "GPIO ERROR: Pin number (%d) exceeds possible range for group %d\n", PadNumber, GroupIndex));
-        return EFI_INVALID_PARAMETER;
-      }
-
       //
       // Check if selected GPIO Pad is not owned by CSME/ISH
       //
@@ -292,16 +358,6 @@ GpioConfigurePch (
         Index++;
         continue;
       }
-
-      //
-      // Check if Pad enabled for SCI is to be in unlocked state
-      //
-      if (((GpioData->GpioConfig.InterruptConfig & GpioIntSci) == GpioIntSci) &&
-          ((GpioData->GpioConfig.LockConfig & B_GPIO_LOCK_CONFIG_PAD_CONF_LOCK_MASK) != GpioPadConfigUnlock)){
-        DEBUG ((DEBUG_ERROR, "GPIO ERROR: %a used for SCI is not unlocked!\n", GpioName (GpioData->GpioPad)));
-        ASSERT (FALSE);
-        return EFI_INVALID_PARAMETER;
-      }
       DEBUG_CODE_END ();
 
       ZeroMem (PadCfgDwReg, sizeof (PadCfgDwReg));
@@ -322,30 +378,12 @@ GpioConfigurePch (
       PadCfgReg = S_GPIO_PCR_PADCFG * PadNumber + GpioGroupInfo[GroupIndex].PadCfgOffset;
 
       //
-      // Write PADCFG DW0 register
+      // Write PADCFG DW0, DW1 and DW2 registers. Registers for which
+      // GpioConfig leaves all fields at hardware default are not accessed.
       //
-      MmioAndThenOr32 (
-        PCH_PCR_ADDRESS (GpioCom, PadCfgReg),
-        ~PadCfgDwRegMask[0],
-        PadCfgDwReg[0]
-        );
-      //
-      // Write PADCFG DW1 register
-      //
-      MmioAndThenOr32 (
-        PCH_PCR_ADDRESS (GpioCom, PadCfgReg + 0x4),
-        ~PadCfgDwRegMask[1],
-        PadCfgDwReg[1]
-        );
-
-      //
-      // Write PADCFG DW2 register
-      //
-      MmioAndThenOr32 (
-        PCH_PCR_ADDRESS (GpioCom, PadCfgReg + 0x8),
-        ~PadCfgDwRegMask[2],
-        PadCfgDwReg[2]
-        );
+      GpioWriteRegisterMasked (PCH_PCR_ADDRESS (GpioCom, PadCfgReg), PadCfgDwRegMask[0], PadCfgDwReg[0]);
+      GpioWriteRegisterMasked (PCH_PCR_ADDRESS (GpioCom, PadCfgReg + 0x4), PadCfgDwRegMask[1], PadCfgDwReg[1]);
+      GpioWriteRegisterMasked (PCH_PCR_ADDRESS (GpioCom, PadCfgReg + 0x8), PadCfgDwRegMask[2], PadCfgDwReg[2]);
 
       //
       // Get GPIO DW register values from GPIO config data
@@ -365,9 +403,9 @@ GpioConfigurePch (
       // Write HOSTSW_OWN registers
       //
       if (GpioGroupInfo[GroupIndex].HostOwnOffset != NO_REGISTER_FOR_PROPERTY) {
-        MmioAndThenOr32 (
+        GpioWriteRegisterMasked (
           PCH_PCR_ADDRESS (GpioCom, GpioGroupInfo[GroupIndex].HostOwnOffset + DwNum * 0x4),
-          ~GroupDwData[DwNum].HostSoftOwnRegMask,
+          GroupDwData[DwNum].HostSoftOwnRegMask,
           GroupDwData[DwNum].HostSoftOwnReg
           );
       }
@@ -376,9 +414,9 @@ GpioConfigurePch (
       // Write GPI_GPE_EN registers
       //
       if (GpioGroupInfo[GroupIndex].GpiGpeEnOffset != NO_REGISTER_FOR_PROPERTY) {
-        MmioAndThenOr32 (
+        GpioWriteRegisterMasked (
           PCH_PCR_ADDRESS (GpioCom, GpioGroupInfo[GroupIndex].GpiGpeEnOffset + DwNum * 0x4),
-          ~GroupDwData[DwNum].GpiGpeEnRegMask,
+          GroupDwData[DwNum].GpiGpeEnRegMask,
           GroupDwData[DwNum].GpiGpeEnReg
           );
       }
@@ -387,9 +425,9 @@ GpioConfigurePch (
       // Write GPI_NMI_EN registers
       //
       if (GpioGroupInfo[GroupIndex].NmiEnOffset != NO_REGISTER_FOR_PROPERTY) {
-        MmioAndThenOr32 (
+        GpioWriteRegisterMasked (
           PCH_PCR_ADDRESS (GpioCom, GpioGroupInfo[GroupIndex].NmiEnOffset + DwNum * 0x4),
-          ~GroupDwData[DwNum].GpiNmiEnRegMask,
+          GroupDwData[DwNum].GpiNmiEnRegMask,
           GroupDwData[DwNum].GpiNmiEnReg
           );
       } else if (GroupDwData[DwNum].GpiNmiEnReg != 0x0) {
@@ -401,9 +439,9 @@ GpioConfigurePch (
       // Write GPI_SMI_EN registers
       //
       if (GpioGroupInfo[GroupIndex].SmiEnOffset != NO_REGISTER_FOR_PROPERTY) {
-        MmioAndThenOr32 (
+        GpioWriteRegisterMasked (
           PCH_PCR_ADDRESS (GpioCom, GpioGroupInfo[GroupIndex].SmiEnOffset + DwNum * 0x4),
-          ~GroupDwData[DwNum].GpiSmiEnRegMask,
+          GroupDwData[DwNum].GpiSmiEnRegMask,
           GroupDwData[DwNum].GpiSmiEnReg
           );
       } else if (GroupDwData[DwNum].GpiSmiEnReg != 0x0) {
@@ -548,11 +586,15 @@ GpioConfigurePads (
 {
   EFI_STATUS   Status;
 
+  PERF_INMODULE_BEGIN ("GpioConfigurePads");
+
   Status =  GpioConfigurePch (NumberOfItems, GpioInitTableAddress);
 
   CreateGpioCheckConflictHob (GpioInitTableAddress, NumberOfItems);
 
   GpioClearAllGpioInterrupts ();
+
+  PERF_INMODULE_END ("GpioConfigurePads");
   return Status;
 }
 
@@ -15,6 +15,7 @@ SPDX-License-Identifier: BSD-2-Clause-Patent
 #include <Library/IoLib.h>
 #include <Library/MemoryAllocationLib.h>
 #include <Library/PcdLib.h>
+#include <Library/TimerLib.h>
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/UefiLib.h>
 
@@ -37,6 +38,13 @@ STATIC UINT8 * CONST Phy2MdioController = PcdGetPtr (PcdPhy2MdioController);
 //
 STATIC UINT8 * CONST PhySmiAddresses = PcdGetPtr (PcdPhySmiAddresses);
 
+//
+// PHYs being brought up, and the timer tracking them
+//
+STATIC LIST_ENTRY BringUpList = INITIALIZE_LIST_HEAD_VARIABLE (BringUpList);
+STATIC EFI_EVENT BringUpEvent;
+STATIC BOOLEAN BringUpEventArmed;
+
 STATIC MV_PHY_DEVICE MvPhyDevices[] = {
   { MV_PHY_DEVICE_1512, MvPhyInit1512 },
   { MV_PHY_DEVICE_1112, MvPhyInit1112 },
@@ -156,43 +164,29 @@ MvPhyM88e1111sConfig (
   return EFI_SUCCESS;
 }
 
-EFI_STATUS
+/**
+  Parse the 88E1xxx PHY status register.
+
+  @param[in out]   *PhyDev         A pointer to the PHY device structure.
+  @param[in]        Data           Value of the PHY status register, with the
+                                   speed resolved if the link is up.
+
+**/
+STATIC
+VOID
 MvPhyParseStatus (
-  IN PHY_DEVICE *PhyDev
+  IN OUT PHY_DEVICE *PhyDev,
+  IN     UINT32     Data
   )
 {
-  UINT32 Data;
   UINT32 Speed;
 
-  Mdio->Read (Mdio, PhyDev->Addr, PhyDev->MdioIndex, MIIM_88E1xxx_PHY_STATUS, &Data);
-
-  if ((Data & MIIM_88E1xxx_PHYSTAT_LINK) &&
-    !(Data & MIIM_88E1xxx_PHYSTAT_SPDDONE)) {
-    INTN i = 0;
-
-    DEBUG((DEBUG_ERROR,"MvPhyDxe: Waiting for PHY realtime link"));
-    while (!(Data & MIIM_88E1xxx_PHYSTAT_SPDDONE)) {
-      if (i > PHY_AUTONEGOTIATE_TIMEOUT) {
-        DEBUG((DEBUG_ERROR," TIMEOUT !\n"));
-        PhyDev->LinkUp = FALSE;
-        break;
-      }
-
-      if ((i++ % 1000) == 0)
-        DEBUG((DEBUG_ERROR, "."));
-      gBS->Stall(1000);
-      Mdio->Read (Mdio, PhyDev->Addr, PhyDev->MdioIndex, MIIM_88E1xxx_PHY_STATUS, &Data);
-    }
-    DEBUG((DEBUG_ERROR," done\n"));
-    gBS->Stall(500000);
+  if (Data & MIIM_88E1xxx_PHYSTAT_LINK) {
+    DEBUG((DEBUG_ERROR, "MvPhyDxe: link up, "));
+    PhyDev->LinkUp = TRUE;
   } else {
-    if (Data & MIIM_88E1xxx_PHYSTAT_LINK) {
-      DEBUG((DEBUG_ERROR, "MvPhyDxe: link up, "));
-      PhyDev->LinkUp = TRUE;
-    } else {
-      DEBUG((DEBUG_ERROR, "MvPhyDxe: link down, "));
-      PhyDev->LinkUp = FALSE;
-    }
+    DEBUG((DEBUG_ERROR, "MvPhyDxe: link down, "));
+    PhyDev->LinkUp = FALSE;
   }
 
   if (Data & MIIM_88E1xxx_PHYSTAT_DUPLEX) {
@@ -219,60 +213,219 @@ MvPhyParseStatus (
     PhyDev->Speed = SPEED_10;
     break;
   }
+}
 
-  return EFI_SUCCESS;
+/**
+  Return the time elapsed since a performance counter value.
+
+  @param[in]        Start          Performance counter value.
+
+  @return Elapsed time in ms.
+
+**/
+STATIC
+UINT64
+MvPhyElapsedTime (
+  IN UINT64 Start
+  )
+{
+  UINT64 CounterStart;
+  UINT64 CounterEnd;
+  UINT64 Ticks;
+
+  GetPerformanceCounterProperties (&CounterStart, &CounterEnd);
+  if (CounterStart > CounterEnd) {
+    Ticks = Start - GetPerformanceCounter ();
+  } else {
+    Ticks = GetPerformanceCounter () - Start;
+  }
+
+  return DivU64x32 (GetTimeInNanoSecond (Ticks), 1000000);
 }
 
 /**
-  Configure PHY device autonegotiation.
+  Advance the bring-up of a PHY without waiting.
+
+  @param[in out]   *BringUp        A pointer to the PHY bring-up state.
 
-  @param[in out]   *PhyDevice      A pointer to configured PHY device structure.
+  @retval TRUE     The bring-up is complete.
+  @retval FALSE    The bring-up is still in progress.
 
 **/
 STATIC
-EFI_STATUS
-MvPhyConfigureAutonegotiation (
-  IN OUT PHY_DEVICE *PhyDevice
+BOOLEAN
+MvPhyBringUpPoll (
+  IN OUT MV_PHY_BRINGUP *BringUp
   )
 {
+  PHY_DEVICE *PhyDev;
+  UINT64 Elapsed;
   UINT32 Data;
-  INTN Index;
 
-  /* Read BMSR register in order to check autoneg capabilities and status. */
-  Mdio->Read (Mdio, PhyDevice->Addr, PhyDevice->MdioIndex, MII_BMSR, &Data);
+  PhyDev = BringUp->PhyDev;
+  Elapsed = MvPhyElapsedTime (BringUp->StartTime);
 
-  if ((Data & BMSR_ANEGCAPABLE) && !(Data & BMSR_ANEGCOMPLETE)) {
-
-    DEBUG ((DEBUG_INFO,
-      "%a: Waiting for PHY auto negotiation...",
-      __FUNCTION__));
+  switch (BringUp->State) {
+  case MV_PHY_BRINGUP_AUTONEG:
+    /* Read BMSR register in order to check autoneg capabilities and status. */
+    Mdio->Read (Mdio, PhyDev->Addr, PhyDev->MdioIndex, MII_BMSR, &Data);
+    if ((Data & BMSR_ANEGCAPABLE) && !(Data & BMSR_ANEGCOMPLETE)) {
+      if (Elapsed <= PHY_AUTONEGOTIATE_TIMEOUT) {
+        return FALSE;
+      }
+      DEBUG ((DEBUG_ERROR, "MvPhyDxe: PHY#%d autonegotiation timeout\n", BringUp->PhyIndex));
+      PhyDev->LinkUp = FALSE;
+      BringUp->State = MV_PHY_BRINGUP_DONE;
+      break;
+    }
 
-    /* Wait for autonegotiation to complete and read media status */
-    for (Index = 0; !(Data & BMSR_ANEGCOMPLETE); Index++) {
-      if (Index > PHY_AUTONEGOTIATE_TIMEOUT) {
-        DEBUG ((DEBUG_ERROR, "%a: Timeout\n", __FUNCTION__));
-        PhyDevice->LinkUp = FALSE;
-        return EFI_TIMEOUT;
+    BringUp->State = MV_PHY_BRINGUP_SPEED;
+    /* Fall through */
+  case MV_PHY_BRINGUP_SPEED:
+    Mdio->Read (Mdio, PhyDev->Addr, PhyDev->MdioIndex, MIIM_88E1xxx_PHY_STATUS, &Data);
+    if ((Data & MIIM_88E1xxx_PHYSTAT_LINK) &&
+      !(Data & MIIM_88E1xxx_PHYSTAT_SPDDONE)) {
+      if (Elapsed <= PHY_AUTONEGOTIATE_TIMEOUT) {
+        BringUp->SpeedWait = TRUE;
+        return FALSE;
       }
-      gBS->Stall (1000);  /* 1 ms */
-      Mdio->Read (Mdio, PhyDevice->Addr, PhyDevice->MdioIndex, MII_BMSR, &Data);
+      DEBUG ((DEBUG_ERROR, "MvPhyDxe: PHY#%d realtime link timeout\n", BringUp->PhyIndex));
+      MvPhyParseStatus (PhyDev, Data);
+      PhyDev->LinkUp = FALSE;
+      BringUp->State = MV_PHY_BRINGUP_DONE;
+      break;
     }
 
-    PhyDevice->LinkUp = TRUE;
-    DEBUG ((DEBUG_INFO, "%a: link up\n", __FUNCTION__));
-  } else {
-    Mdio->Read (Mdio, PhyDevice->Addr, PhyDevice->MdioIndex, MII_BMSR, &Data);
-
-    if (Data & BMSR_LSTATUS) {
-      PhyDevice->LinkUp = TRUE;
-      DEBUG ((DEBUG_INFO, "%a: link up\n", __FUNCTION__));
-    } else {
-      PhyDevice->LinkUp = FALSE;
-      DEBUG ((DEBUG_INFO, "%a: link down\n", __FUNCTION__));
+    MvPhyParseStatus (PhyDev, Data);
+
+    /* Give the link time to settle if the speed was only just resolved */
+    if (!BringUp->SpeedWait) {
+      BringUp->State = MV_PHY_BRINGUP_DONE;
+      break;
+    }
+    BringUp->SettleTime = GetPerformanceCounter ();
+    BringUp->State = MV_PHY_BRINGUP_SETTLE;
+    return FALSE;
+  case MV_PHY_BRINGUP_SETTLE:
+    if (MvPhyElapsedTime (BringUp->SettleTime) < PHY_SPEED_SETTLE_TIME) {
+      return FALSE;
     }
+    BringUp->State = MV_PHY_BRINGUP_DONE;
+    break;
+  case MV_PHY_BRINGUP_DONE:
+    return TRUE;
   }
 
-  return EFI_SUCCESS;
+  DEBUG ((DEBUG_INFO,
+    "MvPhyDxe: PHY#%d link %a after %Ld ms\n",
+    BringUp->PhyIndex,
+    PhyDev->LinkUp ? "up" : "down",
+    MvPhyElapsedTime (BringUp->StartTime)));
+
+  return TRUE;
+}
+
+/**
+  Timer notification advancing the bring-up of all PHYs.
+
+  @param[in]        Event          The bring-up timer.
+  @param[in]        Context        Unused.
+
+**/
+STATIC
+VOID
+EFIAPI
+MvPhyBringUpNotify (
+  IN EFI_EVENT Event,
+  IN VOID      *Context
+  )
+{
+  LIST_ENTRY *Node;
+  BOOLEAN Pending;
+
+  Pending = FALSE;
+  for (Node = GetFirstNode (&BringUpList);
+       !IsNull (&BringUpList, Node);
+       Node = GetNextNode (&BringUpList, Node)) {
+    if (!MvPhyBringUpPoll (BASE_CR (Node, MV_PHY_BRINGUP, Link))) {
+      Pending = TRUE;
+    }
+  }
+
+  if (!Pending) {
+    gBS->SetTimer (Event, TimerCancel, 0);
+    BringUpEventArmed = FALSE;
+  }
+}
+
+/**
+  Start tracking the autonegotiation of a PHY in the background.
+
+  @param[in]       *PhyDev         A pointer to the PHY device structure.
+  @param[in]        PhyIndex       Index of the PHY.
+
+**/
+STATIC
+EFI_STATUS
+MvPhyStartBringUp (
+  IN PHY_DEVICE *PhyDev,
+  IN UINT32     PhyIndex
+  )
+{
+  MV_PHY_BRINGUP *BringUp;
+  EFI_STATUS Status;
+  EFI_TPL OldTpl;
+
+  BringUp = AllocateZeroPool (sizeof (MV_PHY_BRINGUP));
+  if (BringUp == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  BringUp->PhyDev = PhyDev;
+  BringUp->PhyIndex = PhyIndex;
+  BringUp->State = MV_PHY_BRINGUP_AUTONEG;
+  BringUp->StartTime = GetPerformanceCounter ();
+
+  OldTpl = gBS->RaiseTPL (TPL_CALLBACK);
+
+  InsertTailList (&BringUpList, &BringUp->Link);
+
+  Status = EFI_SUCCESS;
+  if (!MvPhyBringUpPoll (BringUp) && !BringUpEventArmed) {
+    Status = gBS->SetTimer (BringUpEvent, TimerPeriodic, PHY_BRINGUP_POLL_PERIOD);
+    BringUpEventArmed = !EFI_ERROR (Status);
+  }
+
+  /* The caller frees PhyDev on failure, so it must not stay on the list */
+  if (EFI_ERROR (Status)) {
+    RemoveEntryList (&BringUp->Link);
+    FreePool (BringUp);
+  }
+
+  gBS->RestoreTPL (OldTpl);
+
+  return Status;
+}
+
+STATIC
+MV_PHY_BRINGUP *
+MvPhyFindBringUp (
+  IN PHY_DEVICE *PhyDev
+  )
+{
+  LIST_ENTRY *Node;
+  MV_PHY_BRINGUP *BringUp;
+
+  for (Node = GetFirstNode (&BringUpList);
+       !IsNull (&BringUpList, Node);
+       Node = GetNextNode (&BringUpList, Node)) {
+    BringUp = BASE_CR (Node, MV_PHY_BRINGUP, Link);
+    if (BringUp->PhyDev == PhyDev) {
+      return BringUp;
+    }
+  }
+
+  return NULL;
 }
 
 STATIC
@@ -306,8 +459,6 @@ MvPhyInit1512 (
     IN OUT PHY_DEVICE *PhyDev
     )
 {
-  EFI_STATUS Status;
-
   if (PhyDev->Connection == PHY_CONNECTION_SGMII) {
     /* Select page 0xff and update configuration registers according to
      * Marvell Release Notes - Alaska 88E1510/88E1518/88E1512 Rev A0,
@@ -340,17 +491,6 @@ MvPhyInit1512 (
 
   MvPhyM88e1111sConfig (PhyDev);
 
-  /* autonegotiation on startup is not always required */
-  if (!PcdGetBool (PcdPhyStartupAutoneg))
-    return EFI_SUCCESS;
-
-  Status = MvPhyConfigureAutonegotiation (PhyDev);
-  if (EFI_ERROR (Status)) {
-    return Status;
-  }
-
-  MvPhyParseStatus (PhyDev);
-
   return EFI_SUCCESS;
 }
 
@@ -368,19 +508,8 @@ MvPhyInit1112 (
   IN OUT PHY_DEVICE              *PhyDevice
   )
 {
-  EFI_STATUS Status;
-
   MvPhyM88e1111sConfig (PhyDevice);
 
-  if (PcdGetBool (PcdPhyStartupAutoneg)) {
-    Status = MvPhyConfigureAutonegotiation (PhyDevice);
-    if (EFI_ERROR (Status)) {
-      return Status;
-    }
-
-    MvPhyParseStatus (PhyDevice);
-  }
-
   return EFI_SUCCESS;
 }
 
@@ -438,7 +567,17 @@ MvPhyInit (
     PhyConnection));
   *OutPhyDev = PhyDev;
 
-  return MvPhyDevices[PhyId].DevInit (Snp, PhyDev);
+  Status = MvPhyDevices[PhyId].DevInit (Snp, PhyDev);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  /* autonegotiation on startup is not always required */
+  if (!PcdGetBool (PcdPhyStartupAutoneg))
+    return EFI_SUCCESS;
+
+  /* Do not wait for the link here, so that all PHYs negotiate at once */
+  return MvPhyStartBringUp (PhyDev, PhyIndex);
 }
 
 EFI_STATUS
@@ -447,8 +586,20 @@ MvPhyStatus (
   IN PHY_DEVICE  *PhyDev
   )
 {
+  MV_PHY_BRINGUP *BringUp;
+  EFI_TPL OldTpl;
   UINT32 Data;
 
+  /* Wait for the bring-up of this PHY only, the others carry on meanwhile */
+  BringUp = MvPhyFindBringUp (PhyDev);
+  if (BringUp != NULL) {
+    OldTpl = gBS->RaiseTPL (TPL_CALLBACK);
+    while (!MvPhyBringUpPoll (BringUp)) {
+      gBS->Stall (1000);
+    }
+    gBS->RestoreTPL (OldTpl);
+  }
+
   Mdio->Read (Mdio, PhyDev->Addr, PhyDev->MdioIndex, MII_BMSR, &Data);
   Mdio->Read (Mdio, PhyDev->Addr, PhyDev->MdioIndex, MII_BMSR, &Data);
 
@@ -472,6 +623,18 @@ MvPhyDxeInitialise (
   EFI_STATUS Status;
   EFI_HANDLE Handle = NULL;
 
+  Status = gBS->CreateEvent (
+                  EVT_TIMER | EVT_NOTIFY_SIGNAL,
+                  TPL_CALLBACK,
+                  MvPhyBringUpNotify,
+                  NULL,
+                  &BringUpEvent
+                  );
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "MvPhyDxe: Failed to create bring-up event\n"));
+    return Status;
+  }
+
   Phy = AllocateZeroPool (sizeof (MARVELL_PHY_PROTOCOL));
   Phy->Status = MvPhyStatus;
   Phy->Init = MvPhyInit;
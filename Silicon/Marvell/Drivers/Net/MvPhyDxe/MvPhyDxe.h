@@ -21,7 +21,11 @@ SPDX-License-Identifier: BSD-2-Clause-Patent
 #define BMSR_ANEGCAPABLE               0x0008 /* 1 = Able to perform auto-neg */
 #define BMSR_ANEGCOMPLETE              0x0020 /* 1 = Auto-neg complete */
 
-#define PHY_AUTONEGOTIATE_TIMEOUT      5000
+#define PHY_AUTONEGOTIATE_TIMEOUT      5000   /* ms */
+#define PHY_SPEED_SETTLE_TIME          500    /* ms */
+
+/* Period of the timer tracking the PHYs bring-up, in 100ns units */
+#define PHY_BRINGUP_POLL_PERIOD        EFI_TIMER_PERIOD_MILLISECONDS (10)
 
 /* 88E1011 PHY Status Register */
 #define MIIM_88E1xxx_PHY_STATUS        0x11
@@ -65,6 +69,28 @@ typedef struct {
   MV_PHY_DEVICE_INIT DevInit;
 } MV_PHY_DEVICE;
 
+typedef enum {
+  MV_PHY_BRINGUP_AUTONEG,     /* Waiting for autonegotiation to complete */
+  MV_PHY_BRINGUP_SPEED,       /* Waiting for the link speed to be resolved */
+  MV_PHY_BRINGUP_SETTLE,      /* Waiting for the link to settle */
+  MV_PHY_BRINGUP_DONE
+} MV_PHY_BRINGUP_STATE;
+
+/*
+ * Autonegotiation of the PHYs runs in the background, all PHYs at once, and
+ * is tracked from a single timer event. Only MvPhyStatus() waits for it, for
+ * the PHY it is called on.
+ */
+typedef struct {
+  LIST_ENTRY           Link;
+  PHY_DEVICE           *PhyDev;
+  UINT32               PhyIndex;
+  MV_PHY_BRINGUP_STATE State;
+  BOOLEAN              SpeedWait;
+  UINT64               StartTime;     /* Performance counter values */
+  UINT64               SettleTime;
+} MV_PHY_BRINGUP;
+
 STATIC
 EFI_STATUS
 MvPhyInit1512 (
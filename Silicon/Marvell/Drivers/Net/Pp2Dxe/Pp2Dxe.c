@@ -483,6 +483,11 @@ Pp2DxePhyInitialize (
 {
   EFI_STATUS Status;
 
+  if (Pp2Context->PhyDev != NULL) {
+    /* PHY already initialized, possibly still autonegotiating */
+    return EFI_SUCCESS;
+  }
+
   Status = gBS->LocateProtocol (
                &gMarvellPhyProtocolGuid,
                NULL,
@@ -506,15 +511,54 @@ Pp2DxePhyInitialize (
              );
 
   if (EFI_ERROR(Status) && Status != EFI_TIMEOUT) {
+    if (Pp2Context->PhyDev != NULL) {
+      FreePool (Pp2Context->PhyDev);
+      Pp2Context->PhyDev = NULL;
+    }
     return Status;
   }
 
-  Pp2Context->Phy->Status(Pp2Context->Phy, Pp2Context->PhyDev);
   Mvpp2SmiPhyAddrCfg(&Pp2Context->Port, Pp2Context->Port.GopIndex, Pp2Context->PhyDev->Addr);
 
   return EFI_SUCCESS;
 }
 
+/**
+  Start the PHY of a port as soon as the PHY protocol is available, so that
+  autonegotiation of all ports runs in the background, before any of them is
+  initialized through SNP.
+
+  @param[in]        Event          The PHY protocol notification event.
+  @param[in]        Context        The port context.
+
+**/
+STATIC
+VOID
+EFIAPI
+Pp2DxePhyProtocolNotify (
+  IN EFI_EVENT Event,
+  IN VOID      *Context
+  )
+{
+  PP2DXE_CONTEXT *Pp2Context;
+  EFI_STATUS Status;
+
+  Pp2Context = Context;
+
+  Status = Pp2DxePhyInitialize (Pp2Context);
+  if (Status == EFI_NOT_FOUND) {
+    /* Spurious notification, the protocol is not installed yet */
+    return;
+  }
+
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_WARN, "Pp2Dxe%d: PHY initialization failed: %r\n", Pp2Context->Instance, Status));
+  }
+
+  gBS->CloseEvent (Event);
+  Pp2Context->PhyNotifyEvent = NULL;
+}
+
 EFI_STATUS
 EFIAPI
 Pp2DxeSnpInitialize (
@@ -564,6 +608,11 @@ Pp2DxeSnpInitialize (
     ReturnUnlock (SavedTpl, Status);
   }
 
+  /* Wait for the autonegotiation of this port's PHY to complete */
+  if (Pp2Context->PhyDev != NULL) {
+    Pp2Context->Phy->Status(Pp2Context->Phy, Pp2Context->PhyDev);
+  }
+
   Status = Pp2DxeLateInitialize(Pp2Context);
   ReturnUnlock (SavedTpl, Status);
 }
@@ -1321,6 +1370,7 @@ Pp2DxeInitialiseController (
   UINT32 NetCompConfig = 0;
   STATIC UINT8 DeviceInstance;
   UINT8 *Pp2PortMappingTable;
+  VOID *Registration;
 
   Mvpp2Shared->Base = BaseAddress;
   Mvpp2Shared->Rfu1Base = Mvpp2Shared->Base + MVPP22_RFU1_OFFSET;
@@ -1455,6 +1505,17 @@ Pp2DxeInitialiseController (
       MvGop110FlCfg (&Pp2Context->Port);
     }
 
+    /* Start PHY autonegotiation early, without waiting for the link */
+    if (Pp2Context->Port.PhyIndex != 0xff) {
+      Pp2Context->PhyNotifyEvent = EfiCreateProtocolNotifyEvent (
+                                     &gMarvellPhyProtocolGuid,
+                                     TPL_CALLBACK,
+                                     Pp2DxePhyProtocolNotify,
+                                     Pp2Context,
+                                     &Registration
+                                     );
+    }
+
     Status = gBS->CreateEvent (
                  EVT_SIGNAL_EXIT_BOOT_SERVICES,
                  TPL_NOTIFY,
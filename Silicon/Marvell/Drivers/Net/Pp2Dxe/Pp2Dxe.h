@@ -339,6 +339,7 @@ typedef struct {
   UINTN                       CompletionQueueHead;
   UINTN                       CompletionQueueTail;
   EFI_EVENT                   EfiExitBootServicesEvent;
+  EFI_EVENT                   PhyNotifyEvent;
   PP2_DEVICE_PATH             *DevicePath;
   EFI_ADAPTER_INFORMATION_PROTOCOL Aip;
 } PP2DXE_CONTEXT;
@@ -10,6 +10,7 @@
 #include <IndustryStandard/Pci22.h>
 #include <Library/PciSegmentLib.h>
 #include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
 #include <Library/DebugLib.h>
 #include <Library/IoLib.h>
 #include <Library/MemoryAllocationLib.h>
@@ -124,6 +125,10 @@ PciLsCfgTarget (
            (((Address >> 15) & 0x1F) << 19) |
            (((Address >> 12) & 0x7) << 16);
 
+  //
+  // The viewport is shared with PciHostBridgeLib, so it is always selected
+  // before the region registers are written.
+  //
   if (Bus > 1) {
     MmioWrite32 ((UINTN)Dbi + IATU_VIEWPORT_OFF, IATU_VIEWPORT_OUTBOUND | IATU_REGION_INDEX1);
   } else {
@@ -234,8 +239,6 @@ PciSegmentLibReadWorker (
   Segment = (Address >> 32);
   Offset = (Address & 0xfff );
 
-  Base = PciSegmentLibGetConfigBase (Address, Segment, Offset);
-
   // ignore devices > 0 on bus 0
   if ((Address & 0xff00000) == 0 && (Address & 0xf8000) != 0) {
     return MAX_UINT32;
@@ -246,6 +249,8 @@ PciSegmentLibReadWorker (
     return MAX_UINT32;
   }
 
+  Base = PciSegmentLibGetConfigBase (Address, Segment, Offset);
+
   switch (Width) {
   case PciCfgWidthUint8:
     return MmioRead8 (Base);
@@ -286,8 +291,6 @@ PciSegmentLibWriteWorker (
   Segment = (Address >> 32);
   Offset = (Address & 0xfff );
 
-  Base = PciSegmentLibGetConfigBase (Address, Segment, Offset);
-
   // ignore devices > 0 on bus 0
   if ((Address & 0xff00000) == 0 && (Address & 0xf8000) != 0) {
     return Data;
@@ -298,6 +301,8 @@ PciSegmentLibWriteWorker (
     return MAX_UINT32;
   }
 
+  Base = PciSegmentLibGetConfigBase (Address, Segment, Offset);
+
   switch (Width) {
   case PciCfgWidthUint8:
     MmioWrite8 (Base , Data);
@@ -501,6 +506,88 @@ PciSegmentWrite32 (
   return PciSegmentLibWriteWorker (Address, PciCfgWidthUint32, Value);
 }
 
+/**
+  Reads a range of PCI configuration registers of a single function with one
+  config window setup.
+
+  The config space of a function is mapped linearly once the outbound window
+  targets it, so the window is programmed once for the whole range rather
+  than for each register. The root port config space of Gen4 controllers is
+  paged above INDIRECT_ADDR_BNDRY and is left to the register by register
+  path.
+
+  @param  StartAddress  The starting address that encodes the PCI Segment, Bus,
+                        Device, Function and Register.
+  @param  Size          The size in bytes of the transfer.
+  @param  Buffer        The pointer to a buffer receiving the data read.
+
+  @retval TRUE          The range was read.
+  @retval FALSE         The range must be read register by register.
+
+**/
+STATIC
+BOOLEAN
+PciSegmentLibReadBufferDirect (
+  IN  UINT64                   StartAddress,
+  IN  UINTN                    Size,
+  OUT VOID                     *Buffer
+  )
+{
+  UINT64    Base;
+  UINT16    Segment;
+  UINT8     Bus;
+
+  Segment = (StartAddress >> 32);
+  Bus = ((UINT32)StartAddress >> 20) & 0xff;
+
+  if ((Bus == 0) && PciLsGen4Ctrl) {
+    return FALSE;
+  }
+
+  // Devices ignored by the workers read as all ones
+  if (((StartAddress & 0xfe00000) == 0) && ((StartAddress & 0xf8000) != 0)) {
+    SetMem (Buffer, Size, 0xff);
+    return TRUE;
+  }
+
+  Base = PciSegmentLibGetConfigBase (StartAddress, Segment,
+           StartAddress & 0xfff);
+
+  if (((Base & BIT0) != 0) && (Size >= sizeof (UINT8))) {
+    *(UINT8 *)Buffer = MmioRead8 (Base);
+    Base += sizeof (UINT8);
+    Size -= sizeof (UINT8);
+    Buffer = (UINT8 *)Buffer + 1;
+  }
+
+  if (((Base & BIT1) != 0) && (Size >= sizeof (UINT16))) {
+    WriteUnaligned16 (Buffer, MmioRead16 (Base));
+    Base += sizeof (UINT16);
+    Size -= sizeof (UINT16);
+    Buffer = (UINT16 *)Buffer + 1;
+  }
+
+  while (Size >= sizeof (UINT32)) {
+    WriteUnaligned32 (Buffer, MmioRead32 (Base));
+    Base += sizeof (UINT32);
+    Size -= sizeof (UINT32);
+    Buffer = (UINT32 *)Buffer + 1;
+  }
+
+  if (Size >= sizeof (UINT16)) {
+    WriteUnaligned16 (Buffer, MmioRead16 (Base));
+    Base += sizeof (UINT16);
+    Size -= sizeof (UINT16);
+    Buffer = (UINT16 *)Buffer + 1;
+  }
+
+  if (Size >= sizeof (UINT8)) {
+    *(UINT8 *)Buffer = MmioRead8 (Base);
+  }
+
+  return TRUE;
+}
+
 /**
   Reads a range of PCI configuration registers into a caller supplied buffer.
 
@@ -545,6 +632,10 @@ PciSegmentReadBuffer (
   //
   ReturnValue = Size;
 
+  if (PciSegmentLibReadBufferDirect (StartAddress, Size, Buffer)) {
+    return ReturnValue;
+  }
+
   if ((StartAddress & BIT0) != 0) {
     //
     // Read a byte if StartAddress is byte aligned
@@ -0,0 +1,197 @@
+/** @file
+  Clear a memory buffer on all harts through the MP Services Protocol.
+
+  The buffer is cleared once on the boot hart alone, then split in equal
+  chunks across the boot hart and all the enabled application processors,
+  the boot hart clearing its own chunk while the others run, and both
+  timings are printed.
+
+  Copyright (c) 2020, Hewlett Packard Enterprise Development LP. All rights reserved.<BR>
+
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <Uefi.h>
+#include <Protocol/MpService.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/TimerLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+
+#define MP_ZERO_MEM_BUFFER_SIZE   SIZE_64MB
+
+typedef struct {
+  EFI_MP_SERVICES_PROTOCOL  *MpServices;
+  UINT8                     *Buffer;
+  UINTN                     ChunkSize;
+  UINTN                     Size;
+  UINTN                     *ChunkIndex;    // Chunk of each processor number
+} MP_ZERO_MEM_CONTEXT;
+
+/**
+  Clear the chunk of the buffer owned by the calling processor.
+
+  @param  Buffer            The MP_ZERO_MEM_CONTEXT.
+
+**/
+STATIC
+VOID
+EFIAPI
+MpZeroMemChunk (
+  IN VOID   *Buffer
+  )
+{
+  MP_ZERO_MEM_CONTEXT *Context;
+  UINTN               ProcessorNumber;
+  UINTN               Offset;
+
+  Context = Buffer;
+  Context->MpServices->WhoAmI (Context->MpServices, &ProcessorNumber);
+
+  Offset = Context->ChunkIndex[ProcessorNumber] * Context->ChunkSize;
+  if (Offset < Context->Size) {
+    ZeroMem (Context->Buffer + Offset, MIN (Context->ChunkSize, Context->Size - Offset));
+  }
+}
+
+/**
+  Return the time elapsed since a performance counter value.
+
+  @param  Start             Performance counter value.
+
+  @return Elapsed time in us.
+
+**/
+STATIC
+UINT64
+MpZeroMemElapsedTime (
+  IN UINT64   Start
+  )
+{
+  return DivU64x32 (GetTimeInNanoSecond (GetPerformanceCounter () - Start), 1000);
+}
+
+/**
+  The entry point of the application.
+
+  @param  ImageHandle       The firmware allocated handle for the EFI image.
+  @param  SystemTable       A pointer to the EFI System Table.
+
+  @retval EFI_SUCCESS       The buffer was cleared.
+  @retval other             The MP Services Protocol is not available, or
+                            the buffer could not be allocated.
+
+**/
+EFI_STATUS
+EFIAPI
+MpZeroMemMain (
+  IN EFI_HANDLE         ImageHandle,
+  IN EFI_SYSTEM_TABLE   *SystemTable
+  )
+{
+  MP_ZERO_MEM_CONTEXT       Context;
+  EFI_PROCESSOR_INFORMATION ProcessorInfo;
+  EFI_EVENT                 WaitEvent;
+  EFI_STATUS                Status;
+  UINTN                     NumberOfProcessors;
+  UINTN                     NumberOfEnabledProcessors;
+  UINTN                     Index;
+  UINTN                     Chunk;
+  UINT64                    Start;
+  UINT64                    SingleTime;
+  UINT64                    MpTime;
+
+  Status = gBS->LocateProtocol (
+                  &gEfiMpServiceProtocolGuid,
+                  NULL,
+                  (VOID **)&Context.MpServices
+                  );
+  if (EFI_ERROR (Status)) {
+    Print (L"MP Services Protocol not found: %r\n", Status);
+    return Status;
+  }
+
+  Context.MpServices->GetNumberOfProcessors (
+                        Context.MpServices,
+                        &NumberOfProcessors,
+                        &NumberOfEnabledProcessors
+                        );
+
+  //
+  // Give consecutive chunks to the enabled processors
+  //
+  Context.ChunkIndex = AllocateZeroPool (NumberOfProcessors * sizeof (UINTN));
+  if (Context.ChunkIndex == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+  Chunk = 0;
+  for (Index = 0; Index < NumberOfProcessors; Index++) {
+    Context.MpServices->GetProcessorInfo (Context.MpServices, Index, &ProcessorInfo);
+    if ((ProcessorInfo.StatusFlag & PROCESSOR_ENABLED_BIT) != 0) {
+      Context.ChunkIndex[Index] = Chunk++;
+    }
+  }
+
+  Context.Size = MP_ZERO_MEM_BUFFER_SIZE;
+  Context.ChunkSize = ALIGN_VALUE (
+                        (Context.Size + NumberOfEnabledProcessors - 1) / NumberOfEnabledProcessors,
+                        EFI_PAGE_SIZE
+                        );
+  Context.Buffer = AllocatePages (EFI_SIZE_TO_PAGES (Context.Size));
+  if (Context.Buffer == NULL) {
+    FreePool (Context.ChunkIndex);
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Status = gBS->CreateEvent (0, TPL_CALLBACK, NULL, NULL, &WaitEvent);
+  if (EFI_ERROR (Status)) {
+    goto Exit;
+  }
+
+  SetMem (Context.Buffer, Context.Size, 0xA5);
+  Start = GetPerformanceCounter ();
+  ZeroMem (Context.Buffer, Context.Size);
+  SingleTime = MpZeroMemElapsedTime (Start);
+
+  SetMem (Context.Buffer, Context.Size, 0xA5);
+  Start = GetPerformanceCounter ();
+  Status = Context.MpServices->StartupAllAPs (
+                                 Context.MpServices,
+                                 MpZeroMemChunk,
+                                 FALSE,
+                                 WaitEvent,
+                                 0,
+                                 &Context,
+                                 NULL
+                                 );
+  if (EFI_ERROR (Status) && Status != EFI_NOT_STARTED) {
+    Print (L"StartupAllAPs failed: %r\n", Status);
+    goto CloseEvent;
+  }
+
+  MpZeroMemChunk (&Context);
+  if (Status == EFI_SUCCESS) {
+    while (gBS->CheckEvent (WaitEvent) == EFI_NOT_READY) {
+      CpuPause ();
+    }
+  }
+  MpTime = MpZeroMemElapsedTime (Start);
+
+  Print (L"Cleared %d MB: %ld us on 1 hart, %ld us on %d harts\n",
+    (UINT32)(Context.Size / SIZE_1MB),
+    SingleTime,
+    MpTime,
+    (UINT32)NumberOfEnabledProcessors
+    );
+  Status = EFI_SUCCESS;
+
+CloseEvent:
+  gBS->CloseEvent (WaitEvent);
+Exit:
+  FreePages (Context.Buffer, EFI_SIZE_TO_PAGES (Context.Size));
+  FreePool (Context.ChunkIndex);
+  return Status;
+}
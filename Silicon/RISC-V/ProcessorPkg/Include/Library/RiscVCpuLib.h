@@ -68,4 +68,13 @@ RiscVReadMachineImplementId (VOID);
 VOID
 RiscVSetSupervisorAddressTranslationRegister(UINT64);
 
+UINT64
+RiscVGetSupervisorAddressTranslationRegister(VOID);
+
+VOID
+RiscVLocalTlbFlushAll(VOID);
+
+VOID
+RiscVWaitForInterrupt(VOID);
+
 #endif
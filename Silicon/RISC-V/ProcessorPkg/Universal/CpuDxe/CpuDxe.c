@@ -14,6 +14,7 @@
 //
 STATIC BOOLEAN mInterruptState = FALSE;
 STATIC EFI_HANDLE mCpuHandle = NULL;
+STATIC EFI_EVENT mIdleLoopEvent = NULL;
 
 EFI_CPU_ARCH_PROTOCOL  gCpu = {
   CpuFlushCpuDataCache,
@@ -268,8 +269,39 @@ CpuSetMemoryAttributes (
   IN UINT64                    Attributes
   )
 {
-  DEBUG ((DEBUG_INFO, "%a: Set memory attributes not supported yet\n", __FUNCTION__));
-  return EFI_UNSUPPORTED;
+  EFI_STATUS  Status;
+
+  if (Length == 0) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Status = MmuSetMemoryAttributes (BaseAddress, Length, Attributes);
+  if (Status == EFI_UNSUPPORTED) {
+    DEBUG ((DEBUG_INFO, "%a: Cannot set attributes of 0x%lx - 0x%lx\n",
+      __FUNCTION__, BaseAddress, Length));
+  }
+  return Status;
+}
+
+/**
+  Idle loop callback, signaled by the DXE core while waiting for an event.
+
+  Stalls the hart until the next interrupt instead of spinning, the timer
+  interrupt bounds the wait.
+
+  @param  Event             The idle loop event.
+  @param  Context           Not used.
+
+**/
+STATIC
+VOID
+EFIAPI
+IdleLoopEventCallback (
+  IN EFI_EVENT                Event,
+  IN VOID                     *Context
+  )
+{
+  RiscVWaitForInterrupt ();
 }
 
 /**
@@ -302,6 +334,15 @@ InitializeCpu (
   //
   DisableInterrupts ();
 
+  //
+  // Memory attributes cannot be set without address translation, this is
+  // not fatal.
+  //
+  Status = InitializeMmu ();
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_WARN, "%a: Address translation not enabled: %r\n", __FUNCTION__, Status));
+  }
+
   //
   // Install CPU Architectural Protocol
   //
@@ -311,6 +352,31 @@ InitializeCpu (
                   NULL
                   );
   ASSERT_EFI_ERROR (Status);
-  return Status;
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  //
+  // Wait for interrupts rather than spin when the DXE core is idle.
+  //
+  Status = gBS->CreateEventEx (
+                  EVT_NOTIFY_SIGNAL,
+                  TPL_NOTIFY,
+                  IdleLoopEventCallback,
+                  NULL,
+                  &gIdleLoopEventGuid,
+                  &mIdleLoopEvent
+                  );
+  ASSERT_EFI_ERROR (Status);
+
+  //
+  // Running on the boot hart only is not fatal
+  //
+  Status = InitializeMpSupport (mCpuHandle);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_WARN, "%a: MP services not available: %r\n", __FUNCTION__, Status));
+  }
+
+  return EFI_SUCCESS;
 }
 
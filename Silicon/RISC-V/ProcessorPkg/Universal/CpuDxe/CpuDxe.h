@@ -12,14 +12,23 @@
 
 #include <PiDxe.h>
 
+#include <Guid/IdleLoopEvent.h>
 #include <Protocol/Cpu.h>
 #include <Library/BaseLib.h>
 #include <Library/CpuExceptionHandlerLib.h>
+#include <Library/BaseMemoryLib.h>
 #include <Library/DebugLib.h>
+#include <Library/DxeServicesTableLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/PcdLib.h>
 #include <Library/RiscVCpuLib.h>
+#include <Library/TimerLib.h>
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/UefiDriverEntryPoint.h>
 
+#include "CpuMmu.h"
+#include "CpuMp.h"
+
 /**
   Flush CPU data cache. If the instruction cache is fully coherent
   with all DMA operations then function can just return EFI_SUCCESS.
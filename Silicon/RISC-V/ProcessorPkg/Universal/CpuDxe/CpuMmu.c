@@ -0,0 +1,548 @@
+/** @file
+  RISC-V Sv39/Sv48 page table management.
+
+  DXE runs on an identity map. Memory is mapped with the largest pages
+  possible: large pages are split when the attributes of part of them change,
+  and tables whose entries all end up contiguous with the same attributes are
+  folded back into a single large page.
+
+  Without the Svpbmt extension, cacheability is set by the platform PMAs and
+  the cache attributes are only recorded in the GCD.
+
+  Copyright (c) 2020, Hewlett Packard Enterprise Development LP. All rights reserved.<BR>
+
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include "CpuDxe.h"
+
+STATIC UINT64    *mMmuRootTable;
+STATIC UINTN     mMmuLevels;
+STATIC UINT64    mMmuMaxAddress;
+STATIC EFI_EVENT mMmuExitBootServicesEvent;
+
+//
+// Free page table pages, linked through their first entry. Pages released
+// while updating the page tables are only returned to the pool once the TLB
+// has been flushed.
+//
+STATIC UINT64    *mMmuPool;
+STATIC UINTN     mMmuPoolCount;
+STATIC UINT64    *mMmuReleased;
+STATIC BOOLEAN   mMmuRefilling;
+
+/**
+  Add pages to the page table pool.
+
+  @param  Count                 Number of pages to add.
+
+**/
+STATIC
+VOID
+MmuGrowPool (
+  IN UINTN    Count
+  )
+{
+  UINT64 *Pages;
+  UINTN  Index;
+
+  //
+  // Allocating memory may update the attributes of the allocated pages,
+  // which is served from the pages left in the pool.
+  //
+  mMmuRefilling = TRUE;
+  Pages = AllocatePages (Count);
+  mMmuRefilling = FALSE;
+  if (Pages == NULL) {
+    return;
+  }
+
+  for (Index = 0; Index < Count; Index++) {
+    *Pages = (UINT64)(UINTN)mMmuPool;
+    mMmuPool = Pages;
+    mMmuPoolCount++;
+    Pages += RISCV_MMU_TABLE_ENTRIES;
+  }
+}
+
+/**
+  Make sure the page table pool can absorb a page table update.
+
+**/
+STATIC
+VOID
+MmuRefillPool (
+  VOID
+  )
+{
+  if (mMmuPoolCount < RISCV_MMU_POOL_LOW && !mMmuRefilling) {
+    MmuGrowPool (RISCV_MMU_POOL_REFILL);
+  }
+}
+
+/**
+  Take a zeroed page table page from the pool.
+
+  @return The page, or NULL if the pool is empty.
+
+**/
+STATIC
+UINT64 *
+MmuAllocateTable (
+  VOID
+  )
+{
+  UINT64 *Table;
+
+  Table = mMmuPool;
+  if (Table != NULL) {
+    mMmuPool = (UINT64 *)(UINTN)*Table;
+    mMmuPoolCount--;
+    ZeroMem (Table, EFI_PAGE_SIZE);
+  }
+  return Table;
+}
+
+/**
+  Return whether a page table entry points to a next level table.
+
+**/
+STATIC
+BOOLEAN
+MmuIsTable (
+  IN UINT64   Entry
+  )
+{
+  return (Entry & (RISCV_PTE_V | RISCV_PTE_R | RISCV_PTE_W | RISCV_PTE_X)) == RISCV_PTE_V;
+}
+
+/**
+  Return the address an entry points to.
+
+**/
+STATIC
+UINT64
+MmuEntryAddress (
+  IN UINT64   Entry
+  )
+{
+  return ((Entry & RISCV_PTE_PPN_MASK) >> RISCV_PTE_PPN_SHIFT) << RISCV_MMU_PAGE_SHIFT;
+}
+
+/**
+  Release a page table page, and the tables it points to.
+
+  @param  Table                 The page table.
+  @param  Level                 The level of the page table.
+
+**/
+STATIC
+VOID
+MmuReleaseTable (
+  IN UINT64   *Table,
+  IN UINTN    Level
+  )
+{
+  UINTN Index;
+
+  if (Level > 0) {
+    for (Index = 0; Index < RISCV_MMU_TABLE_ENTRIES; Index++) {
+      if (MmuIsTable (Table[Index])) {
+        MmuReleaseTable ((UINT64 *)(UINTN)MmuEntryAddress (Table[Index]), Level - 1);
+      }
+    }
+  }
+
+  *Table = (UINT64)(UINTN)mMmuReleased;
+  mMmuReleased = Table;
+}
+
+/**
+  Return the pages released by an update to the pool, once the TLB is flushed.
+
+**/
+STATIC
+VOID
+MmuRecyclePool (
+  VOID
+  )
+{
+  UINT64 *Table;
+
+  while (mMmuReleased != NULL) {
+    Table = mMmuReleased;
+    mMmuReleased = (UINT64 *)(UINTN)*Table;
+    *Table = (UINT64)(UINTN)mMmuPool;
+    mMmuPool = Table;
+    mMmuPoolCount++;
+  }
+}
+
+/**
+  Compute the flags of a leaf entry from EFI memory attributes.
+
+  The flags of an entry mapping read-protected memory are kept with V clear,
+  so that it still describes its other attributes.
+
+  @param  Attributes            The EFI_MEMORY_* attributes.
+  @param  OldEntry              The entry being replaced, providing the memory
+                                type if Attributes has no cache attribute.
+
+  @return The flags of the leaf entry.
+
+**/
+STATIC
+UINT64
+MmuLeafFlags (
+  IN UINT64   Attributes,
+  IN UINT64   OldEntry
+  )
+{
+  UINT64 Flags;
+
+  Flags = RISCV_PTE_V | RISCV_PTE_R | RISCV_PTE_W | RISCV_PTE_X |
+          RISCV_PTE_A | RISCV_PTE_D;
+
+  if ((Attributes & EFI_MEMORY_RP) != 0) {
+    Flags &= ~RISCV_PTE_V;
+  }
+  if ((Attributes & EFI_MEMORY_RO) != 0) {
+    Flags &= ~RISCV_PTE_W;
+  }
+  if ((Attributes & EFI_MEMORY_XP) != 0) {
+    Flags &= ~RISCV_PTE_X;
+  }
+
+  if ((Attributes & EFI_MEMORY_CACHETYPE_MASK) == 0) {
+    Flags |= OldEntry & RISCV_PTE_PBMT_MASK;
+  } else if (PcdGetBool (PcdRiscVMmuSvpbmt)) {
+    if ((Attributes & EFI_MEMORY_UC) != 0) {
+      Flags |= RISCV_PTE_PBMT_IO;
+    } else if ((Attributes & (EFI_MEMORY_WC | EFI_MEMORY_WT)) != 0) {
+      Flags |= RISCV_PTE_PBMT_NC;
+    }
+  }
+
+  return Flags;
+}
+
+/**
+  Fold a page table back into a single leaf entry, if all its entries are
+  identical leaves mapping a contiguous region.
+
+  @param  Entry                 The entry pointing to the table.
+  @param  Level                 The level of the entry.
+
+**/
+STATIC
+VOID
+MmuCoalesceTable (
+  IN OUT UINT64   *Entry,
+  IN     UINTN    Level
+  )
+{
+  UINT64 *Table;
+  UINT64 First;
+  UINT64 Expected;
+  UINT64 Step;
+  UINTN  Index;
+
+  if (Level > RISCV_MMU_MAX_LEAF_LEVEL) {
+    return;
+  }
+
+  Table = (UINT64 *)(UINTN)MmuEntryAddress (*Entry);
+  First = Table[0];
+  if (MmuIsTable (First)) {
+    return;
+  }
+
+  //
+  // Unmapped entries are all zero, leaves map consecutive blocks.
+  //
+  Step = (First == 0) ? 0 : LShiftU64 (1, (Level - 1) * RISCV_MMU_LEVEL_BITS) << RISCV_PTE_PPN_SHIFT;
+  if ((MmuEntryAddress (First) &
+       (LShiftU64 (1, RISCV_MMU_PAGE_SHIFT + Level * RISCV_MMU_LEVEL_BITS) - 1)) != 0) {
+    return;
+  }
+
+  Expected = First;
+  for (Index = 1; Index < RISCV_MMU_TABLE_ENTRIES; Index++) {
+    Expected += Step;
+    if (Table[Index] != Expected) {
+      return;
+    }
+  }
+
+  *Entry = First;
+  MmuReleaseTable (Table, Level - 1);
+}
+
+/**
+  Set the attributes of a region in a page table, splitting large pages at
+  the edges of the region and folding tables back when possible.
+
+  @param  Table                 The page table.
+  @param  Level                 The level of the page table, 0 for 4KB pages.
+  @param  Base                  The start of the region.
+  @param  End                   The end of the region.
+  @param  Attributes            The EFI_MEMORY_* attributes of the region.
+
+  @retval EFI_SUCCESS           The attributes were set.
+  @retval EFI_OUT_OF_RESOURCES  The page table pool is empty.
+
+**/
+STATIC
+EFI_STATUS
+MmuUpdateTable (
+  IN UINT64   *Table,
+  IN UINTN    Level,
+  IN UINT64   Base,
+  IN UINT64   End,
+  IN UINT64   Attributes
+  )
+{
+  EFI_STATUS Status;
+  UINT64     *Entry;
+  UINT64     *NextTable;
+  UINT64     BlockSize;
+  UINT64     BlockStart;
+  UINT64     BlockEnd;
+  UINT64     ChunkEnd;
+  UINT64     Step;
+  UINTN      Index;
+
+  BlockSize = LShiftU64 (1, RISCV_MMU_PAGE_SHIFT + Level * RISCV_MMU_LEVEL_BITS);
+
+  while (Base < End) {
+    Index = (UINTN)RShiftU64 (Base, RISCV_MMU_PAGE_SHIFT + Level * RISCV_MMU_LEVEL_BITS) &
+            (RISCV_MMU_TABLE_ENTRIES - 1);
+    Entry = &Table[Index];
+    BlockStart = Base & ~(BlockSize - 1);
+    BlockEnd = BlockStart + BlockSize;
+    ChunkEnd = MIN (End, BlockEnd);
+
+    if (Base == BlockStart && ChunkEnd == BlockEnd &&
+        Level <= RISCV_MMU_MAX_LEAF_LEVEL) {
+      //
+      // The whole block is covered: map it with a single leaf
+      //
+      if (MmuIsTable (*Entry)) {
+        NextTable = (UINT64 *)(UINTN)MmuEntryAddress (*Entry);
+        *Entry = (RShiftU64 (BlockStart, RISCV_MMU_PAGE_SHIFT) << RISCV_PTE_PPN_SHIFT) |
+                 MmuLeafFlags (Attributes, NextTable[0]);
+        MmuReleaseTable (NextTable, Level - 1);
+      } else {
+        *Entry = (RShiftU64 (BlockStart, RISCV_MMU_PAGE_SHIFT) << RISCV_PTE_PPN_SHIFT) |
+                 MmuLeafFlags (Attributes, *Entry);
+      }
+    } else {
+      if (!MmuIsTable (*Entry)) {
+        //
+        // Split the large page, or create the missing table. The new table
+        // is complete before it is linked, so the region stays mapped.
+        //
+        NextTable = MmuAllocateTable ();
+        if (NextTable == NULL) {
+          return EFI_OUT_OF_RESOURCES;
+        }
+        if (*Entry != 0) {
+          Step = LShiftU64 (1, (Level - 1) * RISCV_MMU_LEVEL_BITS) << RISCV_PTE_PPN_SHIFT;
+          NextTable[0] = *Entry;
+          for (Index = 1; Index < RISCV_MMU_TABLE_ENTRIES; Index++) {
+            NextTable[Index] = NextTable[Index - 1] + Step;
+          }
+        }
+        MemoryFence ();
+        *Entry = (RShiftU64 ((UINTN)NextTable, RISCV_MMU_PAGE_SHIFT) << RISCV_PTE_PPN_SHIFT) |
+                 RISCV_PTE_V;
+      }
+
+      Status = MmuUpdateTable (
+                 (UINT64 *)(UINTN)MmuEntryAddress (*Entry),
+                 Level - 1,
+                 Base,
+                 ChunkEnd,
+                 Attributes
+                 );
+      if (EFI_ERROR (Status)) {
+        return Status;
+      }
+
+      MmuCoalesceTable (Entry, Level);
+    }
+
+    Base = ChunkEnd;
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Update the page table attributes of a memory region.
+
+  @param  BaseAddress           The start of the region.
+  @param  Length                The size of the region.
+  @param  Attributes            The EFI_MEMORY_* attributes of the region.
+
+  @retval EFI_SUCCESS           The attributes were set.
+  @retval EFI_UNSUPPORTED       Address translation is off, or the region is
+                                not page aligned or out of reach.
+  @retval EFI_OUT_OF_RESOURCES  The page tables could not be allocated.
+
+**/
+EFI_STATUS
+MmuSetMemoryAttributes (
+  IN EFI_PHYSICAL_ADDRESS      BaseAddress,
+  IN UINT64                    Length,
+  IN UINT64                    Attributes
+  )
+{
+  EFI_STATUS Status;
+
+  if (mMmuRootTable == NULL) {
+    return EFI_UNSUPPORTED;
+  }
+
+  if (((BaseAddress | Length) & EFI_PAGE_MASK) != 0 ||
+      BaseAddress >= mMmuMaxAddress ||
+      Length > mMmuMaxAddress - BaseAddress) {
+    DEBUG ((DEBUG_ERROR, "%a: Unsupported region 0x%lx - 0x%lx\n",
+      __FUNCTION__, BaseAddress, Length));
+    return EFI_UNSUPPORTED;
+  }
+
+  MmuRefillPool ();
+
+  Status = MmuUpdateTable (
+             mMmuRootTable,
+             mMmuLevels - 1,
+             BaseAddress,
+             BaseAddress + Length,
+             Attributes
+             );
+
+  RiscVLocalTlbFlushAll ();
+  MmuRecyclePool ();
+
+  return Status;
+}
+
+/**
+  Turn address translation off before handing over to the OS, which expects
+  to be entered with satp cleared.
+
+  @param  Event                 The ExitBootServices event.
+  @param  Context               Unused.
+
+**/
+STATIC
+VOID
+EFIAPI
+MmuExitBootServices (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  RiscVSetSupervisorAddressTranslationRegister (0);
+  RiscVLocalTlbFlushAll ();
+  mMmuRootTable = NULL;
+}
+
+/**
+  Build an identity map of the GCD memory space and turn address translation
+  on, using Sv39 or Sv48 as needed.
+
+  @retval EFI_SUCCESS           Address translation is on.
+  @retval EFI_UNSUPPORTED       The hart does not support the required mode.
+  @retval EFI_OUT_OF_RESOURCES  The page tables could not be allocated.
+
+**/
+EFI_STATUS
+InitializeMmu (
+  VOID
+  )
+{
+  EFI_GCD_MEMORY_SPACE_DESCRIPTOR *MemorySpaceMap;
+  EFI_STATUS                      Status;
+  UINTN                           NumberOfDescriptors;
+  UINTN                           Index;
+  UINT64                          Top;
+  UINT64                          Satp;
+  UINT64                          Mode;
+
+  Status = gDS->GetMemorySpaceMap (&NumberOfDescriptors, &MemorySpaceMap);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  Top = 0;
+  for (Index = 0; Index < NumberOfDescriptors; Index++) {
+    if (MemorySpaceMap[Index].GcdMemoryType != EfiGcdMemoryTypeNonExistent) {
+      Top = MAX (Top, MemorySpaceMap[Index].BaseAddress + MemorySpaceMap[Index].Length);
+    }
+  }
+  FreePool (MemorySpaceMap);
+
+  //
+  // Identity mapped addresses must be valid virtual addresses of the lower
+  // half of the address space. Prefer the shorter walks of Sv39.
+  //
+  Top = ALIGN_VALUE (Top, SIZE_1GB);
+  if (Top <= LShiftU64 (1, 38)) {
+    mMmuLevels = RISCV_MMU_SV39_LEVELS;
+    Mode = RISCV_SATP_MODE_SV39;
+  } else if (Top <= LShiftU64 (1, 47)) {
+    mMmuLevels = RISCV_MMU_SV48_LEVELS;
+    Mode = RISCV_SATP_MODE_SV48;
+  } else {
+    return EFI_UNSUPPORTED;
+  }
+  mMmuMaxAddress = LShiftU64 (1, RISCV_MMU_PAGE_SHIFT + mMmuLevels * RISCV_MMU_LEVEL_BITS - 1);
+
+  //
+  // Sv48 needs a table of 1GB pages per 512GB
+  //
+  MmuGrowPool (RISCV_MMU_POOL_REFILL + (UINTN)RShiftU64 (Top, 39));
+  mMmuRootTable = MmuAllocateTable ();
+  if (mMmuRootTable == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  //
+  // Map everything below the top of the memory space with 1GB pages,
+  // the DXE core then refines the attributes of each GCD region.
+  //
+  Status = MmuUpdateTable (mMmuRootTable, mMmuLevels - 1, 0, Top, EFI_MEMORY_WB);
+  if (EFI_ERROR (Status)) {
+    mMmuRootTable = NULL;
+    return Status;
+  }
+
+  Satp = LShiftU64 (Mode, RISCV_SATP_MODE_BIT_POSITION) |
+         RShiftU64 ((UINTN)mMmuRootTable, RISCV_MMU_PAGE_SHIFT);
+  RiscVSetSupervisorAddressTranslationRegister (Satp);
+  RiscVLocalTlbFlushAll ();
+
+  //
+  // Writing an unsupported mode to satp has no effect
+  //
+  if (RiscVGetSupervisorAddressTranslationRegister () != Satp) {
+    DEBUG ((DEBUG_WARN, "%a: Sv%d not supported\n", __FUNCTION__,
+      (UINT32)(RISCV_MMU_PAGE_SHIFT + mMmuLevels * RISCV_MMU_LEVEL_BITS)));
+    mMmuRootTable = NULL;
+    return EFI_UNSUPPORTED;
+  }
+
+  DEBUG ((DEBUG_INFO, "%a: Sv%d identity map up to 0x%lx\n", __FUNCTION__,
+    (UINT32)(RISCV_MMU_PAGE_SHIFT + mMmuLevels * RISCV_MMU_LEVEL_BITS), Top));
+
+  return gBS->CreateEvent (
+                EVT_SIGNAL_EXIT_BOOT_SERVICES,
+                TPL_NOTIFY,
+                MmuExitBootServices,
+                NULL,
+                &mMmuExitBootServicesEvent
+                );
+}
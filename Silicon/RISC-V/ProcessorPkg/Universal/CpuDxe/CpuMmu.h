@@ -0,0 +1,83 @@
+/** @file
+  RISC-V Sv39/Sv48 page table management.
+
+  Copyright (c) 2020, Hewlett Packard Enterprise Development LP. All rights reserved.<BR>
+
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef CPU_MMU_H_
+#define CPU_MMU_H_
+
+//
+// Page table entry
+//
+#define RISCV_PTE_V                 BIT0
+#define RISCV_PTE_R                 BIT1
+#define RISCV_PTE_W                 BIT2
+#define RISCV_PTE_X                 BIT3
+#define RISCV_PTE_U                 BIT4
+#define RISCV_PTE_G                 BIT5
+#define RISCV_PTE_A                 BIT6
+#define RISCV_PTE_D                 BIT7
+#define RISCV_PTE_PPN_SHIFT         10
+#define RISCV_PTE_PPN_MASK          0x003FFFFFFFFFFC00ULL
+#define RISCV_PTE_PBMT_MASK         (BIT62 | BIT61)
+#define RISCV_PTE_PBMT_PMA          0
+#define RISCV_PTE_PBMT_NC           BIT61
+#define RISCV_PTE_PBMT_IO           BIT62
+
+#define RISCV_MMU_PAGE_SHIFT        12
+#define RISCV_MMU_LEVEL_BITS        9
+#define RISCV_MMU_TABLE_ENTRIES     512
+#define RISCV_MMU_SV39_LEVELS       3
+#define RISCV_MMU_SV48_LEVELS       4
+
+//
+// Largest leaf level used, 1GB pages
+//
+#define RISCV_MMU_MAX_LEAF_LEVEL    2
+
+//
+// Page table pages kept in reserve, so that no memory is allocated while the
+// page tables are being updated.
+//
+#define RISCV_MMU_POOL_LOW          (4 * (RISCV_MMU_SV48_LEVELS - 1))
+#define RISCV_MMU_POOL_REFILL       32
+
+/**
+  Build an identity map of the GCD memory space and turn address translation
+  on, using Sv39 or Sv48 as needed.
+
+  @retval EFI_SUCCESS           Address translation is on.
+  @retval EFI_UNSUPPORTED       The hart does not support the required mode.
+  @retval EFI_OUT_OF_RESOURCES  The page tables could not be allocated.
+
+**/
+EFI_STATUS
+InitializeMmu (
+  VOID
+  );
+
+/**
+  Update the page table attributes of a memory region.
+
+  @param  BaseAddress           The start of the region.
+  @param  Length                The size of the region.
+  @param  Attributes            The EFI_MEMORY_* attributes of the region.
+
+  @retval EFI_SUCCESS           The attributes were set.
+  @retval EFI_UNSUPPORTED       Address translation is off, or the region is
+                                not page aligned or out of reach.
+  @retval EFI_OUT_OF_RESOURCES  The page tables could not be allocated.
+
+**/
+EFI_STATUS
+MmuSetMemoryAttributes (
+  IN EFI_PHYSICAL_ADDRESS      BaseAddress,
+  IN UINT64                    Length,
+  IN UINT64                    Attributes
+  );
+
+#endif
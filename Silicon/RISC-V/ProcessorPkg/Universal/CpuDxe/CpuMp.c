@@ -0,0 +1,1018 @@
+/** @file
+  RISC-V MP services, built on the SBI Hart State Management extension.
+
+  Application processors are kept stopped in SBI. Each procedure dispatched
+  to one of them starts the hart at CpuMpApEntry with its own stack; the hart
+  stops itself again once the procedure returns. Non-blocking requests are
+  completed from a periodic timer event.
+
+  Copyright (c) 2020, Hewlett Packard Enterprise Development LP. All rights reserved.<BR>
+
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include "CpuDxe.h"
+
+#include <sbi/riscv_asm.h>
+#include <sbi/riscv_encoding.h>
+
+STATIC CPU_MP_DATA mCpuMp;
+
+/**
+  Return the time elapsed since a performance counter value.
+
+  The RISC-V machine timer always counts up.
+
+  @param  Start             Performance counter value.
+
+  @return Elapsed time in us.
+
+**/
+STATIC
+UINT64
+CpuMpElapsedTime (
+  IN UINT64             Start
+  )
+{
+  return DivU64x32 (GetTimeInNanoSecond (GetPerformanceCounter () - Start), 1000);
+}
+
+/**
+  Return the index of the calling hart in mCpuMp.Processors.
+
+  @return The processor number, or mCpuMp.NumberOfProcessors if not found.
+
+**/
+STATIC
+UINTN
+CpuMpWhoAmI (
+  VOID
+  )
+{
+  SBI_SCRATCH *Scratch;
+  UINTN       Index;
+
+  SbiGetMscratch (&Scratch);
+  for (Index = 0; Index < mCpuMp.NumberOfProcessors; Index++) {
+    if (mCpuMp.Processors[Index].Scratch == Scratch) {
+      break;
+    }
+  }
+  return Index;
+}
+
+/**
+  Run the procedure assigned to an application processor, then stop the hart.
+
+  @param  Processor         The CPU_MP_PROCESSOR of the calling hart.
+
+**/
+VOID
+EFIAPI
+CpuMpApProcedure (
+  IN CPU_MP_PROCESSOR   *Processor
+  )
+{
+  if (Processor->Procedure != NULL) {
+    Processor->Procedure (Processor->ProcedureArgument);
+  }
+
+  //
+  // Make the results of the procedure visible before reporting completion
+  //
+  MemoryFence ();
+  Processor->State = CpuMpStateFinished;
+  MemoryFence ();
+
+  SbiHartStop ();
+  CpuDeadLoop ();
+}
+
+/**
+  Start an idle application processor on its assigned procedure.
+
+  @param  Processor         The application processor.
+
+  @retval EFI_SUCCESS       The hart was started.
+  @retval other             The hart could not be started.
+
+**/
+STATIC
+EFI_STATUS
+CpuMpStartAp (
+  IN CPU_MP_PROCESSOR   *Processor
+  )
+{
+  EFI_STATUS Status;
+  UINTN      HartStatus;
+
+  //
+  // The hart may still be completing the stop request issued at the end of
+  // its previous procedure.
+  //
+  do {
+    Status = SbiHartGetStatus (Processor->HartId, &HartStatus);
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+  } while (HartStatus == SBI_HSM_HART_STATUS_STOP_PENDING);
+
+  //
+  // The hart is started with address translation off and no trap vector.
+  // Give it those of the boot hart, so that the procedure runs in the same
+  // environment and its exceptions are reported.
+  //
+  Processor->Stvec = csr_read (CSR_STVEC);
+  Processor->Satp  = RiscVGetSupervisorAddressTranslationRegister ();
+
+  Processor->State = CpuMpStateBusy;
+  MemoryFence ();
+
+  Status = SbiHartStart (
+             Processor->HartId,
+             (UINTN)CpuMpApEntry,
+             (UINTN)Processor
+             );
+  if (EFI_ERROR (Status)) {
+    Processor->State = CpuMpStateIdle;
+  }
+  return Status;
+}
+
+/**
+  Return whether a processor can be given a procedure.
+
+  @param  Processor         The processor.
+
+**/
+STATIC
+BOOLEAN
+CpuMpApAvailable (
+  IN CPU_MP_PROCESSOR   *Processor
+  )
+{
+  //
+  // Reclaim the processors whose request was abandoned after a timeout.
+  //
+  if (Processor->Request == CpuMpRequestNone &&
+      Processor->State == CpuMpStateFinished) {
+    Processor->State = CpuMpStateIdle;
+  }
+
+  return (Processor->StatusFlag & PROCESSOR_AS_BSP_BIT) == 0 &&
+         (Processor->StatusFlag & PROCESSOR_ENABLED_BIT) != 0 &&
+         Processor->State == CpuMpStateIdle;
+}
+
+/**
+  Arm the timer completing the non-blocking requests.
+
+**/
+STATIC
+VOID
+CpuMpArmCheckEvent (
+  VOID
+  )
+{
+  EFI_STATUS Status;
+
+  if (!mCpuMp.CheckEventArmed) {
+    Status = gBS->SetTimer (mCpuMp.CheckEvent, TimerPeriodic, CPU_MP_CHECK_PERIOD);
+    ASSERT_EFI_ERROR (Status);
+    mCpuMp.CheckEventArmed = !EFI_ERROR (Status);
+  }
+}
+
+/**
+  Check the completion of the StartupThisAP () request of a processor.
+
+  @param  Processor         The processor.
+
+  @retval EFI_SUCCESS       The procedure returned.
+  @retval EFI_TIMEOUT       The procedure did not return in time.
+  @retval EFI_NOT_READY     The procedure is still running.
+
+**/
+STATIC
+EFI_STATUS
+CpuMpCheckThisAp (
+  IN CPU_MP_PROCESSOR   *Processor
+  )
+{
+  if (Processor->State == CpuMpStateFinished) {
+    Processor->State = CpuMpStateIdle;
+    Processor->Request = CpuMpRequestNone;
+    if (Processor->Finished != NULL) {
+      *Processor->Finished = TRUE;
+    }
+    return EFI_SUCCESS;
+  }
+
+  if (Processor->Timeout != 0 &&
+      CpuMpElapsedTime (Processor->StartTime) >= Processor->Timeout) {
+    //
+    // A hart cannot be stopped from another one through SBI: leave it
+    // running, it is reclaimed once its procedure returns.
+    //
+    Processor->Request = CpuMpRequestNone;
+    return EFI_TIMEOUT;
+  }
+
+  return EFI_NOT_READY;
+}
+
+/**
+  Report the failed processors of a StartupAllAPs () request.
+
+  The processors still owned by the request are those that did not complete.
+
+  @retval TRUE              Some processors did not complete the request.
+  @retval FALSE             All the processors completed the request.
+
+**/
+STATIC
+BOOLEAN
+CpuMpFinishAllAps (
+  VOID
+  )
+{
+  CPU_MP_PROCESSOR *Processor;
+  UINTN            *FailedCpuList;
+  UINTN            FailedCount;
+  UINTN            Index;
+
+  FailedCount = 0;
+  for (Index = 0; Index < mCpuMp.NumberOfProcessors; Index++) {
+    if (mCpuMp.Processors[Index].Request == CpuMpRequestAllAps) {
+      FailedCount++;
+    }
+  }
+
+  FailedCpuList = NULL;
+  if (FailedCount != 0 && mCpuMp.AllApsFailedCpuList != NULL) {
+    FailedCpuList = AllocatePool ((FailedCount + 1) * sizeof (UINTN));
+  }
+
+  FailedCount = 0;
+  for (Index = 0; Index < mCpuMp.NumberOfProcessors; Index++) {
+    Processor = &mCpuMp.Processors[Index];
+    if (Processor->Request != CpuMpRequestAllAps) {
+      continue;
+    }
+    Processor->Request = CpuMpRequestNone;
+    if (FailedCpuList != NULL) {
+      FailedCpuList[FailedCount++] = Index;
+    }
+  }
+
+  if (mCpuMp.AllApsFailedCpuList != NULL) {
+    if (FailedCpuList != NULL) {
+      FailedCpuList[FailedCount] = END_OF_CPU_LIST;
+    }
+    *mCpuMp.AllApsFailedCpuList = FailedCpuList;
+  }
+
+  mCpuMp.AllApsActive = FALSE;
+  return FailedCount != 0;
+}
+
+/**
+  Check the completion of the StartupAllAPs () request, starting the next
+  processor in single-threaded mode.
+
+  @param  Status            The result of the completed request:
+                            EFI_SUCCESS if all the procedures returned,
+                            EFI_TIMEOUT if some did not return in time,
+                            EFI_NOT_READY if some processors could not be
+                            started.
+
+  @retval TRUE              The request completed.
+  @retval FALSE             The procedures are still running.
+
+**/
+STATIC
+BOOLEAN
+CpuMpCheckAllAps (
+  OUT EFI_STATUS        *Status
+  )
+{
+  CPU_MP_PROCESSOR *Processor;
+  BOOLEAN          Running;
+  UINTN            Index;
+
+  Running = FALSE;
+  for (Index = 0; Index < mCpuMp.NumberOfProcessors; Index++) {
+    Processor = &mCpuMp.Processors[Index];
+    if (Processor->Request != CpuMpRequestAllAps) {
+      continue;
+    }
+    if (Processor->State == CpuMpStateFinished) {
+      Processor->State = CpuMpStateIdle;
+      Processor->Request = CpuMpRequestNone;
+    } else if (Processor->State == CpuMpStateBusy) {
+      Running = TRUE;
+    }
+  }
+
+  //
+  // In single-threaded mode, the processors not started yet are idle and
+  // owned by the request.
+  //
+  while (!Running && mCpuMp.AllApsNextIndex < mCpuMp.NumberOfProcessors) {
+    Processor = &mCpuMp.Processors[mCpuMp.AllApsNextIndex++];
+    if (Processor->Request != CpuMpRequestAllAps) {
+      continue;
+    }
+    if (EFI_ERROR (CpuMpStartAp (Processor))) {
+      continue;
+    }
+    Running = TRUE;
+  }
+
+  if (!Running) {
+    //
+    // Processors which failed to start remain owned by the request
+    //
+    *Status = CpuMpFinishAllAps () ? EFI_NOT_READY : EFI_SUCCESS;
+    return TRUE;
+  }
+
+  if (mCpuMp.AllApsTimeout != 0 &&
+      CpuMpElapsedTime (mCpuMp.AllApsStartTime) >= mCpuMp.AllApsTimeout) {
+    CpuMpFinishAllAps ();
+    *Status = EFI_TIMEOUT;
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+/**
+  Timer notification completing the non-blocking requests.
+
+  @param  Event             The check timer.
+  @param  Context           Unused.
+
+**/
+STATIC
+VOID
+EFIAPI
+CpuMpCheckNotify (
+  IN EFI_EVENT          Event,
+  IN VOID               *Context
+  )
+{
+  CPU_MP_PROCESSOR *Processor;
+  EFI_STATUS       Status;
+  BOOLEAN          Pending;
+  UINTN            Index;
+
+  Pending = FALSE;
+
+  for (Index = 0; Index < mCpuMp.NumberOfProcessors; Index++) {
+    Processor = &mCpuMp.Processors[Index];
+    if (Processor->Request != CpuMpRequestThisAp ||
+        Processor->WaitEvent == NULL) {
+      continue;
+    }
+    if (CpuMpCheckThisAp (Processor) == EFI_NOT_READY) {
+      Pending = TRUE;
+    } else {
+      gBS->SignalEvent (Processor->WaitEvent);
+    }
+  }
+
+  if (mCpuMp.AllApsActive && mCpuMp.AllApsWaitEvent != NULL) {
+    if (!CpuMpCheckAllAps (&Status)) {
+      Pending = TRUE;
+    } else {
+      gBS->SignalEvent (mCpuMp.AllApsWaitEvent);
+    }
+  }
+
+  if (!Pending) {
+    gBS->SetTimer (Event, TimerCancel, 0);
+    mCpuMp.CheckEventArmed = FALSE;
+  }
+}
+
+/**
+  This service retrieves the number of logical processor in the platform
+  and the number of those logical processors that are enabled on this boot.
+  This service may only be called from the BSP.
+
+  @param  This                       A pointer to the EFI_MP_SERVICES_PROTOCOL instance.
+  @param  NumberOfProcessors         Pointer to the total number of logical processors in
+                                     the system, including the BSP and disabled APs.
+  @param  NumberOfEnabledProcessors  Pointer to the number of enabled logical processors
+                                     that exist in system, including the BSP.
+
+  @retval EFI_SUCCESS                The number of logical processors and enabled
+                                     logical processors was retrieved.
+  @retval EFI_DEVICE_ERROR           The calling processor is an AP.
+  @retval EFI_INVALID_PARAMETER      NumberOfProcessors or NumberOfEnabledProcessors is NULL.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+CpuMpGetNumberOfProcessors (
+  IN  EFI_MP_SERVICES_PROTOCOL  *This,
+  OUT UINTN                     *NumberOfProcessors,
+  OUT UINTN                     *NumberOfEnabledProcessors
+  )
+{
+  UINTN Index;
+
+  if (NumberOfProcessors == NULL || NumberOfEnabledProcessors == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (CpuMpWhoAmI () != mCpuMp.BspIndex) {
+    return EFI_DEVICE_ERROR;
+  }
+
+  *NumberOfProcessors = mCpuMp.NumberOfProcessors;
+  *NumberOfEnabledProcessors = 0;
+  for (Index = 0; Index < mCpuMp.NumberOfProcessors; Index++) {
+    if ((mCpuMp.Processors[Index].StatusFlag & PROCESSOR_ENABLED_BIT) != 0) {
+      (*NumberOfEnabledProcessors)++;
+    }
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Gets detailed MP-related information on the requested processor at the
+  instant this call is made. This service may only be called from the BSP.
+
+  @param  This                  A pointer to the EFI_MP_SERVICES_PROTOCOL instance.
+  @param  ProcessorNumber       The handle number of processor.
+  @param  ProcessorInfoBuffer   A pointer to the buffer where information for
+                                the requested processor is deposited.
+
+  @retval EFI_SUCCESS           Processor information was returned.
+  @retval EFI_DEVICE_ERROR      The calling processor is an AP.
+  @retval EFI_INVALID_PARAMETER ProcessorInfoBuffer is NULL.
+  @retval EFI_NOT_FOUND         The processor with the handle specified by
+                                ProcessorNumber does not exist in the platform.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+CpuMpGetProcessorInfo (
+  IN  EFI_MP_SERVICES_PROTOCOL   *This,
+  IN  UINTN                      ProcessorNumber,
+  OUT EFI_PROCESSOR_INFORMATION  *ProcessorInfoBuffer
+  )
+{
+  CPU_MP_PROCESSOR *Processor;
+
+  if (ProcessorInfoBuffer == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (CpuMpWhoAmI () != mCpuMp.BspIndex) {
+    return EFI_DEVICE_ERROR;
+  }
+
+  if (ProcessorNumber >= mCpuMp.NumberOfProcessors) {
+    return EFI_NOT_FOUND;
+  }
+
+  Processor = &mCpuMp.Processors[ProcessorNumber];
+  ZeroMem (ProcessorInfoBuffer, sizeof (EFI_PROCESSOR_INFORMATION));
+  ProcessorInfoBuffer->ProcessorId = Processor->HartId;
+  ProcessorInfoBuffer->StatusFlag = Processor->StatusFlag;
+  ProcessorInfoBuffer->Location.Core = (UINT32)Processor->HartId;
+
+  return EFI_SUCCESS;
+}
+
+/**
+  This service executes a caller provided function on all enabled APs.
+
+  @param  This                    A pointer to the EFI_MP_SERVICES_PROTOCOL instance.
+  @param  Procedure               A pointer to the function to be run on enabled
+                                  APs of the system.
+  @param  SingleThread            If TRUE, then all the enabled APs execute the
+                                  function specified by Procedure one by one, in
+                                  ascending order of processor handle number.
+                                  If FALSE, then all the enabled APs execute the
+                                  function specified by Procedure simultaneously.
+  @param  WaitEvent               The event created by the caller with CreateEvent()
+                                  service. If it is NULL, then execute in blocking
+                                  mode, otherwise in non-blocking mode.
+  @param  TimeoutInMicroSeconds   Indicates the time limit in microseconds for APs
+                                  to return from Procedure, zero means infinity.
+  @param  ProcedureArgument       The parameter passed into Procedure for all APs.
+  @param  FailedCpuList           If NULL, this parameter is ignored. Otherwise,
+                                  it returns the list of the processors that did
+                                  not finish Procedure within the timeout.
+
+  @retval EFI_SUCCESS             In blocking mode, all APs have finished before
+                                  the timeout expired. In non-blocking mode, the
+                                  function has been dispatched to all enabled APs.
+  @retval EFI_DEVICE_ERROR        Caller processor is AP.
+  @retval EFI_NOT_STARTED         No enabled APs exist in the system.
+  @retval EFI_NOT_READY           Any enabled APs are busy. In blocking mode,
+                                  also returned when some APs could not be
+                                  started.
+  @retval EFI_TIMEOUT             In blocking mode, the timeout expired before
+                                  all enabled APs have finished.
+  @retval EFI_INVALID_PARAMETER   Procedure is NULL.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+CpuMpStartupAllAPs (
+  IN  EFI_MP_SERVICES_PROTOCOL  *This,
+  IN  EFI_AP_PROCEDURE          Procedure,
+  IN  BOOLEAN                   SingleThread,
+  IN  EFI_EVENT                 WaitEvent               OPTIONAL,
+  IN  UINTN                     TimeoutInMicroSeconds,
+  IN  VOID                      *ProcedureArgument      OPTIONAL,
+  OUT UINTN                     **FailedCpuList         OPTIONAL
+  )
+{
+  CPU_MP_PROCESSOR *Processor;
+  EFI_STATUS       Status;
+  EFI_TPL          OldTpl;
+  BOOLEAN          Done;
+  UINTN            Count;
+  UINTN            Index;
+
+  if (FailedCpuList != NULL) {
+    *FailedCpuList = NULL;
+  }
+
+  if (Procedure == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (CpuMpWhoAmI () != mCpuMp.BspIndex) {
+    return EFI_DEVICE_ERROR;
+  }
+
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+
+  if (mCpuMp.AllApsActive) {
+    gBS->RestoreTPL (OldTpl);
+    return EFI_NOT_READY;
+  }
+
+  Count = 0;
+  for (Index = 0; Index < mCpuMp.NumberOfProcessors; Index++) {
+    Processor = &mCpuMp.Processors[Index];
+    if ((Processor->StatusFlag & PROCESSOR_AS_BSP_BIT) != 0 ||
+        (Processor->StatusFlag & PROCESSOR_ENABLED_BIT) == 0) {
+      continue;
+    }
+    if (!CpuMpApAvailable (Processor)) {
+      gBS->RestoreTPL (OldTpl);
+      return EFI_NOT_READY;
+    }
+    Count++;
+  }
+
+  if (Count == 0) {
+    gBS->RestoreTPL (OldTpl);
+    return EFI_NOT_STARTED;
+  }
+
+  mCpuMp.AllApsActive = TRUE;
+  mCpuMp.AllApsSingleThread = SingleThread;
+  mCpuMp.AllApsProcedure = Procedure;
+  mCpuMp.AllApsArgument = ProcedureArgument;
+  mCpuMp.AllApsWaitEvent = WaitEvent;
+  mCpuMp.AllApsFailedCpuList = FailedCpuList;
+  mCpuMp.AllApsTimeout = TimeoutInMicroSeconds;
+  mCpuMp.AllApsStartTime = GetPerformanceCounter ();
+  mCpuMp.AllApsNextIndex = SingleThread ? 0 : mCpuMp.NumberOfProcessors;
+
+  for (Index = 0; Index < mCpuMp.NumberOfProcessors; Index++) {
+    Processor = &mCpuMp.Processors[Index];
+    if (!CpuMpApAvailable (Processor)) {
+      continue;
+    }
+    Processor->Procedure = Procedure;
+    Processor->ProcedureArgument = ProcedureArgument;
+    Processor->Request = CpuMpRequestAllAps;
+    if (!SingleThread) {
+      //
+      // A processor failing to start is reported in FailedCpuList
+      //
+      CpuMpStartAp (Processor);
+    }
+  }
+
+  if (WaitEvent != NULL) {
+    CpuMpArmCheckEvent ();
+    gBS->RestoreTPL (OldTpl);
+    return EFI_SUCCESS;
+  }
+
+  //
+  // Wait at the caller's TPL, only raising it to check the request
+  //
+  gBS->RestoreTPL (OldTpl);
+  do {
+    CpuPause ();
+    OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+    Done = CpuMpCheckAllAps (&Status);
+    gBS->RestoreTPL (OldTpl);
+  } while (!Done);
+
+  return Status;
+}
+
+/**
+  This service lets the caller get one enabled AP to execute a caller-provided
+  function.
+
+  @param  This                    A pointer to the EFI_MP_SERVICES_PROTOCOL instance.
+  @param  Procedure               A pointer to the function to be run on the
+                                  designated AP of the system.
+  @param  ProcessorNumber         The handle number of the AP.
+  @param  WaitEvent               The event created by the caller with CreateEvent()
+                                  service. If it is NULL, then execute in blocking
+                                  mode, otherwise in non-blocking mode.
+  @param  TimeoutInMicroseconds   Indicates the time limit in microseconds for the
+                                  AP to finish this Procedure, zero means infinity.
+  @param  ProcedureArgument       The parameter passed into Procedure.
+  @param  Finished                If NULL, this parameter is ignored. In non-blocking
+                                  mode, it is set to TRUE when the AP finishes.
+
+  @retval EFI_SUCCESS             In blocking mode, specified AP finished before
+                                  the timeout expires. In non-blocking mode, the
+                                  function has been dispatched to specified AP.
+  @retval EFI_DEVICE_ERROR        The calling processor is an AP.
+  @retval EFI_TIMEOUT             In blocking mode, the timeout expired before
+                                  the specified AP has finished.
+  @retval EFI_NOT_READY           The specified AP is busy.
+  @retval EFI_NOT_FOUND           The processor with the handle specified by
+                                  ProcessorNumber does not exist.
+  @retval EFI_INVALID_PARAMETER   ProcessorNumber specifies the BSP or disabled AP.
+  @retval EFI_INVALID_PARAMETER   Procedure is NULL.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+CpuMpStartupThisAP (
+  IN  EFI_MP_SERVICES_PROTOCOL  *This,
+  IN  EFI_AP_PROCEDURE          Procedure,
+  IN  UINTN                     ProcessorNumber,
+  IN  EFI_EVENT                 WaitEvent               OPTIONAL,
+  IN  UINTN                     TimeoutInMicroseconds,
+  IN  VOID                      *ProcedureArgument      OPTIONAL,
+  OUT BOOLEAN                   *Finished               OPTIONAL
+  )
+{
+  CPU_MP_PROCESSOR *Processor;
+  EFI_STATUS       Status;
+  EFI_TPL          OldTpl;
+
+  if (Finished != NULL) {
+    *Finished = FALSE;
+  }
+
+  if (Procedure == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (CpuMpWhoAmI () != mCpuMp.BspIndex) {
+    return EFI_DEVICE_ERROR;
+  }
+
+  if (ProcessorNumber >= mCpuMp.NumberOfProcessors) {
+    return EFI_NOT_FOUND;
+  }
+
+  Processor = &mCpuMp.Processors[ProcessorNumber];
+  if ((Processor->StatusFlag & PROCESSOR_AS_BSP_BIT) != 0 ||
+      (Processor->StatusFlag & PROCESSOR_ENABLED_BIT) == 0) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+
+  if (!CpuMpApAvailable (Processor) ||
+      Processor->Request != CpuMpRequestNone) {
+    gBS->RestoreTPL (OldTpl);
+    return EFI_NOT_READY;
+  }
+
+  Processor->Procedure = Procedure;
+  Processor->ProcedureArgument = ProcedureArgument;
+  Processor->WaitEvent = WaitEvent;
+  Processor->Finished = Finished;
+  Processor->Timeout = TimeoutInMicroseconds;
+  Processor->StartTime = GetPerformanceCounter ();
+
+  Status = CpuMpStartAp (Processor);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "%a: Failed to start hart %d: %r\n",
+      __FUNCTION__, (UINT32)Processor->HartId, Status));
+    gBS->RestoreTPL (OldTpl);
+    return EFI_DEVICE_ERROR;
+  }
+  Processor->Request = CpuMpRequestThisAp;
+
+  if (WaitEvent != NULL) {
+    CpuMpArmCheckEvent ();
+    gBS->RestoreTPL (OldTpl);
+    return EFI_SUCCESS;
+  }
+
+  //
+  // Wait at the caller's TPL, only raising it to check the request
+  //
+  gBS->RestoreTPL (OldTpl);
+  do {
+    CpuPause ();
+    OldTpl = gBS->RaiseTPL (TPL_NOTIFY);
+    Status = CpuMpCheckThisAp (Processor);
+    gBS->RestoreTPL (OldTpl);
+  } while (Status == EFI_NOT_READY);
+
+  return Status;
+}
+
+/**
+  This service switches the requested AP to be the BSP from that point onward.
+
+  The BSP of RISC-V DXE cannot be switched.
+
+  @retval EFI_UNSUPPORTED       Switching the BSP is not supported.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+CpuMpSwitchBSP (
+  IN EFI_MP_SERVICES_PROTOCOL  *This,
+  IN  UINTN                    ProcessorNumber,
+  IN  BOOLEAN                  EnableOldBSP
+  )
+{
+  return EFI_UNSUPPORTED;
+}
+
+/**
+  This service lets the caller enable or disable an AP from this point onward.
+  This service may only be called from the BSP.
+
+  @param  This              A pointer to the EFI_MP_SERVICES_PROTOCOL instance.
+  @param  ProcessorNumber   The handle number of AP.
+  @param  EnableAP          Specifies the new state for the processor.
+  @param  HealthFlag        If not NULL, a pointer to a value that specifies the
+                            new health status of the AP.
+
+  @retval EFI_SUCCESS             The specified AP was enabled or disabled successfully.
+  @retval EFI_UNSUPPORTED         Enabling or disabling an AP cannot be completed
+                                  prior to this service returning.
+  @retval EFI_DEVICE_ERROR        The calling processor is an AP.
+  @retval EFI_NOT_FOUND           Processor with the handle specified by
+                                  ProcessorNumber does not exist.
+  @retval EFI_INVALID_PARAMETER   ProcessorNumber specifies the BSP.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+CpuMpEnableDisableAP (
+  IN  EFI_MP_SERVICES_PROTOCOL  *This,
+  IN  UINTN                     ProcessorNumber,
+  IN  BOOLEAN                   EnableAP,
+  IN  UINT32                    *HealthFlag OPTIONAL
+  )
+{
+  CPU_MP_PROCESSOR *Processor;
+
+  if (CpuMpWhoAmI () != mCpuMp.BspIndex) {
+    return EFI_DEVICE_ERROR;
+  }
+
+  if (ProcessorNumber >= mCpuMp.NumberOfProcessors) {
+    return EFI_NOT_FOUND;
+  }
+
+  Processor = &mCpuMp.Processors[ProcessorNumber];
+  if ((Processor->StatusFlag & PROCESSOR_AS_BSP_BIT) != 0) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (EnableAP) {
+    Processor->StatusFlag |= PROCESSOR_ENABLED_BIT;
+  } else {
+    Processor->StatusFlag &= ~PROCESSOR_ENABLED_BIT;
+  }
+
+  if (HealthFlag != NULL) {
+    Processor->StatusFlag &= ~PROCESSOR_HEALTH_STATUS_BIT;
+    Processor->StatusFlag |= *HealthFlag & PROCESSOR_HEALTH_STATUS_BIT;
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  This return the handle number for the calling processor. This service may
+  be called from the BSP and APs.
+
+  @param  This              A pointer to the EFI_MP_SERVICES_PROTOCOL instance.
+  @param  ProcessorNumber   Pointer to the handle number of AP.
+
+  @retval EFI_SUCCESS             The current processor handle number was returned
+                                  in ProcessorNumber.
+  @retval EFI_INVALID_PARAMETER   ProcessorNumber is NULL.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+CpuMpWhoAmIService (
+  IN  EFI_MP_SERVICES_PROTOCOL  *This,
+  OUT UINTN                     *ProcessorNumber
+  )
+{
+  if (ProcessorNumber == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  *ProcessorNumber = CpuMpWhoAmI ();
+  return EFI_SUCCESS;
+}
+
+STATIC EFI_MP_SERVICES_PROTOCOL mMpServices = {
+  CpuMpGetNumberOfProcessors,
+  CpuMpGetProcessorInfo,
+  CpuMpStartupAllAPs,
+  CpuMpStartupThisAP,
+  CpuMpSwitchBSP,
+  CpuMpEnableDisableAP,
+  CpuMpWhoAmIService
+};
+
+/**
+  Check that an application processor can be started, by running an empty
+  procedure on it.
+
+  Harts without supervisor mode, like the monitor core of the U54-MC, are
+  refused by SBI.
+
+  @param  Processor         The application processor.
+
+  @retval EFI_SUCCESS       The processor can be used.
+  @retval EFI_TIMEOUT       The processor was started but did not answer.
+  @retval other             The processor could not be started.
+
+**/
+STATIC
+EFI_STATUS
+CpuMpProbeAp (
+  IN CPU_MP_PROCESSOR   *Processor
+  )
+{
+  EFI_STATUS Status;
+  UINT64     StartTime;
+
+  Processor->Procedure = NULL;
+  Status = CpuMpStartAp (Processor);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  StartTime = GetPerformanceCounter ();
+  while (Processor->State != CpuMpStateFinished) {
+    if (CpuMpElapsedTime (StartTime) >= CPU_MP_AP_PROBE_TIMEOUT) {
+      return EFI_TIMEOUT;
+    }
+    CpuPause ();
+  }
+
+  Processor->State = CpuMpStateIdle;
+  return EFI_SUCCESS;
+}
+
+/**
+  Discover the harts and install the MP Services Protocol.
+
+  @param  Handle            Handle to install the protocol on.
+
+  @retval EFI_SUCCESS       The protocol was installed.
+  @retval EFI_UNSUPPORTED   The SBI implementation does not support HSM.
+  @retval other             The protocol could not be installed.
+
+**/
+EFI_STATUS
+InitializeMpSupport (
+  IN EFI_HANDLE         Handle
+  )
+{
+  CPU_MP_PROCESSOR  *Processor;
+  SBI_SCRATCH       *BspScratch;
+  SBI_SCRATCH       *Scratch;
+  EFI_STATUS        Status;
+  UINT8             *Stacks;
+  UINTN             HartStatus;
+  UINTN             HartCount;
+  UINTN             HartId;
+  INTN              Probe;
+
+  SbiProbeExtension (SBI_EXT_HSM, &Probe);
+  if (Probe == 0) {
+    DEBUG ((DEBUG_WARN, "%a: SBI HSM extension not available\n", __FUNCTION__));
+    return EFI_UNSUPPORTED;
+  }
+
+  HartCount = 0;
+  for (HartId = 0; HartId < RISC_V_MAX_HART_SUPPORTED; HartId++) {
+    SbiGetMscratchHartid (HartId, &Scratch);
+    if (Scratch != NULL) {
+      HartCount++;
+    }
+  }
+
+  mCpuMp.Processors = AllocateZeroPool (HartCount * sizeof (CPU_MP_PROCESSOR));
+  if (mCpuMp.Processors == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Stacks = AllocatePages (EFI_SIZE_TO_PAGES (HartCount * CPU_MP_AP_STACK_SIZE));
+  if (Stacks == NULL) {
+    FreePool (mCpuMp.Processors);
+    mCpuMp.Processors = NULL;
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  SbiGetMscratch (&BspScratch);
+
+  for (HartId = 0; HartId < RISC_V_MAX_HART_SUPPORTED; HartId++) {
+    SbiGetMscratchHartid (HartId, &Scratch);
+    if (Scratch == NULL) {
+      continue;
+    }
+
+    Processor = &mCpuMp.Processors[mCpuMp.NumberOfProcessors];
+    Processor->HartId = HartId;
+    Processor->Scratch = Scratch;
+    Processor->StatusFlag = PROCESSOR_ENABLED_BIT | PROCESSOR_HEALTH_STATUS_BIT;
+
+    if (Scratch == BspScratch) {
+      Processor->StatusFlag |= PROCESSOR_AS_BSP_BIT;
+      mCpuMp.BspIndex = mCpuMp.NumberOfProcessors++;
+      continue;
+    }
+
+    Status = SbiHartGetStatus (HartId, &HartStatus);
+    if (EFI_ERROR (Status) || HartStatus != SBI_HSM_HART_STATUS_STOPPED) {
+      continue;
+    }
+
+    Processor->StackTop = (UINTN)Stacks + (mCpuMp.NumberOfProcessors + 1) * CPU_MP_AP_STACK_SIZE;
+    Status = CpuMpProbeAp (Processor);
+    if (Status == EFI_TIMEOUT) {
+      //
+      // The hart may still come up later and owns this entry: report it as
+      // disabled and failed rather than reusing the entry.
+      //
+      DEBUG ((DEBUG_ERROR, "%a: Hart %d did not start\n", __FUNCTION__, (UINT32)HartId));
+      Processor->StatusFlag = 0;
+    } else if (EFI_ERROR (Status)) {
+      DEBUG ((DEBUG_INFO, "%a: Hart %d cannot be started: %r\n", __FUNCTION__, (UINT32)HartId, Status));
+      ZeroMem (Processor, sizeof (CPU_MP_PROCESSOR));
+      continue;
+    }
+
+    mCpuMp.NumberOfProcessors++;
+  }
+
+  DEBUG ((DEBUG_INFO, "%a: %d processors, BSP is hart %d\n",
+    __FUNCTION__,
+    (UINT32)mCpuMp.NumberOfProcessors,
+    (UINT32)mCpuMp.Processors[mCpuMp.BspIndex].HartId
+    ));
+
+  Status = gBS->CreateEvent (
+                  EVT_TIMER | EVT_NOTIFY_SIGNAL,
+                  TPL_NOTIFY,
+                  CpuMpCheckNotify,
+                  NULL,
+                  &mCpuMp.CheckEvent
+                  );
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  return gBS->InstallMultipleProtocolInterfaces (
+                &Handle,
+                &gEfiMpServiceProtocolGuid, &mMpServices,
+                NULL
+                );
+}
@@ -0,0 +1,131 @@
+/** @file
+  RISC-V MP services, built on the SBI Hart State Management extension.
+
+  Copyright (c) 2020, Hewlett Packard Enterprise Development LP. All rights reserved.<BR>
+
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef CPU_MP_H_
+#define CPU_MP_H_
+
+#include <Protocol/MpService.h>
+#include <Library/RiscVEdk2SbiLib.h>
+
+//
+// Stack size of each application processor
+//
+#define CPU_MP_AP_STACK_SIZE        SIZE_32KB
+
+//
+// Time given to an application processor to answer the start-up probe, in us
+//
+#define CPU_MP_AP_PROBE_TIMEOUT     100000
+
+//
+// Period of the timer completing non-blocking requests, in 100ns units
+//
+#define CPU_MP_CHECK_PERIOD         EFI_TIMER_PERIOD_MILLISECONDS (1)
+
+typedef enum {
+  CpuMpStateIdle,                   // Hart stopped, available
+  CpuMpStateBusy,                   // Hart started, running a procedure
+  CpuMpStateFinished                // Procedure returned, hart stopping
+} CPU_MP_STATE;
+
+typedef enum {
+  CpuMpRequestNone,
+  CpuMpRequestThisAp,
+  CpuMpRequestAllAps
+} CPU_MP_REQUEST;
+
+//
+// StackTop, Stvec and Satp must be the first members, they are loaded by
+// CpuMpApEntry.
+//
+typedef struct {
+  UINTN                 StackTop;
+  UINTN                 Stvec;
+  UINTN                 Satp;
+  UINTN                 HartId;
+  SBI_SCRATCH           *Scratch;
+  UINT32                StatusFlag;
+  volatile UINT32       State;
+  EFI_AP_PROCEDURE      Procedure;
+  VOID                  *ProcedureArgument;
+  //
+  // Request the procedure belongs to, and StartupThisAP () completion data
+  //
+  CPU_MP_REQUEST        Request;
+  EFI_EVENT             WaitEvent;
+  BOOLEAN               *Finished;
+  UINT64                StartTime;
+  UINTN                 Timeout;
+} CPU_MP_PROCESSOR;
+
+typedef struct {
+  CPU_MP_PROCESSOR      *Processors;
+  UINTN                 NumberOfProcessors;
+  UINTN                 BspIndex;
+  EFI_EVENT             CheckEvent;
+  BOOLEAN               CheckEventArmed;
+  //
+  // StartupAllAPs () request in progress
+  //
+  BOOLEAN               AllApsActive;
+  BOOLEAN               AllApsSingleThread;
+  EFI_AP_PROCEDURE      AllApsProcedure;
+  VOID                  *AllApsArgument;
+  EFI_EVENT             AllApsWaitEvent;
+  UINTN                 **AllApsFailedCpuList;
+  UINTN                 AllApsNextIndex;
+  UINT64                AllApsStartTime;
+  UINTN                 AllApsTimeout;
+} CPU_MP_DATA;
+
+/**
+  Entry point of the application processors, started through SBI HSM.
+
+  Sets up the stack, trap vector and address translation of the hart and
+  calls CpuMpApProcedure ().
+
+  @param  HartId            Id of the hart, in a0.
+  @param  Processor         The CPU_MP_PROCESSOR of the hart, in a1.
+
+**/
+VOID
+EFIAPI
+CpuMpApEntry (
+  IN UINTN              HartId,
+  IN CPU_MP_PROCESSOR   *Processor
+  );
+
+/**
+  Run the procedure assigned to an application processor, then stop the hart.
+
+  @param  Processor         The CPU_MP_PROCESSOR of the calling hart.
+
+**/
+VOID
+EFIAPI
+CpuMpApProcedure (
+  IN CPU_MP_PROCESSOR   *Processor
+  );
+
+/**
+  Discover the harts and install the MP Services Protocol.
+
+  @param  Handle            Handle to install the protocol on.
+
+  @retval EFI_SUCCESS       The protocol was installed.
+  @retval EFI_UNSUPPORTED   The SBI implementation does not support HSM.
+  @retval other             The protocol could not be installed.
+
+**/
+EFI_STATUS
+InitializeMpSupport (
+  IN EFI_HANDLE         Handle
+  );
+
+#endif